@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <exception>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <io/file.h>
 #include <krpc.h>
 #include <memory>
@@ -36,7 +37,6 @@
 // TODO in private_interface on socket close automatically close connected
 // searches!
 // TODO awake next timeout[0ms]
-// TODO use ip not ip:port in bloomfilters
 // TODO if both eth0 & wlan0 is active there is some problem
 
 // TODO getopt: repeating bootstrap nodes
@@ -48,7 +48,6 @@
 // TODO log explicit error response (error module)
 // XXX ipv6
 // XXX client: multiple receiver for the same search
-// TODO replace bad node
 //
 static void
 die(const char *s) {
@@ -150,7 +149,7 @@ parse(dht::Domain dom, dht::DHT &dht, dht::Modules &modules,
     } else if (std::strcmp(pctx.msg_type, "r") == 0) { /*response*/
       tx::TxContext tctx;
       std::size_t cnt = dht.client.active;
-      if (tx::consume_transaction(dht, pctx.tx, tctx)) {
+      if (tx::consume_transaction(dht, pctx.tx, peer, tctx)) {
         assertx((cnt - 1) == dht.client.active);
         logger::receive::res::known_tx(mctx, tctx);
         return tctx.handle(mctx);
@@ -160,7 +159,7 @@ parse(dht::Domain dom, dht::DHT &dht, dht::Modules &modules,
       }
     } else if (std::strcmp(pctx.msg_type, "e") == 0) { /*error*/
       tx::TxContext tctx;
-      if (tx::consume_transaction(dht, pctx.tx, tctx)) {
+      if (tx::consume_transaction(dht, pctx.tx, peer, tctx)) {
         logger::receive::res::known_tx(mctx, tctx);
       } else {
         logger::receive::res::unknown_tx(mctx, in);
@@ -402,6 +401,7 @@ on_interrupt(void *closure, uint32_t events) {
           info.ssi_signo);
   sp::deinit_cache(self->dht);
   sp::dump(self->dht, self->options.dump_file);
+  db::flush(self->dht.db.persist);
   self->dht.should_exit = true;
   return 0;
 }
@@ -446,7 +446,6 @@ setup_epoll(dht::DHT &self, dht::ModulesAwake &awake, dht::Options &options,
 template <typename Awake>
 static int
 main_loop(dht::DHT &self, Awake on_awake) noexcept {
-  Timestamp previous(0);
   fprintf(stderr, "main_loop:BEGIN\n");
 
   constexpr std::size_t size = 16 * 1024;
@@ -454,14 +453,11 @@ main_loop(dht::DHT &self, Awake on_awake) noexcept {
 
   sp::Milliseconds timeout(0);
   while (!self.should_exit) {
-    // always increasing clock
-    self.now = std::max(sp::now(), previous);
+    dht::tick(self);
 
     core_tick(self.core, timeout);
     sp::Buffer outBuffer(out.get(), size);
     timeout = on_awake(outBuffer);
-
-    previous = self.now;
   } // for
 
   return 0;
@@ -518,13 +514,18 @@ main(int argc, char **argv) {
     return 3;
   }
 
-  dht::Client client{udp_fd, priv_fd};
+  dht::Client client{udp_fd, priv_fd, options.transactions};
+  if (!client.buffer) {
+    fprintf(stderr, "failed to allocate %zu transactions\n",
+            options.transactions);
+    return 3;
+  }
 
   sp_upnp *upnp = sp_upnp_new();
 
   auto r = prng::seed<prng::xorshift32>();
   fprintf(stderr, "sizeof(dht::DHT[%zu])\n", sizeof(dht::DHT));
-  Timestamp now = sp::now();
+  Timestamp now(0);
 
   auto mdht =
       std::make_unique<dht::DHT>(local_ip, client, r, now, options, upnp);
@@ -542,6 +543,16 @@ main(int argc, char **argv) {
     die("restore failed\n");
   }
 
+  if (!db::restore(mdht->db)) {
+    die("peer db restore failed\n");
+  }
+  fprintf(stderr,
+          "peer db: restored %" PRIu64 " infohashes, %" PRIu64
+          " peers, %" PRIu64 " log records in %" PRIu64 "ms\n",
+          mdht->db.persist.restored_infohashes,
+          mdht->db.persist.restored_peers, mdht->db.persist.replayed_records,
+          mdht->db.persist.restore_ms);
+
 #if 0
   {
     char str[256] = {0};
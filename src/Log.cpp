@@ -682,22 +682,15 @@ routing::can_not_insert(const dht::DHTMetaRoutingTable &ctx,
 }
 
 void
-routing::head_node(const dht::DHTMetaRoutingTable &rt, sp::Milliseconds x) {
+routing::head_node(const dht::DHTMetaRoutingTable &rt) {
   timeout::Timeout *timeout = rt.tb.timeout;
-  if (timeout) {
-    dht::Node *head = timeout->timeout_node;
-    if (head) {
-      char remote[30] = {0};
-      auto f = stdout;
-      __print_time(f, rt.now);
-      to_string(head->contact, remote, sizeof(remote));
-      fprintf(f, "Node[%s, ", remote);
-      fprintf(f, "req_sent:");
-      __print_time(f, head->req_sent);
-      fprintf(f, ", wakeup:");
-      __print_time(f, (head->req_sent + x));
-      fprintf(f, "]\n");
-    }
+  Timestamp next(0);
+  if (timeout && timeout::next_expire(timeout->wheel, next)) {
+    auto f = stdout;
+    __print_time(f, rt.now);
+    fprintf(f, "Node[wakeup:");
+    __print_time(f, next);
+    fprintf(f, "]\n");
   }
 }
 
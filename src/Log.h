@@ -160,7 +160,7 @@ void
 can_not_insert(const dht::DHTMetaRoutingTable &, const dht::Node &) noexcept;
 
 void
-head_node(const dht::DHTMetaRoutingTable &, sp::Milliseconds timeout);
+head_node(const dht::DHTMetaRoutingTable &);
 } // namespace routing
 
 // ========================================
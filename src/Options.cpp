@@ -17,7 +17,8 @@ Options::Options()
     , local_socket{0}
     , publish_socket{0}
     , db_path{0}
-    , systemd{false} {
+    , systemd{false}
+    , transactions{1024} {
   memcpy(dump_file, default_dump_path, strlen(default_dump_path));
 }
 
@@ -39,6 +40,7 @@ parse(Options &self, int argc, char **argv) noexcept {
           {"local", required_argument, nullptr, 'l'},
           {"help", no_argument, nullptr, 'h'},
           {"systemd", no_argument, nullptr, 's'},
+          {"transactions", required_argument, nullptr, 't'},
           //  The last element of the array has to be filled with zeros
           {nullptr, 0, nullptr, 0} //
       };
@@ -115,6 +117,17 @@ parse(Options &self, int argc, char **argv) noexcept {
       self.systemd = true;
       break;
 
+    case 't': {
+      char *end = nullptr;
+      unsigned long long value = std::strtoull(optarg, &end, 10);
+      if (end == optarg || *end != '\0' || value == 0 || value > 64 * 1024) {
+        fprintf(stderr, "invalid transactions option '%s' (1-%u)\n", optarg,
+                64 * 1024);
+        return false;
+      }
+      self.transactions = std::size_t(value);
+    } break;
+
     case 'h':
       printf("option -h\n");
       return false;
@@ -14,6 +14,8 @@ struct Options {
   char db_path[PATH_MAX];
   char scrape_socket_path[PATH_MAX];
   bool systemd;
+  /* The maximum number of in-flight outgoing transactions */
+  std::size_t transactions;
 
   Options();
 };
@@ -22,11 +24,11 @@ sp_debug_Options(const struct Options *in) {
   static char buf[4096] = {'\0'};
   snprintf(buf, sizeof(buf),
            "dump_file[%.*s]local_socket[%.*s]publish_socket[%.*s]db_path[%.*s]"
-           "scrape_socket_path[%.*s]systemd[%s]",
+           "scrape_socket_path[%.*s]systemd[%s]transactions[%zu]",
            (int)PATH_MAX, in->dump_file, (int)PATH_MAX, in->local_socket,
            (int)PATH_MAX, in->publish_socket, (int)PATH_MAX, in->db_path,
            (int)PATH_MAX, in->scrape_socket_path,
-           in->systemd ? "TRUE" : "FALSE");
+           in->systemd ? "TRUE" : "FALSE", in->transactions);
   return buf;
 }
 
@@ -80,19 +80,6 @@ bootstrap_insert_force(DHT &self, KContact &remote) noexcept {
 #endif
 }
 
-//==========================================
-void
-bootstrap_reclaim(DHT &, dht::KContact *in) noexcept {
-  assertx(in);
-  delete in;
-}
-
-//==========================================
-dht::KContact *
-bootstrap_alloc(DHT &, const dht::KContact &cur) noexcept {
-  return new dht::KContact(cur);
-}
-
 //==========================================
 bool
 bootstrap_take_head(DHT &self, dht::KContact &out) noexcept {
@@ -25,14 +25,6 @@ bootstrap_insert(DHTMetaScrape &self, const KContact &contact) noexcept;
 void
 bootstrap_insert_force(DHT &, KContact &) noexcept;
 
-//==========================================
-void
-bootstrap_reclaim(DHT &, dht::KContact *) noexcept;
-
-//==========================================
-dht::KContact *
-bootstrap_alloc(DHT &, const dht::KContact &cur) noexcept;
-
 //==========================================
 bool
 bootstrap_take_head(DHT &, dht::KContact &out) noexcept;
@@ -14,7 +14,8 @@ namespace client {
 template <typename F>
 static Res
 send(dht::DHT &dht, const Contact &remote, sp::Buffer &out, F request,
-     dht::Module &module, void *closure) noexcept {
+     dht::Module &module, const tx::TxClosure &closure,
+     dht::TxClass cls) noexcept {
   Res result = Res::ERR_TOKEN;
   sp::reset(out);
 
@@ -23,7 +24,7 @@ send(dht::DHT &dht, const Contact &remote, sp::Buffer &out, F request,
   krpc::Transaction tx;
   tx::TxContext ctx{module.response, module.response_timeout, closure};
 
-  if (tx::mint_transaction(dht, /*OUT*/ tx, ctx)) {
+  if (tx::mint_transaction(dht, /*OUT*/ tx, ctx, remote, cls)) {
     result = request(out, tx) ? Res::OK : Res::ERR;
     if (result == Res::OK) {
       sp::flip(out);
@@ -34,7 +35,7 @@ send(dht::DHT &dht, const Contact &remote, sp::Buffer &out, F request,
       logger::transmit::error::udp(dht);
       // since we fail to send request, we clear the transaction
       tx::TxContext dummy;
-      if (!tx::consume_transaction(dht, tx, dummy)) {
+      if (!tx::cancel_transaction(dht, tx, dummy)) {
         assertx(false);
       }
     }
@@ -55,7 +56,8 @@ ping(dht::DHT &dht, sp::Buffer &buf, const dht::Node &node) noexcept {
     return krpc::request::ping(out, t, dht.id);
   };
 
-  Res result = send(dht, node.contact, buf, serialize, ping, nullptr);
+  Res result = send(dht, node.contact, buf, serialize, ping, tx::TxClosure(),
+                    dht::TxClass::MAINTENANCE);
   if (result == Res::OK) {
     logger::transmit::ping(dht, node.contact, result); // TODO log tx}
   }
@@ -65,7 +67,8 @@ ping(dht::DHT &dht, sp::Buffer &buf, const dht::Node &node) noexcept {
 //=====================================
 Res
 find_node(dht::DHT &dht, sp::Buffer &buf, const Contact &dest,
-          const dht::NodeId &search, void *closure) noexcept {
+          const dht::NodeId &search, const tx::TxClosure &closure,
+          dht::TxClass cls) noexcept {
   dht::Module find_node;
   find_node::setup(find_node);
 
@@ -75,7 +78,7 @@ find_node(dht::DHT &dht, sp::Buffer &buf, const Contact &dest,
     return krpc::request::find_node(o, t, dht.id, search, n4, n6);
   };
 
-  Res result = send(dht, dest, buf, serialize, find_node, closure);
+  Res result = send(dht, dest, buf, serialize, find_node, closure, cls);
   if (result == Res::OK) {
     logger::transmit::find_node(dht, dest, result); // TODO log tx
   }
@@ -85,7 +88,8 @@ find_node(dht::DHT &dht, sp::Buffer &buf, const Contact &dest,
 //=====================================
 Res
 get_peers(dht::DHT &dht, sp::Buffer &buf, const Contact &dest,
-          const dht::Infohash &search, void *closure) noexcept {
+          const dht::Infohash &search, const tx::TxClosure &closure,
+          dht::TxClass cls) noexcept {
   dht::Module get_peers;
   get_peers::setup(get_peers);
 
@@ -95,7 +99,7 @@ get_peers(dht::DHT &dht, sp::Buffer &buf, const Contact &dest,
     return krpc::request::get_peers(o, t, dht.id, search, n4, n6);
   };
 
-  Res result = send(dht, dest, buf, serialize, get_peers, closure);
+  Res result = send(dht, dest, buf, serialize, get_peers, closure, cls);
   if (result == Res::OK) {
     logger::transmit::get_peers(dht, dest, search, result); // TODO log tx
   }
@@ -105,7 +109,8 @@ get_peers(dht::DHT &dht, sp::Buffer &buf, const Contact &dest,
 //=====================================
 Res
 sample_infohashes(dht::DHT &self, sp::Buffer &buf, const Contact &dest,
-                  const dht::Key &target, void *closure) noexcept {
+                  const dht::Key &target, const tx::TxClosure &closure,
+                  dht::TxClass cls) noexcept {
   dht::Module s_ih;
   sample_infohashes::setup(s_ih);
 
@@ -115,7 +120,7 @@ sample_infohashes(dht::DHT &self, sp::Buffer &buf, const Contact &dest,
     return krpc::request::sample_infohashes(o, t, self.id, target, n4, n6);
   };
 
-  Res result = send(self, dest, buf, serialize, s_ih, closure);
+  Res result = send(self, dest, buf, serialize, s_ih, closure, cls);
   if (result == Res::OK) {
     logger::transmit::sample_infohashes(self, dest, target, result);
   }
@@ -13,17 +13,18 @@ ping(dht::DHT &, sp::Buffer &, const dht::Node &) noexcept;
 //=====================================
 Res
 find_node(dht::DHT &, sp::Buffer &, const Contact &, const dht::NodeId &,
-          void *) noexcept;
+          const tx::TxClosure &, dht::TxClass) noexcept;
 
 //=====================================
 Res
 get_peers(dht::DHT &, sp::Buffer &, const Contact &, const dht::Infohash &,
-          void *) noexcept;
+          const tx::TxClosure &, dht::TxClass) noexcept;
 
 //=====================================
 Res
 sample_infohashes(dht::DHT &, sp::Buffer &, const Contact &,
-                  const dht::Key &, void *) noexcept;
+                  const dht::Key &, const tx::TxClosure &,
+                  dht::TxClass) noexcept;
 
 //=====================================
 namespace priv {
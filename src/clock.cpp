@@ -0,0 +1,80 @@
+#include "clock.h"
+#include "shared.h"
+
+#include <algorithm>
+#include <ctime>
+#include <util/assert.h>
+
+namespace dht {
+//=====================================
+static std::uint64_t
+read_ms(clockid_t id) noexcept {
+  struct timespec ts {};
+  if (clock_gettime(id, &ts) != 0) {
+    assertx(false);
+    return 0;
+  }
+
+  return (std::uint64_t(ts.tv_sec) * 1000) +
+         (std::uint64_t(ts.tv_nsec) / 1000000);
+}
+
+static std::uint64_t
+monotonic_ms() noexcept {
+#ifdef CLOCK_MONOTONIC_COARSE
+  return read_ms(CLOCK_MONOTONIC_COARSE);
+#else
+  return read_ms(CLOCK_MONOTONIC);
+#endif
+}
+
+//=====================================
+/*dht::Clock*/
+Clock::Clock() noexcept
+    : fake(false)
+    , base(0)
+    , reads(0) {
+  init_monotonic(*this);
+}
+
+//=====================================
+void
+init_monotonic(Clock &self) noexcept {
+  const std::uint64_t wall = read_ms(CLOCK_REALTIME);
+  const std::uint64_t mono = monotonic_ms();
+
+  self.fake = false;
+  self.base = wall > mono ? wall - mono : 0;
+}
+
+void
+init_fake(Clock &self, const Timestamp &now) noexcept {
+  self.fake = true;
+  self.base = std::uint64_t(now);
+}
+
+void
+advance(Clock &self, sp::Milliseconds delta) noexcept {
+  assertx(self.fake);
+  self.base += delta.value;
+}
+
+Timestamp
+read(Clock &self) noexcept {
+  ++self.reads;
+  if (self.fake) {
+    return Timestamp(self.base);
+  }
+
+  return Timestamp(self.base + monotonic_ms());
+}
+
+//=====================================
+const Timestamp &
+tick(DHT &self) noexcept {
+  self.now = std::max(read(self.clock), self.now);
+  return self.now;
+}
+
+//=====================================
+} // namespace dht
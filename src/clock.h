@@ -0,0 +1,63 @@
+#ifndef SP_MAINLINE_DHT_CLOCK_H
+#define SP_MAINLINE_DHT_CLOCK_H
+
+#include <cstdint>
+
+#include "util.h"
+
+namespace dht {
+struct DHT;
+
+//=====================================
+/* The time source of DHT::now.
+ *
+ * The monotonic clock reads CLOCK_MONOTONIC_COARSE which is served by the
+ * vDSO without a syscall. It is offset by the wall clock at init so the
+ * timestamps keep the magnitude of sp::now().
+ *
+ * A fake clock only moves when advanced, used to test timing dependent code.
+ */
+struct Clock {
+  bool fake;
+  /* fake: the current time, monotonic: wall clock - monotonic clock at init */
+  std::uint64_t base;
+  std::uint64_t reads;
+
+  /* monotonic */
+  Clock() noexcept;
+
+  Clock(const Clock &) = delete;
+  Clock(const Clock &&) = delete;
+
+  Clock &
+  operator=(const Clock &) = delete;
+  Clock &
+  operator=(const Clock &&) = delete;
+};
+
+//=====================================
+void
+init_monotonic(Clock &) noexcept;
+
+void
+init_fake(Clock &, const Timestamp &now) noexcept;
+
+/* Only valid for a fake clock */
+void
+advance(Clock &, sp::Milliseconds) noexcept;
+
+Timestamp
+read(Clock &) noexcept;
+
+//=====================================
+/* Read the clock once at the start of a tick and cache it in DHT::now, which
+ * everything during the tick uses instead of reading the clock. DHT::now
+ * never goes backwards.
+ */
+const Timestamp &
+tick(DHT &) noexcept;
+
+//=====================================
+} // namespace dht
+
+#endif
@@ -2,57 +2,581 @@
 
 #include "Log.h"
 #include "timeout.h"
+#include <algorithm>
 #include <hash/fnv.h>
-#include <tree/bst_extra.h>
+#include <sha1.h>
+#include <utility>
 
 #include <prng/util.h>
-namespace dht {
+namespace db {
 //=====================================
-// dht::KeyValue
-KeyValue::KeyValue(const dht::Infohash &pid) noexcept
-    : id(pid)
-    , peers{}
-    , timeout_peer{nullptr}
-    , name{nullptr} {
+/*db::ExpiryQueue*/
+static timeout::Timer &
+timer_of(void *ctx, std::uint32_t handle) noexcept;
+
+ExpiryQueue::ExpiryQueue() noexcept
+    : entries(nullptr)
+    , length(0)
+    , used(0)
+    , capacity(0)
+    , free_list(0)
+    , wheel(sp::Milliseconds(NodeTime::resolution), timer_of, this) {
+}
+
+ExpiryQueue::~ExpiryQueue() noexcept {
+  free(entries);
+  entries = nullptr;
+  length = 0;
+  used = 0;
+  capacity = 0;
+  free_list = 0;
+}
+
+static ExpiryQueue::Entry &
+entry_of(ExpiryQueue &self, std::uint32_t handle) noexcept {
+  assertx(handle > 0 && handle <= self.used);
+  return self.entries[handle - 1];
+}
+
+static timeout::Timer &
+timer_of(void *ctx, std::uint32_t handle) noexcept {
+  return entry_of(*(ExpiryQueue *)ctx, handle).timer;
+}
+
+static std::size_t
+grown_capacity(const ExpiryQueue &self) noexcept {
+  return self.capacity == 0 ? 64 : self.capacity * 2;
 }
 
-KeyValue::~KeyValue() {
-  if (name) {
-    free(name);
-    name = nullptr;
+/* Take an entry for $id, the handle of the entry or 0 if out of memory */
+static std::uint32_t
+acquire(ExpiryQueue &self, const dht::Infohash &id) noexcept {
+  std::uint32_t handle = self.free_list;
+  if (handle) {
+    self.free_list = entry_of(self, handle).next_free;
+  } else {
+    if (self.used == self.capacity) {
+      const std::size_t capacity = grown_capacity(self);
+      auto *entries = (ExpiryQueue::Entry *)realloc(
+          self.entries, capacity * sizeof(ExpiryQueue::Entry));
+      if (!entries) {
+        return 0;
+      }
+      self.entries = entries;
+      self.capacity = capacity;
+    }
+    handle = std::uint32_t(++self.used);
+    entry_of(self, handle).timer = timeout::Timer();
   }
+
+  ExpiryQueue::Entry &entry = entry_of(self, handle);
+  assertx(!timeout::is_scheduled(entry.timer));
+  entry.id = id;
+  entry.next_free = 0;
+  ++self.length;
+  return handle;
 }
 
-bool
-operator>(const KeyValue &self, const dht::Infohash &o) noexcept {
-  return self.id > o.id;
+/* Cancel the timer of $handle and put its entry on the free list */
+static void
+release(ExpiryQueue &self, std::uint32_t handle) noexcept {
+  timeout::cancel(self.wheel, handle);
+  ExpiryQueue::Entry &entry = entry_of(self, handle);
+  entry.next_free = self.free_list;
+  self.free_list = handle;
+  assertx(self.length > 0);
+  --self.length;
 }
 
-bool
-operator>(const KeyValue &self, const KeyValue &o) noexcept {
-  return self.id > o.id.id;
+//=====================================
+/*db::IpQuota*/
+IpQuota::IpQuota() noexcept
+    : entries(nullptr)
+    , capacity(0)
+    , length(0) {
 }
 
-bool
-operator>(const dht::Infohash &f, const KeyValue &s) noexcept {
-  return f > s.id.id;
+IpQuota::~IpQuota() noexcept {
+  free(entries);
+  entries = nullptr;
+  capacity = 0;
+  length = 0;
+}
+
+static std::size_t
+home(const IpQuota &self, const Ip &ip) noexcept {
+  return fnv_ip(ip) & (self.capacity - 1);
+}
+
+static IpQuota::Entry *
+find(IpQuota &self, const Ip &ip) noexcept {
+  if (self.capacity == 0) {
+    return nullptr;
+  }
+
+  for (std::size_t i = home(self, ip);; i = (i + 1) & (self.capacity - 1)) {
+    IpQuota::Entry &cur = self.entries[i];
+    if (cur.count == 0) {
+      return nullptr;
+    }
+    if (cur.ip == ip) {
+      return &cur;
+    }
+  }
+}
+
+static std::uint32_t
+lookup(IpQuota &self, const Ip &ip) noexcept {
+  IpQuota::Entry *const e = find(self, ip);
+  return e ? e->count : 0;
+}
+
+static void
+place(IpQuota &self, const IpQuota::Entry &entry) noexcept {
+  std::size_t i = home(self, entry.ip);
+  while (self.entries[i].count != 0) {
+    i = (i + 1) & (self.capacity - 1);
+  }
+  self.entries[i] = entry;
+}
+
+/* max load factor of 1/2 */
+static bool
+is_full(const IpQuota &self) noexcept {
+  return (self.length + 1) * 2 > self.capacity;
+}
+
+static std::size_t
+grown_capacity(const IpQuota &self) noexcept {
+  return self.capacity == 0 ? 64 : self.capacity * 2;
+}
+
+static bool
+increment(IpQuota &self, const Ip &ip) noexcept {
+  IpQuota::Entry *e;
+  if ((e = find(self, ip))) {
+    ++e->count;
+    return true;
+  }
+
+  if (is_full(self)) {
+    const std::size_t capacity = grown_capacity(self);
+    auto *entries =
+        (IpQuota::Entry *)calloc(capacity, sizeof(IpQuota::Entry));
+    if (!entries) {
+      return false;
+    }
+
+    IpQuota::Entry *const old = self.entries;
+    const std::size_t old_capacity = self.capacity;
+    self.entries = entries;
+    self.capacity = capacity;
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+      if (old[i].count != 0) {
+        place(self, old[i]);
+      }
+    }
+    free(old);
+  }
+
+  place(self, IpQuota::Entry{ip, 1});
+  ++self.length;
+  return true;
+}
+
+static void
+decrement(IpQuota &self, const Ip &ip) noexcept {
+  IpQuota::Entry *const e = find(self, ip);
+  assertx(e);
+  if (!e || --e->count > 0) {
+    return;
+  }
+
+  /* backward shift deletion, move later entries of the same probe run into the
+   * hole so lookups does not stop early */
+  const std::size_t mask = self.capacity - 1;
+  std::size_t hole = std::size_t(e - self.entries);
+  for (std::size_t i = (hole + 1) & mask; self.entries[i].count != 0;
+       i = (i + 1) & mask) {
+    const std::size_t h = home(self, self.entries[i].ip);
+    /* can the entry at $i be moved to $hole without passing its home */
+    if (((i - h) & mask) >= ((i - hole) & mask)) {
+      self.entries[hole] = self.entries[i];
+      self.entries[i].count = 0;
+      hole = i;
+    }
+  }
+  --self.length;
 }
 
 //=====================================
-} // namespace dht
+/* Bytes the expiry queue grows by when one more entry is acquired */
+static std::size_t
+schedule_growth(const DHTMetaDatabase &self) noexcept {
+  const ExpiryQueue &queue = self.expiry;
+  if (queue.free_list != 0 || queue.used < queue.capacity) {
+    return 0;
+  }
+  return (grown_capacity(queue) - queue.capacity) * sizeof(ExpiryQueue::Entry);
+}
+
+/* (Re)schedule the expiry of the least recently announced peer of $kv */
+static void
+schedule(DHTMetaDatabase &self, dht::KeyValue &kv) noexcept {
+  const sp::Milliseconds timeout(self.config.peer_age_refresh);
+  assertx(!is_empty(kv.peers));
+
+  ExpiryQueue &queue = self.expiry;
+  if (kv.expiry == 0) {
+    if ((kv.expiry = acquire(queue, kv.id)) == 0) {
+      /* retried on the next announce */
+      return;
+    }
+  }
+
+  const Timestamp expire(activity(kv.peers.data[0]) + timeout);
+  timeout::schedule(queue.wheel, kv.expiry, self.now, expire);
+}
+
+/* Release the expiry entry of $kv before it is removed */
+static void
+unschedule(DHTMetaDatabase &self, dht::KeyValue &kv) noexcept {
+  if (kv.expiry != 0) {
+    release(self.expiry, kv.expiry);
+    kv.expiry = 0;
+  }
+}
+
+//=====================================
+// http://www.bittorrent.org/beps/bep_0033.html
+template <int SIZE>
+static void
+bloomfilter_insert(uint8_t (&bloom)[SIZE], const Ip &ip) noexcept {
+  const int m = SIZE * 8;
+  uint8_t hash[20]{0};
+  SHA1_CTX ctx{};
+
+  SHA1Init(&ctx);
+
+  if (ip.type == IpType::IPV4) {
+    // both implementations work
+    // the standard want for example the address 192.168.0.1 to be proccesed in
+    // the order 192,168,0,1
+#if 0
+    Ipv4 ipv4 = ip.ipv4;
+    unsigned char c0 = (ipv4 & (uint32_t(0xff) << 24)) >> 24;
+    unsigned char c1 = (ipv4 & (uint32_t(0xff) << 16)) >> 16;
+    unsigned char c2 = (ipv4 & (uint32_t(0xff) << 8)) >> 8;
+    unsigned char c3 = (ipv4 & (0xff));
+    // printf("%d.%d.%d.%d\n", c0, c1, c2, c3);
+    SHA1Update(&ctx, &c0, 1);
+    SHA1Update(&ctx, &c1, 1);
+    SHA1Update(&ctx, &c2, 1);
+    SHA1Update(&ctx, &c3, 1);
+#else
+    Ipv4 tmp = htonl(ip.ipv4);
+    const uint8_t *raw = (const uint8_t *)&tmp;
+    SHA1Update(&ctx, raw, (uint32_t)sizeof(ip.ipv4));
+#endif
+  } else {
+    assertx(false);
+    // const void *raw = (const void *)&ip.ipv6.raw;
+    // SHA1Update(&ctx, (const uint8_t *)raw, (uint32_t)sizeof(ip.ipv6));
+  }
+  SHA1Final(hash, &ctx);
+
+  int index1 = hash[0] | hash[1] << 8;
+  int index2 = hash[2] | hash[3] << 8;
+
+  // truncate index to m (11 bits required)
+  index1 %= m;
+  index2 %= m;
+
+  bloom[index1 / 8] = uint8_t(bloom[index1 / 8] | (0x01 << (index1 % 8)));
+  bloom[index2 / 8] = uint8_t(bloom[index2 / 8] | (0x01 << (index2 % 8)));
+}
+
+static void
+bloom_insert(dht::ScrapeBloom &self, const dht::Peer &peer) noexcept {
+  if (peer.seed) {
+    bloomfilter_insert(self.seeds, peer.contact.ip);
+  } else {
+    bloomfilter_insert(self.peers, peer.contact.ip);
+  }
+}
+
+static void
+rebuild(dht::ScrapeBloom &self, const dht::PeerList &peers) noexcept {
+  memset(self.seeds, 0, sizeof(self.seeds));
+  memset(self.peers, 0, sizeof(self.peers));
+  for_each(peers, [&self](const dht::Peer &cur) { //
+    bloom_insert(self, cur);
+  });
+  self.stale = false;
+}
+
+//=====================================
+static void
+encode(sp::byte *out, const Contact &contact) noexcept {
+  const Ipv4 ip = htonl(contact.ip.ipv4);
+  const Port port = htons(contact.port);
+  out[0] = '6';
+  out[1] = ':';
+  memcpy(out + 2, &ip, sizeof(ip));
+  memcpy(out + 2 + sizeof(ip), &port, sizeof(port));
+}
+
+static std::uint32_t
+grown_capacity(const dht::CompactBlob &self) noexcept {
+  return self.capacity == 0 ? 8 : self.capacity * 2;
+}
+
+static bool
+append(dht::CompactBlob &self, dht::Pool &pool,
+       const Contact &contact) noexcept {
+  constexpr std::size_t record = dht::CompactBlob::record;
+  if (self.length == self.capacity) {
+    const std::uint32_t capacity = grown_capacity(self);
+    auto *data = (sp::byte *)reallocate(pool, self.data, self.capacity * record,
+                                        capacity * record);
+    if (!data) {
+      return false;
+    }
+    self.data = data;
+    self.capacity = capacity;
+  }
+
+  encode(self.data + (self.length * record), contact);
+  ++self.length;
+  return true;
+}
+
+static bool
+compact_insert(dht::CompactPeers &self, dht::Pool &pool,
+               const dht::Peer &peer) noexcept {
+  if (peer.contact.ip.type != IpType::IPV4) {
+    /* values only carries IPv4 contacts */
+    return true;
+  }
+  return append(peer.seed ? self.seeds : self.peers, pool, peer.contact);
+}
+
+static void
+rebuild(dht::CompactPeers &self, dht::Pool &pool,
+        const dht::PeerList &peers) noexcept {
+  self.seeds.length = 0;
+  self.peers.length = 0;
+  self.stale = !for_all(peers, [&self, &pool](const dht::Peer &cur) {
+    return compact_insert(self, pool, cur);
+  });
+}
+
+//=====================================
+/* The cached filters and encoded peers of $kv no longer match its peers */
+static void
+invalidate(dht::KeyValue &kv) noexcept {
+  if (kv.bloom) {
+    kv.bloom->stale = true;
+  }
+  if (kv.compact) {
+    kv.compact->stale = true;
+  }
+}
+
+//=====================================
+/* The memory beyond the memory budget the db would use with pool blocks of
+ * $sizes and $extra bytes more outside of the pool, 0 if it fits.
+ */
+static std::size_t
+overrun(const DHTMetaDatabase &self, const std::size_t *sizes, std::size_t n,
+        std::size_t extra) noexcept {
+  const std::size_t bytes = growth(self.lookup_table.pool, sizes, n) + extra;
+  if (bytes == 0) {
+    return 0;
+  }
+  const std::size_t total = memory(self) + bytes;
+  const std::size_t budget = self.config.db_memory_budget;
+  return total > budget ? total - budget : 0;
+}
+
+/* $peer was appended to the peers of $kv */
+static void
+on_append(DHTMetaDatabase &self, dht::KeyValue &kv,
+          const dht::Peer &peer) noexcept {
+  constexpr std::size_t record = dht::CompactBlob::record;
+  if (kv.bloom && !kv.bloom->stale) {
+    bloom_insert(*kv.bloom, peer);
+  }
+  if (kv.compact && !kv.compact->stale) {
+    const dht::CompactBlob &blob =
+        peer.seed ? kv.compact->seeds : kv.compact->peers;
+    std::size_t size = 0;
+    if (blob.length == blob.capacity) {
+      size = grown_capacity(blob) * record;
+    }
+    /* rebuilt by values() once there is room */
+    if (overrun(self, &size, 1, 0) > 0 ||
+        !compact_insert(*kv.compact, self.lookup_table.pool, peer)) {
+      kv.compact->stale = true;
+    }
+  }
+}
+
+//=====================================
+static std::size_t
+pooled(std::size_t size) noexcept {
+  return size == 0 ? 0 : dht::block_size(size);
+}
+
+/* Pool memory owned by $kv, its shared name is accounted by the NameTable */
+static std::size_t
+footprint(const dht::KeyValue &kv) noexcept {
+  constexpr std::size_t record = dht::CompactBlob::record;
+  std::size_t result = pooled(kv.peers.capacity * sizeof(dht::Peer));
+  if (kv.bloom) {
+    result += pooled(sizeof(dht::ScrapeBloom));
+  }
+  if (kv.compact) {
+    result += pooled(sizeof(dht::CompactPeers));
+    result += pooled(kv.compact->seeds.capacity * record);
+    result += pooled(kv.compact->peers.capacity * record);
+  }
+  return result;
+}
+
+/* Called before $kv is changed, account() is called after */
+static void
+unaccount(DHTMetaDatabase &self, const dht::KeyValue &kv) noexcept {
+  assertx(self.heap_bytes >= footprint(kv));
+  assertx(self.peers >= length(kv.peers));
+  self.heap_bytes -= footprint(kv);
+  self.peers -= length(kv.peers);
+}
+
+static void
+account(DHTMetaDatabase &self, const dht::KeyValue &kv) noexcept {
+  self.heap_bytes += footprint(kv);
+  self.peers += length(kv.peers);
+}
+
+//=====================================
+/* get_peers hits are halved every $hits_half_life minutes */
+static constexpr std::uint16_t hits_half_life = 10;
+
+static std::uint16_t
+now_minute(const DHTMetaDatabase &self) noexcept {
+  return std::uint16_t(std::uint64_t(self.now) / (60 * 1000));
+}
+
+static std::uint8_t
+decay_hits(const DHTMetaDatabase &self, dht::KeyValue &kv) noexcept {
+  const std::uint16_t elapsed =
+      std::uint16_t(now_minute(self) - kv.hits_minute);
+  const std::uint16_t periods = elapsed / hits_half_life;
+  if (periods > 0) {
+    kv.hits = periods >= 8 ? 0 : std::uint8_t(kv.hits >> periods);
+    kv.hits_minute =
+        std::uint16_t(kv.hits_minute + (periods * hits_half_life));
+  }
+  return kv.hits;
+}
+
+/* Relative worth of keeping $kv, recent hits weigh more than peers and the
+ * worth drops the longer ago the last announce was.
+ */
+static std::uint64_t
+value(const DHTMetaDatabase &self, dht::KeyValue &kv) noexcept {
+  std::uint64_t result = std::uint64_t(decay_hits(self, kv)) * 4;
+  result += length(kv.peers);
+
+  std::uint64_t minutes = 0;
+  if (!is_empty(kv.peers)) {
+    const Timestamp last(activity(kv.peers.data[kv.peers.length - 1]));
+    if (self.now > last) {
+      minutes = (std::uint64_t(self.now) - std::uint64_t(last)) / (60 * 1000);
+    }
+  }
+  /* halved when the last announce was 16 minutes ago */
+  return (result << 14) / (16 + minutes);
+}
+
+/* Remove $kv and release the IP quota of its peers */
+static void
+erase(DHTMetaDatabase &self, dht::KeyValue &kv) noexcept {
+  unaccount(self, kv);
+  unschedule(self, kv);
+  for_each(kv.peers, [&self](const dht::Peer &cur) {
+    decrement(self.ip_quota, cur.contact.ip);
+  });
+  remove_at(self.lookup_table, kv);
+  self.activity++;
+}
+
+/* Evict the least valuable of a few randomly sampled infohashes until blocks
+ * of $sizes and $extra more bytes fit within the memory budget, at most
+ * $max_evictions per call. Since the pool keeps its arenas an eviction does
+ * not lower memory(), the blocks it frees are reused instead. The entry of
+ * $keep is never evicted, other entries are not moved. False if there still
+ * is not room.
+ */
+static bool
+evict(DHTMetaDatabase &self, const dht::Infohash &keep,
+      const std::size_t *sizes, std::size_t n, std::size_t extra) noexcept {
+  constexpr std::size_t candidates = 8;
+  constexpr std::size_t max_evictions = 4;
+
+  for (std::size_t i = 0; i < max_evictions; ++i) {
+    if (overrun(self, sizes, n, extra) == 0) {
+      break;
+    }
+
+    dht::Infohash picked[candidates];
+    const std::size_t sampled =
+        sample(self.lookup_table, self.random, picked, candidates);
+
+    dht::KeyValue *victim = nullptr;
+    std::uint64_t victim_value = 0;
+    for (std::size_t k = 0; k < sampled; ++k) {
+      dht::KeyValue *cur;
+      if (picked[k] == keep || !(cur = find(self.lookup_table, picked[k]))) {
+        continue;
+      }
+      const std::uint64_t v = value(self, *cur);
+      if (!victim || v < victim_value) {
+        victim = cur;
+        victim_value = v;
+      }
+    }
+
+    if (!victim) {
+      break;
+    }
+    log_evict(self.persist, victim->id);
+    erase(self, *victim);
+    ++self.evictions;
+  }
+
+  return overrun(self, sizes, n, extra) == 0;
+}
 
-// TODO !! store peers using ip as key not ip:port
-namespace db {
 //=====================================
 DHTMetaDatabase::DHTMetaDatabase(dht::Config &cfg, prng::xorshift32 &rnd,
                                  Timestamp &n, const dht::Options &opt)
     : scrape_client{n, opt.scrape_socket_path, opt.db_path}
-    , lookup_table()
+    , lookup_table((std::uint64_t(random(rnd)) << 32) | random(rnd))
+    , expiry()
+    , ip_quota()
+    , ip_capped{0}
+    , over_budget{0}
+    , peers_evicted{0}
+    , heap_bytes{0}
+    , peers{0}
+    , evictions{0}
     , key{}
     , activity{0}
-    , length_lookup_table{0}
-    , last_generated{0}
+    , samples_key{random(rnd)}
     , random_samples{}
+    , persist{opt.dump_file}
     , config{cfg}
     , random{rnd}
     , now{n} {
@@ -66,6 +590,9 @@ lookup(DHTMetaDatabase &self, const dht::Infohash &infohash) noexcept {
   if ((needle = find(self.lookup_table, infohash))) {
 
     if (!is_empty(needle->peers)) {
+      if (decay_hits(self, *needle) < 255) {
+        ++needle->hits;
+      }
       return needle;
     }
   }
@@ -74,52 +601,450 @@ lookup(DHTMetaDatabase &self, const dht::Infohash &infohash) noexcept {
 } // db::lookup()
 
 //=====================================
-bool
-insert(DHTMetaDatabase &self, const dht::Infohash &infohash,
-       const Contact &contact, bool seed, const char *name) noexcept {
-  auto new_table = [](DHTMetaDatabase &selfx, const dht::Infohash &ih) {
-    auto ires = insert(selfx.lookup_table, ih);
-    selfx.activity++;
-    selfx.length_lookup_table++;
-    return std::get<0>(ires);
-  };
-
-  dht::KeyValue *table;
-  if (!(table = lookup(self, infohash))) {
-    table = new_table(self, infohash);
-  }
-
-  if (table) {
-    if (strlen(name) > 0) {
-      if (!table->name) {
-        table->name = (char *)calloc(128 + 1, sizeof(char));
+/* Keep the peers ordered by activity when the last peer is older than the
+ * peers before it, only a restored peer can be. Returns its new position. */
+static dht::Peer *
+order_last(dht::PeerList &peers) noexcept {
+  std::size_t i = length(peers) - 1;
+  for (; i > 0; --i) {
+    dht::Peer &prev = peers.data[i - 1];
+    dht::Peer &cur = peers.data[i];
+    if (prev.activity.ticks <= cur.activity.ticks) {
+      break;
+    }
+    std::swap(prev, cur);
+  }
+  return peers.data + i;
+}
+
+/* Make room within the memory budget for a new peer of $infohash, $kv is its
+ * entry if it exists. Growth outside of the pool, of the table, the expiry
+ * queue and the IP quota, is not undone by evicting so it is never evicted
+ * for. False if the peer does not fit.
+ */
+static bool
+make_room(DHTMetaDatabase &self, const dht::Infohash &infohash,
+          const dht::KeyValue *kv, bool new_ip, const char *name) noexcept {
+  const dht::Config &cfg = self.config;
+  const InfohashTable &table = self.lookup_table;
+
+  /* the peer list of a new entry or the grown list of a full one, a list
+   * at its max drops its oldest peer instead */
+  std::size_t sizes[2] = {sizeof(dht::Peer) * dht::PeerList::initial_capacity,
+                          0};
+  if (kv) {
+    const std::size_t n = length(kv->peers);
+    sizes[0] = n < cfg.db_max_peers_per_infohash ? push_size(kv->peers) : 0;
+  }
+
+  std::size_t extra = 0;
+  if (strlen(name) > 0) {
+    extra += name_growth(table, kv, name, sizes[1]);
+  }
+  if (!kv) {
+    extra += insert_growth(table, infohash);
+  }
+  if (!kv || kv->expiry == 0) {
+    extra += schedule_growth(self);
+  }
+  if (new_ip && is_full(self.ip_quota)) {
+    const std::size_t capacity = grown_capacity(self.ip_quota);
+    extra += (capacity - self.ip_quota.capacity) * sizeof(IpQuota::Entry);
+  }
+
+  if (overrun(self, nullptr, 0, extra) > 0) {
+    return false;
+  }
+  return evict(self, infohash, sizes, 2, extra);
+}
+
+static bool
+store_peer(DHTMetaDatabase &self, const dht::Infohash &infohash,
+           const Contact &contact, bool seed, const char *name,
+           const Timestamp &now) noexcept {
+  const dht::Config &cfg = self.config;
+
+  /* peers are identified by ip, a NATed peer announcing from a new port
+   * replaces its previous port */
+  dht::KeyValue *table = find(self.lookup_table, infohash);
+  dht::Peer *existing = table ? find(table->peers, contact.ip) : nullptr;
+
+  if (existing && Timestamp(existing->activity) > now) {
+    /* a replayed announce older than the stored one */
+    return true;
+  }
+
+  if (!existing) {
+    const std::uint32_t quota = lookup(self.ip_quota, contact.ip);
+    if (quota >= cfg.db_max_infohashes_per_ip) {
+      ++self.ip_capped;
+      return false;
+    }
+
+    if (!make_room(self, infohash, table, quota == 0, name)) {
+      ++self.over_budget;
+      return false;
+    }
+
+    if (!table) {
+      bool inserted = false;
+      if (!(table = insert(self.lookup_table, infohash, inserted))) {
+        return false;
       }
-      strncpy(table->name, name, 128);
+      table->hits_minute = now_minute(self);
+      self.activity++;
     }
+  }
 
-    dht::Peer *existing;
+  unaccount(self, *table);
+  bool renamed = false;
+  if (strlen(name) > 0) {
+    std::size_t size;
+    const std::size_t slots = name_growth(self.lookup_table, table, name, size);
+    /* a new name which does not fit within the memory budget is not kept */
+    if (overrun(self, &size, 1, slots) == 0) {
+      renamed = !table->name || strncmp(table->name->str, name, 128) != 0;
+      renamed = set_name(self.lookup_table, *table, name) && renamed;
+    }
+  }
 
-    if ((existing = find(table->peers, contact))) {
-      timeout::unlink(*table, existing);
-      existing->activity = self.now;
-      timeout::append_all(*table, existing);
+  if (existing) {
+    if (existing->seed != seed) {
+      invalidate(*table);
+    } else if (existing->contact.port != contact.port && table->compact) {
+      table->compact->stale = true;
+    }
+    existing->activity = now;
+    existing->seed = seed;
+    existing->contact.port = contact.port;
+    touch(table->peers, existing);
+    existing = order_last(table->peers);
 
-      existing->seed = seed;
-      existing->contact.port = contact.port;
+    log_announce(self.persist, infohash, *existing);
+    logger::peer_db::update(self, infohash, *existing);
+  } else {
+    if (!is_empty(table->peers) &&
+        length(table->peers) >= cfg.db_max_peers_per_infohash) {
+      const Ip dropped = table->peers.data[0].contact.ip;
+      decrement(self.ip_quota, dropped);
+      drop_front(table->peers, self.lookup_table.pool, 1);
+      log_remove(self.persist, infohash, dropped);
+      ++self.peers_evicted;
+      invalidate(*table);
+    }
 
-      logger::peer_db::update(self, infohash, *existing);
-    } else {
-      existing = insert(table->peers, dht::Peer(contact, self.now, seed));
-      if (existing) {
-        timeout::append_all(*table, existing);
-        logger::peer_db::insert(self, infohash, contact);
+    bool res = increment(self.ip_quota, contact.ip);
+    const dht::Peer peer(contact, now, seed);
+    if (res && !push_back(table->peers, self.lookup_table.pool, peer)) {
+      decrement(self.ip_quota, contact.ip);
+      res = false;
+    }
+    if (!res) {
+      if (is_empty(table->peers)) {
+        remove(self.lookup_table, infohash);
+      } else {
+        account(self, *table);
       }
+      return false;
     }
+    on_append(self, *table, peer);
+    order_last(table->peers);
+    log_announce(self.persist, infohash, peer);
+    logger::peer_db::insert(self, infohash, contact);
+  }
+  account(self, *table);
+
+  if (renamed) {
+    /* after the announce which created the entry */
+    log_name(self.persist, infohash, *table->name);
+  }
+
+  if (table->expiry == 0) {
+    schedule(self, *table);
   }
 
   return true;
+}
+
+static bool
+store(DHTMetaDatabase &self, const dht::Infohash &infohash,
+      const Contact &contact, bool seed, const char *name,
+      const Timestamp &now) noexcept {
+  write_begin(self.lookup_table, infohash);
+  const bool result = store_peer(self, infohash, contact, seed, name, now);
+  write_end(self.lookup_table, infohash);
+  return result;
+}
+
+bool
+insert(DHTMetaDatabase &self, const dht::Infohash &infohash,
+       const Contact &contact, bool seed, const char *name) noexcept {
+  return store(self, infohash, contact, seed, name, self.now);
 } // db::insert()
 
+//=====================================
+bool
+restore_peer(DHTMetaDatabase &self, const dht::Infohash &infohash,
+             const Contact &contact, bool seed,
+             const Timestamp &activity) noexcept {
+  return store(self, infohash, contact, seed, "", activity);
+}
+
+bool
+restore_name(DHTMetaDatabase &self, const dht::Infohash &infohash,
+             const char *name) noexcept {
+  dht::KeyValue *const kv = find(self.lookup_table, infohash);
+  if (!kv) {
+    return false;
+  }
+  unaccount(self, *kv);
+  const bool result = set_name(self.lookup_table, *kv, name);
+  account(self, *kv);
+  return result;
+}
+
+/* Remove the peers of $kv where $f returns true */
+template <typename F>
+static void
+remove_peers_if(DHTMetaDatabase &self, dht::KeyValue &kv, F f) noexcept {
+  const dht::Infohash id = kv.id;
+  dht::PeerList &peers = kv.peers;
+  write_begin(self.lookup_table, id);
+  unaccount(self, kv);
+  bool removed = false;
+  for (std::size_t i = length(peers); i-- > 0;) {
+    if (f(peers.data[i])) {
+      decrement(self.ip_quota, peers.data[i].contact.ip);
+      erase(peers, self.lookup_table.pool, peers.data + i);
+      removed = true;
+    }
+  }
+  if (removed) {
+    invalidate(kv);
+  }
+
+  if (is_empty(peers)) {
+    unschedule(self, kv);
+    remove_at(self.lookup_table, kv);
+    self.activity++;
+  } else {
+    account(self, kv);
+  }
+  write_end(self.lookup_table, id);
+}
+
+void
+remove_peer(DHTMetaDatabase &self, const dht::Infohash &infohash,
+            const Ip &ip) noexcept {
+  dht::KeyValue *const kv = find(self.lookup_table, infohash);
+  if (kv) {
+    remove_peers_if(self, *kv, [&ip](const dht::Peer &cur) { //
+      return cur.contact.ip == ip;
+    });
+  }
+}
+
+void
+remove_expired(DHTMetaDatabase &self, const dht::Infohash &infohash,
+               const NodeTime &cutoff) noexcept {
+  dht::KeyValue *const kv = find(self.lookup_table, infohash);
+  if (kv) {
+    remove_peers_if(self, *kv, [&cutoff](const dht::Peer &cur) {
+      return cur.activity.ticks <= cutoff.ticks;
+    });
+  }
+}
+
+void
+remove(DHTMetaDatabase &self, const dht::Infohash &infohash) noexcept {
+  dht::KeyValue *const kv = find(self.lookup_table, infohash);
+  if (kv) {
+    erase(self, *kv);
+  }
+}
+
+//=====================================
+bool
+register_reader(DHTMetaDatabase &self, /*OUT*/ std::size_t &reader) noexcept {
+  return dht::register_reader(self.lookup_table.epoch, reader);
+}
+
+void
+unregister_reader(DHTMetaDatabase &self, std::size_t reader) noexcept {
+  dht::unregister_reader(self.lookup_table.epoch, reader);
+}
+
+std::size_t
+read_peers(DHTMetaDatabase &self, std::size_t reader,
+           const dht::Infohash &infohash, /*OUT*/ dht::Peer *out,
+           std::size_t max) noexcept {
+  return read_peers(self.lookup_table, reader, infohash, out, max);
+}
+
+std::size_t
+memory(const DHTMetaDatabase &self) noexcept {
+  /* the arenas of the pool are counted, also their blocks freed for reuse */
+  std::size_t result = memory(self.lookup_table);
+  result += self.expiry.capacity * sizeof(ExpiryQueue::Entry);
+  result += self.ip_quota.capacity * sizeof(IpQuota::Entry);
+  return result;
+}
+
+//=====================================
+void
+scrape(DHTMetaDatabase &self, dht::KeyValue &kv,
+       /*OUT*/ std::uint8_t (&seeds)[256],
+       /*OUT*/ std::uint8_t (&peers)[256]) noexcept {
+  /* the filters are only a cache, never evict to keep them */
+  const std::size_t size = sizeof(*kv.bloom);
+  if (!kv.bloom && overrun(self, &size, 1, 0) == 0) {
+    unaccount(self, kv);
+    dht::Pool &pool = self.lookup_table.pool;
+    if ((kv.bloom = (dht::ScrapeBloom *)allocate(pool, sizeof(*kv.bloom)))) {
+      kv.bloom->stale = true;
+    }
+    account(self, kv);
+  }
+
+  if (kv.bloom) {
+    if (kv.bloom->stale) {
+      rebuild(*kv.bloom, kv.peers);
+    }
+    memcpy(seeds, kv.bloom->seeds, sizeof(seeds));
+    memcpy(peers, kv.bloom->peers, sizeof(peers));
+  } else {
+    /* over the memory budget or out of memory, build a throwaway copy */
+    dht::ScrapeBloom tmp;
+    rebuild(tmp, kv.peers);
+    memcpy(seeds, tmp.seeds, sizeof(seeds));
+    memcpy(peers, tmp.peers, sizeof(peers));
+  }
+} // db::scrape()
+
+//=====================================
+/*db::PeerWindow*/
+PeerWindow::PeerWindow() noexcept
+    : part{}
+    , length{}
+    , parts{0} {
+}
+
+/* The pool blocks the encoded peers of $kv need to be built, besides the
+ * blocks they already have */
+static void
+compact_sizes(const dht::KeyValue &kv,
+              /*OUT*/ std::size_t (&sizes)[3]) noexcept {
+  constexpr std::size_t record = dht::CompactBlob::record;
+  const dht::CompactPeers *const compact = kv.compact;
+  std::size_t seeds = 0;
+  for_each(kv.peers, [&seeds](const dht::Peer &cur) {
+    seeds += cur.seed ? 1 : 0;
+  });
+  const std::size_t others = length(kv.peers) - seeds;
+  sizes[0] = compact ? 0 : sizeof(dht::CompactPeers);
+  sizes[1] = compact && seeds <= compact->seeds.capacity ? 0 : seeds * record;
+  sizes[2] = compact && others <= compact->peers.capacity ? 0 : others * record;
+}
+
+/* A window of the selected peers encoded into $result.scratch, used when the
+ * encoded peers can not be kept with $kv.
+ */
+static bool
+values_scratch(DHTMetaDatabase &self, const dht::KeyValue &kv, bool seeds,
+               bool peers, /*OUT*/ PeerWindow &result) noexcept {
+  constexpr std::size_t record = dht::CompactBlob::record;
+  result.parts = 0;
+  const std::size_t n = length(kv.peers);
+  if (n == 0) {
+    return false;
+  }
+
+  const std::size_t max =
+      std::min(self.config.db_max_values_bytes, sizeof(result.scratch)) /
+      record;
+  const std::size_t start = random(self.random) % n;
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < n && count < max; ++i) {
+    const dht::Peer &cur = kv.peers.data[(start + i) % n];
+    if ((cur.seed ? seeds : peers) && cur.contact.ip.type == IpType::IPV4) {
+      encode(result.scratch + (count * record), cur.contact);
+      ++count;
+    }
+  }
+
+  if (count > 0) {
+    result.part[0] = result.scratch;
+    result.length[0] = count * record;
+    result.parts = 1;
+  }
+  return result.parts > 0;
+}
+
+bool
+values(DHTMetaDatabase &self, dht::KeyValue &kv, bool seeds, bool peers,
+       /*OUT*/ PeerWindow &result) noexcept {
+  constexpr std::size_t record = dht::CompactBlob::record;
+
+  if (!kv.compact || kv.compact->stale) {
+    /* the encoded peers are only a cache, never evict to keep them */
+    std::size_t sizes[3];
+    compact_sizes(kv, sizes);
+    if (overrun(self, sizes, 3, 0) > 0) {
+      return values_scratch(self, kv, seeds, peers, result);
+    }
+  }
+
+  if (!kv.compact) {
+    unaccount(self, kv);
+    dht::Pool &pool = self.lookup_table.pool;
+    kv.compact = (dht::CompactPeers *)allocate(pool, sizeof(*kv.compact));
+    if (kv.compact) {
+      memset(kv.compact, 0, sizeof(*kv.compact));
+      kv.compact->stale = true;
+    }
+    account(self, kv);
+    if (!kv.compact) {
+      return values_scratch(self, kv, seeds, peers, result);
+    }
+  }
+
+  if (kv.compact->stale) {
+    unaccount(self, kv);
+    rebuild(*kv.compact, self.lookup_table.pool, kv.peers);
+    account(self, kv);
+  }
+
+  /* the selected peers as if the seed blob was followed by the peer blob */
+  const dht::CompactBlob &first = kv.compact->seeds;
+  const dht::CompactBlob &second = kv.compact->peers;
+  const std::size_t n_first = seeds ? first.length : 0;
+  const std::size_t n = n_first + (peers ? second.length : 0);
+  if (n == 0) {
+    return false;
+  }
+
+  std::size_t remaining =
+      std::min(n, self.config.db_max_values_bytes / record);
+  std::size_t pos = random(self.random) % n;
+  result.parts = 0;
+  while (remaining > 0) {
+    const bool in_first = pos < n_first;
+    const dht::CompactBlob &blob = in_first ? first : second;
+    const std::size_t offset = in_first ? pos : pos - n_first;
+    const std::size_t chunk = std::min(remaining, blob.length - offset);
+
+    assertx(result.parts < 3);
+    result.part[result.parts] = blob.data + (offset * record);
+    result.length[result.parts] = chunk * record;
+    ++result.parts;
+
+    remaining -= chunk;
+    pos = (pos + chunk) % n;
+  }
+
+  return result.parts > 0;
+} // db::values()
+
 //=====================================
 static dht::TokenKey &
 get_token_key(DHTMetaDatabase &self) noexcept {
@@ -179,58 +1104,104 @@ is_valid_token(DHTMetaDatabase &self, dht::Node &node,
 } // db::is_valid_token()
 
 //=====================================
-Timestamp
-on_awake_peer_db(DHTMetaDatabase &self, sp::Buffer &) noexcept {
+bool
+expire_peers(DHTMetaDatabase &self, dht::Budget &budget) noexcept {
   const sp::Milliseconds timeout(self.config.peer_age_refresh);
-  sp::StaticArray<dht::KeyValue *, 16> empty;
-  Timestamp next{self.now};
+  ExpiryQueue &queue = self.expiry;
+  collect(self.lookup_table.epoch);
 
-  binary::rec::inorder(self.lookup_table, [&](dht::KeyValue &cur) {
-    dht::Peer *peer;
-    while ((peer = timeout::take_peer(self, cur, timeout))) {
-      assertx_n(remove(cur.peers, *peer));
+  for (;;) {
+    /* cascading the wheel is not counted against $budget */
+    timeout::advance(queue.wheel, self.now);
+    if (!timeout::has_expired(queue.wheel, self.now)) {
+      break;
     }
+    if (!spend(budget)) {
+      return false;
+    }
+    const std::uint32_t handle = timeout::take_expired(queue.wheel, self.now);
+    assertx(handle != 0);
+
+    const dht::Infohash id = entry_of(queue, handle).id;
+    dht::KeyValue *const cur = find(self.lookup_table, id);
+    assertx(cur);
+    assertx(cur->expiry == handle);
 
-    if (cur.timeout_peer) {
-      next = std::min(next, cur.timeout_peer->activity);
+    /* peers are ordered by activity, the expired peers are a prefix */
+    dht::PeerList &peers = cur->peers;
+    write_begin(self.lookup_table, id);
+    unaccount(self, *cur);
+    std::size_t expired = 0;
+    while (expired < length(peers) &&
+           self.now >= (activity(peers.data[expired]) + timeout)) {
+      decrement(self.ip_quota, peers.data[expired].contact.ip);
+      ++expired;
     }
-    if (is_empty(cur.peers)) {
-      assertx(!cur.timeout_peer);
-      insert(empty, &cur);
+    drop_front(peers, self.lookup_table.pool, expired);
+    if (expired > 0) {
+      invalidate(*cur);
+      const std::uint64_t horizon = std::uint64_t(self.now) - timeout.value;
+      log_expire(self.persist, cur->id, NodeTime(Timestamp(horizon)));
     }
-  });
 
-  for_each(empty, [&](auto cur) { //
-    assertx_n(remove(self.lookup_table, cur->id));
-    self.length_lookup_table--;
-    self.activity++;
-  });
+    if (is_empty(peers)) {
+      unschedule(self, *cur);
+      remove_at(self.lookup_table, *cur);
+      self.activity++;
+    } else {
+      account(self, *cur);
+      schedule(self, *cur);
+    }
+    write_end(self.lookup_table, id);
+  }
 
-  Timestamp tmp(next + timeout);
-  assertx(tmp > self.now);
-  return tmp;
+  return true;
+}
+
+Timestamp
+next_peer_expiry(const DHTMetaDatabase &self) noexcept {
+  Timestamp result(0);
+  if (!timeout::next_expire(self.expiry.wheel, result)) {
+    return self.now + sp::Milliseconds(self.config.peer_age_refresh);
+  }
+
+  if (result <= self.now) {
+    return self.now + sp::Milliseconds(1);
+  }
+  return result;
 }
 
 //=====================================
+static std::uint64_t
+samples_window(const DHTMetaDatabase &self, const Timestamp &now) noexcept {
+  const sp::Milliseconds interval(self.config.db_samples_refresh_interval);
+  return std::uint64_t(now) / interval.value;
+}
+
 sp::UinStaticArray<dht::Infohash, 20> &
-randomize_samples(DHTMetaDatabase &self) noexcept {
-  if (!is_empty(self.lookup_table)) {
-    sp::Timestamp next_generated =
-        self.last_generated + self.config.db_samples_refresh_interval;
-    if (next_generated <= self.now) {
-      clear(self.random_samples);
-      binary::rec::inorder(self.lookup_table, [&](dht::KeyValue &cur) {
-        if (!is_full(self.random_samples)) {
-          insert(self.random_samples, dht::Infohash(cur.id));
-        } else {
-          auto idx = random(self.random) % self.length_lookup_table;
-          if (idx < capacity(self.random_samples)) {
-            insert_at(self.random_samples, idx, dht::Infohash(cur.id));
-          }
-        }
-      });
-      self.last_generated = self.now;
-    }
+randomize_samples(DHTMetaDatabase &self, const Contact &remote) noexcept {
+  constexpr std::size_t k = 20;
+  const std::uint64_t window = samples_window(self, self.now);
+
+  uint32_t h = fnv_1a::encode32(&self.samples_key, sizeof(self.samples_key));
+  if (remote.ip.type == IpType::IPV4) {
+    h = fnv_1a::encode(&remote.ip.ipv4, sizeof(remote.ip.ipv4), h);
+  } else {
+#ifdef IP_IPV6
+    h = fnv_1a::encode(&remote.ip.ipv6, sizeof(remote.ip.ipv6), h);
+#else
+    assertx(false);
+#endif
+  }
+  h = fnv_1a::encode(&window, sizeof(window), h);
+  prng::xorshift32 r(h == 0 ? 1 : h);
+
+  dht::Infohash picked[k];
+  const std::size_t n = sample(self.lookup_table, r, picked, k);
+
+  clear(self.random_samples);
+  for (std::size_t i = 0; i < n; ++i) {
+    insert(self.random_samples, picked[i]);
   }
   return self.random_samples;
 }
@@ -238,13 +1209,10 @@ randomize_samples(DHTMetaDatabase &self) noexcept {
 //=====================================
 std::uint32_t
 next_randomize_samples(DHTMetaDatabase &self, const Timestamp &now) noexcept {
-  Timestamp next_refresh =
-      self.last_generated + self.config.db_samples_refresh_interval;
-  if (next_refresh <= now) {
-    return (uint32_t)sp::Seconds(self.config.db_samples_refresh_interval).value;
-  }
-  Timestamp delta = next_refresh - now;
-  return (uint32_t)sp::Seconds(delta).value;
+  const sp::Milliseconds interval(self.config.db_samples_refresh_interval);
+  const std::uint64_t next = (samples_window(self, now) + 1) * interval.value;
+  const std::uint64_t delta = next - std::uint64_t(now);
+  return std::uint32_t((delta + 999) / 1000);
 }
 
 //=====================================
@@ -2,56 +2,119 @@
 #define SP_MAINLINE_DHT_DB_H
 
 // #include "shared.h"
+#include "db_persist.h"
+#include "infohash_table.h"
 #include "spbt_scrape_client.h"
 #include "util.h"
 #include "Options.h"
 
 #include <collection/Array.h>
-#include <list/SkipList.h>
-#include <tree/avl.h>
 
-namespace dht {
-//=====================================
-struct KeyValue {
-  dht::Infohash id;
-  sp::SkipList<dht::Peer, 6> peers;
-  dht::Peer *timeout_peer;
-  char *name;
-
-  explicit KeyValue(const dht::Infohash &) noexcept;
-
-  KeyValue(const KeyValue &) = delete;
-  KeyValue(const KeyValue &&) = delete;
-
-  KeyValue &
-  operator=(const KeyValue &) = delete;
-  KeyValue &
-  operator=(const KeyValue &&) = delete;
+namespace db {
 
-  ~KeyValue();
+//=====================================
+/* When the least recently announced peer of each infohash expires, the same
+ * peer timeout applies to every infohash. An infohash owns one entry while it
+ * has peers, KeyValue::expiry is its handle and the timer of the entry is
+ * scheduled in $wheel. Released entries are reused before the array grows.
+ */
+struct ExpiryQueue {
+  struct Entry {
+    timeout::Timer timer;
+    dht::Infohash id;
+    /* handle of the next free entry, only valid when released */
+    std::uint32_t next_free;
+  };
+
+  Entry *entries;
+  /* entries in use */
+  std::size_t length;
+  /* entries handed out at least once, the rest of $capacity is untouched */
+  std::size_t used;
+  std::size_t capacity;
+  /* handle of the first released entry, 0 if none */
+  std::uint32_t free_list;
+  timeout::Wheel wheel;
+
+  ExpiryQueue() noexcept;
+
+  ExpiryQueue(const ExpiryQueue &) = delete;
+  ExpiryQueue(const ExpiryQueue &&) = delete;
+
+  ExpiryQueue &
+  operator=(const ExpiryQueue &) = delete;
+  ExpiryQueue &
+  operator=(const ExpiryQueue &&) = delete;
+
+  ~ExpiryQueue() noexcept;
 };
 
-bool
-operator>(const KeyValue &, const dht::Infohash &) noexcept;
-
-bool
-operator>(const KeyValue &, const KeyValue &) noexcept;
-
-bool
-operator>(const dht::Infohash &, const KeyValue &) noexcept;
-} // namespace dht
+//=====================================
+/* The number of infohashes each IP is stored as a peer for. Open addressing
+ * with linear probing, a slot with a zero count is empty.
+ */
+struct IpQuota {
+  struct Entry {
+    Ip ip;
+    std::uint32_t count;
+  };
+
+  Entry *entries;
+  std::size_t capacity;
+  std::size_t length;
+
+  IpQuota() noexcept;
+
+  IpQuota(const IpQuota &) = delete;
+  IpQuota(const IpQuota &&) = delete;
+
+  IpQuota &
+  operator=(const IpQuota &) = delete;
+  IpQuota &
+  operator=(const IpQuota &&) = delete;
+
+  ~IpQuota() noexcept;
+};
 
-namespace db {
+//=====================================
+/* A window of the pre-encoded peers of an infohash, in at most three parts
+ * since the window wraps around.
+ */
+struct PeerWindow {
+  const sp::byte *part[3];
+  /* in bytes */
+  std::size_t length[3];
+  std::size_t parts;
+  /* holds the window when the db is too full to keep the encoded peers */
+  sp::byte scratch[1024];
+
+  PeerWindow() noexcept;
+};
 
 //=====================================
 struct DHTMetaDatabase {
   dht::DHTMeta_spbt_scrape_client scrape_client;
-  avl::Tree<dht::KeyValue> lookup_table;
+  InfohashTable lookup_table;
+  ExpiryQueue expiry;
+  IpQuota ip_quota;
+  /* announces dropped since the IP is stored for too many infohashes */
+  std::uint64_t ip_capped;
+  /* announces dropped since they did not fit within the memory budget */
+  std::uint64_t over_budget;
+  /* peers replaced since their infohash had too many peers */
+  std::uint64_t peers_evicted;
+  /* heap memory of the peer lists and names of every entry */
+  std::size_t heap_bytes;
+  /* number of peers stored for all infohashes */
+  std::size_t peers;
+  /* infohashes evicted since the db exceeded its memory budget */
+  std::uint64_t evictions;
   dht::TokenKey key[2];
   uint32_t activity;
-  uint32_t length_lookup_table;
-  Timestamp last_generated{0};
+  /* secret mixed into the per requester sample selection */
+  std::uint32_t samples_key;
   sp::UinStaticArray<dht::Infohash, 20> random_samples;
+  Persist persist;
 
   dht::Config &config;
   prng::xorshift32 &random;
@@ -65,14 +128,92 @@ struct DHTMetaDatabase {
 };
 
 //=====================================
+/* Find the peers of $key, counted as a get_peers hit when deciding what to
+ * evict.
+ */
 dht::KeyValue *
 lookup(DHTMetaDatabase &, const dht::Infohash &key) noexcept;
 
 //=====================================
+/* Store $value as a peer of $key. When a new peer would grow the db beyond
+ * Config::db_memory_budget a few of the least valuable infohashes are evicted
+ * first and their memory reused, the value of an infohash is judged by its
+ * recent get_peers hits, its number of peers and the time since its last
+ * announce. False if the peer still does not fit.
+ */
 bool
 insert(DHTMetaDatabase &, const dht::Infohash &key, const Contact &value,
        bool seed, const char *name) noexcept;
 
+/* Store $value as a peer of $key last announced at $activity, used when the
+ * db is restored. A record older than the stored peer is ignored, a peer
+ * which already expired is kept until the next expire_peers().
+ */
+bool
+restore_peer(DHTMetaDatabase &, const dht::Infohash &key, const Contact &value,
+             bool seed, const Timestamp &activity) noexcept;
+
+bool
+restore_name(DHTMetaDatabase &, const dht::Infohash &key,
+             const char *name) noexcept;
+
+/* Remove the peer with $ip from $key */
+void
+remove_peer(DHTMetaDatabase &, const dht::Infohash &key, const Ip &) noexcept;
+
+/* Remove the peers of $key last announced at or before $cutoff */
+void
+remove_expired(DHTMetaDatabase &, const dht::Infohash &key,
+               const NodeTime &cutoff) noexcept;
+
+/* Remove $key and all of its peers */
+void
+remove(DHTMetaDatabase &, const dht::Infohash &key) noexcept;
+
+//=====================================
+/* Register a thread which reads the db concurrently with the thread running
+ * the dht, false if there are too many readers.
+ */
+bool
+register_reader(DHTMetaDatabase &, /*OUT*/ std::size_t &reader) noexcept;
+
+void
+unregister_reader(DHTMetaDatabase &, std::size_t reader) noexcept;
+
+/* Copy at most $max peers of $key from a registered reader thread, the least
+ * recently announced first. Returns the number of peers copied.
+ */
+std::size_t
+read_peers(DHTMetaDatabase &, std::size_t reader, const dht::Infohash &key,
+           /*OUT*/ dht::Peer *out, std::size_t max) noexcept;
+
+/* Copy the BEP33 bloom filters of the seeds and the peers of $kv. The filters
+ * are kept with $kv and updated on announce, they are only rebuilt after
+ * peers were removed or changed between seed and peer. When keeping them
+ * would grow the db beyond its memory budget they are built into a copy.
+ */
+void
+scrape(DHTMetaDatabase &, dht::KeyValue &, /*OUT*/ std::uint8_t (&seeds)[256],
+       /*OUT*/ std::uint8_t (&peers)[256]) noexcept;
+
+/* Select the peers for a get_peers reply, the seeds and/or the other peers of
+ * $kv. The peers are kept encoded with $kv and a window of at most
+ * Config::db_max_values_bytes starting at a random peer is selected, so large
+ * swarms does not overflow the datagram and every peer gets returned. When
+ * keeping them would grow the db beyond its memory budget the window is
+ * encoded into PeerWindow::scratch instead, nothing is evicted for them.
+ * False if no peer was selected.
+ */
+bool
+values(DHTMetaDatabase &, dht::KeyValue &, bool seeds, bool peers,
+       /*OUT*/ PeerWindow &) noexcept;
+
+/* Heap memory used by the db, kept up to date on every change. The pool is
+ * counted at its high-water mark since it keeps its arenas.
+ */
+std::size_t
+memory(const DHTMetaDatabase &) noexcept;
+
 //=====================================
 void
 mint_token(DHTMetaDatabase &, const Contact &, dht::Token &) noexcept;
@@ -81,14 +222,26 @@ bool
 is_valid_token(DHTMetaDatabase &, dht::Node &, const dht::Token &) noexcept;
 
 //=====================================
+/* Expire the peers which are due, each infohash with due peers spends one unit
+ * of $budget. False if $budget ran out before all due peers were expired.
+ */
+bool
+expire_peers(DHTMetaDatabase &, dht::Budget &) noexcept;
+
+/* When expire_peers() next has work to do */
 Timestamp
-on_awake_peer_db(DHTMetaDatabase &, sp::Buffer &) noexcept;
+next_peer_expiry(const DHTMetaDatabase &) noexcept;
 
 //=====================================
+/* Random infohashes for a BEP51 response to $remote. The samples of a
+ * requester stay the same within a refresh interval, different requesters and
+ * intervals get a different subset.
+ */
 sp::UinStaticArray<dht::Infohash, 20> &
-randomize_samples(DHTMetaDatabase &) noexcept;
+randomize_samples(DHTMetaDatabase &, const Contact &remote) noexcept;
 
 //=====================================
+/* Seconds until the current refresh interval of the samples ends */
 std::uint32_t
 next_randomize_samples(DHTMetaDatabase &, const Timestamp &now) noexcept;
 
@@ -0,0 +1,853 @@
+#include "db_persist.h"
+
+#include "clock.h"
+#include "db.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <util/assert.h>
+
+namespace db {
+//=====================================
+/* Every integer is stored in network byte order. The snapshot starts with
+ *   magic:32 version:32 generation:64 entries:64 peers:64
+ * followed by $entries infohashes of
+ *   infohash:160 name_length:8 name count:32
+ * followed by $count peers of
+ *   ipv4:32 port:16 activity:32 seed:8
+ * where activity is seconds since the epoch. A log record is
+ *   type:8 infohash:160
+ * followed by the fields of its type. Only IPv4 peers are persisted.
+ */
+static constexpr std::uint32_t snapshot_magic = 0x73706462;
+static constexpr std::uint32_t snapshot_version = 1;
+static constexpr std::size_t header_size = 32;
+static constexpr std::size_t peer_size = 11;
+static constexpr std::size_t max_name = 255;
+
+enum class Record : std::uint8_t {
+  /* peer:88 */
+  ANNOUNCE = 1,
+  /* name_length:8 name */
+  NAME = 2,
+  /* ipv4:32 */
+  REMOVE = 3,
+  /* cutoff:32 */
+  EXPIRE = 4,
+  EVICT = 5,
+};
+
+//=====================================
+static sp::byte *
+put(sp::byte *it, const void *data, std::size_t length) noexcept {
+  memcpy(it, data, length);
+  return it + length;
+}
+
+static sp::byte *
+put_u8(sp::byte *it, std::uint8_t value) noexcept {
+  return put(it, &value, sizeof(value));
+}
+
+static sp::byte *
+put_u16(sp::byte *it, std::uint16_t value) noexcept {
+  value = htons(value);
+  return put(it, &value, sizeof(value));
+}
+
+static sp::byte *
+put_u32(sp::byte *it, std::uint32_t value) noexcept {
+  value = htonl(value);
+  return put(it, &value, sizeof(value));
+}
+
+static sp::byte *
+put_u64(sp::byte *it, std::uint64_t value) noexcept {
+  it = put_u32(it, std::uint32_t(value >> 32));
+  return put_u32(it, std::uint32_t(value));
+}
+
+/* Times are stored as absolute seconds, NodeTime is relative to the start of
+ * the process
+ */
+static std::uint32_t
+seconds_of(const NodeTime &t) noexcept {
+  return std::uint32_t(Timestamp(t).value / 1000);
+}
+
+static NodeTime
+from_seconds(std::uint32_t seconds) noexcept {
+  return NodeTime(Timestamp(std::uint64_t(seconds) * 1000));
+}
+
+static sp::byte *
+put_peer(sp::byte *it, const dht::Peer &peer) noexcept {
+  it = put_u32(it, peer.contact.ip.ipv4);
+  it = put_u16(it, peer.contact.port);
+  it = put_u32(it, seconds_of(peer.activity));
+  return put_u8(it, peer.seed ? 1 : 0);
+}
+
+//=====================================
+struct Reader {
+  const sp::byte *it;
+  const sp::byte *end;
+};
+
+static bool
+take(Reader &self, void *out, std::size_t length) noexcept {
+  if (std::size_t(self.end - self.it) < length) {
+    return false;
+  }
+  memcpy(out, self.it, length);
+  self.it += length;
+  return true;
+}
+
+static bool
+take_u8(Reader &self, std::uint8_t &out) noexcept {
+  return take(self, &out, sizeof(out));
+}
+
+static bool
+take_u16(Reader &self, std::uint16_t &out) noexcept {
+  if (!take(self, &out, sizeof(out))) {
+    return false;
+  }
+  out = ntohs(out);
+  return true;
+}
+
+static bool
+take_u32(Reader &self, std::uint32_t &out) noexcept {
+  if (!take(self, &out, sizeof(out))) {
+    return false;
+  }
+  out = ntohl(out);
+  return true;
+}
+
+static bool
+take_u64(Reader &self, std::uint64_t &out) noexcept {
+  std::uint32_t high, low;
+  if (!take_u32(self, high) || !take_u32(self, low)) {
+    return false;
+  }
+  out = (std::uint64_t(high) << 32) | low;
+  return true;
+}
+
+struct PeerRecord {
+  Contact contact;
+  NodeTime activity;
+  bool seed;
+};
+
+static bool
+take_peer(Reader &self, PeerRecord &out) noexcept {
+  std::uint32_t ip, activity;
+  std::uint16_t port;
+  std::uint8_t seed;
+  if (!take_u32(self, ip) || !take_u16(self, port) ||
+      !take_u32(self, activity) || !take_u8(self, seed)) {
+    return false;
+  }
+  out.contact = Contact(Ipv4(ip), Port(port));
+  out.activity = from_seconds(activity);
+  out.seed = seed != 0;
+  return true;
+}
+
+/* A null terminated name of at most $max_name characters */
+static bool
+take_name(Reader &self, char (&out)[max_name + 1]) noexcept {
+  std::uint8_t length;
+  if (!take_u8(self, length) || !take(self, out, length)) {
+    return false;
+  }
+  out[length] = '\0';
+  return true;
+}
+
+//=====================================
+/* A read only mapping of a whole file */
+struct Mapped {
+  const sp::byte *data;
+  std::size_t length;
+};
+
+/* False if $path does not exist or could not be mapped */
+static bool
+map(const char *path, Mapped &out) noexcept {
+  out.data = nullptr;
+  out.length = 0;
+
+  const int file = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (file < 0) {
+    return false;
+  }
+
+  struct stat st {};
+  bool result = false;
+  if (fstat(file, &st) == 0 && st.st_size >= 0) {
+    out.length = std::size_t(st.st_size);
+    if (out.length == 0) {
+      result = true;
+    } else {
+      void *const addr =
+          ::mmap(nullptr, out.length, PROT_READ, MAP_PRIVATE, file, 0);
+      if (addr != MAP_FAILED) {
+        madvise(addr, out.length, MADV_SEQUENTIAL);
+        out.data = (const sp::byte *)addr;
+        result = true;
+      }
+    }
+  }
+  ::close(file);
+  return result;
+}
+
+static void
+unmap(Mapped &self) noexcept {
+  if (self.data) {
+    ::munmap((void *)self.data, self.length);
+  }
+  self.data = nullptr;
+  self.length = 0;
+}
+
+static bool
+write_all(int file, const sp::byte *data, std::size_t length) noexcept {
+  while (length > 0) {
+    const ssize_t written = ::write(file, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    length -= std::size_t(written);
+  }
+  return true;
+}
+
+static void
+close_file(int &file) noexcept {
+  if (file != -1) {
+    ::close(file);
+    file = -1;
+  }
+}
+
+//=====================================
+template <std::size_t SIZE>
+static void
+log_path(const Persist &self, std::uint64_t generation,
+         char (&out)[SIZE]) noexcept {
+  snprintf(out, SIZE, "%s.log.%" PRIu64, self.path, generation);
+}
+
+template <std::size_t SIZE>
+static void
+tmp_path(const Persist &self, char (&out)[SIZE]) noexcept {
+  snprintf(out, SIZE, "%s.tmp", self.path);
+}
+
+//=====================================
+/*db::Persist*/
+Persist::Persist(const char *dump_file) noexcept
+    : path{0}
+    , generation(0)
+    , first_generation(0)
+    , log(-1)
+    , log_buffer(nullptr)
+    , log_capacity(0)
+    , log_length(0)
+    , snapshot(-1)
+    , shard(0)
+    , cursor(0)
+    , rehashes(0)
+    , shard_offset(0)
+    , shard_entries(0)
+    , shard_peers(0)
+    , snapshot_entries(0)
+    , snapshot_peers(0)
+    , snapshot_buffer{}
+    , snapshot_length(0)
+    , snapshot_offset(0)
+    , snapshot_sync(0)
+    , next_snapshot(0)
+    , next_flush(0)
+    , snapshots(0)
+    , snapshot_failures(0)
+    , log_records(0)
+    , log_failures(0)
+    , restore_ms(0)
+    , restored_infohashes(0)
+    , restored_peers(0)
+    , replayed_records(0) {
+  if (dump_file && strlen(dump_file) > 0) {
+    snprintf(path, sizeof(path), "%s.peers", dump_file);
+  }
+}
+
+Persist::~Persist() noexcept {
+  close_file(log);
+  free(log_buffer);
+  log_buffer = nullptr;
+  log_capacity = 0;
+  log_length = 0;
+  if (snapshot != -1) {
+    char tmp[PATH_MAX + 8];
+    tmp_path(*this, tmp);
+    close_file(snapshot);
+    unlink(tmp);
+  }
+}
+
+//=====================================
+bool
+flush(Persist &self) noexcept {
+  if (self.log == -1 || self.log_length == 0) {
+    return true;
+  }
+
+  /* on failure the records are dropped, the next snapshot covers them */
+  const bool result = write_all(self.log, self.log_buffer, self.log_length);
+  if (!result) {
+    ++self.log_failures;
+  }
+  self.log_length = 0;
+  if (self.log_capacity > Persist::buffer_size) {
+    /* a burst is over, allocated again at the usual size */
+    free(self.log_buffer);
+    self.log_buffer = nullptr;
+    self.log_capacity = 0;
+  }
+  return result;
+}
+
+/* Room for a log record of $length bytes, nullptr if nothing is logged */
+static sp::byte *
+reserve(Persist &self, Record type, const dht::Infohash &id,
+        std::size_t length) noexcept {
+  if (self.log == -1) {
+    return nullptr;
+  }
+
+  length += 1 + sizeof(id.id);
+  if (self.log_length + length > self.log_capacity) {
+    /* grown rather than flushed, a record is logged from within a write
+     * section of the db where no file is written */
+    std::size_t capacity = std::max(self.log_capacity, Persist::buffer_size);
+    while (capacity < self.log_length + length) {
+      capacity *= 2;
+    }
+    auto *buffer = (sp::byte *)realloc(self.log_buffer, capacity);
+    if (!buffer) {
+      ++self.log_failures;
+      return nullptr;
+    }
+    self.log_buffer = buffer;
+    self.log_capacity = capacity;
+  }
+
+  sp::byte *it = self.log_buffer + self.log_length;
+  self.log_length += length;
+  ++self.log_records;
+
+  it = put_u8(it, std::uint8_t(type));
+  return put(it, id.id, sizeof(id.id));
+}
+
+void
+log_announce(Persist &self, const dht::Infohash &id,
+             const dht::Peer &peer) noexcept {
+  if (peer.contact.ip.type != IpType::IPV4) {
+    return;
+  }
+
+  sp::byte *const it = reserve(self, Record::ANNOUNCE, id, peer_size);
+  if (it) {
+    put_peer(it, peer);
+  }
+}
+
+void
+log_name(Persist &self, const dht::Infohash &id,
+         const dht::Name &name) noexcept {
+  const std::size_t length = std::min<std::size_t>(name.length, max_name);
+  sp::byte *it = reserve(self, Record::NAME, id, 1 + length);
+  if (it) {
+    it = put_u8(it, std::uint8_t(length));
+    put(it, name.str, length);
+  }
+}
+
+void
+log_remove(Persist &self, const dht::Infohash &id, const Ip &ip) noexcept {
+  if (ip.type != IpType::IPV4) {
+    return;
+  }
+
+  sp::byte *const it = reserve(self, Record::REMOVE, id, sizeof(ip.ipv4));
+  if (it) {
+    put_u32(it, ip.ipv4);
+  }
+}
+
+void
+log_expire(Persist &self, const dht::Infohash &id,
+           const NodeTime &cutoff) noexcept {
+  sp::byte *const it =
+      reserve(self, Record::EXPIRE, id, sizeof(std::uint32_t));
+  if (it) {
+    put_u32(it, seconds_of(cutoff));
+  }
+}
+
+void
+log_evict(Persist &self, const dht::Infohash &id) noexcept {
+  reserve(self, Record::EVICT, id, 0);
+}
+
+//=====================================
+static bool
+snapshot_write(Persist &self, const sp::byte *data,
+               std::size_t length) noexcept {
+  assertx(length <= sizeof(self.snapshot_buffer));
+  if (self.snapshot_length + length > sizeof(self.snapshot_buffer)) {
+    if (!write_all(self.snapshot, self.snapshot_buffer,
+                   self.snapshot_length)) {
+      return false;
+    }
+    self.snapshot_offset += self.snapshot_length;
+    self.snapshot_length = 0;
+  }
+
+  memcpy(self.snapshot_buffer + self.snapshot_length, data, length);
+  self.snapshot_length += length;
+  return true;
+}
+
+static bool
+snapshot_entry(Persist &self, const dht::KeyValue &kv) noexcept {
+  std::uint32_t count = 0;
+  for_each(kv.peers, [&count](const dht::Peer &cur) {
+    if (cur.contact.ip.type == IpType::IPV4) {
+      ++count;
+    }
+  });
+  if (count == 0) {
+    return true;
+  }
+
+  sp::byte raw[sizeof(kv.id.id) + 1 + max_name + 4];
+  const std::size_t name_length =
+      kv.name ? std::min<std::size_t>(kv.name->length, max_name) : 0;
+  sp::byte *it = put(raw, kv.id.id, sizeof(kv.id.id));
+  it = put_u8(it, std::uint8_t(name_length));
+  if (name_length > 0) {
+    it = put(it, kv.name->str, name_length);
+  }
+  it = put_u32(it, count);
+  if (!snapshot_write(self, raw, std::size_t(it - raw))) {
+    return false;
+  }
+
+  const bool result = for_all(kv.peers, [&self](const dht::Peer &cur) {
+    if (cur.contact.ip.type != IpType::IPV4) {
+      return true;
+    }
+    sp::byte peer[peer_size];
+    put_peer(peer, cur);
+    return snapshot_write(self, peer, sizeof(peer));
+  });
+  if (result) {
+    ++self.snapshot_entries;
+    self.snapshot_peers += count;
+  }
+  return result;
+}
+
+/* Start writing the current shard, from the first slot */
+static void
+shard_begin(Persist &self, const InfohashTable &table) noexcept {
+  self.cursor = 0;
+  if (self.shard < InfohashTable::shards) {
+    self.rehashes = table.shard[self.shard].rehashes;
+  }
+  self.shard_offset = self.snapshot_offset + self.snapshot_length;
+  self.shard_entries = self.snapshot_entries;
+  self.shard_peers = self.snapshot_peers;
+}
+
+/* Drop what has been written of the current shard and start it over */
+static bool
+shard_restart(Persist &self, const InfohashTable &table) noexcept {
+  if (self.shard_offset < self.snapshot_offset) {
+    /* part of the shard has been flushed already */
+    const auto offset = off_t(self.shard_offset);
+    if (ftruncate(self.snapshot, offset) != 0 ||
+        lseek(self.snapshot, offset, SEEK_SET) != offset) {
+      return false;
+    }
+    self.snapshot_offset = self.shard_offset;
+  }
+  self.snapshot_length = std::size_t(self.shard_offset - self.snapshot_offset);
+  self.snapshot_entries = self.shard_entries;
+  self.snapshot_peers = self.shard_peers;
+  shard_begin(self, table);
+  return true;
+}
+
+/* Start a new log generation and a snapshot of the db as of the start */
+static bool
+snapshot_begin(DHTMetaDatabase &db) noexcept {
+  Persist &self = db.persist;
+  char file[PATH_MAX + 32];
+
+  flush(self);
+  log_path(self, self.generation + 1, file);
+  const int log = ::open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (log < 0) {
+    return false;
+  }
+
+  char tmp[PATH_MAX + 8];
+  tmp_path(self, tmp);
+  const int snapshot =
+      ::open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (snapshot < 0) {
+    ::close(log);
+    unlink(file);
+    return false;
+  }
+
+  close_file(self.log);
+  self.log = log;
+  ++self.generation;
+
+  self.snapshot = snapshot;
+  self.shard = 0;
+  self.snapshot_entries = 0;
+  self.snapshot_peers = 0;
+  /* the header is written when the snapshot is complete */
+  memset(self.snapshot_buffer, 0, header_size);
+  self.snapshot_length = header_size;
+  self.snapshot_offset = 0;
+  shard_begin(self, db.lookup_table);
+  return true;
+}
+
+static void
+snapshot_abort(Persist &self) noexcept {
+  char tmp[PATH_MAX + 8];
+  tmp_path(self, tmp);
+  close_file(self.snapshot);
+  unlink(tmp);
+  self.snapshot_length = 0;
+  self.snapshot_sync = Timestamp(0);
+}
+
+/* Write the rest of the complete snapshot and its header, and start the
+ * writeback of the file without waiting for it */
+static bool
+snapshot_seal(Persist &self) noexcept {
+  if (!write_all(self.snapshot, self.snapshot_buffer, self.snapshot_length)) {
+    return false;
+  }
+  self.snapshot_length = 0;
+
+  sp::byte header[header_size];
+  sp::byte *it = put_u32(header, snapshot_magic);
+  it = put_u32(it, snapshot_version);
+  it = put_u64(it, self.generation);
+  it = put_u64(it, self.snapshot_entries);
+  put_u64(it, self.snapshot_peers);
+  if (pwrite(self.snapshot, header, sizeof(header), 0) != sizeof(header)) {
+    return false;
+  }
+  /* only a hint, the fdatasync() of snapshot_commit() is what counts */
+  sync_file_range(self.snapshot, 0, 0, SYNC_FILE_RANGE_WRITE);
+  return true;
+}
+
+/* Replace the previous snapshot with the sealed one and remove the logs it
+ * made obsolete, by now the writeback started by snapshot_seal() is mostly
+ * done so the fdatasync() only has the remainder to wait for */
+static bool
+snapshot_commit(Persist &self) noexcept {
+  if (fdatasync(self.snapshot) != 0) {
+    return false;
+  }
+
+  char tmp[PATH_MAX + 8];
+  tmp_path(self, tmp);
+  close_file(self.snapshot);
+  if (rename(tmp, self.path) != 0) {
+    unlink(tmp);
+    return false;
+  }
+
+  for (; self.first_generation < self.generation; ++self.first_generation) {
+    char file[PATH_MAX + 32];
+    log_path(self, self.first_generation, file);
+    unlink(file);
+  }
+  self.snapshot_sync = Timestamp(0);
+  ++self.snapshots;
+  return true;
+}
+
+/* Write the next entries of the snapshot, false if $budget ran out */
+static bool
+snapshot_continue(DHTMetaDatabase &db, dht::Budget &budget) noexcept {
+  Persist &self = db.persist;
+  const InfohashTable &table = db.lookup_table;
+  const sp::Milliseconds interval(db.config.db_snapshot_interval);
+
+  for (; self.shard < InfohashTable::shards;
+       ++self.shard, shard_begin(self, table)) {
+    const InfohashTable::Shard &shard = table.shard[self.shard];
+    /* the slots of the shard moved, the shards already written are kept */
+    if (shard.rehashes != self.rehashes && !shard_restart(self, table)) {
+      snapshot_abort(self);
+      ++self.snapshot_failures;
+      self.next_snapshot = db.now + interval;
+      return true;
+    }
+
+    for (; self.cursor < shard.capacity; ++self.cursor) {
+      if (!is_occupied(shard, self.cursor)) {
+        continue;
+      }
+      if (!spend(budget)) {
+        return false;
+      }
+      if (!snapshot_entry(self, shard.slots[self.cursor])) {
+        snapshot_abort(self);
+        ++self.snapshot_failures;
+        self.next_snapshot = db.now + interval;
+        return true;
+      }
+    }
+  }
+
+  if (!snapshot_seal(self)) {
+    snapshot_abort(self);
+    ++self.snapshot_failures;
+    self.next_snapshot = db.now + interval;
+    return true;
+  }
+  self.snapshot_sync = db.now + db.config.db_log_flush_interval;
+  return true;
+}
+
+Timestamp
+persist(DHTMetaDatabase &db, dht::Budget &budget) noexcept {
+  Persist &self = db.persist;
+  const sp::Milliseconds interval(db.config.db_snapshot_interval);
+
+  if (self.log == -1) {
+    return db.now + interval;
+  }
+
+  if (db.now >= self.next_flush) {
+    flush(self);
+    self.next_flush = db.now + db.config.db_log_flush_interval;
+  }
+
+  if (self.snapshot == -1 && db.now >= self.next_snapshot) {
+    if (!snapshot_begin(db)) {
+      ++self.snapshot_failures;
+      self.next_snapshot = db.now + interval;
+    }
+  }
+
+  const Timestamp unsealed(0);
+  if (self.snapshot != -1 && self.snapshot_sync == unsealed) {
+    if (!snapshot_continue(db, budget)) {
+      return db.now + sp::Milliseconds(1);
+    }
+  } else if (self.snapshot != -1 && db.now >= self.snapshot_sync) {
+    if (!snapshot_commit(self)) {
+      snapshot_abort(self);
+      ++self.snapshot_failures;
+    }
+    self.next_snapshot = db.now + interval;
+  }
+
+  if (self.snapshot == -1) {
+    return std::min(self.next_flush, self.next_snapshot);
+  }
+  if (self.snapshot_sync != unsealed) {
+    return std::min(self.next_flush, self.snapshot_sync);
+  }
+  return db.now + sp::Milliseconds(1);
+}
+
+//=====================================
+/* Load the entries of the snapshot in $in, the log generation it was written
+ * with is the first to replay */
+static bool
+load_snapshot(DHTMetaDatabase &db, Mapped &in,
+              /*OUT*/ std::uint64_t &generation) noexcept {
+  Reader r{in.data, in.data + in.length};
+  std::uint32_t magic, version;
+  std::uint64_t entries, peers;
+  if (!take_u32(r, magic) || !take_u32(r, version) ||
+      !take_u64(r, generation) || !take_u64(r, entries) ||
+      !take_u64(r, peers)) {
+    return false;
+  }
+  if (magic != snapshot_magic || version != snapshot_version) {
+    return false;
+  }
+
+  for (std::uint64_t i = 0; i < entries; ++i) {
+    dht::Infohash id;
+    char name[max_name + 1];
+    std::uint32_t count;
+    if (!take(r, id.id, sizeof(id.id)) || !take_name(r, name) ||
+        !take_u32(r, count)) {
+      return false;
+    }
+
+    for (std::uint32_t k = 0; k < count; ++k) {
+      PeerRecord peer;
+      if (!take_peer(r, peer)) {
+        return false;
+      }
+      restore_peer(db, id, peer.contact, peer.seed, peer.activity);
+    }
+    if (strlen(name) > 0) {
+      restore_name(db, id, name);
+    }
+  }
+  return true;
+}
+
+/* Apply the records of a log, a torn record at the end is ignored */
+static void
+replay(DHTMetaDatabase &db, Mapped &in) noexcept {
+  Reader r{in.data, in.data + in.length};
+  for (;;) {
+    std::uint8_t type;
+    dht::Infohash id;
+    if (!take_u8(r, type) || !take(r, id.id, sizeof(id.id))) {
+      return;
+    }
+
+    switch (Record(type)) {
+    case Record::ANNOUNCE: {
+      PeerRecord peer;
+      if (!take_peer(r, peer)) {
+        return;
+      }
+      restore_peer(db, id, peer.contact, peer.seed, peer.activity);
+    } break;
+    case Record::NAME: {
+      char name[max_name + 1];
+      if (!take_name(r, name)) {
+        return;
+      }
+      restore_name(db, id, name);
+    } break;
+    case Record::REMOVE: {
+      std::uint32_t ip;
+      if (!take_u32(r, ip)) {
+        return;
+      }
+      remove_peer(db, id, Ip(Ipv4(ip)));
+    } break;
+    case Record::EXPIRE: {
+      std::uint32_t cutoff;
+      if (!take_u32(r, cutoff)) {
+        return;
+      }
+      remove_expired(db, id, from_seconds(cutoff));
+    } break;
+    case Record::EVICT:
+      remove(db, id);
+      break;
+    default:
+      /* corrupt */
+      return;
+    }
+    ++db.persist.replayed_records;
+  }
+}
+
+bool
+restore(DHTMetaDatabase &db) noexcept {
+  Persist &self = db.persist;
+  if (strlen(self.path) == 0) {
+    return true;
+  }
+  assertx(self.log == -1);
+
+  dht::Clock clock;
+  const Timestamp start = read(clock);
+  std::uint64_t generation = 0;
+  Mapped in;
+  if (map(self.path, in)) {
+    if (!load_snapshot(db, in, generation)) {
+      generation = 0;
+    }
+    unmap(in);
+  }
+
+  char file[PATH_MAX + 32];
+  /* logs left behind when the previous run stopped between replacing the
+   * snapshot and removing them */
+  for (std::uint64_t g = generation; g-- > 0;) {
+    log_path(self, g, file);
+    if (unlink(file) != 0) {
+      break;
+    }
+  }
+
+  self.first_generation = generation;
+  for (;; ++generation) {
+    log_path(self, generation, file);
+    if (!map(file, in)) {
+      break;
+    }
+    replay(db, in);
+    unmap(in);
+  }
+
+  /* the peers which expired while the node was down */
+  dht::Budget budget(~std::size_t(0));
+  expire_peers(db, budget);
+
+  /* continue in a new log since the last one may end with a torn record */
+  log_path(self, generation, file);
+  self.log = ::open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (self.log < 0) {
+    self.log = -1;
+    return false;
+  }
+  self.generation = generation;
+  self.next_flush = db.now + db.config.db_log_flush_interval;
+  /* compact the replayed logs into a snapshot */
+  self.next_snapshot = db.now;
+
+  self.restore_ms = std::uint64_t(read(clock)) - std::uint64_t(start);
+  self.restored_infohashes = length(db.lookup_table);
+  self.restored_peers = db.peers;
+  return true;
+}
+
+//=====================================
+} // namespace db
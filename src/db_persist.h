@@ -0,0 +1,138 @@
+#ifndef SP_MAINLINE_DHT_DB_PERSIST_H
+#define SP_MAINLINE_DHT_DB_PERSIST_H
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+
+#include "infohash_table.h"
+#include "util.h"
+
+namespace db {
+struct DHTMetaDatabase;
+
+//=====================================
+/* Snapshot and write-ahead log of the peer db, so a restarted node does not
+ * start out with an empty db.
+ *
+ * The snapshot is written to $path a few entries per awake tick, every
+ * snapshot starts a new log generation "$path.log.<generation>" which records
+ * the announces, removals and expiries made while and after it is written.
+ * Since the snapshot is written incrementally an entry may already contain a
+ * change which is also in the log, replaying a log record is idempotent. Once
+ * the snapshot is complete it replaces the previous one and the older logs are
+ * removed. On restore the snapshot is loaded and every log from its generation
+ * on is replayed.
+ *
+ * Log records are buffered and only written by persist() and flush(), which
+ * run outside of the write sections of the db. A burst of records between two
+ * flushes grows the buffer instead. A complete snapshot is not synced at once,
+ * its writeback is started and it replaces the previous snapshot a flush
+ * interval later, when the fdatasync() has little left to wait for.
+ */
+struct Persist {
+  static constexpr std::size_t buffer_size = 64 * 1024;
+
+  /* snapshot file, empty if persistence is disabled */
+  char path[PATH_MAX];
+  /* the log generation records are appended to */
+  std::uint64_t generation;
+  /* the oldest log generation which may still exist */
+  std::uint64_t first_generation;
+  int log;
+  /* at least $buffer_size once a record is logged, shrunk on flush */
+  sp::byte *log_buffer;
+  std::size_t log_capacity;
+  std::size_t log_length;
+
+  /* the snapshot being written, -1 if none */
+  int snapshot;
+  /* the next shard and slot of the InfohashTable to write */
+  std::size_t shard;
+  std::size_t cursor;
+  /* Shard::rehashes when $shard was started, slots move on rehash so the
+   * shard is written again */
+  std::uint64_t rehashes;
+  /* the snapshot as of the start of $shard, restored to write it again */
+  std::uint64_t shard_offset;
+  std::uint64_t shard_entries;
+  std::uint64_t shard_peers;
+  std::uint64_t snapshot_entries;
+  std::uint64_t snapshot_peers;
+  sp::byte snapshot_buffer[buffer_size];
+  std::size_t snapshot_length;
+  /* bytes of the snapshot written to the file, followed by the buffer */
+  std::uint64_t snapshot_offset;
+  /* when the complete snapshot is synced and replaces the previous one, 0
+   * while it is still written */
+  Timestamp snapshot_sync;
+
+  Timestamp next_snapshot;
+  Timestamp next_flush;
+
+  std::uint64_t snapshots;
+  std::uint64_t snapshot_failures;
+  std::uint64_t log_records;
+  std::uint64_t log_failures;
+  /* outcome of the restore on startup */
+  std::uint64_t restore_ms;
+  std::uint64_t restored_infohashes;
+  std::uint64_t restored_peers;
+  std::uint64_t replayed_records;
+
+  explicit Persist(const char *dump_file) noexcept;
+
+  Persist(const Persist &) = delete;
+  Persist(const Persist &&) = delete;
+
+  Persist &
+  operator=(const Persist &) = delete;
+  Persist &
+  operator=(const Persist &&) = delete;
+
+  ~Persist() noexcept;
+};
+
+//=====================================
+/* Load the last snapshot and replay the logs written after it, peers which
+ * expired in the meantime are dropped. Afterwards a new log generation is
+ * started and the next snapshot is due at once. A missing snapshot is not an
+ * error, false if the log could not be opened.
+ */
+bool
+restore(DHTMetaDatabase &) noexcept;
+
+/* Write the buffered log records when due and continue the snapshot, each
+ * entry written spends one unit of $budget. Returns when to be called next.
+ */
+Timestamp
+persist(DHTMetaDatabase &, dht::Budget &) noexcept;
+
+/* Write the buffered log records, used on shutdown */
+bool
+flush(Persist &) noexcept;
+
+//=====================================
+/* $peer was announced for $id, nothing is logged before restore() */
+void
+log_announce(Persist &, const dht::Infohash &, const dht::Peer &) noexcept;
+
+void
+log_name(Persist &, const dht::Infohash &, const dht::Name &) noexcept;
+
+/* The peer with $ip was removed from $id */
+void
+log_remove(Persist &, const dht::Infohash &, const Ip &) noexcept;
+
+/* The peers of $id last announced at or before $cutoff expired */
+void
+log_expire(Persist &, const dht::Infohash &, const NodeTime &cutoff) noexcept;
+
+/* $id was evicted with all of its peers */
+void
+log_evict(Persist &, const dht::Infohash &) noexcept;
+
+//=====================================
+} // namespace db
+
+#endif
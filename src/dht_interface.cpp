@@ -11,6 +11,7 @@
 #include "dht.h"
 #include "krpc.h"
 #include "krpc_parse.h"
+#include "node_store.h"
 #include "scrape.h"
 #include "search.h"
 #include "spbt_scrape_client.h"
@@ -18,8 +19,6 @@
 #include "timeout_impl.h"
 #include "transaction.h"
 
-#include <sha1.h>
-
 #include <algorithm>
 #include <cstring>
 #include <prng/util.h>
@@ -38,10 +37,22 @@ static Timestamp
 on_awake_eager_tx_timeout(DHT &, sp::Buffer &) noexcept;
 
 static Timestamp
-on_awake_peer_db_glue(DHT &self, sp::Buffer &buf) noexcept {
+on_awake_peer_db_glue(DHT &self, sp::Buffer &) noexcept {
   assertxs(self.now == self.db.now, std::uint64_t(self.now),
            std::uint64_t(self.db.now));
-  return db::on_awake_peer_db(self.db, buf);
+
+  Budget budget(self.config.awake_budget);
+  if (!db::expire_peers(self.db, budget)) {
+    ++self.statistics.deferred_peer_expiry;
+    return self.now + sp::Milliseconds(1);
+  }
+  return db::next_peer_expiry(self.db);
+}
+
+static Timestamp
+on_awake_peer_db_persist(DHT &self, sp::Buffer &) noexcept {
+  Budget budget(self.config.awake_budget);
+  return db::persist(self.db, budget);
 }
 } // namespace dht
 
@@ -60,6 +71,7 @@ setup(dht::Modules &modules, bool setup_cb) noexcept {
   if (setup_cb) {
 #if 1
     insert(modules.awake.on_awake, &dht::on_awake_peer_db_glue);
+    insert(modules.awake.on_awake, &dht::on_awake_peer_db_persist);
 #endif
     insert(modules.awake.on_awake, &dht::on_awake_find_nodes);
     insert(modules.awake.on_awake, &dht::on_awake_ping);
@@ -73,20 +85,20 @@ setup(dht::Modules &modules, bool setup_cb) noexcept {
 //=====================================
 
 namespace dht {
-template <typename F>
 static void
-for_each(Node *node, F f) noexcept {
-  while (node) {
-    f(node);
-    node = node->timeout_next;
+inc_outstanding(Node &node) noexcept {
+  const std::uint8_t max = ~std::uint8_t(0);
+  NodeLiveness *const l = liveness(node);
+  if (l && l->outstanding != max) {
+    ++l->outstanding;
   }
 }
 
 static void
-inc_outstanding(Node &node) noexcept {
-  const std::uint8_t max = ~std::uint8_t(0);
-  if (node.outstanding != max) {
-    ++node.outstanding;
+mark_req_sent(Node &node, const Timestamp &now) noexcept {
+  node.req_sent = now;
+  if (NodeLiveness *const l = liveness(node)) {
+    l->req_sent = now;
   }
 }
 
@@ -96,7 +108,16 @@ on_awake_ping(DHT &self, sp::Buffer &out) noexcept {
   Config &cfg = self.config;
 
   /* Send ping to nodes */
-  auto f = [&out, &self](auto &, auto &node) {
+  auto f = [&out, &self, &cfg](auto &, auto &node) {
+    /* Another routing table has recently sent a request to the same node,
+     * requeue without sending a duplicate ping.
+     */
+    if (is_recently_contacted(node, self.now, cfg.refresh_interval)) {
+      node.req_sent = liveness(node)->req_sent;
+      ++node_store().ping_skipped;
+      return true;
+    }
+
     bool result = client::ping(self, out, node) == client::Res::OK;
     if (result) {
       inc_outstanding(node);
@@ -108,19 +129,25 @@ on_awake_ping(DHT &self, sp::Buffer &out) noexcept {
        * since there is only 3 in the queue and we will
        * immediately awake and send ping  to the same 3 nodes
        */
-      node.req_sent = self.now;
+      mark_req_sent(node, self.now);
     }
 
     return result;
   };
-  timeout::for_all_node(self.routing_table, cfg.refresh_interval, f, &self);
+  Budget budget(cfg.awake_budget);
+  timeout::for_all_node(self.routing_table, cfg.refresh_interval, budget, f,
+                        &self);
+  if (is_exhausted(budget)) {
+    ++self.statistics.deferred_ping;
+    return self.now + sp::Milliseconds(1);
+  }
 
-  /* Calculate next timeout based on the head if the timeout list which is in
-   * sorted order where to oldest node is first in the list.
+  /* Calculate next timeout based on when the first node in the timeout wheel
+   * is due.
    */
-  Node *const tHead = self.tb.timeout->timeout_node;
-  if (tHead) {
-    self.tb.timeout->timeout_next = tHead->req_sent + cfg.refresh_interval;
+  Timestamp next(0);
+  if (timeout::next_expire(self.tb.timeout->wheel, next)) {
+    self.tb.timeout->timeout_next = next;
 
     if (self.now >= self.tb.timeout->timeout_next) {
       self.tb.timeout->timeout_next = self.now + cfg.min_timeout_interval;
@@ -139,14 +166,17 @@ static Timestamp
 on_awake_eager_tx_timeout(DHT &self, sp::Buffer &) noexcept {
   Config &cfg = self.config;
 
-  tx::eager_tx_timeout(self);
-  auto head = tx::next_timeout(self);
-  if (!head) {
+  Budget budget(cfg.awake_budget);
+  if (!tx::eager_tx_timeout(self, budget)) {
+    ++self.statistics.deferred_tx_timeout;
+    return self.now + sp::Milliseconds(1);
+  }
+
+  Timestamp next(0);
+  if (!tx::next_timeout(self, next)) {
     return self.now + cfg.refresh_interval;
   }
-  auto next = head->sent + cfg.transaction_timeout;
-  assertxs(next > self.now, uint64_t(head->sent),
-           uint64_t(head->sent + cfg.transaction_timeout), uint64_t(self.now));
+  assertxs(next > self.now, uint64_t(next), uint64_t(self.now));
   return next;
 }
 
@@ -171,33 +201,45 @@ awake_look_for_nodes(dht::DHT &self, DHTMetaRoutingTable &rt, sp::Buffer &out,
     const Contact &c = remote.contact;
     dht::NodeId &sid = self.id;
 
-    result = client::find_node(self, out, c, /*search*/ sid, nullptr);
+    result = client::find_node(self, out, c, /*search*/ sid, tx::TxClosure(),
+                               TxClass::MAINTENANCE);
     if (result == client::Res::OK) {
       inc_outstanding(remote);
       inc_active_searches();
-      remote.req_sent = now;
+      mark_req_sent(remote, now);
     }
     // }
 
     return result == client::Res::OK;
   };
-  timeout::for_all_node(self.routing_table, cfg.refresh_interval, f, &self);
+  Budget budget(cfg.awake_budget);
+  timeout::for_all_node(self.routing_table, cfg.refresh_interval, budget, f,
+                        &self);
+  const bool deferred = is_exhausted(budget);
+  if (deferred) {
+    ++self.statistics.deferred_find_node;
+  }
 
   if (use_bootstrap) {
     dht::KContact cur;
-    while (tx::has_free_transaction(self) && bootstrap_take_head(self, cur)) {
-      auto closure = bootstrap_alloc(self, cur);
-      auto result = client::find_node(self, out, cur.contact, rt.id, closure);
+    while (tx::has_free_transaction(self, TxClass::BOOTSTRAP) &&
+           bootstrap_take_head(self, cur)) {
+      auto result =
+          client::find_node(self, out, cur.contact, rt.id, tx::TxClosure(cur),
+                            TxClass::BOOTSTRAP);
       if (result == client::Res::OK) {
         inc_active_searches();
       } else {
         bootstrap_insert_force(self, cur);
-        bootstrap_reclaim(self, closure);
         break;
       }
     } // while
   }
 
+  if (deferred) {
+    return now + sp::Milliseconds(1);
+  }
+
   if (missing_contacts > 0) {
     Timestamp next = tx::next_available(self);
     if (next > now) {
@@ -271,7 +313,9 @@ dht_activity(dht::MessageContext &ctx, const dht::NodeId &senderId) noexcept {
     result->properties.is_readonly = ctx.read_only;
     if (!result->properties.is_good) {
       result->properties.is_good = true;
-      result->outstanding = 0;
+      if (NodeLiveness *const l = liveness(*result)) {
+        l->outstanding = 0;
+      }
       assertx(self.routing_table.bad_nodes > 0);
       self.routing_table.bad_nodes--;
     }
@@ -304,16 +348,15 @@ handle_ip_election(dht::MessageContext &ctx,
 static void
 __bootstrap_insert(dht::DHT &self, const dht::NodeId &id,
                    const Contact &remote) noexcept {
-  std::size_t max_rank = 4;
+  const std::size_t min_rank = 4;
   dht::DHTMetaScrape *max = nullptr;
-  for (auto scrape : self.active_scrapes) {
-    assertx(scrape);
-    auto scrape_rank = rank(scrape->routing_table.id, id);
-    if (scrape_rank >= max_rank) {
-      // XXX check boostrap heap if full and if last element is less than tmp
-      max_rank = scrape_rank;
-      max = scrape;
-    }
+  // XXX check boostrap heap if full and if last element is less than tmp
+  std::size_t slot = best_match(self.scrape_index, id.id, min_rank,
+                                [](std::size_t, std::size_t) { //
+                                  return true;
+                                });
+  if (slot != dht::ScrapeIndex::capacity) {
+    max = self.active_scrapes[slot];
   }
   if (max) {
     bootstrap_insert(*max, dht::IdContact(id, remote));
@@ -355,8 +398,11 @@ message(dht::MessageContext &ctx, const dht::NodeId &sender, F f) noexcept {
     dht::Node *contact = dht_activity(ctx, sender);
 
     handle_ip_election(ctx, sender);
+    /* Refresh the node in every routing table containing it */
+    if (dht::NodeLiveness *const l = find(dht::node_store(), ctx.remote)) {
+      l->remote_activity = self.now;
+    }
     if (contact) {
-      contact->remote_activity = self.now;
       f(*contact);
     } else {
       if (!ctx.read_only) {
@@ -391,15 +437,18 @@ static bool
 handle_response(dht::MessageContext &ctx, const dht::NodeId &sender) noexcept {
   logger::receive::res::ping(ctx);
 
-  message(ctx, sender, [](auto &node) { //
-    node.outstanding = 0;
+  message(ctx, sender, [&ctx](auto &) { //
+    dht::NodeLiveness *const l = find(dht::node_store(), ctx.remote);
+    if (l) {
+      l->outstanding = 0;
+    }
   });
 
   return true;
 } // ping::handle_response()
 
 static bool
-on_response(dht::MessageContext &ctx, void *) noexcept {
+on_response(dht::MessageContext &ctx, const tx::TxClosure &) noexcept {
   krpc::PingResponse res;
   if (krpc::parse_ping_response(ctx, res)) {
     return handle_response(ctx, res.sender);
@@ -418,9 +467,9 @@ on_request(dht::MessageContext &ctx) noexcept {
 
 static void
 on_timeout(dht::DHT &dht, const krpc::Transaction &tx, const Timestamp &sent,
-           void *arg) noexcept {
+           const tx::TxClosure &closure) noexcept {
   logger::transmit::error::ping_response_timeout(dht, tx, sent);
-  assertx(arg == nullptr);
+  assertx(closure.type == tx::TxClosureType::NONE);
 }
 
 void
@@ -481,49 +530,29 @@ handle_response(dht::MessageContext &ctx, const dht::NodeId &sender,
   return true;
 } // find_node::handle_response()
 
-static void
-handle_response_timeout(dht::DHT &dht, void *&closure) noexcept {
-  if (closure) {
-    bootstrap_reclaim(dht, (dht::KContact *)closure);
-    closure = nullptr;
-  }
-}
-
 static void
 on_timeout(dht::DHT &dht, const krpc::Transaction &tx, const Timestamp &sent,
-           void *closure) noexcept {
+           const tx::TxClosure &closure) noexcept {
   logger::transmit::error::find_node_response_timeout(dht, tx, sent);
-  if (closure) {
-    auto *bs = (dht::KContact *)closure;
-    bootstrap_insert_force(dht, *bs);
+  if (closure.type == tx::TxClosureType::BOOTSTRAP) {
+    dht::KContact bs = closure.bootstrap;
+    bootstrap_insert_force(dht, bs);
   }
-
-  handle_response_timeout(dht, closure);
 } // find_node::on_timeout
 
 static bool
-on_response(dht::MessageContext &ctx, void *closure) noexcept {
+on_response(dht::MessageContext &ctx, const tx::TxClosure &closure) noexcept {
   krpc::FindNodeResponse res;
   dht::DHT &dht = ctx.dht;
 
-  dht::KContact cap_copy;
-  dht::KContact *cap_ptr = nullptr;
-  if (closure) {
-    auto *bs = (dht::KContact *)closure;
-
-    // make a copy of the capture so we can delete it
-    cap_copy = *bs;
-    cap_ptr = &cap_copy;
-  }
-  handle_response_timeout(ctx.dht, closure);
-
   if (krpc::parse_find_node_response(ctx, res)) {
 
     if (is_empty(res.nodes)) {
-      if (cap_ptr) {
+      if (closure.type == tx::TxClosureType::BOOTSTRAP) {
         if (nodes_good(dht.routing_table) < 100) {
           /* Only remove bootstrap node if we have gotten some nodes from it */
-          bootstrap_insert_force(dht, *cap_ptr);
+          dht::KContact bs = closure.bootstrap;
+          bootstrap_insert_force(dht, bs);
         }
       }
     }
@@ -557,53 +586,6 @@ setup(dht::Module &module) noexcept {
 // get_peers
 //===========================================================
 namespace get_peers {
-template <int SIZE>
-static void
-bloomfilter_insert(uint8_t (&bloom)[SIZE], const Ip &ip) noexcept {
-  const int m = SIZE * 8;
-  uint8_t hash[20]{0};
-  SHA1_CTX ctx{};
-
-  SHA1Init(&ctx);
-
-  if (ip.type == IpType::IPV4) {
-    // both implementations work
-    // the standard want for example the address 192.168.0.1 to be proccesed in
-    // the order 192,168,0,1
-#if 0
-    Ipv4 ipv4 = ip.ipv4;
-    unsigned char c0 = (ipv4 & (uint32_t(0xff) << 24)) >> 24;
-    unsigned char c1 = (ipv4 & (uint32_t(0xff) << 16)) >> 16;
-    unsigned char c2 = (ipv4 & (uint32_t(0xff) << 8)) >> 8;
-    unsigned char c3 = (ipv4 & (0xff));
-    // printf("%d.%d.%d.%d\n", c0, c1, c2, c3);
-    SHA1Update(&ctx, &c0, 1);
-    SHA1Update(&ctx, &c1, 1);
-    SHA1Update(&ctx, &c2, 1);
-    SHA1Update(&ctx, &c3, 1);
-#else
-    Ipv4 tmp = htonl(ip.ipv4);
-    const uint8_t *raw = (const uint8_t *)&tmp;
-    SHA1Update(&ctx, raw, (uint32_t)sizeof(ip.ipv4));
-#endif
-  } else {
-    assertx(false);
-    // const void *raw = (const void *)&ip.ipv6.raw;
-    // SHA1Update(&ctx, (const uint8_t *)raw, (uint32_t)sizeof(ip.ipv6));
-  }
-  SHA1Final(hash, &ctx);
-
-  int index1 = hash[0] | hash[1] << 8;
-  int index2 = hash[2] | hash[3] << 8;
-
-  // truncate index to m (11 bits required)
-  index1 %= m;
-  index2 %= m;
-
-  bloom[index1 / 8] = uint8_t(bloom[index1 / 8] | (0x01 << (index1 % 8)));
-  bloom[index2 / 8] = uint8_t(bloom[index2 / 8] | (0x01 << (index2 % 8)));
-}
-
 static bool
 handle_get_peers_request(dht::MessageContext &ctx, const dht::NodeId &id,
                          const dht::Infohash &search, sp::maybe<bool> m_noseed,
@@ -617,20 +599,14 @@ handle_get_peers_request(dht::MessageContext &ctx, const dht::NodeId &id,
 
     const krpc::Transaction &t = ctx.transaction;
 
-    const dht::KeyValue *const result = db::lookup(dht.db, search);
+    dht::KeyValue *const result = db::lookup(dht.db, search);
     if (scrape) {
       // http://www.bittorrent.org/beps/bep_0033.html
       uint8_t seeds[256]{};
       uint8_t peers[256]{};
 
       if (result) {
-        for_each(result->peers, [&](const dht::Peer &cur) {
-          if (cur.seed) {
-            bloomfilter_insert(seeds, cur.contact.ip);
-          } else {
-            bloomfilter_insert(peers, cur.contact.ip);
-          }
-        });
+        db::scrape(dht.db, *result, seeds, peers);
 
         krpc::response::get_peers_scrape(ctx.out, t, dht.id, token, seeds,
                                          peers);
@@ -638,21 +614,11 @@ handle_get_peers_request(dht::MessageContext &ctx, const dht::NodeId &id,
       }
     } else {
       if (result) {
-        clear(dht.recycle_contact_list);
-        auto &filtered = dht.recycle_contact_list;
-        for_each(result->peers, [&filtered, &m_noseed](const dht::Peer &cur) {
-          if (m_noseed) {
-            if ((cur.seed == false && m_noseed.get() == true) ||
-                (cur.seed == true && m_noseed.get() == false)) {
-              insert(filtered, cur.contact);
-            }
-          } else {
-            insert(filtered, cur.contact);
-          }
-        });
-
-        if (!is_empty(filtered)) {
-          krpc::response::get_peers_peers(ctx.out, t, dht.id, token, filtered);
+        const bool seeds = !m_noseed || m_noseed.get() == false;
+        const bool peers = !m_noseed || m_noseed.get() == true;
+        db::PeerWindow window;
+        if (db::values(dht.db, *result, seeds, peers, window)) {
+          krpc::response::get_peers_peers(ctx.out, t, dht.id, token, window);
           return;
         }
       }
@@ -741,50 +707,45 @@ scrape_handle_response(
 
 static void
 on_timeout(dht::DHT &dht, const krpc::Transaction &tx, const Timestamp &sent,
-           void *ctx) noexcept {
-  auto closure = (dht::get_peers_context *)ctx;
+           const tx::TxClosure &closure) noexcept {
   logger::transmit::error::get_peers_response_timeout(dht, tx, sent);
-  if (auto sctx = dynamic_cast<dht::SearchContext *>(closure)) {
-    if (sctx) {
-      search_decrement(sctx);
-    }
-  } else if (auto sctx = dynamic_cast<dht::ScrapeContext *>(closure)) {
-    delete sctx;
-  } else {
+  switch (closure.type) {
+  case tx::TxClosureType::SEARCH:
+    search_decrement(closure.search);
+    break;
+  case tx::TxClosureType::SCRAPE:
+    break;
+  default:
     assertx(false);
   }
 }
 
 static bool
-on_response(dht::MessageContext &ctx, void *tmp) noexcept {
-  auto closure = (dht::get_peers_context *)tmp;
+on_response(dht::MessageContext &ctx, const tx::TxClosure &closure) noexcept {
   krpc::GetPeersResponse res;
-  // assertx(closure);
-  if (!closure) {
-    return true;
-  }
 
-  if (krpc::parse_get_peers_response(ctx, res)) {
-    if (auto sctx = dynamic_cast<dht::SearchContext *>(closure)) {
-      dht::Search *search = search_find(ctx.dht.searches, sctx);
-      search_decrement(sctx);
+  switch (closure.type) {
+  case tx::TxClosureType::SEARCH: {
+    dht::SearchContext *const sctx = closure.search;
+    dht::Search *search = search_find(ctx.dht.searches, sctx);
+    search_decrement(sctx);
 
-      if (!search) {
-        return true;
-      }
+    if (!search) {
+      return true;
+    }
+    if (krpc::parse_get_peers_response(ctx, res)) {
       return search_handle_response(ctx, res.id, res.token, res.values,
                                     res.nodes, *search);
-    } else if (auto sctx = dynamic_cast<dht::ScrapeContext *>(closure)) {
-      if (!sctx) {
-        return true;
-      }
-      dht::Infohash ih = sctx->infohash;
-      delete sctx;
+    }
+  } break;
+  case tx::TxClosureType::SCRAPE:
+    if (krpc::parse_get_peers_response(ctx, res)) {
       return scrape_handle_response(ctx, res.id, res.token, res.values,
-                                    res.nodes, ih);
-    } else {
-      assertx(false);
+                                    res.nodes, closure.scrape);
     }
+    break;
+  default:
+    return true;
   }
 
   return false;
@@ -855,7 +816,7 @@ handle_response(dht::MessageContext &ctx, const dht::NodeId &sender) noexcept {
 }
 
 static bool
-on_response(dht::MessageContext &ctx, void *) noexcept {
+on_response(dht::MessageContext &ctx, const tx::TxClosure &) noexcept {
   krpc::AnnouncePeerResponse res;
   if (krpc::parse_announce_peer_response(ctx, res)) {
     return handle_response(ctx, res.id);
@@ -904,9 +865,9 @@ handle_request(dht::MessageContext &ctx, const dht::NodeId &sender,
     dht::Node *nodes[capacity] = {nullptr};
     dht::multiple_closest(self.routing_table, target, nodes);
 
-    std::uint32_t num = self.db.length_lookup_table;
+    std::uint32_t num = std::uint32_t(length(self.db.lookup_table));
     sp::UinStaticArray<dht::Infohash, 20> &samples =
-        db::randomize_samples(self.db);
+        db::randomize_samples(self.db, ctx.remote);
     std::uint32_t interval = db::next_randomize_samples(self.db, self.now);
 
     krpc::response::sample_infohashes(ctx.out, ctx.transaction, self.id,
@@ -932,14 +893,13 @@ handle_response(dht::MessageContext &ctx,
     }
   }
 
-  uint32_t hours = (uint32_t)std::ceil((double)res.interval / 60. / 60.);
-  scrape::on_sample_infohashes(self, ctx.remote, hours, res.samples);
+  scrape::on_sample_infohashes(self, ctx.remote, res.interval, res.samples);
 
   return true;
 }
 
 static bool
-on_response(dht::MessageContext &ctx, void *) noexcept {
+on_response(dht::MessageContext &ctx, const tx::TxClosure &) noexcept {
   dht::DHT &self = ctx.dht;
   krpc::SampleInfohashesResponse res;
 
@@ -963,13 +923,13 @@ on_request(dht::MessageContext &ctx) noexcept {
 
 static void
 on_timeout(dht::DHT &self, const krpc::Transaction &tx, const Timestamp &sent,
-           void *arg) noexcept {
+           const tx::TxClosure &closure) noexcept {
   logger::transmit::error::sample_infohashes_response_timeout(self, tx, sent);
 
   assertx(self.scrape_active_sample_infhohash > 0);
   self.scrape_active_sample_infhohash--;
 
-  assertx(arg == nullptr);
+  assertx(closure.type == tx::TxClosureType::NONE);
 }
 } // namespace sample_infohashes
 
@@ -987,7 +947,7 @@ sample_infohashes::setup(dht::Module &m) noexcept {
 //===========================================================
 namespace error {
 static bool
-on_response(dht::MessageContext &ctx, void *) noexcept {
+on_response(dht::MessageContext &ctx, const tx::TxClosure &) noexcept {
   logger::receive::res::error(ctx);
 
   return true;
@@ -0,0 +1,140 @@
+#include "epoch.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <util/assert.h>
+
+namespace dht {
+//=====================================
+/*dht::Epoch*/
+Epoch::Epoch() noexcept
+    : global(1)
+    , pinned{}
+    , registered{}
+    , readers(0)
+    , retired(nullptr)
+    , length(0)
+    , capacity(0)
+    , leaked(0) {
+}
+
+Epoch::~Epoch() noexcept {
+  assertx(readers.load() == 0);
+  for (std::size_t i = 0; i < length; ++i) {
+    free(retired[i].ptr);
+  }
+  free(retired);
+  retired = nullptr;
+  length = 0;
+  capacity = 0;
+}
+
+//=====================================
+bool
+register_reader(Epoch &self, /*OUT*/ std::size_t &reader) noexcept {
+  for (std::size_t i = 0; i < Epoch::max_readers; ++i) {
+    bool expected = false;
+    if (self.registered[i].compare_exchange_strong(expected, true)) {
+      self.pinned[i].store(0);
+      self.readers.fetch_add(1);
+      reader = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+unregister_reader(Epoch &self, std::size_t reader) noexcept {
+  assertx(reader < Epoch::max_readers);
+  assertx(self.registered[reader].load());
+  self.pinned[reader].store(0);
+  self.readers.fetch_sub(1);
+  self.registered[reader].store(false);
+}
+
+void
+pin(Epoch &self, std::size_t reader) noexcept {
+  assertx(reader < Epoch::max_readers);
+  /* the epoch is only pinned once the writer can not have advanced past it
+   * without seeing the pin */
+  for (;;) {
+    const std::uint64_t current = self.global.load();
+    self.pinned[reader].store(current, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (self.global.load() == current) {
+      return;
+    }
+  }
+}
+
+void
+unpin(Epoch &self, std::size_t reader) noexcept {
+  assertx(reader < Epoch::max_readers);
+  self.pinned[reader].store(0, std::memory_order_release);
+}
+
+//=====================================
+/* The oldest epoch pinned by a reader */
+static std::uint64_t
+oldest_pinned(const Epoch &self) noexcept {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  std::uint64_t result = std::numeric_limits<std::uint64_t>::max();
+  for (std::size_t i = 0; i < Epoch::max_readers; ++i) {
+    const std::uint64_t cur = self.pinned[i].load(std::memory_order_acquire);
+    if (cur != 0) {
+      result = std::min(result, cur);
+    }
+  }
+  return result;
+}
+
+void
+retire(Epoch &self, void *ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+  if (self.readers.load() == 0) {
+    free(ptr);
+    return;
+  }
+
+  /* readers pinning from now on can not reach $ptr */
+  const std::uint64_t epoch = self.global.fetch_add(1);
+  if (self.length == self.capacity) {
+    const std::size_t capacity = self.capacity == 0 ? 16 : self.capacity * 2;
+    auto *retired = (Epoch::Retired *)realloc(
+        self.retired, capacity * sizeof(Epoch::Retired));
+    if (!retired) {
+      /* waiting for the readers could deadlock with a reader spinning on the
+       * write section the writer is in, so $ptr is leaked instead */
+      ++self.leaked;
+      return;
+    }
+    self.retired = retired;
+    self.capacity = capacity;
+  }
+  self.retired[self.length++] = Epoch::Retired{ptr, epoch};
+}
+
+void
+collect(Epoch &self) noexcept {
+  if (self.length == 0) {
+    return;
+  }
+
+  const std::uint64_t oldest = oldest_pinned(self);
+  std::size_t length = 0;
+  for (std::size_t i = 0; i < self.length; ++i) {
+    if (self.retired[i].epoch < oldest) {
+      free(self.retired[i].ptr);
+    } else {
+      self.retired[length++] = self.retired[i];
+    }
+  }
+  self.length = length;
+}
+
+//=====================================
+} // namespace dht
@@ -0,0 +1,81 @@
+#ifndef SP_MAINLINE_DHT_EPOCH_H
+#define SP_MAINLINE_DHT_EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace dht {
+//=====================================
+/* Epoch based reclamation of memory shared between a single writer and up to
+ * $max_readers reader threads. A reader pins the current epoch for the length
+ * of a read, memory the writer unlinks is retired with the epoch it was
+ * unlinked in and only freed once every pinned reader has pinned a later
+ * epoch. Without registered readers retired memory is freed at once.
+ */
+struct Epoch {
+  static constexpr std::size_t max_readers = 64;
+
+  struct Retired {
+    void *ptr;
+    std::uint64_t epoch;
+  };
+
+  std::atomic<std::uint64_t> global;
+  /* the epoch pinned by each reader, 0 when not pinned */
+  std::atomic<std::uint64_t> pinned[max_readers];
+  std::atomic<bool> registered[max_readers];
+  std::atomic<std::size_t> readers;
+
+  /* owned by the writer */
+  Retired *retired;
+  std::size_t length;
+  std::size_t capacity;
+  /* retired memory never freed since there was no memory to track it */
+  std::uint64_t leaked;
+
+  Epoch() noexcept;
+
+  Epoch(const Epoch &) = delete;
+  Epoch(const Epoch &&) = delete;
+
+  Epoch &
+  operator=(const Epoch &) = delete;
+  Epoch &
+  operator=(const Epoch &&) = delete;
+
+  ~Epoch() noexcept;
+};
+
+//=====================================
+/* Claim a reader slot, false if every slot is taken */
+bool
+register_reader(Epoch &, /*OUT*/ std::size_t &reader) noexcept;
+
+void
+unregister_reader(Epoch &, std::size_t reader) noexcept;
+
+/* Start a read, memory reachable from now on is not freed until unpin() */
+void
+pin(Epoch &, std::size_t reader) noexcept;
+
+void
+unpin(Epoch &, std::size_t reader) noexcept;
+
+//=====================================
+/* Free $ptr, which was allocated with malloc, once no reader can reach it.
+ * Called by the writer after $ptr was unlinked, possibly within a write
+ * section, so it never waits for the readers. When out of memory $ptr is
+ * leaked and counted in Epoch::leaked.
+ */
+void
+retire(Epoch &, void *ptr) noexcept;
+
+/* Free the retired memory no reader can reach anymore, called by the writer */
+void
+collect(Epoch &) noexcept;
+
+//=====================================
+} // namespace dht
+
+#endif
@@ -0,0 +1,978 @@
+#include "infohash_table.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <hash/fnv.h>
+#include <new>
+#include <prng/util.h>
+#include <utility>
+#include <util/assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace dht {
+//=====================================
+// dht::PeerList
+PeerList::PeerList() noexcept
+    : data(nullptr)
+    , length(0)
+    , capacity(0) {
+}
+
+PeerList::PeerList(PeerList &&o) noexcept
+    : data(o.data)
+    , length(o.length)
+    , capacity(o.capacity) {
+  o.data = nullptr;
+  o.length = 0;
+  o.capacity = 0;
+}
+
+PeerList::~PeerList() noexcept {
+  /* the peers are owned by the pool */
+  assertx(data == nullptr);
+}
+
+//=====================================
+Peer *
+find(PeerList &self, const Contact &needle) noexcept {
+  for (std::uint32_t i = 0; i < self.length; ++i) {
+    if (self.data[i] == needle) {
+      return self.data + i;
+    }
+  }
+  return nullptr;
+}
+
+Peer *
+find(PeerList &self, const Ip &needle) noexcept {
+  for (std::uint32_t i = 0; i < self.length; ++i) {
+    if (self.data[i].contact.ip == needle) {
+      return self.data + i;
+    }
+  }
+  return nullptr;
+}
+
+bool
+is_empty(const PeerList &self) noexcept {
+  return self.length == 0;
+}
+
+std::size_t
+length(const PeerList &self) noexcept {
+  return self.length;
+}
+
+//=====================================
+static std::uint32_t
+grown_capacity(const PeerList &self) noexcept {
+  return self.capacity == 0 ? PeerList::initial_capacity : self.capacity * 2;
+}
+
+static bool
+grow(PeerList &self, Pool &pool) noexcept {
+  const std::uint32_t capacity = grown_capacity(self);
+  auto *data = (Peer *)allocate(pool, sizeof(Peer) * capacity);
+  if (!data) {
+    return false;
+  }
+
+  for (std::uint32_t i = 0; i < self.length; ++i) {
+    new (data + i) Peer(self.data[i]);
+    self.data[i].~Peer();
+  }
+  deallocate(pool, self.data, sizeof(Peer) * self.capacity);
+
+  self.data = data;
+  self.capacity = capacity;
+  return true;
+}
+
+std::size_t
+push_size(const PeerList &self) noexcept {
+  if (self.length < self.capacity) {
+    return 0;
+  }
+  return sizeof(Peer) * grown_capacity(self);
+}
+
+Peer *
+push_back(PeerList &self, Pool &pool, const Peer &peer) noexcept {
+  if (self.length == self.capacity) {
+    if (!grow(self, pool)) {
+      return nullptr;
+    }
+  }
+
+  return new (self.data + self.length++) Peer(peer);
+}
+
+Peer *
+touch(PeerList &self, Peer *peer) noexcept {
+  assertx(peer >= self.data && peer < self.data + self.length);
+
+  Peer *const last = self.data + (self.length - 1);
+  if (peer != last) {
+    const Peer tmp(*peer);
+    for (Peer *it = peer; it != last; ++it) {
+      *it = it[1];
+    }
+    *last = tmp;
+  }
+  return last;
+}
+
+void
+drop_front(PeerList &self, Pool &pool, std::size_t n) noexcept {
+  assertx(n <= self.length);
+  if (n == 0) {
+    return;
+  }
+
+  const std::uint32_t remaining = self.length - std::uint32_t(n);
+  for (std::uint32_t i = 0; i < remaining; ++i) {
+    self.data[i] = self.data[i + n];
+  }
+  for (std::uint32_t i = remaining; i < self.length; ++i) {
+    self.data[i].~Peer();
+  }
+  self.length = remaining;
+
+  if (self.length == 0) {
+    clear(self, pool);
+  }
+}
+
+void
+erase(PeerList &self, Pool &pool, Peer *peer) noexcept {
+  assertx(peer >= self.data && peer < self.data + self.length);
+
+  Peer *const last = self.data + (self.length - 1);
+  for (Peer *it = peer; it != last; ++it) {
+    *it = it[1];
+  }
+  last->~Peer();
+  --self.length;
+
+  if (self.length == 0) {
+    clear(self, pool);
+  }
+}
+
+void
+clear(PeerList &self, Pool &pool) noexcept {
+  for (std::uint32_t i = 0; i < self.length; ++i) {
+    self.data[i].~Peer();
+  }
+  deallocate(pool, self.data, sizeof(Peer) * self.capacity);
+  self.data = nullptr;
+  self.length = 0;
+  self.capacity = 0;
+}
+
+//=====================================
+// dht::KeyValue
+KeyValue::KeyValue(const dht::Infohash &pid) noexcept
+    : id(pid)
+    , expiry(0)
+    , dense(0)
+    , hits(0)
+    , hits_minute(0)
+    , peers{}
+    , name{nullptr}
+    , bloom{nullptr}
+    , compact{nullptr} {
+}
+
+KeyValue::KeyValue(KeyValue &&o) noexcept
+    : id(o.id)
+    , expiry(o.expiry)
+    , dense(o.dense)
+    , hits(o.hits)
+    , hits_minute(o.hits_minute)
+    , peers(std::move(o.peers))
+    , name(o.name)
+    , bloom(o.bloom)
+    , compact(o.compact) {
+  o.name = nullptr;
+  o.bloom = nullptr;
+  o.compact = nullptr;
+}
+
+KeyValue::~KeyValue() {
+  /* released by the InfohashTable */
+  assertx(name == nullptr);
+  assertx(bloom == nullptr);
+  assertx(compact == nullptr);
+}
+
+//=====================================
+} // namespace dht
+
+namespace db {
+//=====================================
+/*db::NameTable*/
+NameTable::NameTable() noexcept
+    : slots(nullptr)
+    , capacity(0)
+    , length(0)
+    , bytes(0) {
+}
+
+NameTable::~NameTable() noexcept {
+  /* the names are owned by the pool */
+  free(slots);
+  slots = nullptr;
+  capacity = 0;
+  length = 0;
+  bytes = 0;
+}
+
+//=====================================
+/*db::InfohashTable::Shard*/
+InfohashTable::Shard::Shard() noexcept
+    : control(nullptr)
+    , slots(nullptr)
+    , capacity(0)
+    , length(0)
+    , deleted(0)
+    , rehashes(0)
+    , sequence(0)
+    , writing(0) {
+}
+
+//=====================================
+/*db::InfohashTable*/
+InfohashTable::InfohashTable(std::uint64_t s) noexcept
+    : shard{}
+    , capacity(0)
+    , length(0)
+    , dense(nullptr)
+    , dense_capacity(0)
+    , seed(s)
+    , epoch()
+    , pool()
+    , names()
+    , lookups(0)
+    , probes(0)
+    , rehashes(0) {
+  pool.epoch = &epoch;
+}
+
+static void
+release(InfohashTable &, dht::KeyValue &) noexcept;
+
+InfohashTable::~InfohashTable() noexcept {
+  for (Shard &cur : shard) {
+    for (std::size_t i = 0; i < cur.capacity; ++i) {
+      if (is_occupied(cur, i)) {
+        release(*this, cur.slots[i]);
+        cur.slots[i].~KeyValue();
+      }
+    }
+    free(cur.control);
+    free(cur.slots);
+    cur.control = nullptr;
+    cur.slots = nullptr;
+    cur.capacity = 0;
+    cur.length = 0;
+    cur.deleted = 0;
+  }
+  free(dense);
+  dense = nullptr;
+  dense_capacity = 0;
+  capacity = 0;
+  length = 0;
+}
+
+static InfohashTable::Shard &
+shard_of(InfohashTable &self, const dht::Infohash &key) noexcept {
+  return self.shard[key.id[0] >> (8 - InfohashTable::shard_bits)];
+}
+
+static const InfohashTable::Shard &
+shard_of(const InfohashTable &self, const dht::Infohash &key) noexcept {
+  return self.shard[key.id[0] >> (8 - InfohashTable::shard_bits)];
+}
+
+//=====================================
+static std::uint64_t
+mix(std::uint64_t a, std::uint64_t b) noexcept {
+  const __uint128_t r = __uint128_t(a) * b;
+  return std::uint64_t(r) ^ std::uint64_t(r >> 64);
+}
+
+static std::uint64_t
+hash(const InfohashTable &self, const dht::Infohash &key) noexcept {
+  static_assert(sizeof(key.id) == 20);
+  std::uint64_t w0;
+  std::uint64_t w1;
+  std::uint32_t w2;
+  std::memcpy(&w0, key.id + 0, sizeof(w0));
+  std::memcpy(&w1, key.id + 8, sizeof(w1));
+  std::memcpy(&w2, key.id + 16, sizeof(w2));
+
+  const std::uint64_t a = mix(w0 ^ self.seed ^ 0xa0761d6478bd642full,
+                              w1 ^ 0xe7037ed1a0b428dbull);
+  return mix(a ^ w2, self.seed ^ 0x8ebc6af09c88c6e3ull);
+}
+
+static std::uint8_t
+fingerprint(std::uint64_t h) noexcept {
+  return std::uint8_t(h & 0x7f);
+}
+
+static std::size_t
+first_group(std::size_t capacity, std::uint64_t h) noexcept {
+  const std::size_t groups = capacity / InfohashTable::group;
+  return std::size_t(h >> 7) & (groups - 1);
+}
+
+/* Triangular probing, visits every group since the number of groups is a
+ * power of 2 */
+static std::size_t
+next_group(std::size_t capacity, std::size_t current,
+           std::size_t step) noexcept {
+  const std::size_t groups = capacity / InfohashTable::group;
+  return (current + step) & (groups - 1);
+}
+
+/* Bitmask of the slots in the group starting at $ctrl equal to $needle */
+static std::uint32_t
+match(const std::uint8_t *ctrl, std::uint8_t needle) noexcept {
+#ifdef __SSE2__
+  const __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  const __m128i cmp = _mm_cmpeq_epi8(group, _mm_set1_epi8(char(needle)));
+  return std::uint32_t(_mm_movemask_epi8(cmp));
+#else
+  std::uint32_t result = 0;
+  for (std::size_t i = 0; i < InfohashTable::group; ++i) {
+    if (ctrl[i] == needle) {
+      result |= std::uint32_t(1) << i;
+    }
+  }
+  return result;
+#endif
+}
+
+/* Bitmask of the empty or deleted slots in the group starting at $ctrl */
+static std::uint32_t
+match_free(const std::uint8_t *ctrl) noexcept {
+#ifdef __SSE2__
+  const __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return std::uint32_t(_mm_movemask_epi8(group));
+#else
+  std::uint32_t result = 0;
+  for (std::size_t i = 0; i < InfohashTable::group; ++i) {
+    if (ctrl[i] & InfohashTable::empty) {
+      result |= std::uint32_t(1) << i;
+    }
+  }
+  return result;
+#endif
+}
+
+/* Index of $key in the slots, $capacity if not found. Takes the arrays of a
+ * shard instead of the shard so a reader can probe a consistent copy. */
+static std::size_t
+find_index(const InfohashTable &self, const std::uint8_t *control,
+           const dht::KeyValue *slots, std::size_t capacity,
+           const dht::Infohash &key, std::uint64_t &probes) noexcept {
+  if (capacity == 0) {
+    return capacity;
+  }
+
+  const std::uint64_t h = hash(self, key);
+  const std::uint8_t fp = fingerprint(h);
+  std::size_t g = first_group(capacity, h);
+  for (std::size_t step = 1;; ++step) {
+    ++probes;
+    const std::size_t base = g * InfohashTable::group;
+    const std::uint8_t *const ctrl = control + base;
+
+    std::uint32_t m = match(ctrl, fp);
+    while (m) {
+      const std::size_t idx = base + std::size_t(__builtin_ctz(m));
+      if (slots[idx].id == key) {
+        return idx;
+      }
+      m &= m - 1;
+    }
+
+    if (match(ctrl, InfohashTable::empty)) {
+      return capacity;
+    }
+    if (step == capacity / InfohashTable::group) {
+      return capacity;
+    }
+    g = next_group(capacity, g, step);
+  }
+}
+
+static std::size_t
+find_index(const InfohashTable &self, const InfohashTable::Shard &shard,
+           const dht::Infohash &key, std::uint64_t &probes) noexcept {
+  return find_index(self, shard.control, shard.slots, shard.capacity, key,
+                    probes);
+}
+
+/* First empty or deleted slot in the probe sequence of $h */
+static std::size_t
+find_free(const std::uint8_t *control, std::size_t capacity,
+          std::uint64_t h) noexcept {
+  std::size_t g = first_group(capacity, h);
+  for (std::size_t step = 1;; ++step) {
+    const std::size_t base = g * InfohashTable::group;
+    const std::uint32_t m = match_free(control + base);
+    if (m) {
+      return base + std::size_t(__builtin_ctz(m));
+    }
+    assertx(step < capacity / InfohashTable::group);
+    g = next_group(capacity, g, step);
+  }
+}
+
+/* The capacity of the dense array needed for $length keys */
+static std::size_t
+dense_capacity(const InfohashTable &self, std::size_t length) noexcept {
+  if (length <= self.dense_capacity) {
+    return self.dense_capacity;
+  }
+
+  std::size_t capacity = self.dense_capacity == 0 ? 64 : self.dense_capacity;
+  while (capacity < length) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+static bool
+reserve_dense(InfohashTable &self, std::size_t length) noexcept {
+  if (length <= self.dense_capacity) {
+    return true;
+  }
+
+  const std::size_t capacity = dense_capacity(self, length);
+  auto *dense =
+      (dht::Infohash *)realloc(self.dense, capacity * sizeof(dht::Infohash));
+  if (!dense) {
+    return false;
+  }
+
+  self.dense = dense;
+  self.dense_capacity = capacity;
+  return true;
+}
+
+/* Move the entries of $shard to new arrays of $capacity slots, the old arrays
+ * are retired since readers may still be probing them */
+static bool
+rehash(InfohashTable &self, InfohashTable::Shard &shard,
+       std::size_t capacity) noexcept {
+  assertx(capacity >= InfohashTable::group);
+  assertx((capacity & (capacity - 1)) == 0);
+  assertx(capacity > shard.length);
+
+  auto *control = (std::uint8_t *)malloc(capacity);
+  auto *slots = (dht::KeyValue *)malloc(sizeof(dht::KeyValue) * capacity);
+  if (!control || !slots) {
+    free(control);
+    free(slots);
+    return false;
+  }
+  std::memset(control, InfohashTable::empty, capacity);
+
+  for (std::size_t i = 0; i < shard.capacity; ++i) {
+    if (is_occupied(shard, i)) {
+      /* copied rather than moved, readers may still read the old slot */
+      const dht::KeyValue &cur = shard.slots[i];
+      const std::uint64_t h = hash(self, cur.id);
+      const std::size_t idx = find_free(control, capacity, h);
+      std::memcpy((void *)(slots + idx), (const void *)&cur, sizeof(cur));
+      control[idx] = fingerprint(h);
+    }
+  }
+
+  retire(self.epoch, shard.control);
+  retire(self.epoch, shard.slots);
+  self.capacity = self.capacity - shard.capacity + capacity;
+  shard.control = control;
+  shard.slots = slots;
+  shard.capacity = capacity;
+  shard.deleted = 0;
+  ++shard.rehashes;
+  ++self.rehashes;
+
+  return true;
+}
+
+//=====================================
+static std::uint32_t
+hash(const InfohashTable &self, const char *name, std::size_t length) noexcept {
+  const std::uint32_t h = std::uint32_t(self.seed ^ (self.seed >> 32));
+  return fnv_1a::encode(name, length, h);
+}
+
+static std::size_t
+name_size(std::size_t length) noexcept {
+  return offsetof(dht::Name, str) + length + 1;
+}
+
+/* max load factor of 1/2 */
+static bool
+is_full(const NameTable &self) noexcept {
+  return (self.length + 1) * 2 > self.capacity;
+}
+
+static std::size_t
+grown_capacity(const NameTable &self) noexcept {
+  return self.capacity == 0 ? 64 : self.capacity * 2;
+}
+
+static void
+place(NameTable &self, dht::Name *name) noexcept {
+  std::size_t i = name->hash & (self.capacity - 1);
+  while (self.slots[i]) {
+    i = (i + 1) & (self.capacity - 1);
+  }
+  self.slots[i] = name;
+}
+
+/* Find or create the interned $name with a reference for the caller */
+static dht::Name *
+intern(InfohashTable &self, const char *name, std::size_t length) noexcept {
+  NameTable &names = self.names;
+  const std::uint32_t h = hash(self, name, length);
+  if (names.capacity > 0) {
+    const std::size_t mask = names.capacity - 1;
+    for (std::size_t i = h & mask; names.slots[i]; i = (i + 1) & mask) {
+      dht::Name *const cur = names.slots[i];
+      if (cur->hash == h && cur->length == length &&
+          std::memcmp(cur->str, name, length) == 0) {
+        ++cur->refs;
+        return cur;
+      }
+    }
+  }
+
+  if (is_full(names)) {
+    const std::size_t capacity = grown_capacity(names);
+    auto *slots = (dht::Name **)calloc(capacity, sizeof(dht::Name *));
+    if (!slots) {
+      return nullptr;
+    }
+
+    dht::Name **const old = names.slots;
+    const std::size_t old_capacity = names.capacity;
+    names.slots = slots;
+    names.capacity = capacity;
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+      if (old[i]) {
+        place(names, old[i]);
+      }
+    }
+    free(old);
+  }
+
+  auto *const result = (dht::Name *)allocate(self.pool, name_size(length));
+  if (!result) {
+    return nullptr;
+  }
+  result->refs = 1;
+  result->hash = h;
+  result->length = std::uint32_t(length);
+  std::memcpy(result->str, name, length);
+  result->str[length] = '\0';
+
+  place(names, result);
+  ++names.length;
+  names.bytes += dht::block_size(name_size(length));
+  return result;
+}
+
+static void
+release(InfohashTable &self, dht::Name *name) noexcept {
+  assertx(name->refs > 0);
+  if (--name->refs > 0) {
+    return;
+  }
+
+  /* backward shift deletion, see IpQuota */
+  NameTable &names = self.names;
+  const std::size_t mask = names.capacity - 1;
+  std::size_t hole = name->hash & mask;
+  while (names.slots[hole] != name) {
+    hole = (hole + 1) & mask;
+  }
+  names.slots[hole] = nullptr;
+  for (std::size_t i = (hole + 1) & mask; names.slots[i]; i = (i + 1) & mask) {
+    const std::size_t h = names.slots[i]->hash & mask;
+    if (((i - h) & mask) >= ((i - hole) & mask)) {
+      names.slots[hole] = names.slots[i];
+      names.slots[i] = nullptr;
+      hole = i;
+    }
+  }
+  --names.length;
+
+  names.bytes -= dht::block_size(name_size(name->length));
+  deallocate(self.pool, name, name_size(name->length));
+}
+
+/* Return everything $kv owns to the pool */
+static void
+release(InfohashTable &self, dht::KeyValue &kv) noexcept {
+  clear(kv.peers, self.pool);
+  if (kv.name) {
+    release(self, (dht::Name *)kv.name);
+    kv.name = nullptr;
+  }
+  if (kv.bloom) {
+    deallocate(self.pool, kv.bloom, sizeof(*kv.bloom));
+    kv.bloom = nullptr;
+  }
+  if (kv.compact) {
+    constexpr std::size_t record = dht::CompactBlob::record;
+    dht::CompactPeers &compact = *kv.compact;
+    deallocate(self.pool, compact.seeds.data, compact.seeds.capacity * record);
+    deallocate(self.pool, compact.peers.data, compact.peers.capacity * record);
+    deallocate(self.pool, kv.compact, sizeof(*kv.compact));
+    kv.compact = nullptr;
+  }
+}
+
+//=====================================
+dht::KeyValue *
+find(InfohashTable &self, const dht::Infohash &key) noexcept {
+  ++self.lookups;
+  InfohashTable::Shard &shard = shard_of(self, key);
+  const std::size_t idx = find_index(self, shard, key, self.probes);
+  return idx == shard.capacity ? nullptr : shard.slots + idx;
+}
+
+const dht::KeyValue *
+find(const InfohashTable &self, const dht::Infohash &key) noexcept {
+  std::uint64_t probes = 0;
+  const InfohashTable::Shard &shard = shard_of(self, key);
+  const std::size_t idx = find_index(self, shard, key, probes);
+  return idx == shard.capacity ? nullptr : shard.slots + idx;
+}
+
+/* max load factor of 7/8 including tombstones */
+static bool
+is_full(const InfohashTable::Shard &shard) noexcept {
+  return (shard.length + shard.deleted + 1) * 8 > shard.capacity * 7;
+}
+
+/* The capacity of a full $shard once rehashed, the same if it is only full of
+ * tombstones */
+static std::size_t
+rehash_capacity(const InfohashTable::Shard &shard) noexcept {
+  if (shard.capacity == 0) {
+    return InfohashTable::group * 4;
+  }
+  if ((shard.length + 1) * 16 > shard.capacity * 7) {
+    return shard.capacity * 2;
+  }
+  return shard.capacity;
+}
+
+std::size_t
+insert_growth(const InfohashTable &self, const dht::Infohash &key) noexcept {
+  if (find(self, key)) {
+    return 0;
+  }
+
+  const std::size_t dense = dense_capacity(self, self.length + 1);
+  std::size_t result = (dense - self.dense_capacity) * sizeof(dht::Infohash);
+  const InfohashTable::Shard &shard = shard_of(self, key);
+  if (is_full(shard)) {
+    const std::size_t capacity = rehash_capacity(shard) - shard.capacity;
+    result += capacity * (1 + sizeof(dht::KeyValue));
+  }
+  return result;
+}
+
+dht::KeyValue *
+insert(InfohashTable &self, const dht::Infohash &key,
+       /*OUT*/ bool &inserted) noexcept {
+  inserted = false;
+
+  dht::KeyValue *result;
+  if ((result = find(self, key))) {
+    return result;
+  }
+
+  if (!reserve_dense(self, self.length + 1)) {
+    return nullptr;
+  }
+
+  InfohashTable::Shard &shard = shard_of(self, key);
+  write_begin(self, key);
+  if (is_full(shard)) {
+    if (!rehash(self, shard, rehash_capacity(shard))) {
+      write_end(self, key);
+      return nullptr;
+    }
+  }
+
+  const std::uint64_t h = hash(self, key);
+  const std::size_t idx = find_free(shard.control, shard.capacity, h);
+  if (shard.control[idx] == InfohashTable::tombstone) {
+    assertx(shard.deleted > 0);
+    --shard.deleted;
+  }
+
+  result = new (shard.slots + idx) dht::KeyValue(key);
+  shard.control[idx] = fingerprint(h);
+  result->dense = std::uint32_t(self.length);
+  self.dense[self.length] = key;
+  ++shard.length;
+  ++self.length;
+  write_end(self, key);
+  inserted = true;
+
+  return result;
+}
+
+bool
+remove(InfohashTable &self, const dht::Infohash &key) noexcept {
+  std::uint64_t probes = 0;
+  InfohashTable::Shard &shard = shard_of(self, key);
+  const std::size_t idx = find_index(self, shard, key, probes);
+  if (idx == shard.capacity) {
+    return false;
+  }
+
+  remove_at(self, shard.slots[idx]);
+  return true;
+}
+
+void
+remove_at(InfohashTable &self, dht::KeyValue &kv) noexcept {
+  InfohashTable::Shard &shard = shard_of(self, kv.id);
+  assertx(&kv >= shard.slots && &kv < shard.slots + shard.capacity);
+  const std::size_t idx = std::size_t(&kv - shard.slots);
+  assertx(is_occupied(shard, idx));
+
+  /* swap the last key into the hole in the dense array */
+  const std::size_t hole = kv.dense;
+  const std::size_t last = self.length - 1;
+  assertx(self.dense[hole] == kv.id);
+  if (hole != last) {
+    std::uint64_t probes = 0;
+    InfohashTable::Shard &other = shard_of(self, self.dense[last]);
+    const std::size_t moved = find_index(self, other, self.dense[last], probes);
+    assertx(moved != other.capacity);
+    other.slots[moved].dense = std::uint32_t(hole);
+    self.dense[hole] = self.dense[last];
+  }
+
+  const dht::Infohash key = kv.id;
+  write_begin(self, key);
+  release(self, kv);
+  kv.~KeyValue();
+  --shard.length;
+  --self.length;
+
+  /* A probe only continues past a group without empty slots, if the group
+   * already has an empty slot no probe sequence depends on this slot being
+   * occupied. */
+  const std::size_t base = idx & ~(InfohashTable::group - 1);
+  if (match(shard.control + base, InfohashTable::empty)) {
+    shard.control[idx] = InfohashTable::empty;
+  } else {
+    shard.control[idx] = InfohashTable::tombstone;
+    ++shard.deleted;
+  }
+  write_end(self, key);
+}
+
+bool
+is_empty(const InfohashTable &self) noexcept {
+  return self.length == 0;
+}
+
+std::size_t
+length(const InfohashTable &self) noexcept {
+  return self.length;
+}
+
+std::size_t
+deleted(const InfohashTable &self) noexcept {
+  std::size_t result = 0;
+  for (const InfohashTable::Shard &shard : self.shard) {
+    result += shard.deleted;
+  }
+  return result;
+}
+
+std::size_t
+memory(const InfohashTable &self) noexcept {
+  std::size_t result = self.capacity * (1 + sizeof(dht::KeyValue));
+  result += self.dense_capacity * sizeof(dht::Infohash);
+  result += self.names.capacity * sizeof(dht::Name *);
+  return result + self.pool.reserved;
+}
+
+bool
+set_name(InfohashTable &self, dht::KeyValue &kv, const char *name) noexcept {
+  const std::size_t length = strnlen(name, 128);
+  if (kv.name && kv.name->length == length &&
+      std::memcmp(kv.name->str, name, length) == 0) {
+    return true;
+  }
+
+  dht::Name *const interned = intern(self, name, length);
+  if (!interned) {
+    return false;
+  }
+  if (kv.name) {
+    release(self, (dht::Name *)kv.name);
+  }
+  kv.name = interned;
+  return true;
+}
+
+std::size_t
+name_growth(const InfohashTable &self, const dht::KeyValue *kv,
+            const char *name, /*OUT*/ std::size_t &size) noexcept {
+  const std::size_t length = strnlen(name, 128);
+  size = 0;
+  if (kv && kv->name && kv->name->length == length &&
+      std::memcmp(kv->name->str, name, length) == 0) {
+    return 0;
+  }
+
+  size = name_size(length);
+  const NameTable &names = self.names;
+  if (!is_full(names)) {
+    return 0;
+  }
+  return (grown_capacity(names) - names.capacity) * sizeof(dht::Name *);
+}
+
+std::size_t
+sample(const InfohashTable &self, prng::xorshift32 &r, dht::Infohash *out,
+       std::size_t n) noexcept {
+  if (self.length <= n) {
+    for (std::size_t i = 0; i < self.length; ++i) {
+      out[i] = self.dense[i];
+    }
+    return self.length;
+  }
+
+  /* Floyd's algorithm, n distinct picks without a retry loop */
+  std::size_t result = 0;
+  for (std::size_t j = self.length - n; j < self.length; ++j) {
+    const dht::Infohash &pick = self.dense[random(r) % (j + 1)];
+    bool taken = false;
+    for (std::size_t i = 0; i < result && !taken; ++i) {
+      taken = out[i] == pick;
+    }
+    out[result++] = taken ? self.dense[j] : pick;
+  }
+  return result;
+}
+
+//=====================================
+void
+write_begin(InfohashTable &self, const dht::Infohash &key) noexcept {
+  InfohashTable::Shard &shard = shard_of(self, key);
+  if (shard.writing++ == 0) {
+    const std::uint32_t sequence = shard.sequence.load();
+    assertx((sequence & 1) == 0);
+    shard.sequence.store(sequence + 1, std::memory_order_relaxed);
+    /* the odd sequence is visible before any of the changes */
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+}
+
+void
+write_end(InfohashTable &self, const dht::Infohash &key) noexcept {
+  InfohashTable::Shard &shard = shard_of(self, key);
+  assertx(shard.writing > 0);
+  if (--shard.writing == 0) {
+    const std::uint32_t sequence = shard.sequence.load();
+    shard.sequence.store(sequence + 1, std::memory_order_release);
+  }
+}
+
+template <typename T>
+static T
+load(const T &field) noexcept {
+  return __atomic_load_n(&field, __ATOMIC_RELAXED);
+}
+
+/* Wait for the writer to leave the shard, returns the even sequence */
+static std::uint32_t
+read_begin(const InfohashTable::Shard &shard) noexcept {
+  for (;;) {
+    const std::uint32_t result =
+        shard.sequence.load(std::memory_order_acquire);
+    if ((result & 1) == 0) {
+      return result;
+    }
+  }
+}
+
+/* Whether the writer changed the shard since read_begin() */
+static bool
+read_retry(const InfohashTable::Shard &shard, std::uint32_t sequence) noexcept {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return shard.sequence.load(std::memory_order_relaxed) != sequence;
+}
+
+std::size_t
+read_peers(InfohashTable &self, std::size_t reader, const dht::Infohash &key,
+           /*OUT*/ dht::Peer *out, std::size_t max) noexcept {
+  const InfohashTable::Shard &shard = shard_of(self, key);
+
+  /* Everything read within the epoch stays allocated even when the writer
+   * retires it, a read which raced with the writer is only discarded. */
+  dht::pin(self.epoch, reader);
+  std::size_t result;
+  for (;;) {
+    const std::uint32_t sequence = read_begin(shard);
+    const std::uint8_t *const control = load(shard.control);
+    const dht::KeyValue *const slots = load(shard.slots);
+    const std::size_t capacity = load(shard.capacity);
+    if (read_retry(shard, sequence)) {
+      continue;
+    }
+
+    std::uint64_t probes = 0;
+    const std::size_t idx =
+        find_index(self, control, slots, capacity, key, probes);
+    if (idx == capacity) {
+      if (read_retry(shard, sequence)) {
+        continue;
+      }
+      result = 0;
+      break;
+    }
+
+    const dht::PeerList &peers = slots[idx].peers;
+    const dht::Peer *const data = load(peers.data);
+    result = std::min(std::size_t(load(peers.length)), max);
+    if (read_retry(shard, sequence)) {
+      continue;
+    }
+
+    std::memcpy((void *)out, (const void *)data, result * sizeof(*out));
+    if (!read_retry(shard, sequence)) {
+      break;
+    }
+  }
+  dht::unpin(self.epoch, reader);
+
+  return result;
+}
+
+//=====================================
+} // namespace db
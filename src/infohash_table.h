@@ -0,0 +1,400 @@
+#ifndef SP_MAINLINE_DHT_INFOHASH_TABLE_H
+#define SP_MAINLINE_DHT_INFOHASH_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "epoch.h"
+#include "pool.h"
+#include "util.h"
+
+#include <prng/xorshift.h>
+
+namespace dht {
+//=====================================
+/* Compact array of the peers announced for an infohash, ordered by the time of
+ * their last announce with the least recent peer first. The array is allocated
+ * from a Pool and has to be cleared before the list is destroyed.
+ */
+struct PeerList {
+  static constexpr std::uint32_t initial_capacity = 2;
+
+  Peer *data;
+  std::uint32_t length;
+  std::uint32_t capacity;
+
+  PeerList() noexcept;
+  PeerList(PeerList &&) noexcept;
+
+  PeerList(const PeerList &) = delete;
+
+  PeerList &
+  operator=(const PeerList &) = delete;
+  PeerList &
+  operator=(const PeerList &&) = delete;
+
+  ~PeerList() noexcept;
+};
+
+Peer *
+find(PeerList &, const Contact &) noexcept;
+
+Peer *
+find(PeerList &, const Ip &) noexcept;
+
+bool
+is_empty(const PeerList &) noexcept;
+
+std::size_t
+length(const PeerList &) noexcept;
+
+/* Bytes the next push_back() allocates, 0 if the list has room */
+std::size_t
+push_size(const PeerList &) noexcept;
+
+/* Append $peer as the most recently announced, nullptr if out of memory */
+Peer *
+push_back(PeerList &, Pool &, const Peer &) noexcept;
+
+/* Move $peer last since it was just announced, returns its new position */
+Peer *
+touch(PeerList &, Peer *) noexcept;
+
+/* Remove the $n least recently announced peers */
+void
+drop_front(PeerList &, Pool &, std::size_t n) noexcept;
+
+/* Remove $peer, the order of the other peers is kept */
+void
+erase(PeerList &, Pool &, Peer *peer) noexcept;
+
+void
+clear(PeerList &, Pool &) noexcept;
+
+template <typename F>
+void
+for_each(const PeerList &self, F f) noexcept {
+  for (std::uint32_t i = 0; i < self.length; ++i) {
+    f(self.data[i]);
+  }
+}
+
+template <typename F>
+bool
+for_all(const PeerList &self, F f) noexcept {
+  for (std::uint32_t i = 0; i < self.length; ++i) {
+    if (!f(self.data[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//=====================================
+/* BEP33 bloom filters of the seeds and the other peers of an infohash */
+struct ScrapeBloom {
+  std::uint8_t seeds[256];
+  std::uint8_t peers[256];
+  /* a peer was removed or changed kind, the filters has to be rebuilt */
+  bool stale;
+};
+
+//=====================================
+/* Peers encoded as the bencoded strings of their compact IPv4 contact, the
+ * entries of the values list in a get_peers reply.
+ */
+struct CompactBlob {
+  /* 6:<ip><port> */
+  static constexpr std::size_t record = 8;
+
+  sp::byte *data;
+  /* in records */
+  std::uint32_t length;
+  std::uint32_t capacity;
+};
+
+struct CompactPeers {
+  CompactBlob seeds;
+  CompactBlob peers;
+  /* a peer was removed or changed, the blobs has to be rebuilt */
+  bool stale;
+};
+
+//=====================================
+/* Interned infohash name shared by every entry with the same name */
+struct Name {
+  std::uint32_t refs;
+  std::uint32_t hash;
+  std::uint32_t length;
+  /* $length characters followed by a null terminator */
+  char str[4];
+};
+
+//=====================================
+struct KeyValue {
+  dht::Infohash id;
+  /* handle of the entry in db::ExpiryQueue, 0 if not queued */
+  std::uint32_t expiry;
+  /* position of $id in InfohashTable::dense */
+  std::uint32_t dense;
+  /* get_peers lookups, halved for every period elapsed since $hits_minute */
+  std::uint8_t hits;
+  std::uint16_t hits_minute;
+  PeerList peers;
+  const Name *name;
+  /* allocated on the first scrape of this entry, nullptr before that */
+  ScrapeBloom *bloom;
+  /* allocated on the first get_peers of this entry, nullptr before that */
+  CompactPeers *compact;
+
+  explicit KeyValue(const dht::Infohash &) noexcept;
+  KeyValue(KeyValue &&) noexcept;
+
+  KeyValue(const KeyValue &) = delete;
+
+  KeyValue &
+  operator=(const KeyValue &) = delete;
+  KeyValue &
+  operator=(const KeyValue &&) = delete;
+
+  ~KeyValue();
+};
+
+//=====================================
+} // namespace dht
+
+namespace db {
+//=====================================
+/* Set of the interned names. Open addressing with linear probing, a slot is
+ * empty when it is nullptr.
+ */
+struct NameTable {
+  dht::Name **slots;
+  std::size_t capacity;
+  std::size_t length;
+  /* bytes of the pool used by the names */
+  std::size_t bytes;
+
+  NameTable() noexcept;
+
+  NameTable(const NameTable &) = delete;
+  NameTable(const NameTable &&) = delete;
+
+  NameTable &
+  operator=(const NameTable &) = delete;
+  NameTable &
+  operator=(const NameTable &&) = delete;
+
+  ~NameTable() noexcept;
+};
+
+//=====================================
+/* Open addressing hash table of KeyValue keyed by infohash, split into $shards
+ * independent shards by the high bits of the first byte of the infohash. Every
+ * slot has a control byte which is either empty, deleted or 7 bits of the hash
+ * of its key. Slots are probed a group at a time where all control bytes of
+ * the group are compared against the needle at once (SSE2 when available),
+ * only slots with a matching fingerprint are compared against the key. The
+ * hash is seeded since infohashes are chosen by remote peers.
+ *
+ * Alongside the slots every key is stored in the dense array, removal swaps
+ * the last key into the hole, so random sampling does not scan the slots.
+ *
+ * The peer lists, names and caches of the entries are allocated from $pool and
+ * released by the table when an entry is removed.
+ *
+ * A single writer thread changes the table while reader threads may copy the
+ * peers of an entry with read_peers(). The sequence of a shard is odd while the
+ * writer changes it and a reader retries when the sequence changed during its
+ * read. The slot arrays of a grown shard and the large peer arrays are retired
+ * to $epoch, so a reader never touches freed memory.
+ */
+struct InfohashTable {
+  static constexpr std::size_t group = 16;
+  /* control bytes of occupied slots have the high bit cleared */
+  static constexpr std::uint8_t empty = 0x80;
+  static constexpr std::uint8_t tombstone = 0xfe;
+  static constexpr std::size_t shard_bits = 4;
+  static constexpr std::size_t shards = std::size_t(1) << shard_bits;
+
+  struct Shard {
+    std::uint8_t *control;
+    dht::KeyValue *slots;
+    /* multiple of $group and a power of 2, 0 if not yet allocated */
+    std::size_t capacity;
+    std::size_t length;
+    /* number of tombstones */
+    std::size_t deleted;
+    /* times the slots were moved to a grown array */
+    std::uint64_t rehashes;
+    /* odd while the writer changes the shard */
+    std::atomic<std::uint32_t> sequence;
+    /* nesting depth of write_begin() */
+    std::uint32_t writing;
+
+    Shard() noexcept;
+  };
+
+  Shard shard[shards];
+  /* sum of all shards */
+  std::size_t capacity;
+  std::size_t length;
+  /* $length keys in no particular order */
+  dht::Infohash *dense;
+  std::size_t dense_capacity;
+  std::uint64_t seed;
+  dht::Epoch epoch;
+  dht::Pool pool;
+  NameTable names;
+
+  std::uint64_t lookups;
+  /* number of groups examined by lookups */
+  std::uint64_t probes;
+  std::uint64_t rehashes;
+
+  explicit InfohashTable(std::uint64_t seed) noexcept;
+
+  InfohashTable(const InfohashTable &) = delete;
+  InfohashTable(const InfohashTable &&) = delete;
+
+  InfohashTable &
+  operator=(const InfohashTable &) = delete;
+  InfohashTable &
+  operator=(const InfohashTable &&) = delete;
+
+  ~InfohashTable() noexcept;
+};
+
+//=====================================
+dht::KeyValue *
+find(InfohashTable &, const dht::Infohash &) noexcept;
+
+const dht::KeyValue *
+find(const InfohashTable &, const dht::Infohash &) noexcept;
+
+/* Find or create the entry for $key, nullptr if out of memory. Entries are
+ * moved when their shard grows so the result is only valid until the next
+ * insert.
+ */
+dht::KeyValue *
+insert(InfohashTable &, const dht::Infohash &key,
+       /*OUT*/ bool &inserted) noexcept;
+
+bool
+remove(InfohashTable &, const dht::Infohash &) noexcept;
+
+/* Remove the entry $kv, other entries are not moved */
+void
+remove_at(InfohashTable &, dht::KeyValue &kv) noexcept;
+
+bool
+is_empty(const InfohashTable &) noexcept;
+
+std::size_t
+length(const InfohashTable &) noexcept;
+
+/* Bytes memory() grows by when $key is inserted, 0 if it already exists */
+std::size_t
+insert_growth(const InfohashTable &, const dht::Infohash &key) noexcept;
+
+/* Number of tombstones in all shards */
+std::size_t
+deleted(const InfohashTable &) noexcept;
+
+/* Heap memory used by the table, its pool and names */
+std::size_t
+memory(const InfohashTable &) noexcept;
+
+/* Set the name of $kv to the interned copy of at most 128 characters of
+ * $name, false if out of memory.
+ */
+bool
+set_name(InfohashTable &, dht::KeyValue &, const char *name) noexcept;
+
+/* Bytes the slots of the names grow by when the name of $kv, nullptr for a
+ * new entry, is set to $name. $size is set to the pool allocation of the
+ * name, 0 if it is unchanged. The name is assumed not to be interned yet.
+ */
+std::size_t
+name_growth(const InfohashTable &, const dht::KeyValue *, const char *name,
+            /*OUT*/ std::size_t &size) noexcept;
+
+/* Copy $n distinct keys picked at random to $out, or every key if there are
+ * fewer than $n. Returns the number of keys copied.
+ */
+std::size_t
+sample(const InfohashTable &, prng::xorshift32 &, dht::Infohash *out,
+       std::size_t n) noexcept;
+
+//=====================================
+/* Mark the shard of $key as being changed by the writer until the matching
+ * write_end(), the entry and its peers may be changed in between. Sections
+ * nest, insert() and remove() start their own.
+ */
+void
+write_begin(InfohashTable &, const dht::Infohash &key) noexcept;
+
+void
+write_end(InfohashTable &, const dht::Infohash &key) noexcept;
+
+/* Copy at most $max peers of $key, the least recently announced first. Safe
+ * to call from a reader thread registered with InfohashTable::epoch while the
+ * writer changes the table. Returns the number of peers copied.
+ */
+std::size_t
+read_peers(InfohashTable &, std::size_t reader, const dht::Infohash &key,
+           /*OUT*/ dht::Peer *out, std::size_t max) noexcept;
+
+//=====================================
+inline bool
+is_occupied(const InfohashTable::Shard &self, std::size_t idx) noexcept {
+  return (self.control[idx] & InfohashTable::empty) == 0;
+}
+
+template <typename F>
+void
+for_each(InfohashTable &self, F f) noexcept {
+  for (InfohashTable::Shard &shard : self.shard) {
+    for (std::size_t i = 0; i < shard.capacity; ++i) {
+      if (is_occupied(shard, i)) {
+        f(shard.slots[i]);
+      }
+    }
+  }
+}
+
+template <typename F>
+void
+for_each(const InfohashTable &self, F f) noexcept {
+  for (const InfohashTable::Shard &shard : self.shard) {
+    for (std::size_t i = 0; i < shard.capacity; ++i) {
+      if (is_occupied(shard, i)) {
+        f((const dht::KeyValue &)shard.slots[i]);
+      }
+    }
+  }
+}
+
+/* Remove every entry where $f returns true, returns the number removed */
+template <typename F>
+std::size_t
+remove_if(InfohashTable &self, F f) noexcept {
+  std::size_t result = 0;
+  for (InfohashTable::Shard &shard : self.shard) {
+    for (std::size_t i = 0; i < shard.capacity; ++i) {
+      if (is_occupied(shard, i)) {
+        if (f(shard.slots[i])) {
+          remove_at(self, shard.slots[i]);
+          ++result;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+//=====================================
+} // namespace db
+
+#endif
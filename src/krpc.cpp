@@ -249,20 +249,28 @@ response::get_peers(sp::Buffer &buf, const Transaction &t, //
 bool
 response::get_peers_peers(sp::Buffer &buf, const Transaction &t,
                           const dht::NodeId &id, const dht::Token &token,
-                          const sp::UinArray<Contact> &values) noexcept {
-  return resp(buf, t, [&id, &token, &values](auto &b) {
+                          const db::PeerWindow &window) noexcept {
+  return resp(buf, t, [&id, &token, &window](auto &b) {
     if (!bencode::e::pair(b, "id", id.id, sizeof(id.id))) {
-      assertx(false);
       return false;
     }
 
     if (!bencode::e::pair(b, "token", token.id, token.length)) {
-      assertx(false);
       return false;
     }
 
-    return sp::bencode::e<sp::Buffer>::pair_string_list_contact(b, "values",
-                                                                values);
+    if (!bencode::e::value(b, "values")) {
+      return false;
+    }
+    if (!write(b, 'l')) {
+      return false;
+    }
+    for (std::size_t i = 0; i < window.parts; ++i) {
+      if (!write(b, window.part[i], window.length[i])) {
+        return false;
+      }
+    }
+    return write(b, 'e');
   });
 }
 
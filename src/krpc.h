@@ -62,9 +62,10 @@ get_peers(sp::Buffer &, const Transaction &, const dht::NodeId &id,
           const dht::Token &, bool n4, const dht::Node **, std::size_t,
           bool n6) noexcept;
 
+/* The values are copied as is from the pre-encoded peers of $window */
 bool
 get_peers_peers(sp::Buffer &, const Transaction &, const dht::NodeId &id,
-                const dht::Token &, const sp::UinArray<Contact> &) noexcept;
+                const dht::Token &, const db::PeerWindow &window) noexcept;
 
 bool
 get_peers_scrape(sp::Buffer &, const Transaction &, const dht::NodeId &id,
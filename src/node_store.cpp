@@ -0,0 +1,257 @@
+#include "node_store.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <util/assert.h>
+
+namespace dht {
+//=====================================
+/*dht::NodeLiveness*/
+NodeLiveness::NodeLiveness() noexcept
+    : contact()
+    , remote_activity()
+    , req_sent()
+    , rtt()
+    , refs(0)
+    , next_free(0)
+    , outstanding(0)
+    , timeouts(0) {
+}
+
+//=====================================
+/*dht::NodeStore*/
+NodeStore::NodeStore() noexcept
+    : entries(nullptr)
+    , length(0)
+    , capacity(0)
+    , free(0)
+    , lookup(nullptr)
+    , lookup_capacity(0)
+    , in_use(0)
+    , peak(0)
+    , acquired(0)
+    , shared(0)
+    , released(0)
+    , ping_skipped(0) {
+}
+
+NodeStore::~NodeStore() noexcept {
+  std::free(this->entries);
+  std::free(this->lookup);
+  this->entries = nullptr;
+  this->lookup = nullptr;
+}
+
+NodeStore &
+node_store() noexcept {
+  static NodeStore instance;
+  return instance;
+}
+
+//=====================================
+static std::uint32_t
+hash(const NodeContact &c) noexcept {
+  std::uint64_t h = (std::uint64_t(c.ip.ipv4) << 16) | std::uint64_t(c.port);
+  h *= 0x9E3779B97F4A7C15ull;
+  return std::uint32_t(h >> 32);
+}
+
+static std::uint32_t *
+lookup_slot(NodeStore &self, const NodeContact &needle) noexcept {
+  const std::uint32_t mask = self.lookup_capacity - 1;
+  std::uint32_t i = hash(needle) & mask;
+  while (true) {
+    std::uint32_t *const slot = self.lookup + i;
+    if (*slot == 0 || self.entries[*slot].contact == needle) {
+      return slot;
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+static bool
+lookup_grow(NodeStore &self) noexcept {
+  const std::uint32_t cap =
+      self.lookup_capacity == 0 ? 256 : self.lookup_capacity * 2;
+  auto *lookup = (std::uint32_t *)std::calloc(cap, sizeof(std::uint32_t));
+  if (!lookup) {
+    return false;
+  }
+
+  std::uint32_t *const old = self.lookup;
+  const std::uint32_t old_cap = self.lookup_capacity;
+  self.lookup = lookup;
+  self.lookup_capacity = cap;
+
+  for (std::uint32_t i = 0; i < old_cap; ++i) {
+    if (old[i]) {
+      *lookup_slot(self, self.entries[old[i]].contact) = old[i];
+    }
+  }
+  std::free(old);
+
+  return true;
+}
+
+static void
+lookup_remove(NodeStore &self, std::uint32_t *slot) noexcept {
+  /* backward shift deletion to keep probe sequences intact */
+  const std::uint32_t mask = self.lookup_capacity - 1;
+  std::uint32_t hole = std::uint32_t(slot - self.lookup);
+  std::uint32_t i = hole;
+  while (true) {
+    i = (i + 1) & mask;
+    const std::uint32_t idx = self.lookup[i];
+    if (idx == 0) {
+      break;
+    }
+
+    const std::uint32_t home = hash(self.entries[idx].contact) & mask;
+    /* can $idx be moved to $hole without passing its home slot */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      self.lookup[hole] = idx;
+      hole = i;
+    }
+  }
+  self.lookup[hole] = 0;
+}
+
+static std::uint32_t
+entry_alloc(NodeStore &self) noexcept {
+  if (self.free) {
+    const std::uint32_t result = self.free;
+    self.free = self.entries[result].next_free;
+    return result;
+  }
+
+  if (self.length + 1 >= self.capacity) {
+    const std::uint32_t cap = self.capacity == 0 ? 256 : self.capacity * 2;
+    auto *entries =
+        (NodeLiveness *)std::realloc(self.entries, sizeof(NodeLiveness) * cap);
+    if (!entries) {
+      return 0;
+    }
+    self.entries = entries;
+    self.capacity = cap;
+  }
+
+  /* index 0 is reserved */
+  return ++self.length;
+}
+
+//=====================================
+std::uint32_t
+acquire(NodeStore &self, const Contact &contact,
+        const Timestamp &activity) noexcept {
+  if (contact.ip.type != IpType::IPV4) {
+    return 0;
+  }
+
+  const NodeContact needle(contact);
+  /* keep the load factor below 50% */
+  if ((self.in_use + 1) * 2 > self.lookup_capacity) {
+    if (!lookup_grow(self)) {
+      return 0;
+    }
+  }
+
+  std::uint32_t *const slot = lookup_slot(self, needle);
+  if (*slot) {
+    NodeLiveness &entry = self.entries[*slot];
+    assertx(entry.refs > 0);
+    ++entry.refs;
+    if (Timestamp(entry.remote_activity) < activity) {
+      entry.remote_activity = activity;
+    }
+    ++self.acquired;
+    ++self.shared;
+    return *slot;
+  }
+
+  const std::uint32_t idx = entry_alloc(self);
+  if (idx == 0) {
+    return 0;
+  }
+
+  NodeLiveness *entry = new (self.entries + idx) NodeLiveness;
+  entry->contact = needle;
+  entry->remote_activity = activity;
+  entry->refs = 1;
+  *slot = idx;
+
+  ++self.acquired;
+  ++self.in_use;
+  self.peak = std::max(self.peak, self.in_use);
+
+  return idx;
+}
+
+void
+release(NodeStore &self, std::uint32_t idx) noexcept {
+  if (idx == 0) {
+    return;
+  }
+
+  assertxs(idx <= self.length, idx, self.length);
+  NodeLiveness &entry = self.entries[idx];
+  assertx(entry.refs > 0);
+  ++self.released;
+
+  if (--entry.refs == 0) {
+    std::uint32_t *const slot = lookup_slot(self, entry.contact);
+    assertx(*slot == idx);
+    lookup_remove(self, slot);
+
+    entry = NodeLiveness();
+    entry.next_free = self.free;
+    self.free = idx;
+    --self.in_use;
+  }
+}
+
+NodeLiveness *
+find(NodeStore &self, const Contact &contact) noexcept {
+  if (self.lookup_capacity == 0 || contact.ip.type != IpType::IPV4) {
+    return nullptr;
+  }
+
+  const std::uint32_t idx = *lookup_slot(self, NodeContact(contact));
+  return liveness(self, idx);
+}
+
+NodeLiveness *
+liveness(NodeStore &self, std::uint32_t idx) noexcept {
+  if (idx == 0) {
+    return nullptr;
+  }
+  assertxs(idx <= self.length, idx, self.length);
+  assertx(self.entries[idx].refs > 0);
+  return self.entries + idx;
+}
+
+const NodeLiveness *
+liveness(const NodeStore &self, std::uint32_t idx) noexcept {
+  if (idx == 0) {
+    return nullptr;
+  }
+  assertxs(idx <= self.length, idx, self.length);
+  assertx(self.entries[idx].refs > 0);
+  return self.entries + idx;
+}
+
+NodeLiveness *
+liveness(const Node &node) noexcept {
+  return liveness(node_store(), node.shared);
+}
+
+bool
+is_recently_contacted(const Node &node, const Timestamp &now,
+                      sp::Milliseconds interval) noexcept {
+  const NodeLiveness *l = liveness(node);
+  if (l && Timestamp(l->req_sent) > Timestamp(node.req_sent)) {
+    return (Timestamp(l->req_sent) + interval) > now;
+  }
+  return false;
+}
+
+} // namespace dht
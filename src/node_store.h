@@ -0,0 +1,101 @@
+#ifndef SP_MAINLINE_DHT_NODE_STORE_H
+#define SP_MAINLINE_DHT_NODE_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util.h"
+
+namespace dht {
+//=====================================
+/* Liveness of a remote node shared between the main and all scrape routing
+ * tables containing the same ip:port. A response from the remote refreshes
+ * the node in every table and a request sent by one table is visible to the
+ * others so the same node is not pinged multiple times.
+ */
+struct NodeLiveness {
+  NodeContact contact;
+  /* When we received request or response from remote */
+  NodeTime remote_activity;
+  /* When we last sent a request to remote from any routing table */
+  NodeTime req_sent;
+  /* Round trip time of requests sent to remote */
+  Rtt rtt;
+  /* Number of routing table Nodes referencing this entry, 0 when free */
+  std::uint32_t refs;
+  /* Next free entry when $refs is 0 */
+  std::uint32_t next_free;
+  std::uint8_t outstanding;
+  /* Consecutive transactions to remote which timed out, reset on response */
+  std::uint8_t timeouts;
+
+  NodeLiveness() noexcept;
+};
+
+struct NodeStore {
+  /* $entries[0] is unused, index 0 means no entry */
+  NodeLiveness *entries;
+  std::uint32_t length;
+  std::uint32_t capacity;
+  std::uint32_t free;
+
+  /* open addressing contact -> entry index, $lookup_capacity is a power of 2 */
+  std::uint32_t *lookup;
+  std::uint32_t lookup_capacity;
+
+  std::uint64_t in_use;
+  std::uint64_t peak;
+  std::uint64_t acquired;
+  std::uint64_t shared;
+  std::uint64_t released;
+  std::uint64_t ping_skipped;
+
+  NodeStore() noexcept;
+
+  NodeStore(const NodeStore &) = delete;
+  NodeStore(const NodeStore &&) = delete;
+
+  NodeStore &
+  operator=(const NodeStore &) = delete;
+  NodeStore &
+  operator=(const NodeStore &&) = delete;
+
+  ~NodeStore() noexcept;
+};
+
+/* The process global store */
+NodeStore &
+node_store() noexcept;
+
+/* Reference the entry of $contact, creating it with $activity as the remote
+ * activity when it is not present. Returns 0 when out of memory.
+ */
+std::uint32_t
+acquire(NodeStore &, const Contact &, const Timestamp &activity) noexcept;
+
+void
+release(NodeStore &, std::uint32_t) noexcept;
+
+NodeLiveness *
+find(NodeStore &, const Contact &) noexcept;
+
+NodeLiveness *
+liveness(NodeStore &, std::uint32_t) noexcept;
+
+const NodeLiveness *
+liveness(const NodeStore &, std::uint32_t) noexcept;
+
+/* The shared liveness of a routing table Node, nullptr if $node is not part
+ * of a routing table.
+ */
+NodeLiveness *
+liveness(const Node &node) noexcept;
+
+/* Has any routing table sent a request to $node within $interval */
+bool
+is_recently_contacted(const Node &node, const Timestamp &now,
+                      sp::Milliseconds interval) noexcept;
+
+} // namespace dht
+
+#endif
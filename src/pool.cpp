@@ -0,0 +1,204 @@
+#include "pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <util/assert.h>
+
+namespace dht {
+//=====================================
+/*dht::Pool*/
+Pool::Pool() noexcept
+    : free_list{}
+    , arenas(nullptr)
+    , bump(nullptr)
+    , bump_length(0)
+    , reserved(0)
+    , used(0)
+    , epoch(nullptr) {
+}
+
+Pool::~Pool() noexcept {
+  while (arenas) {
+    Arena *const next = arenas->next;
+    free(arenas);
+    arenas = next;
+  }
+  bump = nullptr;
+  bump_length = 0;
+  reserved = 0;
+  used = 0;
+}
+
+//=====================================
+/* Smallest class which fits $size */
+static std::size_t
+size_class(std::size_t size) noexcept {
+  constexpr std::size_t min = std::size_t(1) << Pool::min_shift;
+  if (size <= min) {
+    return 0;
+  }
+  const std::size_t shift = 64 - std::size_t(__builtin_clzll(size - 1));
+  return shift - Pool::min_shift;
+}
+
+/* Largest class which fits in $size */
+static std::size_t
+floor_class(std::size_t size) noexcept {
+  const std::size_t shift = 63 - std::size_t(__builtin_clzll(size));
+  return std::min(shift - Pool::min_shift, Pool::classes - 1);
+}
+
+static std::size_t
+class_size(std::size_t cls) noexcept {
+  return std::size_t(1) << (cls + Pool::min_shift);
+}
+
+static void
+push(Pool &self, std::size_t cls, void *ptr) noexcept {
+  auto *const block = (Pool::Block *)ptr;
+  block->next = self.free_list[cls];
+  self.free_list[cls] = block;
+}
+
+/* Start a new arena, what is left of the current one is handed out to the
+ * free lists of the smaller classes */
+static bool
+grow(Pool &self) noexcept {
+  auto *const arena = (Pool::Arena *)malloc(Pool::arena);
+  if (!arena) {
+    return false;
+  }
+
+  while (self.bump_length >= class_size(0)) {
+    const std::size_t cls = floor_class(self.bump_length);
+    push(self, cls, self.bump);
+    self.bump += class_size(cls);
+    self.bump_length -= class_size(cls);
+  }
+
+  arena->next = self.arenas;
+  self.arenas = arena;
+  self.bump = (std::uint8_t *)arena + sizeof(Pool::Arena);
+  self.bump_length = Pool::arena - sizeof(Pool::Arena);
+  self.reserved += Pool::arena;
+  return true;
+}
+
+//=====================================
+std::size_t
+block_size(std::size_t size) noexcept {
+  if (size > Pool::max) {
+    return size;
+  }
+  return class_size(size_class(size));
+}
+
+std::size_t
+growth(const Pool &self, const std::size_t *sizes, std::size_t n) noexcept {
+  std::size_t result = 0;
+  std::size_t bump_length = self.bump_length;
+  /* the next free block of each class not yet taken by an earlier size */
+  const Pool::Block *next[Pool::classes];
+  std::copy(self.free_list, self.free_list + Pool::classes, next);
+  bool arena = false;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (sizes[i] == 0) {
+      continue;
+    }
+    if (sizes[i] > Pool::max) {
+      result += sizes[i];
+      continue;
+    }
+
+    const std::size_t cls = size_class(sizes[i]);
+    if (next[cls]) {
+      next[cls] = next[cls]->next;
+      continue;
+    }
+    if (bump_length >= class_size(cls)) {
+      bump_length -= class_size(cls);
+      continue;
+    }
+    /* one new arena serves all of the small requests */
+    arena = true;
+  }
+  return result + (arena ? Pool::arena : 0);
+}
+
+void *
+allocate(Pool &self, std::size_t size) noexcept {
+  if (size > Pool::max) {
+    void *const result = malloc(size);
+    if (result) {
+      self.reserved += size;
+      self.used += size;
+    }
+    return result;
+  }
+
+  const std::size_t cls = size_class(size);
+  const std::size_t bytes = class_size(cls);
+  void *result;
+  if (self.free_list[cls]) {
+    result = self.free_list[cls];
+    self.free_list[cls] = self.free_list[cls]->next;
+  } else {
+    if (self.bump_length < bytes) {
+      if (!grow(self)) {
+        return nullptr;
+      }
+    }
+    result = self.bump;
+    self.bump += bytes;
+    self.bump_length -= bytes;
+  }
+
+  self.used += bytes;
+  return result;
+}
+
+void
+deallocate(Pool &self, void *ptr, std::size_t size) noexcept {
+  if (!ptr) {
+    return;
+  }
+
+  if (size > Pool::max) {
+    assertx(self.reserved >= size);
+    if (self.epoch) {
+      retire(*self.epoch, ptr);
+    } else {
+      free(ptr);
+    }
+    self.reserved -= size;
+    self.used -= size;
+    return;
+  }
+
+  const std::size_t cls = size_class(size);
+  assertx(self.used >= class_size(cls));
+  push(self, cls, ptr);
+  self.used -= class_size(cls);
+}
+
+void *
+reallocate(Pool &self, void *ptr, std::size_t old_size,
+           std::size_t size) noexcept {
+  if (ptr && block_size(old_size) == block_size(size) && size <= Pool::max) {
+    return ptr;
+  }
+
+  void *const result = allocate(self, size);
+  if (!result) {
+    return nullptr;
+  }
+  if (ptr) {
+    std::memcpy(result, ptr, std::min(old_size, size));
+    deallocate(self, ptr, old_size);
+  }
+  return result;
+}
+
+//=====================================
+} // namespace dht
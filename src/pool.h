@@ -0,0 +1,91 @@
+#ifndef SP_MAINLINE_DHT_POOL_H
+#define SP_MAINLINE_DHT_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "epoch.h"
+
+namespace dht {
+//=====================================
+/* Size class allocator for the small allocations of the peer db. A request
+ * is rounded up to a power of 2 between 16 bytes and $max, every class keeps a
+ * free list of blocks carved from arenas of $arena bytes. Arenas are only
+ * returned with the pool, so the churn of peer lists and names in a long
+ * running process reuses blocks instead of fragmenting the heap. The arenas
+ * in $reserved stay at their high-water mark, a freed block is kept for the
+ * next request of its class and growth() tells whether a request can be
+ * served without reserving more. Requests larger than $max are passed on to
+ * malloc, when $epoch is set they are retired to it instead of freed since
+ * readers may still be copying them.
+ */
+struct Pool {
+  static constexpr std::size_t min_shift = 4;
+  static constexpr std::size_t classes = 10;
+  static constexpr std::size_t max = std::size_t(1)
+                                     << (min_shift + classes - 1);
+  static constexpr std::size_t arena = 64 * 1024;
+
+  struct Block {
+    Block *next;
+  };
+  struct Arena {
+    Arena *next;
+    /* keeps the blocks 16 byte aligned */
+    std::size_t pad;
+  };
+
+  Block *free_list[classes];
+  Arena *arenas;
+  /* the part of the newest arena not yet carved into blocks */
+  std::uint8_t *bump;
+  std::size_t bump_length;
+  /* bytes of arenas and of large allocations */
+  std::size_t reserved;
+  /* bytes of blocks and of large allocations handed out */
+  std::size_t used;
+  Epoch *epoch;
+
+  Pool() noexcept;
+
+  Pool(const Pool &) = delete;
+  Pool(const Pool &&) = delete;
+
+  Pool &
+  operator=(const Pool &) = delete;
+  Pool &
+  operator=(const Pool &&) = delete;
+
+  ~Pool() noexcept;
+};
+
+//=====================================
+/* The number of bytes actually used to serve a request of $size */
+std::size_t
+block_size(std::size_t size) noexcept;
+
+/* The bytes which would have to be reserved to serve one request of each of
+ * $sizes, 0 if they all fit in the free blocks and the current arena. Sizes
+ * of 0 are ignored.
+ */
+std::size_t
+growth(const Pool &, const std::size_t *sizes, std::size_t n) noexcept;
+
+/* nullptr if out of memory */
+void *
+allocate(Pool &, std::size_t size) noexcept;
+
+/* $size has to be the same as when $ptr was allocated */
+void
+deallocate(Pool &, void *ptr, std::size_t size) noexcept;
+
+/* Move $ptr to a block of $size bytes, the content is copied as is. On
+ * failure nullptr is returned and $ptr is left untouched.
+ */
+void *
+reallocate(Pool &, void *ptr, std::size_t old_size, std::size_t size) noexcept;
+
+//=====================================
+} // namespace dht
+
+#endif
@@ -31,7 +31,7 @@ priv::e<Buffer>::value(Buffer &buf, const dht::Node &node) noexcept {
       return false;
     }
 
-    if (!bencode::priv::e<Buffer>::pair(b, "contact", node.contact)) {
+    if (!bencode::priv::e<Buffer>::pair(b, "contact", Contact(node.contact))) {
       return false;
     }
 
@@ -115,7 +115,7 @@ priv::e<Buffer>::value(Buffer &buf, const dht::Peer &t) noexcept {
       return false;
     }
 
-    if (!bencode::e<Buffer>::pair(b, "activity", t.activity.value)) {
+    if (!bencode::e<Buffer>::pair(b, "activity", dht::activity(t).value)) {
       return false;
     }
 
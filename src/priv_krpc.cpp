@@ -3,6 +3,7 @@
 #include "cache.h"
 #include "encode_bencode.h"
 #include "krpc_shared.h"
+#include "node_store.h"
 #include "util.h"
 #include <tree/bst_extra.h>
 #include <udp.h>
@@ -167,6 +168,110 @@ response::dump(sp::Buffer &buf, const Transaction &t,
       return false;
     }
 
+    if (!bencode::e::value(b, "db")) {
+      return false;
+    }
+    res = bencode::e::dict(b, [&dht](auto &b2) {
+      const db::InfohashTable &table = dht.db.lookup_table;
+      if (!bencode::e::pair(b2, "infohashes", std::uint64_t(table.length))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "capacity", std::uint64_t(table.capacity))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "tombstones",
+                            std::uint64_t(deleted(table)))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "lookups", table.lookups)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "probes", table.probes)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "rehashes", table.rehashes)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "readers",
+                            std::uint64_t(table.epoch.readers.load()))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "retired", std::uint64_t(table.epoch.length))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "retired_leaked", table.epoch.leaked)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "expiry_queue",
+                            std::uint64_t(dht.db.expiry.length))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "ips", std::uint64_t(dht.db.ip_quota.length))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "ip_capped", dht.db.ip_capped)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "over_budget", dht.db.over_budget)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "peers_evicted", dht.db.peers_evicted)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "bytes", std::uint64_t(memory(dht.db)))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "entries", std::uint64_t(dht.db.peers))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "evictions", dht.db.evictions)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "pool_reserved",
+                            std::uint64_t(table.pool.reserved))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "pool_used", std::uint64_t(table.pool.used))) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "names", std::uint64_t(table.names.length))) {
+        return false;
+      }
+      const db::Persist &persist = dht.db.persist;
+      if (!bencode::e::pair(b2, "snapshots", persist.snapshots)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "snapshot_failures",
+                            persist.snapshot_failures)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "log_records", persist.log_records)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "log_failures", persist.log_failures)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "restore_ms", persist.restore_ms)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "restored_infohashes",
+                            persist.restored_infohashes)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "restored_peers", persist.restored_peers)) {
+        return false;
+      }
+      if (!bencode::e::pair(b2, "replayed_records",
+                            persist.replayed_records)) {
+        return false;
+      }
+      return bencode::e::pair(b2, "memory", std::uint64_t(memory(table)));
+    });
+
+    if (!res) {
+      return false;
+    }
+
     if (!bencode::e::value(b, "ip_election")) {
       fprintf(stdout, "%s: 29\n", __func__);
       return false;
@@ -300,21 +405,39 @@ response::dump_scrape(sp::Buffer &buf, const Transaction &t,
         return false;
       }
 
-      if (!bencode::e::pair(b2, "scrape_hour_current_idx",
-                            dht.scrape_hour_idx)) {
+      const dht::RevisitTable &revisit = dht.scrape_revisit;
+      if (!bencode::e::pair(b2, "scrape_revisit_length",
+                            std::uint64_t(revisit.length))) {
         fprintf(stdout, "%s: 23\n", __func__);
         return false;
       }
-
-      i = 0;
-      for (const auto &sh : dht.scrape_hour) {
-        char key[64] = {0};
-        sprintf(key, "scrape_hour%zu", i);
-        if (!bencode::e::pair(b2, key, sh.unique_inserts)) {
-          fprintf(stdout, "%s: 24\n", __func__);
-          return false;
-        }
-        ++i;
+      if (!bencode::e::pair(b2, "scrape_revisit_memory",
+                            std::uint64_t(memory(revisit)))) {
+        fprintf(stdout, "%s: 23\n", __func__);
+        return false;
+      }
+      if (!bencode::e::pair(b2, "scrape_revisit_fill_ppm",
+                            fill_ppm(revisit))) {
+        fprintf(stdout, "%s: 23\n", __func__);
+        return false;
+      }
+      if (!bencode::e::pair(b2, "scrape_revisit_fpp_ppm",
+                            false_positive_ppm(revisit))) {
+        fprintf(stdout, "%s: 23\n", __func__);
+        return false;
+      }
+      if (!bencode::e::pair(b2, "scrape_revisit_checks", revisit.checks)) {
+        fprintf(stdout, "%s: 23\n", __func__);
+        return false;
+      }
+      if (!bencode::e::pair(b2, "scrape_revisit_blocked", revisit.blocked)) {
+        fprintf(stdout, "%s: 23\n", __func__);
+        return false;
+      }
+      if (!bencode::e::pair(b2, "scrape_revisit_evictions",
+                            revisit.evictions)) {
+        fprintf(stdout, "%s: 24\n", __func__);
+        return false;
       }
 
       return true;
@@ -356,16 +479,16 @@ response::dump_db(sp::Buffer &buf, const Transaction &t,
     }
 
     res = bencode::e::dict(b, [&dht](auto &b2) {
-      binary::rec::inorder(dht.db.lookup_table,
-                           [&b2, &dht](dht::KeyValue &e) -> bool {
-                             return bencode::e::dict(b2, [&e, &dht](auto &b3) {
-                               char buffer[64]{0};
-                               assertx_n(to_string(e.id, buffer));
-
-                               if (!bencode::e::pair(b3, "infohash", buffer)) {
-                                 fprintf(stdout, "%s: 26\n", __func__);
-                                 return false;
-                               }
+      for_each(dht.db.lookup_table,
+               [&b2, &dht](const dht::KeyValue &e) -> bool {
+                 return bencode::e::dict(b2, [&e, &dht](auto &b3) {
+                   char buffer[64]{0};
+                   assertx_n(to_string(e.id, buffer));
+
+                   if (!bencode::e::pair(b3, "infohash", buffer)) {
+                     fprintf(stdout, "%s: 26\n", __func__);
+                     return false;
+                   }
 #if 0
               if (!bencode::e::pair(b3, "rank",
                                     dht::rank(dht.id.id, e.id.id))) {
@@ -374,22 +497,22 @@ response::dump_db(sp::Buffer &buf, const Transaction &t,
               }
 #endif
 
-                               std::uint64_t l(sp::n::length(e.peers));
-                               if (!bencode::e::pair(b3, "entries", l)) {
-                                 fprintf(stdout, "%s: 28\n", __func__);
-                                 return false;
-                               }
-
-                               if (e.name) {
-                                 if (!bencode::e::pair(b3, "name", e.name)) {
-                                   fprintf(stdout, "%s: 29\n", __func__);
-                                   return false;
-                                 }
-                               }
-
-                               return true;
-                             });
-                           });
+                   std::uint64_t l(length(e.peers));
+                   if (!bencode::e::pair(b3, "entries", l)) {
+                     fprintf(stdout, "%s: 28\n", __func__);
+                     return false;
+                   }
+
+                   if (e.name) {
+                     if (!bencode::e::pair(b3, "name", e.name->str)) {
+                       fprintf(stdout, "%s: 29\n", __func__);
+                       return false;
+                     }
+                   }
+
+                   return true;
+                 });
+               });
       return true;
     });
     return res;
@@ -422,7 +545,11 @@ value(sp::Buffer &buf, const dht::Node &node) noexcept {
       return false;
     }
 
-    if (!bencode::e::pair(b, "outstanding", node.outstanding)) {
+    const dht::NodeLiveness *l = dht::liveness(node);
+    if (!bencode::e::pair(b, "outstanding", l ? l->outstanding : 0)) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "timeouts", l ? l->timeouts : 0)) {
       return false;
     }
 
@@ -583,7 +710,7 @@ serialize(sp::Buffer &b, const dht::Node &node) noexcept {
   std::memcpy(b.raw + b.pos, node.id.id, sizeof(node.id.id));
   b.pos += sizeof(node.id.id);
 
-  if (!serialize(b, node.contact)) {
+  if (!serialize(b, Contact(node.contact))) {
     return false;
   }
 
@@ -597,7 +724,7 @@ serialize_size(const dht::KContact &p) noexcept {
 
 static std::size_t
 serialize_size(const dht::Node &p) noexcept {
-  return sizeof(p.id.id) + serialize_size(p.contact);
+  return sizeof(p.id.id) + serialize_size(Contact(p.contact));
 }
 
 static std::size_t
@@ -821,10 +948,179 @@ pair(sp::Buffer &buf, const char *key, const dht::StatDirection &d,
   // });
 }
 
+static bool
+pair(sp::Buffer &buf, const char *key, const dht::NodeStore &store) noexcept {
+  char skey[64] = {0};
+  sprintf(skey, "%s-in_use", key);
+  if (!bencode::e::pair(buf, skey, store.in_use)) {
+    return false;
+  }
+  sprintf(skey, "%s-peak", key);
+  if (!bencode::e::pair(buf, skey, store.peak)) {
+    return false;
+  }
+  sprintf(skey, "%s-acquired", key);
+  if (!bencode::e::pair(buf, skey, store.acquired)) {
+    return false;
+  }
+  sprintf(skey, "%s-shared", key);
+  if (!bencode::e::pair(buf, skey, store.shared)) {
+    return false;
+  }
+  sprintf(skey, "%s-released", key);
+  if (!bencode::e::pair(buf, skey, store.released)) {
+    return false;
+  }
+  sprintf(skey, "%s-ping_skipped", key);
+  if (!bencode::e::pair(buf, skey, store.ping_skipped)) {
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+pair(sp::Buffer &buf, const char *key, const timeout::Wheel &wheel) noexcept {
+  char skey[64] = {0};
+  sprintf(skey, "%s-length", key);
+  if (!bencode::e::pair(buf, skey, wheel.length)) {
+    return false;
+  }
+  sprintf(skey, "%s-scheduled", key);
+  if (!bencode::e::pair(buf, skey, wheel.scheduled)) {
+    return false;
+  }
+  sprintf(skey, "%s-cancelled", key);
+  if (!bencode::e::pair(buf, skey, wheel.cancelled)) {
+    return false;
+  }
+  sprintf(skey, "%s-expired", key);
+  if (!bencode::e::pair(buf, skey, wheel.expired)) {
+    return false;
+  }
+  sprintf(skey, "%s-cascades", key);
+  if (!bencode::e::pair(buf, skey, wheel.cascades)) {
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+pair(sp::Buffer &buf, const char *key, const dht::Rtt &rtt,
+     const dht::Config &cfg) noexcept {
+  char skey[64] = {0};
+  sprintf(skey, "%s-srtt", key);
+  if (!bencode::e::pair(buf, skey, std::uint64_t(rtt.srtt))) {
+    return false;
+  }
+  sprintf(skey, "%s-rttvar", key);
+  if (!bencode::e::pair(buf, skey, std::uint64_t(rtt.rttvar))) {
+    return false;
+  }
+  sprintf(skey, "%s-rto", key);
+  if (!bencode::e::pair(buf, skey, std::uint64_t(rto(rtt, 0, cfg).value))) {
+    return false;
+  }
+  sprintf(skey, "%s-samples", key);
+  if (!bencode::e::pair(buf, skey, std::uint64_t(rtt.samples))) {
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+pair(sp::Buffer &buf, const char *key, const dht::TxClassStat &stat,
+     const dht::Config &cfg) noexcept {
+  char skey[64] = {0};
+  sprintf(skey, "%s-in_flight", key);
+  if (!bencode::e::pair(buf, skey, std::uint64_t(stat.in_flight))) {
+    return false;
+  }
+  sprintf(skey, "%s-minted", key);
+  if (!bencode::e::pair(buf, skey, stat.minted)) {
+    return false;
+  }
+  sprintf(skey, "%s-responses", key);
+  if (!bencode::e::pair(buf, skey, stat.responses)) {
+    return false;
+  }
+  sprintf(skey, "%s-timeouts", key);
+  if (!bencode::e::pair(buf, skey, stat.timeouts)) {
+    return false;
+  }
+  sprintf(skey, "%s-denied", key);
+  if (!bencode::e::pair(buf, skey, stat.denied)) {
+    return false;
+  }
+  sprintf(skey, "%s-rtt", key);
+  if (!pair(buf, skey, stat.latency, cfg)) {
+    return false;
+  }
+
+  return true;
+}
+
+static bool
+pair(sp::Buffer &buf, const char *key,
+     const dht::RoutingTableSlab &slab) noexcept {
+  char skey[64] = {0};
+  sprintf(skey, "%s-cap", key);
+  if (!bencode::e::pair(buf, skey, std::uint64_t(slab.cap))) {
+    return false;
+  }
+  sprintf(skey, "%s-capacity", key);
+  if (!bencode::e::pair(buf, skey, std::uint64_t(capacity(slab)))) {
+    return false;
+  }
+  sprintf(skey, "%s-in_use", key);
+  if (!bencode::e::pair(buf, skey, slab.in_use)) {
+    return false;
+  }
+  sprintf(skey, "%s-peak", key);
+  if (!bencode::e::pair(buf, skey, slab.peak)) {
+    return false;
+  }
+  sprintf(skey, "%s-allocs", key);
+  if (!bencode::e::pair(buf, skey, slab.allocs)) {
+    return false;
+  }
+  sprintf(skey, "%s-frees", key);
+  if (!bencode::e::pair(buf, skey, slab.frees)) {
+    return false;
+  }
+  sprintf(skey, "%s-reused", key);
+  if (!bencode::e::pair(buf, skey, slab.reused)) {
+    return false;
+  }
+  sprintf(skey, "%s-cap_reached", key);
+  if (!bencode::e::pair(buf, skey, slab.cap_reached)) {
+    return false;
+  }
+
+  const std::uint64_t saved = dht::node_bytes_saved_per_table();
+  sprintf(skey, "%s-node_bytes", key);
+  if (!bencode::e::pair(buf, skey, std::uint64_t(sizeof(dht::Node)))) {
+    return false;
+  }
+  sprintf(skey, "%s-node_saved_per_table", key);
+  if (!bencode::e::pair(buf, skey, saved)) {
+    return false;
+  }
+  sprintf(skey, "%s-node_saved", key);
+  if (!bencode::e::pair(buf, skey, saved * slab.in_use)) {
+    return false;
+  }
+
+  return true;
+}
+
 bool
 response::statistics(sp::Buffer &buf, const Transaction &t,
-                     const dht::Stat &stat) noexcept {
-  return resp(buf, t, [&stat](auto &b) { //
+                     const dht::DHT &dht) noexcept {
+  const dht::Stat &stat = dht.statistics;
+  return resp(buf, t, [&dht, &stat](auto &b) { //
     if (!pair(b, "transmit", stat.transmit, true)) {
       return false;
     }
@@ -840,6 +1136,60 @@ response::statistics(sp::Buffer &buf, const Transaction &t,
     if (!bencode::e::pair(b, "scrape_swapped_ih", stat.scrape_swapped_ih)) {
       return false;
     }
+    if (!bencode::e::pair(b, "deferred_tx_timeout", stat.deferred_tx_timeout)) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "deferred_ping", stat.deferred_ping)) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "deferred_find_node", stat.deferred_find_node)) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "deferred_scrape", stat.deferred_scrape)) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "deferred_peer_expiry",
+                          stat.deferred_peer_expiry)) {
+      return false;
+    }
+    if (!pair(b, "rt_slab", dht::routing_table_slab())) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "rt_replacements_cached",
+                          dht.routing_table.replacements_cached)) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "rt_replacements_promoted",
+                          dht.routing_table.replacements_promoted)) {
+      return false;
+    }
+    if (!pair(b, "node_store", dht::node_store())) {
+      return false;
+    }
+    if (!pair(b, "rtt", dht.client.rtt, dht.config)) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "tx_active", std::uint64_t(dht.client.active))) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "tx_capacity",
+                          std::uint64_t(dht.client.capacity))) {
+      return false;
+    }
+    if (!pair(b, "tx_wheel", dht.client.wheel)) {
+      return false;
+    }
+    if (!bencode::e::pair(b, "tx_source_mismatch",
+                          dht.client.source_mismatch)) {
+      return false;
+    }
+    for (std::size_t i = 0; i < dht::tx_classes; ++i) {
+      char key[32] = {0};
+      sprintf(key, "tx_%s", to_string(dht::TxClass(i)));
+      if (!pair(b, key, dht.client.classes[i], dht.config)) {
+        return false;
+      }
+    }
     return true;
   });
 }
@@ -51,7 +51,7 @@ dump_db(sp::Buffer &b, const krpc::Transaction &t, const dht::DHT &) noexcept;
 
 bool
 statistics(sp::Buffer &b, const krpc::Transaction &t,
-           const dht::Stat &) noexcept;
+           const dht::DHT &) noexcept;
 
 bool
 search(sp::Buffer &b, const krpc::Transaction &t) noexcept;
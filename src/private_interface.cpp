@@ -201,8 +201,9 @@ scheduled_search(dht::DHT &dht, sp::Buffer &scratch) noexcept {
       auto head = peek_head(s->queue);
       if (head) {
         reset(scratch);
-        auto res =
-            client::get_peers(dht, scratch, head->contact, s->search, s->ctx);
+        auto res = client::get_peers(dht, scratch, head->contact, s->search,
+                                     tx::TxClosure(s->ctx),
+                                     dht::TxClass::SEARCH);
         if (res == client::Res::OK) {
           search_increment(s->ctx);
           drop_head(s->queue);
@@ -323,8 +324,7 @@ namespace statistics {
 static bool
 on_request(dht::MessageContext &ctx) noexcept {
   dht::DHT &dht = ctx.dht;
-  return krpc::priv::response::statistics(ctx.out, ctx.transaction,
-                                          dht.statistics);
+  return krpc::priv::response::statistics(ctx.out, ctx.transaction, dht);
 }
 
 void
@@ -0,0 +1,206 @@
+#include "revisit_table.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <util/assert.h>
+
+namespace dht {
+//=====================================
+/*dht::RevisitTable*/
+RevisitTable::RevisitTable(std::size_t n, std::uint64_t s) noexcept
+    : buckets(nullptr)
+    , capacity(0)
+    , length(0)
+    , cursor(0)
+    , seed(s)
+    , checks(0)
+    , blocked(0)
+    , evictions(0) {
+  assertx((n & (n - 1)) == 0);
+  buckets = (Bucket *)aligned_alloc(alignof(Bucket), n * sizeof(Bucket));
+  if (buckets) {
+    std::memset((void *)buckets, 0, n * sizeof(Bucket));
+    capacity = n;
+  }
+}
+
+RevisitTable::~RevisitTable() noexcept {
+  free(buckets);
+  buckets = nullptr;
+  capacity = 0;
+  length = 0;
+  cursor = 0;
+}
+
+//=====================================
+static std::uint64_t
+mix(std::uint64_t a, std::uint64_t b) noexcept {
+  const __uint128_t r = __uint128_t(a) * b;
+  return std::uint64_t(r) ^ std::uint64_t(r >> 64);
+}
+
+static std::uint64_t
+hash(const RevisitTable &self, const Ip &ip) noexcept {
+  std::uint64_t w = ip.ipv4;
+#ifdef IP_IPV6
+  if (ip.type == IpType::IPV6) {
+    std::uint64_t w0;
+    std::uint64_t w1;
+    std::memcpy(&w0, ip.ipv6.raw + 0, sizeof(w0));
+    std::memcpy(&w1, ip.ipv6.raw + 8, sizeof(w1));
+    w = w0 ^ mix(w1, 0x589965cc75374cc3ull);
+  }
+#endif
+  const std::uint64_t a = mix(w ^ self.seed ^ 0xa0761d6478bd642full,
+                              0xe7037ed1a0b428dbull);
+  return mix(a, self.seed ^ 0x8ebc6af09c88c6e3ull);
+}
+
+static std::uint16_t
+tag(std::uint64_t h) noexcept {
+  const auto result = std::uint16_t(h >> 48);
+  return result == 0 ? 1 : result;
+}
+
+static RevisitTable::Bucket &
+bucket(RevisitTable &self, std::uint64_t h) noexcept {
+  return self.buckets[h & (self.capacity - 1)];
+}
+
+static std::uint16_t
+minutes(const Timestamp &now) noexcept {
+  return std::uint16_t(std::uint64_t(now) / (60 * 1000));
+}
+
+/* Minutes until $slot expires, 0 or less if it has expired */
+static std::int16_t
+remaining(const RevisitTable::Slot &slot, std::uint16_t now) noexcept {
+  return std::int16_t(std::uint16_t(slot.until - now));
+}
+
+static void
+clear(RevisitTable &self, RevisitTable::Slot &slot) noexcept {
+  assertx(self.length > 0);
+  slot.tag = 0;
+  slot.until = 0;
+  --self.length;
+}
+
+//=====================================
+bool
+is_blocked(RevisitTable &self, const Ip &ip, const Timestamp &now) noexcept {
+  if (self.capacity == 0) {
+    return false;
+  }
+
+  ++self.checks;
+  const std::uint64_t h = hash(self, ip);
+  const std::uint16_t t = tag(h);
+  const std::uint16_t m = minutes(now);
+  for (const RevisitTable::Slot &cur : bucket(self, h).slots) {
+    if (cur.tag == t && remaining(cur, m) > 0) {
+      ++self.blocked;
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+block(RevisitTable &self, const Ip &ip, const Timestamp &now,
+      sp::Milliseconds interval) noexcept {
+  if (self.capacity == 0) {
+    return;
+  }
+
+  const std::uint64_t h = hash(self, ip);
+  const std::uint16_t t = tag(h);
+  const std::uint16_t m = minutes(now);
+  /* rounded up, the ip is not revisited before $interval has passed */
+  std::uint64_t wait = (interval.value + (60 * 1000 - 1)) / (60 * 1000);
+  if (wait > RevisitTable::max_minutes) {
+    wait = RevisitTable::max_minutes;
+  }
+  if (wait == 0) {
+    return;
+  }
+  const auto until = std::uint16_t(m + wait);
+
+  RevisitTable::Slot *free_slot = nullptr;
+  RevisitTable::Slot *first_due = nullptr;
+  for (RevisitTable::Slot &cur : bucket(self, h).slots) {
+    if (cur.tag != 0 && remaining(cur, m) <= 0) {
+      clear(self, cur);
+    }
+    if (cur.tag == 0) {
+      if (!free_slot) {
+        free_slot = &cur;
+      }
+    } else if (cur.tag == t) {
+      if (remaining(cur, m) < std::int16_t(wait)) {
+        cur.until = until;
+      }
+      return;
+    } else if (!first_due || remaining(cur, m) < remaining(*first_due, m)) {
+      first_due = &cur;
+    }
+  }
+
+  if (!free_slot) {
+    assertx(first_due);
+    clear(self, *first_due);
+    free_slot = first_due;
+    ++self.evictions;
+  }
+  free_slot->tag = t;
+  free_slot->until = until;
+  ++self.length;
+}
+
+bool
+sweep(RevisitTable &self, const Timestamp &now, Budget &budget) noexcept {
+  const std::uint16_t m = minutes(now);
+  while (self.cursor < self.capacity) {
+    if (!spend(budget)) {
+      return false;
+    }
+    for (RevisitTable::Slot &cur : self.buckets[self.cursor].slots) {
+      if (cur.tag != 0 && remaining(cur, m) <= 0) {
+        clear(self, cur);
+      }
+    }
+    ++self.cursor;
+  }
+
+  self.cursor = 0;
+  return true;
+}
+
+std::size_t
+memory(const RevisitTable &self) noexcept {
+  return self.capacity * sizeof(RevisitTable::Bucket);
+}
+
+std::uint64_t
+fill_ppm(const RevisitTable &self) noexcept {
+  if (self.capacity == 0) {
+    return 0;
+  }
+  const std::uint64_t slots = self.capacity * RevisitTable::bucket_slots;
+  return (std::uint64_t(self.length) * 1'000'000) / slots;
+}
+
+std::uint64_t
+false_positive_ppm(const RevisitTable &self) noexcept {
+  if (self.capacity == 0) {
+    return 0;
+  }
+  /* the occupied slots of the bucket of an unknown ip, each of which has a
+   * matching tag with a probability of 1 in 2^16 - 1 */
+  const std::uint64_t per_bucket = (std::uint64_t(self.length) * 1'000'000) /
+                                   self.capacity;
+  return per_bucket / 0xffff;
+}
+
+//=====================================
+} // namespace dht
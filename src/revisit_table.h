@@ -0,0 +1,102 @@
+#ifndef SP_MAINLINE_DHT_REVISIT_TABLE_H
+#define SP_MAINLINE_DHT_REVISIT_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util.h"
+
+namespace dht {
+//=====================================
+/* When each remote IP may be sent the next request, used to honour the
+ * interval of sample_infohashes.
+ *
+ * An IP hashes to a single bucket of one cache line, a slot in the bucket
+ * holds a 16 bit tag of the hash and the time the IP may be revisited as
+ * minutes modulo 2^16. A check only scans the bucket of the IP. A full bucket
+ * drops the slot which is due first, so an IP may be revisited early but
+ * never later than recorded. Another IP with the same bucket and tag is a
+ * false positive, the probability of which is about the number of occupied
+ * slots in a bucket divided by 2^16.
+ *
+ * Expired slots are cleared when their bucket is updated and by sweep(),
+ * which walks the buckets a budget at a time and has to complete a pass at
+ * least once every 2^15 minutes so the time of a stale slot does not wrap
+ * around into the future.
+ */
+struct RevisitTable {
+  static constexpr std::size_t bucket_slots = 16;
+  /* revisit times further away than this are clamped */
+  static constexpr std::uint32_t max_minutes = 24 * 60;
+
+  struct Slot {
+    /* 0 if empty */
+    std::uint16_t tag;
+    std::uint16_t until;
+  };
+
+  struct alignas(64) Bucket {
+    Slot slots[bucket_slots];
+  };
+
+  Bucket *buckets;
+  /* power of 2, 0 if the allocation failed */
+  std::size_t capacity;
+  /* occupied slots */
+  std::size_t length;
+  /* the next bucket sweep() visits */
+  std::size_t cursor;
+  std::uint64_t seed;
+
+  std::uint64_t checks;
+  std::uint64_t blocked;
+  /* slots dropped from a full bucket before they expired */
+  std::uint64_t evictions;
+
+  RevisitTable(std::size_t buckets, std::uint64_t seed) noexcept;
+
+  RevisitTable(const RevisitTable &) = delete;
+  RevisitTable(const RevisitTable &&) = delete;
+
+  RevisitTable &
+  operator=(const RevisitTable &) = delete;
+  RevisitTable &
+  operator=(const RevisitTable &&) = delete;
+
+  ~RevisitTable() noexcept;
+};
+
+//=====================================
+/* Whether $ip may not be revisited yet */
+bool
+is_blocked(RevisitTable &, const Ip &, const Timestamp &now) noexcept;
+
+/* Do not revisit $ip until $interval from $now has passed, an earlier
+ * recorded time is extended.
+ */
+void
+block(RevisitTable &, const Ip &, const Timestamp &now,
+      sp::Milliseconds interval) noexcept;
+
+/* Clear the expired slots of the buckets from RevisitTable::cursor on, one
+ * bucket per unit of $budget. True when the pass reached the last bucket and
+ * the next sweep starts over from the first.
+ */
+bool
+sweep(RevisitTable &, const Timestamp &now, Budget &budget) noexcept;
+
+std::size_t
+memory(const RevisitTable &) noexcept;
+
+/* Occupied slots in parts per million */
+std::uint64_t
+fill_ppm(const RevisitTable &) noexcept;
+
+/* Estimated false positive rate of a check in parts per million */
+std::uint64_t
+false_positive_ppm(const RevisitTable &) noexcept;
+
+//=====================================
+} // namespace dht
+
+#endif
@@ -10,21 +10,115 @@
 #include <prng/util.h>
 #include <util/assert.h>
 
+#include "node_store.h"
 #include "timeout.h"
 #include "util.h"
 
 namespace dht {
 
 //=====================================
+/*dht::Bucket*/
+BucketCandidate::BucketCandidate() noexcept
+    : id()
+    , contact()
+    , activity()
+    , srtt(UINT32_MAX)
+    , support_sample_infohashes(false) {
+}
+
+/*dht::ReplacementCache*/
+ReplacementCache::ReplacementCache() noexcept
+    : candidates()
+    , length(0) {
+}
+
 /*dht::Bucket*/
 Bucket::Bucket() noexcept
     : contacts()
-    , length(0) {
+    , length(0)
+    , used(0)
+    , order() {
 }
 
 Bucket::~Bucket() noexcept {
 }
 
+static_assert(Bucket::K <= 32, "Bucket::used is a 32bit bitmap");
+static constexpr std::uint32_t bucket_all_used =
+    Bucket::K == 32 ? ~std::uint32_t(0)
+                    : ((std::uint32_t(1) << Bucket::K) - 1);
+
+static int
+id_compare(const Node &node, const Key &id) noexcept {
+  return std::memcmp(node.id.id, id, sizeof(Key));
+}
+
+/* First position in $order with an id not less than $id */
+static std::size_t
+bucket_lower_bound(const Bucket &b, const Key &id) noexcept {
+  std::size_t first = 0;
+  std::size_t last = b.length;
+  while (first < last) {
+    const std::size_t mid = first + ((last - first) / 2);
+    if (id_compare(b.contacts[b.order[mid]], id) < 0) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+  return first;
+}
+
+static Node *
+bucket_find(Bucket &b, const Key &id) noexcept {
+  const std::size_t pos = bucket_lower_bound(b, id);
+  if (pos < b.length) {
+    Node &cur = b.contacts[b.order[pos]];
+    if (id_compare(cur, id) == 0) {
+      return &cur;
+    }
+  }
+  return nullptr;
+}
+
+static Node *
+bucket_free_slot(Bucket &b) noexcept {
+  if (b.used == bucket_all_used) {
+    return nullptr;
+  }
+  return b.contacts + __builtin_ctz(~b.used);
+}
+
+/* Add the already assigned $contact slot to the sorted order */
+static void
+bucket_link(Bucket &b, Node &contact) noexcept {
+  const std::size_t slot = std::size_t(&contact - b.contacts);
+  assertxs(slot < Bucket::K, slot);
+  assertx(!(b.used & (std::uint32_t(1) << slot)));
+
+  const std::size_t pos = bucket_lower_bound(b, contact.id.id);
+  std::memmove(b.order + pos + 1, b.order + pos, b.length - pos);
+  b.order[pos] = std::uint8_t(slot);
+  b.used |= std::uint32_t(1) << slot;
+  ++b.length;
+}
+
+/* Remove $contact from the sorted order, must be called before the slot is
+ * reset since the position is found by the id.
+ */
+static void
+bucket_unlink(Bucket &b, Node &contact) noexcept {
+  const std::size_t slot = std::size_t(&contact - b.contacts);
+  assertxs(slot < Bucket::K, slot);
+  assertx(b.used & (std::uint32_t(1) << slot));
+
+  const std::size_t pos = bucket_lower_bound(b, contact.id.id);
+  assertxs(pos < b.length && b.order[pos] == slot, pos, b.length, slot);
+  std::memmove(b.order + pos, b.order + pos + 1, b.length - pos - 1);
+  b.used &= ~(std::uint32_t(1) << slot);
+  --b.length;
+}
+
 //=====================================
 /*dht::RoutingTable*/
 RoutingTable::RoutingTable(ssize_t d) noexcept
@@ -91,6 +185,186 @@ RoutingTableLess::operator()(const RoutingTable *f,
   return f->depth < s->depth;
 }
 
+//=====================================
+/*dht::RoutingTableSlab*/
+RoutingTableSlab::RoutingTableSlab() noexcept
+    : chunks{nullptr}
+    , by_address{0}
+    , length_chunks(0)
+    , untouched(0)
+    , free(nullptr)
+    , cap(per_chunk * max_chunks)
+    , in_use(0)
+    , peak(0)
+    , allocs(0)
+    , frees(0)
+    , reused(0)
+    , cap_reached(0) {
+}
+
+RoutingTableSlab::~RoutingTableSlab() noexcept {
+  for (std::size_t i = 0; i < length_chunks; ++i) {
+    std::free(chunks[i]);
+    chunks[i] = nullptr;
+  }
+  length_chunks = 0;
+  untouched = 0;
+  free = nullptr;
+}
+
+RoutingTableSlab &
+routing_table_slab() noexcept {
+  static RoutingTableSlab instance;
+  return instance;
+}
+
+RoutingTable *
+alloc(RoutingTableSlab &self, ssize_t depth) noexcept {
+  static_assert(sizeof(RoutingTableSlab::Free) <= sizeof(RoutingTable));
+  void *raw = nullptr;
+
+  if (self.in_use >= self.cap) {
+    ++self.cap_reached;
+    return nullptr;
+  }
+
+  if (self.free) {
+    RoutingTableSlab::Free *head = self.free;
+    self.free = head->next;
+    raw = head;
+    ++self.reused;
+  } else {
+    if (self.untouched == 0) {
+      if (self.length_chunks == RoutingTableSlab::max_chunks) {
+        ++self.cap_reached;
+        return nullptr;
+      }
+
+      void *chunk =
+          std::malloc(sizeof(RoutingTable) * RoutingTableSlab::per_chunk);
+      if (!chunk) {
+        return nullptr;
+      }
+
+      std::size_t i = self.length_chunks;
+      for (; i > 0; --i) {
+        void *const cmp = self.chunks[self.by_address[i - 1]];
+        if (std::uintptr_t(cmp) < std::uintptr_t(chunk)) {
+          break;
+        }
+        self.by_address[i] = self.by_address[i - 1];
+      }
+      self.by_address[i] = std::uint16_t(self.length_chunks);
+
+      self.chunks[self.length_chunks++] = chunk;
+      self.untouched = RoutingTableSlab::per_chunk;
+    }
+
+    auto *chunk = (RoutingTable *)self.chunks[self.length_chunks - 1];
+    raw = chunk + (RoutingTableSlab::per_chunk - self.untouched);
+    --self.untouched;
+  }
+
+  ++self.allocs;
+  ++self.in_use;
+  self.peak = std::max(self.peak, self.in_use);
+
+  return new (raw) RoutingTable(depth);
+}
+
+void
+dealloc(RoutingTableSlab &self, RoutingTable *subject) noexcept {
+  assertx(subject);
+  assertx(self.in_use > 0);
+
+  subject->~RoutingTable();
+
+  auto *head = new (subject) RoutingTableSlab::Free;
+  head->next = self.free;
+  self.free = head;
+
+  ++self.frees;
+  --self.in_use;
+}
+
+std::size_t
+capacity(const RoutingTableSlab &self) noexcept {
+  return (self.length_chunks * RoutingTableSlab::per_chunk);
+}
+
+std::uint32_t
+node_index(const RoutingTableSlab &self, const Node *node) noexcept {
+  constexpr std::size_t per_chunk = RoutingTableSlab::per_chunk;
+  constexpr std::size_t chunk_bytes = sizeof(RoutingTable) * per_chunk;
+  assertx(node);
+  const std::uintptr_t raw = std::uintptr_t(node);
+
+  /* find the last chunk starting at or before $node */
+  std::size_t first = 0;
+  std::size_t last = self.length_chunks;
+  while (first < last) {
+    const std::size_t mid = first + ((last - first) / 2);
+    if (std::uintptr_t(self.chunks[self.by_address[mid]]) <= raw) {
+      first = mid + 1;
+    } else {
+      last = mid;
+    }
+  }
+
+  if (first == 0) {
+    assertxs(false, node);
+    return 0;
+  }
+
+  const std::size_t chunk = self.by_address[first - 1];
+  const std::uintptr_t base = std::uintptr_t(self.chunks[chunk]);
+  if (raw >= base + chunk_bytes) {
+    assertxs(false, node);
+    return 0;
+  }
+
+  const std::size_t table = (raw - base) / sizeof(RoutingTable);
+  const auto *rt = (const RoutingTable *)self.chunks[chunk] + table;
+  const std::size_t slot = std::size_t(node - rt->bucket.contacts);
+  assertxs(slot < Bucket::K, slot);
+
+  return std::uint32_t((((chunk * per_chunk) + table) * Bucket::K) + slot + 1);
+}
+
+Node *
+node_at(const RoutingTableSlab &self, std::uint32_t idx) noexcept {
+  constexpr std::size_t per_chunk = RoutingTableSlab::per_chunk;
+  if (idx == 0) {
+    return nullptr;
+  }
+
+  const std::size_t i = std::size_t(idx) - 1;
+  const std::size_t table = i / Bucket::K;
+  const std::size_t chunk = table / per_chunk;
+  assertxs(chunk < self.length_chunks, chunk, self.length_chunks);
+
+  auto *rt = (RoutingTable *)self.chunks[chunk] + (table % per_chunk);
+  return rt->bucket.contacts + (i % Bucket::K);
+}
+
+/* Layout of dht::Node before it was packed */
+struct LegacyNode {
+  Node *timeout_next;
+  Node *timeout_priv;
+  Timestamp remote_activity;
+  Timestamp req_sent;
+  Contact contact;
+  NodeId id;
+  std::uint8_t outstanding;
+  std::uint8_t properties;
+};
+
+std::size_t
+node_bytes_saved_per_table() noexcept {
+  static_assert(sizeof(LegacyNode) > sizeof(Node));
+  return (sizeof(LegacyNode) - sizeof(Node)) * Bucket::K;
+}
+
 // ========================================
 DHTMetaRoutingTable::DHTMetaRoutingTable(std::size_t cap, prng::xorshift32 &r,
                                          timeout::TimeoutBox &_tb, Timestamp &n,
@@ -106,6 +380,9 @@ DHTMetaRoutingTable::DHTMetaRoutingTable(std::size_t cap, prng::xorshift32 &r,
     , config(_conf)
     , total_nodes(0)
     , bad_nodes(0)
+    , replacements{}
+    , replacements_cached(0)
+    , replacements_promoted(0)
     , retire_good()
     , cache{nullptr} {
 }
@@ -128,8 +405,13 @@ DHTMetaRoutingTable::~DHTMetaRoutingTable() {
           }
         } // for
       }
+      for (std::size_t i = 0; i < Bucket::K; ++i) {
+        Node &node = it->bucket.contacts[i];
+        release(node_store(), node.shared);
+        node.shared = 0;
+      } // for
 
-      delete it;
+      dealloc(routing_table_slab(), it);
       this->root = it = it_next;
     } // while
 
@@ -137,6 +419,10 @@ DHTMetaRoutingTable::~DHTMetaRoutingTable() {
   } // while
 
   this->root = NULL;
+  for (ReplacementCache *&cache : this->replacements) {
+    delete cache;
+    cache = nullptr;
+  }
 }
 
 // ========================================
@@ -235,8 +521,15 @@ debug_bucket_is_valid(const RoutingTable *it) {
   const auto &b = it->bucket;
   assertxs(debug_bucket_count(it->bucket) == it->bucket.length,
            debug_bucket_count(it->bucket), it->bucket.length);
+  assertxs(std::size_t(__builtin_popcount(b.used)) == b.length, b.used,
+           b.length);
   for (std::size_t i = 0; i < Bucket::K; ++i) {
-    is_valid(b.contacts[i]);
+    const bool in_use = b.used & (std::uint32_t(1) << i);
+    assertxs(is_valid(b.contacts[i]) == in_use, i, b.used);
+  }
+  for (std::size_t i = 1; i < b.length; ++i) {
+    assertx(id_compare(b.contacts[b.order[i - 1]],
+                       b.contacts[b.order[i]].id.id) < 0);
   }
   return true;
 }
@@ -368,24 +661,39 @@ reset(DHTMetaRoutingTable &self, Node &contact) noexcept {
     --self.total_nodes;
   }
 
+  release(node_store(), contact.shared);
   contact = Node();
   assertx(!is_valid(contact));
 }
 
+/* Clear $contact.properties.is_good once is_good() no longer holds, the
+ * flag is otherwise only updated by the refresh of the node. True if bad.
+ */
+static bool
+mark_bad(DHTMetaRoutingTable &self, Node &contact) noexcept {
+  if (contact.properties.is_good && !is_good(self, contact)) {
+    contact.properties.is_good = false;
+    self.bad_nodes++;
+  }
+  return !contact.properties.is_good;
+}
+
 static bool
-timeout_unlink_reset_node(DHTMetaRoutingTable &self, Node &contact) {
+timeout_unlink_reset_node(DHTMetaRoutingTable &self, Bucket &bucket,
+                          Node &contact) {
   if (is_valid(contact)) {
     if (self.tb.timeout) {
       timeout::unlink(*self.tb.timeout, &contact);
     }
 
-    if (contact.properties.is_good) {
+    if (!mark_bad(self, contact)) {
       for_each(self.retire_good, [&contact](auto t) { //
         auto retire_good = std::get<0>(t);
         retire_good(std::get<1>(t), contact);
       });
     }
 
+    bucket_unlink(bucket, contact);
     reset(self, contact);
 
     return true;
@@ -416,9 +724,8 @@ debug_timeout_unlink_reset(DHTMetaRoutingTable &self, Node &contact) {
       Node &tmp = it->bucket.contacts[i];
 
       if (tmp.id == contact.id) {
-        timeout_unlink_reset_node(self, contact);
-        assertx(!is_valid(contact));
-        --it->bucket.length;
+        timeout_unlink_reset_node(self, it->bucket, tmp);
+        assertx(!is_valid(tmp));
         return true;
       }
     }
@@ -504,12 +811,18 @@ static RoutingTable *
 alloc_RoutingTable(DHTMetaRoutingTable &self,
                    const std::size_t depth) noexcept {
   if (self.length < self.capacity) {
-    self.length++;
-    auto result = new RoutingTable((ssize_t)depth);
-    return result;
+    auto result = alloc(routing_table_slab(), (ssize_t)depth);
+    if (result) {
+      self.length++;
+      return result;
+    }
+    /* The global slab cap is reached, reuse our own root instead. */
+  }
+
+  if (!self.root) {
+    return nullptr;
   }
 
-  assertx(self.root);
   if (depth > std::size_t(self.root->depth)) {
     RoutingTable *needle = __dequeue_root(self);
     if (!needle) {
@@ -521,14 +834,18 @@ alloc_RoutingTable(DHTMetaRoutingTable &self,
       auto &contact = bucket.contacts[i];
       auto tot = nodes_total(self);
 
-      if (timeout_unlink_reset_node(self, contact)) {
-        bucket.length--;
+      if (timeout_unlink_reset_node(self, bucket, contact)) {
         assertxs(nodes_total(self) == tot - 1, nodes_total(self), tot - 1);
       }
     }
 
     needle->in_tree = nullptr;
     needle->parallel = nullptr;
+    if (!find_RoutingTable(self, std::size_t(needle->depth))) {
+      /* the level is gone together with its replacement cache */
+      delete self.replacements[needle->depth];
+      self.replacements[needle->depth] = nullptr;
+    }
 
     // XXX migrate of possible good contacts in $head to empty/bad linked
     //     RoutingTable contacts. timeout contact
@@ -545,19 +862,23 @@ alloc_RoutingTable(DHTMetaRoutingTable &self,
 static Node *
 bucket_insert(DHTMetaRoutingTable &self, Bucket &bucket, const Node &c,
               /*OUT*/ bool &replaced) noexcept {
-  // TODO binary insert
+  Node *const slot = bucket_free_slot(bucket);
+  if (slot) {
+    *slot = c;
+    slot->shared = acquire(node_store(), c.contact, Timestamp(c.req_sent));
+    bucket_link(bucket, *slot);
+
+    return slot;
+  }
 
   for (std::size_t i = 0; i < Bucket::K; ++i) {
     Node &contact = bucket.contacts[i];
-    if (!is_valid(contact)) { // TODO is_valid is very expensive
-      contact = c;
-      bucket.length++;
-
-      return &contact;
-    } else if (!is_good(self, contact) || contact.properties.is_readonly) {
-      timeout_unlink_reset_node(self, contact);
+    if (mark_bad(self, contact) || contact.properties.is_readonly) {
+      timeout_unlink_reset_node(self, bucket, contact);
 
       contact = c;
+      contact.shared = acquire(node_store(), c.contact, Timestamp(c.req_sent));
+      bucket_link(bucket, contact);
       replaced = true;
 
       return &contact;
@@ -585,40 +906,48 @@ routing_table_level_insert_Node(DHTMetaRoutingTable &self, RoutingTable &table,
   return nullptr;
 }
 
+/* The parallel Bucket:s of a level are sorted on their own, a lookup is a
+ * binary search of each, O(P log K) for P tables in the level.
+ */
 static Node *
-routing_table_level_find_node(DHTMetaRoutingTable &self, RoutingTable &table,
-                              const Key &id, bool &is_full) noexcept {
-  is_full = true;
-
+routing_table_level_find_node(RoutingTable &table, const Key &id) noexcept {
   for (RoutingTable *it = &table; it; it = it->parallel) {
-    Bucket &bucket = it->bucket;
+    Node *const result = bucket_find(it->bucket, id);
+    if (result) {
+      return result;
+    }
+  } // for
 
-    // TODO binary search
-    for (std::size_t i = 0; i < Bucket::K; ++i) {
-      Node &contact = bucket.contacts[i];
+  return nullptr;
+}
 
-      if (is_valid(contact)) {
-        if (!is_good(self, contact)) {
-          is_full = false;
-        }
-        if (contact.id == id) {
-          return &contact;
-        }
-      } else {
-        is_full = false;
+/* A level is full when there is neither a free slot nor a node which is not
+ * good and can be replaced.
+ */
+static bool
+routing_table_level_is_full(const DHTMetaRoutingTable &self,
+                            const RoutingTable &table) noexcept {
+  for (const RoutingTable *it = &table; it; it = it->parallel) {
+    const Bucket &bucket = it->bucket;
+    if (bucket.used != bucket_all_used) {
+      return false;
+    }
+
+    for (std::size_t i = 0; i < Bucket::K; ++i) {
+      if (!is_good(self, bucket.contacts[i])) {
+        return false;
       }
     } // for
   } // for
 
-  return nullptr;
+  return true;
 }
 
 #if 0
 static bool
 node_move(DHTMetaRoutingTable &self, Node &subject, Bucket &dest) noexcept {
   assertx(is_valid(subject));
-  assertx(subject.timeout_next);
-  assertx(subject.timeout_priv);
+  assertx(timeout::is_scheduled(subject.timer));
 
   Node dummy;
   const bool eager = false;
@@ -627,12 +956,10 @@ node_move(DHTMetaRoutingTable &self, Node &subject, Bucket &dest) noexcept {
   auto *nc = bucket_insert(self, dest, dummy, eager, /*OUT*/ replaced);
   assertx(!replaced);
   if (nc) {
-    assertx(!nc->timeout_next);
-    assertx(!nc->timeout_priv);
+    assertx(!timeout::is_scheduled(nc->timer));
+    timeout::unlink(*self.tb.timeout, &subject);
     *nc = subject;
-    nc->timeout_next = nc->timeout_priv = nullptr;
-
-    timeout::move(*self.tb.timeout, &subject, nc);
+    timeout::schedule(*self.tb.timeout, nc, self.config.refresh_interval);
     assertx(is_valid(*nc));
 
     // reset
@@ -870,13 +1197,17 @@ Lstart:
 bool
 is_good(const DHTMetaRoutingTable &dht, const Node &contact) noexcept {
   const Config &config = dht.config;
+  const NodeLiveness *const l = liveness(contact);
+  if (l && l->timeouts >= config.node_max_timeouts) {
+    return false;
+  }
   // XXX configurable non arbitrary limit?
-  if (contact.outstanding > 2) {
+  if (l && l->outstanding > 2) {
 
     /* Using dht.last_activty to better handle a general outage of network
      * connectivity
      */
-    auto resp_timeout = contact.remote_activity + config.refresh_interval;
+    auto resp_timeout = Timestamp(l->remote_activity) + config.refresh_interval;
     // if (resp_timeout > dht.last_activity) {
     if (resp_timeout > dht.now) {
       return false;
@@ -911,8 +1242,7 @@ find_node(DHTMetaRoutingTable &self, const NodeId &search) noexcept {
   const auto r = rank(self.id, search);
   RoutingTable *leaf = find_RoutingTable(self, r);
   if (leaf) {
-    bool is_full = true;
-    return routing_table_level_find_node(self, *leaf, search.id, is_full);
+    return routing_table_level_find_node(*leaf, search.id);
   }
 
   return nullptr;
@@ -1046,6 +1376,89 @@ __make_routing_table(DHTMetaRoutingTable &self, std::size_t r) noexcept {
   return nullptr;
 }
 
+static void
+replacement_remove(ReplacementCache &cache, std::size_t idx) noexcept {
+  assertx(idx < cache.length);
+  cache.candidates[idx] = cache.candidates[--cache.length];
+}
+
+/* Whether $a is a better substitute than $b */
+static bool
+replacement_better(const DHTMetaRoutingTable &self, const BucketCandidate &a,
+                   const BucketCandidate &b) noexcept {
+  const sp::Milliseconds &fresh = self.config.refresh_interval;
+  const bool fresh_a = Timestamp(a.activity) + fresh > self.now;
+  const bool fresh_b = Timestamp(b.activity) + fresh > self.now;
+  if (fresh_a != fresh_b) {
+    return fresh_a;
+  }
+  if (a.srtt != b.srtt) {
+    return a.srtt < b.srtt;
+  }
+  return a.activity.ticks > b.activity.ticks;
+}
+
+static std::size_t
+replacement_best(const DHTMetaRoutingTable &self,
+                 const ReplacementCache &cache) noexcept {
+  assertx(cache.length > 0);
+  std::size_t result = 0;
+  for (std::size_t i = 1; i < cache.length; ++i) {
+    if (replacement_better(self, cache.candidates[i],
+                           cache.candidates[result])) {
+      result = i;
+    }
+  }
+  return result;
+}
+
+static void
+replacement_insert(DHTMetaRoutingTable &self, std::size_t depth,
+                   const Node &c) noexcept {
+  assertx(depth < NodeId::bits);
+  ReplacementCache *&cache = self.replacements[depth];
+  if (!cache) {
+    cache = new (std::nothrow) ReplacementCache;
+    if (!cache) {
+      return;
+    }
+  }
+
+  BucketCandidate candidate;
+  candidate.id = c.id;
+  candidate.contact = c.contact;
+  candidate.activity = activity(c);
+  const NodeLiveness *const l = find(node_store(), Contact(c.contact));
+  if (l && l->rtt.samples > 0) {
+    candidate.srtt = l->rtt.srtt;
+  }
+  candidate.support_sample_infohashes = c.properties.support_sample_infohashes;
+
+  for (std::size_t i = 0; i < cache->length; ++i) {
+    if (cache->candidates[i].id == c.id) {
+      replacement_remove(*cache, i);
+      break;
+    }
+  }
+
+  if (cache->length == ReplacementCache::R) {
+    std::size_t worst = 0;
+    for (std::size_t i = 1; i < cache->length; ++i) {
+      if (replacement_better(self, cache->candidates[worst],
+                             cache->candidates[i])) {
+        worst = i;
+      }
+    }
+    if (!replacement_better(self, candidate, cache->candidates[worst])) {
+      return;
+    }
+    replacement_remove(*cache, worst);
+  }
+
+  cache->candidates[cache->length++] = candidate;
+  ++self.replacements_cached;
+}
+
 Node *
 insert(DHTMetaRoutingTable &self, const Node &contact) noexcept {
   if (!is_valid(contact.id)) {
@@ -1059,14 +1472,12 @@ insert(DHTMetaRoutingTable &self, const Node &contact) noexcept {
   const auto r = rank(self.id, contact.id);
   auto rt = find_RoutingTable(self, r);
   if (rt) {
-    bool is_full = true;
-    Node *const existing = routing_table_level_find_node(
-        self, *rt, contact.id.id, /*OUT*/ is_full);
+    Node *const existing = routing_table_level_find_node(*rt, contact.id.id);
     if (existing) {
       // fprintf(stderr, "%s: EXISTING\n", __func__);
       return existing;
     }
-    if (is_full) {
+    if (routing_table_level_is_full(self, *rt)) {
       rt = nullptr;
     }
   }
@@ -1083,7 +1494,8 @@ insert(DHTMetaRoutingTable &self, const Node &contact) noexcept {
     if (res) {
       // assertxs(prefix_compare(self.id, res->id.id, rt->depth), rt->depth);
       if (self.tb.timeout) {
-        timeout::insert_new(*self.tb.timeout, res);
+        timeout::schedule(*self.tb.timeout, res,
+                          self.config.refresh_interval);
       }
 
       logger::routing::insert(self, *res);
@@ -1097,9 +1509,66 @@ insert(DHTMetaRoutingTable &self, const Node &contact) noexcept {
     }
   }
 
+  /* No room, remember $contact as a substitute for a bad node */
+  if (find_RoutingTable(self, r)) {
+    replacement_insert(self, r, contact);
+  }
+
   return nullptr;
 } // dht::insert()
 
+static Bucket *
+level_bucket_of(RoutingTable &table, const Node &contact) noexcept {
+  for (RoutingTable *it = &table; it; it = it->parallel) {
+    const Node *const first = it->bucket.contacts;
+    if (&contact >= first && &contact < first + Bucket::K) {
+      return &it->bucket;
+    }
+  }
+  return nullptr;
+}
+
+bool
+promote_replacement(DHTMetaRoutingTable &self, Node &contact) noexcept {
+  assertx(is_valid(contact.id));
+  assertx(!timeout::is_scheduled(contact.timer));
+
+  const auto r = rank(self.id, contact.id);
+  RoutingTable *const level = find_RoutingTable(self, r);
+  if (!level) {
+    return false;
+  }
+  Bucket *const bucket = level_bucket_of(*level, contact);
+  assertx(bucket);
+
+  ReplacementCache *const cache = self.replacements[r];
+  while (cache && cache->length > 0) {
+    const std::size_t best = replacement_best(self, *cache);
+    const BucketCandidate candidate = cache->candidates[best];
+    replacement_remove(*cache, best);
+
+    if (routing_table_level_find_node(*level, candidate.id.id)) {
+      continue;
+    }
+
+    bucket_unlink(*bucket, contact);
+    reset(self, contact);
+    contact = Node(candidate.id, candidate.contact, candidate.activity);
+    contact.properties.support_sample_infohashes =
+        candidate.support_sample_infohashes;
+    contact.shared =
+        acquire(node_store(), contact.contact, Timestamp(candidate.activity));
+    bucket_link(*bucket, contact);
+    ++self.total_nodes;
+    ++self.replacements_promoted;
+
+    logger::routing::insert(self, contact);
+    return true;
+  }
+
+  return false;
+}
+
 std::uint32_t
 max_routing_nodes(const DHTMetaRoutingTable &) noexcept {
   return std::uint32_t(Bucket::K) * std::uint32_t(sizeof(Key) * 8);
@@ -14,10 +14,39 @@
 
 namespace dht {
 //=====================================
+/* A recently seen node which did not fit into its full level */
+struct BucketCandidate {
+  NodeId id;
+  NodeContact contact;
+  NodeTime activity;
+  /* SRTT of the remote when it was cached, UINT32_MAX if not measured */
+  std::uint32_t srtt;
+  bool support_sample_infohashes;
+
+  BucketCandidate() noexcept;
+};
+
+/* Replacement cache of a level shared by all of its Bucket:s, used to
+ * substitute a bad node without waiting for a new lookup.
+ */
+struct ReplacementCache {
+  static constexpr std::size_t R = 8;
+  BucketCandidate candidates[R];
+  std::size_t length;
+
+  ReplacementCache() noexcept;
+};
+
 struct Bucket {
   static constexpr std::size_t K = 32;
   Node contacts[K];
   std::size_t length;
+  /* Bit i is set when $contacts[i] is in use */
+  std::uint32_t used;
+  /* Slots of the $length used contacts sorted by NodeId. Contacts never move
+   * between slots since the timeout wheel refers to them by index.
+   */
+  std::uint8_t order[K];
 
   Bucket() noexcept;
   ~Bucket() noexcept;
@@ -97,6 +126,78 @@ template <typename F>
 bool
 for_all(const RoutingTable *it, F f) noexcept;
 
+//=====================================
+/* Pool of RoutingTable:s shared by the main and all scrape routing tables.
+ * Tables are carved out of chunks of /per_chunk/ tables, released tables are
+ * kept on a free list and are handed out again before a new chunk is
+ * allocated. The number of live tables is bounded by /cap/.
+ */
+struct RoutingTableSlab {
+  static constexpr std::size_t per_chunk = 64;
+  static constexpr std::size_t max_chunks = 4096;
+
+  struct Free {
+    Free *next;
+  };
+
+  void *chunks[max_chunks];
+  /* index into $chunks ordered by chunk address */
+  std::uint16_t by_address[max_chunks];
+  std::size_t length_chunks;
+  /* number of never used tables in the last chunk */
+  std::size_t untouched;
+  Free *free;
+  std::size_t cap;
+
+  std::uint64_t in_use;
+  std::uint64_t peak;
+  std::uint64_t allocs;
+  std::uint64_t frees;
+  std::uint64_t reused;
+  std::uint64_t cap_reached;
+
+  RoutingTableSlab() noexcept;
+
+  RoutingTableSlab(const RoutingTableSlab &) = delete;
+  RoutingTableSlab(const RoutingTableSlab &&) = delete;
+
+  RoutingTableSlab &
+  operator=(const RoutingTableSlab &) = delete;
+  RoutingTableSlab &
+  operator=(const RoutingTableSlab &&) = delete;
+
+  ~RoutingTableSlab() noexcept;
+};
+
+/* The process global slab */
+RoutingTableSlab &
+routing_table_slab() noexcept;
+
+RoutingTable *
+alloc(RoutingTableSlab &, ssize_t depth) noexcept;
+
+void
+dealloc(RoutingTableSlab &, RoutingTable *) noexcept;
+
+std::size_t
+capacity(const RoutingTableSlab &) noexcept;
+
+/* A Node in a RoutingTable allocated from the slab is identified by a 32bit
+ * index which is the handle of its timer in the timeout wheel. The index 0
+ * is reserved for null.
+ */
+std::uint32_t
+node_index(const RoutingTableSlab &, const Node *) noexcept;
+
+Node *
+node_at(const RoutingTableSlab &, std::uint32_t) noexcept;
+
+/* Bytes saved per RoutingTable by the packed Node compared to the previous
+ * pointer and 64bit Timestamp based representation.
+ */
+std::size_t
+node_bytes_saved_per_table() noexcept;
+
 template <typename F>
 bool
 for_all_node(const RoutingTable *it, F f) noexcept;
@@ -117,6 +218,13 @@ struct DHTMetaRoutingTable {
   std::uint32_t total_nodes;
   std::uint32_t bad_nodes;
 
+  /* Replacement cache of the level at each depth, allocated when the level
+   * first overflows and freed with the level.
+   */
+  ReplacementCache *replacements[NodeId::bits];
+  std::uint64_t replacements_cached;
+  std::uint64_t replacements_promoted;
+
 public:
   sp::UinStaticArray<
       std::tuple<void (*)(void *ctx, const Node &) noexcept, void *>, 8>
@@ -163,6 +271,15 @@ __dequeue_root(DHTMetaRoutingTable &self) noexcept;
 bool
 is_good(const DHTMetaRoutingTable &dht, const Node &contact) noexcept;
 
+/* Substitute the bad $contact with the best candidate from the replacement
+ * cache of its level. A candidate seen within the refresh interval is
+ * preferred, then the one with the lowest SRTT and then the most recently
+ * seen. $contact must not be scheduled in the timeout wheel and the promoted
+ * node is left unscheduled for the caller to schedule.
+ */
+bool
+promote_replacement(DHTMetaRoutingTable &, Node &contact) noexcept;
+
 /**/
 void
 multiple_closest(DHTMetaRoutingTable &, const NodeId &, Node **result,
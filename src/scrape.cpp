@@ -2,6 +2,7 @@
 #include "bootstrap.h"
 #include "client.h"
 #include "dht.h"
+#include "node_store.h"
 #include "shared.h"
 #include "timeout_impl.h"
 #include "util.h"
@@ -27,13 +28,8 @@ rand_key(prng::xorshift32 &r, dht::NodeId &id) {
 }
 
 static bool
-has_sent_sample_infohash_last_24h(DHT &self, const Ip &ip) {
-  for (auto &bf : self.scrape_hour) {
-    if (test(bf, ip)) {
-      return true;
-    }
-  }
-  return false;
+has_sent_sample_infohash_recently(DHT &self, const Ip &ip) {
+  return is_blocked(self.scrape_revisit, ip, self.now);
 }
 static uint32_t
 last_10m_average(const sp::UinArray<DHTMetaScrape *> &scrapes) {
@@ -48,23 +44,19 @@ last_10m_average(const sp::UinArray<DHTMetaScrape *> &scrapes) {
 
 static dht::DHTMetaScrape *
 best_scrape_match(dht::DHT &self, const dht::Key &id) {
-  dht::DHTMetaScrape *best_match = nullptr;
-  std::size_t max_rank = 0;
-
-  for (auto scrape : self.active_scrapes) {
-    std::size_t r = rank(scrape->id, id);
-    if (r >= max_rank) {
-      auto root = scrape->routing_table.root;
-      bool is_rt_full =
-          scrape->routing_table.length < scrape->routing_table.capacity;
-      if (!root || ((size_t)root->depth <= r || !is_rt_full)) {
-        max_rank = r;
-        best_match = scrape;
-      }
-    }
+  auto accept = [&self](std::size_t slot, std::size_t r) {
+    auto scrape = self.active_scrapes[slot];
+    auto root = scrape->routing_table.root;
+    bool is_rt_full =
+        scrape->routing_table.length < scrape->routing_table.capacity;
+    return !root || ((size_t)root->depth <= r || !is_rt_full);
+  };
+
+  std::size_t slot = best_match(self.scrape_index, id, 0, accept);
+  if (slot == ScrapeIndex::capacity) {
+    return nullptr;
   }
-
-  return best_match;
+  return self.active_scrapes[slot];
 }
 
 static void
@@ -73,12 +65,11 @@ scrape_retire_good(void *ctx, const Node &n) noexcept {
   auto scrape = (DHTMetaScrape *)ctx;
   auto &dht = scrape->dht;
   if (n.properties.support_sample_infohashes) {
-    if (!has_sent_sample_infohash_last_24h(dht, n.contact.ip)) {
+    if (!has_sent_sample_infohash_recently(dht, n.contact.ip)) {
       if (scrape->upcoming_sample_infohashes > 0) {
         scrape->upcoming_sample_infohashes--;
       }
-      assertx(!n.timeout_next);
-      assertx(!n.timeout_priv);
+      assertx(!timeout::is_scheduled(n.timer));
       insert(dht.scrape_retire_good, n);
     }
   }
@@ -94,6 +85,8 @@ swap_in_new(DHT &self, std::size_t idx) {
   auto inx = new DHTMetaScrape(self, ih);
   emplace(inx->routing_table.retire_good, scrape_retire_good, inx);
   self.active_scrapes[idx] = inx;
+  remove(self.scrape_index, idx);
+  insert(self.scrape_index, idx, inx->id.id);
 
   if (old) {
     dht::DHTMetaScrape *best_match = best_scrape_match(self, old->id.id);
@@ -110,7 +103,7 @@ swap_in_new(DHT &self, std::size_t idx) {
 
     for_all_node(old->routing_table.root, [&](const dht::Node &n) {
       if (n.properties.support_sample_infohashes) {
-        if (!has_sent_sample_infohash_last_24h(self, n.contact.ip)) {
+        if (!has_sent_sample_infohash_recently(self, n.contact.ip)) {
           dht::DHTMetaScrape *best_match = best_scrape_match(self, old->id.id);
           if (best_match) {
             Node node(n.id, n.contact);
@@ -138,7 +131,7 @@ on_awake_scrape(DHT &self, sp::Buffer &buf) noexcept {
   {
     bool result = true;
     while (!is_empty(self.scrape_get_peers_ih) &&
-           tx::has_free_transaction(self) && result) {
+           tx::has_free_transaction(self, TxClass::SCRAPE) && result) {
       size_t last_idx = self.scrape_get_peers_ih.length - 1;
       auto &last = self.scrape_get_peers_ih[last_idx];
       auto needle = std::get<0>(last);
@@ -147,13 +140,10 @@ on_awake_scrape(DHT &self, sp::Buffer &buf) noexcept {
         continue;
       }
       auto dest = std::get<1>(last);
-      ScrapeContext *closure = new ScrapeContext(needle);
-      result = client::get_peers(self, buf, dest, needle, closure) ==
-               client::Res::OK;
+      result = client::get_peers(self, buf, dest, needle, tx::TxClosure(needle),
+                                 TxClass::SCRAPE) == client::Res::OK;
       if (result) {
         remove(self.scrape_get_peers_ih, last_idx);
-      } else {
-        delete closure;
       }
       // node.req_sent = dht.now;
     }
@@ -183,21 +173,16 @@ on_awake_scrape(DHT &self, sp::Buffer &buf) noexcept {
       emplace(inx->routing_table.retire_good, scrape_retire_good, inx);
       auto *rt = emplace(self.active_scrapes, inx);
       assertx(rt);
+      insert(self.scrape_index, i, inx->id.id);
     }
   }
 
-  if ((self.scrape_hour_time + sp::Hours(1 * capacity(self.scrape_hour))) <=
-      self.now) {
-    for (auto &f : self.scrape_hour) {
-      clear(f);
-    }
-    self.scrape_hour_time = self.now;
-  } else {
-    while ((self.scrape_hour_time + sp::Hours(1)) <= self.now) {
-      self.scrape_hour_idx =
-          (self.scrape_hour_idx + 1) % capacity(self.scrape_hour);
-      clear(self.scrape_hour[self.scrape_hour_idx]);
-      self.scrape_hour_time = self.scrape_hour_time + sp::Hours(1);
+  if (self.scrape_revisit_sweep <= self.now) {
+    /* a pass is spread over as many awakes as it takes, the next pass starts
+     * an hour after this one completed */
+    Budget budget(self.config.awake_budget);
+    if (sweep(self.scrape_revisit, self.now, budget)) {
+      self.scrape_revisit_sweep = self.now + sp::Hours(1);
     }
   }
 
@@ -234,7 +219,9 @@ on_awake_scrape(DHT &self, sp::Buffer &buf) noexcept {
     }
   }
 
-  if (!is_full(self.scrape_get_peers_ih) && tx::has_free_transaction(self)) {
+  bool deferred = false;
+  if (!is_full(self.scrape_get_peers_ih) &&
+      tx::has_free_transaction(self, TxClass::SCRAPE)) {
     Config &cfg = self.config;
     size_t scrape_idx = random(self.random) % length(self.active_scrapes);
     DHTMetaScrape *scrape = self.active_scrapes[scrape_idx];
@@ -247,13 +234,14 @@ on_awake_scrape(DHT &self, sp::Buffer &buf) noexcept {
         const Contact &c = remote.contact;
 
         if (remote.properties.support_sample_infohashes &&
-            !has_sent_sample_infohash_last_24h(self, c.ip)
+            !has_sent_sample_infohash_recently(self, c.ip)
             // && shared_prefix(needle, remote.id) >= 10
         ) {
           if (is_full(self.scrape_get_peers_ih)) {
             return false;
           }
-          result = client::sample_infohashes(self, buf, c, needle.id, nullptr);
+          result = client::sample_infohashes(self, buf, c, needle.id,
+                                             tx::TxClosure(), TxClass::SCRAPE);
           if (result == client::Res::OK) {
             scrape->stat.sent_sample_infohash++;
             self.scrape_active_sample_infhohash++;
@@ -261,32 +249,48 @@ on_awake_scrape(DHT &self, sp::Buffer &buf) noexcept {
               --scrape->upcoming_sample_infohashes;
             }
           }
+        } else if (is_recently_contacted(remote, self.now,
+                                         cfg.refresh_interval)) {
+          /* Already contacted through another routing table */
+          remote.req_sent = liveness(remote)->req_sent;
+          ++node_store().ping_skipped;
+          return true;
         } else {
           if (length(scrape->bootstrap) + 20 < capacity(scrape->bootstrap)) {
-            result = client::find_node(self, buf, c, needle, nullptr);
+            result = client::find_node(self, buf, c, needle, tx::TxClosure(),
+                                       TxClass::SCRAPE);
           }
         }
 
         if (result == client::Res::OK) {
           remote.req_sent = self.now;
+          if (NodeLiveness *const l = liveness(remote)) {
+            l->req_sent = self.now;
+          }
         }
 
         return result == client::Res::OK;
       };
-      timeout::for_all_node(scrape->routing_table, cfg.refresh_interval, f);
+      Budget budget(cfg.awake_budget);
+      timeout::for_all_node(scrape->routing_table, cfg.refresh_interval, budget,
+                            f);
+      if (is_exhausted(budget)) {
+        ++self.statistics.deferred_scrape;
+        deferred = true;
+      }
     }
   }
 
-  if (tx::has_free_transaction(self)) {
+  if (tx::has_free_transaction(self, TxClass::SCRAPE)) {
     dht::KContact cur;
     size_t scrape_idx = random(self.random) % length(self.active_scrapes);
     DHTMetaScrape *scrape = self.active_scrapes[scrape_idx];
     assertx(scrape);
     if (scrape) {
-      while (tx::has_free_transaction(self) &&
+      while (tx::has_free_transaction(self, TxClass::SCRAPE) &&
              take_head(scrape->bootstrap, cur)) {
-        auto result =
-            client::find_node(self, buf, cur.contact, scrape->id, nullptr);
+        auto result = client::find_node(self, buf, cur.contact, scrape->id,
+                                        tx::TxClosure(), TxClass::SCRAPE);
         if (result != client::Res::OK) {
           // inc_active_searches();
           break;
@@ -304,7 +308,6 @@ on_awake_scrape(DHT &self, sp::Buffer &buf) noexcept {
 
   // TODO timeout is needed for scrape as well
   // - use the same system as for original routing_table
-  // - use reference counted Node which are shared between all routing tables
   // 1. foreach.timeout find_node(nodeId)
   //    TODO which nodeId
   // 2. if there are X amount of nodes in that routing table
@@ -314,6 +317,9 @@ on_awake_scrape(DHT &self, sp::Buffer &buf) noexcept {
   // 1. send sample_infohashes
   // 2. for each infohash that we have not seen before get_peers
 
+  if (deferred) {
+    return self.now + sp::Milliseconds(1);
+  }
   return self.now + sp::Seconds(60);
 }
 } // namespace dht
@@ -334,7 +340,7 @@ scrape::seed_insert(dht::DHT &self, const dht::Node &in_node) {
     dht::Node node(in_node.id, in_node.contact);
     node.properties.support_sample_infohashes =
         in_node.properties.support_sample_infohashes;
-    // Note: node is prepended in the timeout list
+    // Note: node is scheduled in the timeout wheel
     dht::insert(best_match->routing_table, node);
 
     if (node.properties.support_sample_infohashes) {
@@ -416,14 +422,19 @@ scrape::on_get_peers_peer(dht::DHT &self, const dht::Infohash &ih,
 
 bool
 scrape::on_sample_infohashes(
-    dht::DHT &self, const Contact &con, uint32_t hours,
+    dht::DHT &self, const Contact &con, uint32_t interval,
     const sp::UinStaticArray<dht::Infohash, 128> &samples) {
-#if 0
-#else
-  size_t h = (self.scrape_hour_idx + capacity(self.scrape_hour) + hours + 1) %
-             capacity(self.scrape_hour);
-#endif
-  insert(self.scrape_hour[h], con.ip);
+  const Config &cfg = self.config;
+  const sp::Milliseconds min(cfg.scrape_revisit_min);
+  const sp::Milliseconds max(cfg.scrape_revisit_max);
+  /* the interval is in seconds */
+  sp::Milliseconds revisit(sp::Seconds(interval));
+  if (revisit.value < min.value) {
+    revisit = min;
+  } else if (revisit.value > max.value) {
+    revisit = max;
+  }
+  block(self.scrape_revisit, con.ip, self.now, revisit);
 
   for (const dht::Infohash &ih : samples) {
     if (!spbt_has_infohash(self.db.scrape_client, ih)) {
@@ -453,9 +464,8 @@ scrape::main_on_retire_good(void *ctx, const dht::Node &n) noexcept {
   auto dht = (dht::DHT *)ctx;
   assertx(ctx);
   if (n.properties.support_sample_infohashes) {
-    if (!has_sent_sample_infohash_last_24h(*dht, n.contact.ip)) {
-      assertx(!n.timeout_next);
-      assertx(!n.timeout_priv);
+    if (!has_sent_sample_infohash_recently(*dht, n.contact.ip)) {
+      assertx(!timeout::is_scheduled(n.timer));
       insert(dht->scrape_retire_good, n);
     }
   }
@@ -21,8 +21,11 @@ bool
 on_get_peers_peer(dht::DHT &self, const dht::Infohash &ih,
                   const Contact &remote, const sp::UinArray<Contact> &contacts);
 
+/* $con is not sent sample_infohashes again until $interval seconds have
+ * passed, clamped to Config::scrape_revisit_min and scrape_revisit_max.
+ */
 bool
-on_sample_infohashes(dht::DHT &self, const Contact &con, uint32_t hours,
+on_sample_infohashes(dht::DHT &self, const Contact &con, uint32_t interval,
                      const sp::UinStaticArray<dht::Infohash, 128> &samples);
 
 void
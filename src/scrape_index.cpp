@@ -0,0 +1,106 @@
+#include "scrape_index.h"
+
+#include <cstring>
+#include <util/assert.h>
+
+namespace dht {
+//=====================================
+/*dht::ScrapeIndex*/
+ScrapeIndex::ScrapeIndex() noexcept
+    : nodes{}
+    , unused{}
+    , unused_length(0)
+    , ids{}
+    , used{}
+    , root(none)
+    , length(0) {
+  for (std::size_t i = capacity - 1; i-- > 0;) {
+    unused[unused_length++] = std::uint16_t(i);
+  }
+}
+
+//=====================================
+bool
+insert(ScrapeIndex &self, std::size_t slot, const Key &id) noexcept {
+  assertx(slot < ScrapeIndex::capacity);
+  assertx(!self.used[slot]);
+
+  const auto ref = std::uint16_t(ScrapeIndex::leaf | slot);
+  if (self.length == 0) {
+    std::memcpy(self.ids[slot], id, sizeof(Key));
+    self.used[slot] = true;
+    self.root = ref;
+    ++self.length;
+    return true;
+  }
+
+  /* the first bit where $id differs from the closest indexed id */
+  std::uint16_t cur = self.root;
+  while (!(cur & ScrapeIndex::leaf)) {
+    const ScrapeIndex::Node &node = self.nodes[cur];
+    cur = node.child[bit(id, node.bit)];
+  }
+  const std::size_t common = rank(id, self.ids[cur & ~ScrapeIndex::leaf]);
+  if (common == NodeId::bits) {
+    return false;
+  }
+
+  /* the new node goes above the first node which splits on a later bit */
+  std::uint16_t *link = &self.root;
+  while (!(*link & ScrapeIndex::leaf)) {
+    ScrapeIndex::Node &node = self.nodes[*link];
+    if (node.bit > common) {
+      break;
+    }
+    link = &node.child[bit(id, node.bit)];
+  }
+
+  assertx(self.unused_length > 0);
+  const std::uint16_t inner = self.unused[--self.unused_length];
+  ScrapeIndex::Node &node = self.nodes[inner];
+  const bool side = bit(id, common);
+  node.bit = std::uint16_t(common);
+  node.child[side] = ref;
+  node.child[!side] = *link;
+  *link = inner;
+
+  std::memcpy(self.ids[slot], id, sizeof(Key));
+  self.used[slot] = true;
+  ++self.length;
+  return true;
+}
+
+void
+remove(ScrapeIndex &self, std::size_t slot) noexcept {
+  assertx(slot < ScrapeIndex::capacity);
+  if (!self.used[slot]) {
+    return;
+  }
+
+  const auto ref = std::uint16_t(ScrapeIndex::leaf | slot);
+  const Key &id = self.ids[slot];
+  /* replace the parent of the leaf with the sibling of the leaf */
+  std::uint16_t *parent = nullptr;
+  std::uint16_t *link = &self.root;
+  while (*link != ref) {
+    assertx(!(*link & ScrapeIndex::leaf));
+    parent = link;
+    ScrapeIndex::Node &node = self.nodes[*link];
+    link = &node.child[bit(id, node.bit)];
+  }
+
+  if (parent) {
+    const std::uint16_t inner = *parent;
+    const ScrapeIndex::Node &node = self.nodes[inner];
+    *parent = node.child[node.child[0] == ref ? 1 : 0];
+    self.unused[self.unused_length++] = inner;
+  } else {
+    self.root = ScrapeIndex::none;
+  }
+
+  self.used[slot] = false;
+  --self.length;
+}
+
+//=====================================
+} // namespace dht
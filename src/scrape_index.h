@@ -0,0 +1,137 @@
+#ifndef SP_MAINLINE_DHT_SCRAPE_INDEX_H
+#define SP_MAINLINE_DHT_SCRAPE_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util.h"
+
+namespace dht {
+//=====================================
+/* Crit-bit trie of the ids of the active scrapes, keyed by the slot of the
+ * scrape in DHT::active_scrapes. An inner node holds the first bit where the
+ * ids of its two subtrees differ, so a lookup follows at most one node per
+ * bit of the id instead of computing rank() against every scrape.
+ */
+struct ScrapeIndex {
+  static constexpr std::size_t capacity = 256;
+  /* a child with this bit set is the leaf of the slot in the low bits */
+  static constexpr std::uint16_t leaf = 0x8000;
+  static constexpr std::uint16_t none = 0xffff;
+
+  struct Node {
+    std::uint16_t bit;
+    std::uint16_t child[2];
+  };
+
+  Node nodes[capacity - 1];
+  /* the unused nodes */
+  std::uint16_t unused[capacity - 1];
+  std::size_t unused_length;
+  Key ids[capacity];
+  bool used[capacity];
+  std::uint16_t root;
+  std::size_t length;
+
+  ScrapeIndex() noexcept;
+
+  ScrapeIndex(const ScrapeIndex &) = delete;
+  ScrapeIndex(const ScrapeIndex &&) = delete;
+
+  ScrapeIndex &
+  operator=(const ScrapeIndex &) = delete;
+  ScrapeIndex &
+  operator=(const ScrapeIndex &&) = delete;
+};
+
+//=====================================
+/* Index $id as the id of $slot, false if another slot has the same id */
+bool
+insert(ScrapeIndex &, std::size_t slot, const Key &id) noexcept;
+
+void
+remove(ScrapeIndex &, std::size_t slot) noexcept;
+
+//=====================================
+namespace impl {
+/* The highest slot in the subtree of $ref which $f accepts at $rank,
+ * ScrapeIndex::none if none.
+ */
+template <typename F>
+std::uint16_t
+best_in(const ScrapeIndex &self, std::uint16_t ref, std::size_t rank,
+        F &f) noexcept {
+  if (ref & ScrapeIndex::leaf) {
+    const std::uint16_t slot = ref & ~ScrapeIndex::leaf;
+    return f(std::size_t(slot), rank) ? slot : ScrapeIndex::none;
+  }
+
+  const ScrapeIndex::Node &node = self.nodes[ref];
+  const std::uint16_t a = best_in(self, node.child[0], rank, f);
+  const std::uint16_t b = best_in(self, node.child[1], rank, f);
+  if (a == ScrapeIndex::none) {
+    return b;
+  }
+  if (b == ScrapeIndex::none) {
+    return a;
+  }
+  return a > b ? a : b;
+}
+} // namespace impl
+
+/* The slot with the highest rank() against $id which $f(slot, rank) accepts,
+ * the highest slot on a tie. Slots with a rank below $min_rank are not
+ * considered. ScrapeIndex::capacity if $f accepts none.
+ *
+ * The slots are examined in groups of the same rank, starting with the group
+ * sharing the longest prefix with $id, so the lookup stops at the first group
+ * with an accepted slot.
+ */
+template <typename F>
+std::size_t
+best_match(const ScrapeIndex &self, const Key &id, std::size_t min_rank,
+           F f) noexcept {
+  if (self.length == 0) {
+    return ScrapeIndex::capacity;
+  }
+
+  /* the inner nodes passed on the way to the leaf $id ends up at */
+  std::uint16_t path[NodeId::bits];
+  std::size_t depth = 0;
+  std::uint16_t cur = self.root;
+  while (!(cur & ScrapeIndex::leaf)) {
+    const ScrapeIndex::Node &node = self.nodes[cur];
+    path[depth++] = cur;
+    cur = node.child[bit(id, node.bit)];
+  }
+
+  /* no slot shares a longer prefix with $id than this leaf, the ids sharing
+   * exactly $common bits are the subtree below the first node past it */
+  const std::size_t common = rank(id, self.ids[cur & ~ScrapeIndex::leaf]);
+  std::size_t i = 0;
+  while (i < depth && self.nodes[path[i]].bit < common) {
+    ++i;
+  }
+  if (common < min_rank) {
+    return ScrapeIndex::capacity;
+  }
+  std::uint16_t best =
+      impl::best_in(self, i < depth ? path[i] : cur, common, f);
+
+  /* the other side of a node on the path shares exactly its bit */
+  while (best == ScrapeIndex::none && i-- > 0) {
+    const ScrapeIndex::Node &node = self.nodes[path[i]];
+    if (node.bit < min_rank) {
+      break;
+    }
+    const std::uint16_t other = node.child[!bit(id, node.bit)];
+    best = impl::best_in(self, other, node.bit, f);
+  }
+
+  return best == ScrapeIndex::none ? ScrapeIndex::capacity : best;
+}
+
+//=====================================
+} // namespace dht
+
+#endif
@@ -45,6 +45,29 @@ ParseContext::ParseContext(ParseContext &ictx, sp::Buffer &d) noexcept
 
 //=====================================
 namespace tx {
+/*tx::TxClosure*/
+TxClosure::TxClosure() noexcept
+    : type(TxClosureType::NONE)
+    , search(nullptr) {
+}
+
+TxClosure::TxClosure(dht::SearchContext *ctx) noexcept
+    : type(TxClosureType::SEARCH)
+    , search(ctx) {
+  assertx(ctx);
+}
+
+TxClosure::TxClosure(const dht::Infohash &ih) noexcept
+    : type(TxClosureType::SCRAPE)
+    , scrape(ih) {
+}
+
+TxClosure::TxClosure(const dht::KContact &contact) noexcept
+    : type(TxClosureType::BOOTSTRAP)
+    , bootstrap(contact) {
+}
+
+/*tx::TxContext*/
 void
 TxContext::timeout(dht::DHT &dht, Tx *tx) noexcept {
   assertx(tx);
@@ -60,7 +83,8 @@ TxContext::handle(dht::MessageContext &ctx) noexcept {
   return int_handle(ctx, closure);
 }
 
-TxContext::TxContext(TxHandle h, TxCancelHandle ch, void *c) noexcept
+TxContext::TxContext(TxHandle h, TxCancelHandle ch,
+                     const TxClosure &c) noexcept
     : int_handle(h)
     , int_timeout(ch)
     , closure(c)
@@ -72,7 +96,7 @@ TxContext::TxContext(TxHandle h, TxCancelHandle ch, void *c) noexcept
 TxContext::TxContext() noexcept
     : int_handle(nullptr)
     , int_timeout(nullptr)
-    , closure(nullptr)
+    , closure()
     , latency(0) {
 }
 
@@ -80,17 +104,20 @@ void
 reset(TxContext &ctx) noexcept {
   ctx.int_handle = nullptr;
   ctx.int_timeout = nullptr;
-  ctx.closure = nullptr;
+  ctx.closure = TxClosure();
 }
 
 /*dht::Tx*/
 Tx::Tx() noexcept
-    : context{}
-    , timeout_next(nullptr)
-    , timeout_priv(nullptr)
+    : timer()
+    , context{}
+    , next_free(nullptr)
     , sent(0)
+    , expire(0)
+    , remote()
     , prefix{0}
-    , suffix{0} {
+    , suffix{0}
+    , cls(dht::TxClass::SEARCH) {
 }
 
 bool
@@ -160,7 +187,12 @@ Stat::Stat() noexcept
     , received()
     , known_tx()
     , unknown_tx()
-    , scrape_swapped_ih() {
+    , scrape_swapped_ih()
+    , deferred_tx_timeout()
+    , deferred_ping()
+    , deferred_find_node()
+    , deferred_scrape()
+    , deferred_peer_expiry() {
 }
 
 DHTMetaScrape::DHTMetaScrape(dht::DHT &self, const dht::NodeId &_ih) noexcept
@@ -208,6 +240,7 @@ DHT::DHT(const Contact &self, Client &_client, prng::xorshift32 &r,
     , last_activity(0)
     /*total nodes present in the routing table*/
     , now(n)
+    , clock()
     // bootstrap {{{
     , ip_hashers()
     , bootstrap_meta{config, ip_hashers, now}
@@ -216,9 +249,10 @@ DHT::DHT(const Contact &self, Client &_client, prng::xorshift32 &r,
     , searches()
     // {{{
     , active_scrapes()
-    , scrape_hour{}
-    , scrape_hour_idx(0)
-    , scrape_hour_time(n)
+    , scrape_index()
+    , scrape_revisit(SCRAPE_REVISIT_BUCKETS,
+                     (std::uint64_t(random(r)) << 32) | random(r))
+    , scrape_revisit_sweep(n)
     , scrape_bootstrap_filter(config, ip_hashers, now)
     , scrape_active_sample_infhohash(0)
     , scrape_retire_good()
@@ -228,11 +262,9 @@ DHT::DHT(const Contact &self, Client &_client, prng::xorshift32 &r,
     , upnp{_upnp}
     , upnp_external_port{0} {
 
-  for (size_t i = 0; i < capacity(scrape_hour); ++i) {
-    assertx_n(emplace(scrape_hour, ip_hashers));
+  if (now == Timestamp(0)) {
+    tick(*this);
   }
-  fprintf(stdout, "dht scrape_hour theoretical_max_capacity: %zu * %zu\n", sp::theoretical_max_capacity(this->scrape_hour[0]), capacity(this->scrape_hour));
-  assertx(is_full(scrape_hour));
 
   assertx_n(insert(ip_hashers, djb_ip));
   assertx_n(insert(ip_hashers, fnv_ip));
@@ -242,10 +274,16 @@ DHT::DHT(const Contact &self, Client &_client, prng::xorshift32 &r,
     this->db.key[i].created = now;
   }
 
+  if (NodeTime::start(now)) {
+    /* the slab is shared by every DHT of the process, the first one sizes it */
+    routing_table_slab().cap = config.routing_table_cap;
+  }
+
   emplace(routing_table.retire_good, scrape::main_on_retire_good, (void *)this);
 }
 
 DHT::~DHT() {
+  NodeTime::stop();
   // TODO reclaim
 }
 
@@ -13,7 +13,6 @@
 #include <hash/util.h>
 #include <list/FixedList.h>
 #include <list/LinkedList.h>
-#include <tree/StaticTree.h>
 
 #include <core.h>
 #include <heap/binary.h>
@@ -23,11 +22,15 @@
 #include <tree/avl.h>
 #include <util/maybe.h>
 
+#include "clock.h"
 #include "db.h"
 #include "ip_election.h"
+#include "revisit_table.h"
 #include "routing_table.h"
+#include "scrape_index.h"
 #include "search.h"
 #include "timeout.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 #include "upnp_miniupnp.h"
@@ -74,18 +77,46 @@ struct ParseContext {
 namespace tx {
 struct Tx;
 
+// tx::TxClosure
+enum class TxClosureType : std::uint8_t {
+  NONE = 0,
+  /* get_peers of a sp_search */
+  SEARCH = 1,
+  /* get_peers of a scrape */
+  SCRAPE = 2,
+  /* find_node to a bootstrap contact */
+  BOOTSTRAP = 3,
+};
+
+/* The request specific state of an outgoing transaction, stored inline in
+ * the Tx slot instead of a heap allocated closure.
+ */
+struct TxClosure {
+  TxClosureType type;
+  union {
+    dht::SearchContext *search;
+    dht::Infohash scrape;
+    dht::KContact bootstrap;
+  };
+
+  TxClosure() noexcept;
+  explicit TxClosure(dht::SearchContext *) noexcept;
+  explicit TxClosure(const dht::Infohash &) noexcept;
+  explicit TxClosure(const dht::KContact &) noexcept;
+};
+
 using TxCancelHandle = void (*)(dht::DHT &, const krpc::Transaction &,
-                                const Timestamp &, void *);
-using TxHandle = bool (*)(dht::MessageContext &, void *);
+                                const Timestamp &, const TxClosure &);
+using TxHandle = bool (*)(dht::MessageContext &, const TxClosure &);
 // dht::TxContext
 struct TxContext {
   TxHandle int_handle;
   TxCancelHandle int_timeout;
-  void *closure;
+  TxClosure closure;
 
   sp::Timestamp latency;
 
-  TxContext(TxHandle, TxCancelHandle, void *) noexcept;
+  TxContext(TxHandle, TxCancelHandle, const TxClosure &) noexcept;
   TxContext() noexcept;
 
   // TxContext(const TxContext &) noexcept;
@@ -107,16 +138,21 @@ void
 reset(TxContext &) noexcept;
 
 struct Tx {
+  /* Scheduled in Client::wheel while sent */
+  timeout::Timer timer;
   TxContext context;
 
-  // XXX index in Client.buffer array (in order to save memory)
-  Tx *timeout_next;
-  Tx *timeout_priv;
+  /* Next in Client.free when not sent */
+  Tx *next_free;
 
   Timestamp sent;
+  /* $sent + the RTO of $remote, 0 when not sent */
+  Timestamp expire;
+  dht::NodeContact remote;
 
   sp::byte prefix[2];
   sp::byte suffix[4];
+  dht::TxClass cls;
 
   Tx() noexcept;
 
@@ -149,20 +185,50 @@ operator>(const Tx &, const Tx &) noexcept;
 //=====================================
 namespace dht {
 // dht::Client
+struct TxClassStat {
+  std::size_t in_flight;
+  std::uint64_t minted;
+  std::uint64_t responses;
+  std::uint64_t timeouts;
+  /* mint denied because the class were out of transactions */
+  std::uint64_t denied;
+  Rtt latency;
+
+  TxClassStat() noexcept;
+};
+
 struct Client {
-  static constexpr std::size_t tree_capacity = 1024;
+  static constexpr std::size_t default_capacity = 1024;
+  static constexpr std::size_t max_capacity = 64 * 1024;
   fd &udp;
   fd &priv_fd;
-  tx::Tx *timeout_head;
-
-  tx::Tx buffer[tree_capacity];
-  binary::StaticTree<tx::Tx> tree;
+  /* Transactions which are not sent */
+  tx::Tx *free;
+  /* Sent transactions by expire */
+  timeout::Wheel wheel;
+
+  /* All transactions, nullptr if the allocation failed */
+  tx::Tx *buffer;
+  std::size_t capacity;
+  /* open addressing transaction id -> $buffer index + 1 of the sent
+   * transactions, $lookup_capacity is a power of 2 at least twice $capacity.
+   */
+  std::uint32_t *lookup;
+  std::size_t lookup_capacity;
 
   std::size_t active;
+  /* RTT of all responses, used for remotes without an RTT sample */
+  Rtt rtt;
+  TxClassStat classes[tx_classes];
+  /* responses whose transaction id matched a transaction sent to another
+   * remote
+   */
+  std::uint64_t source_mismatch;
 
   void (*deinit)(Client &);
 
-  Client(fd &udp_fd, fd &priv_fd) noexcept;
+  Client(fd &udp_fd, fd &priv_fd,
+         std::size_t capacity = default_capacity) noexcept;
   ~Client() noexcept;
 
   Client(const Client &) = delete;
@@ -223,6 +289,13 @@ struct Stat {
 
   std::uint64_t scrape_swapped_ih;
 
+  /* awake callbacks which ran out of dht::Budget and deferred the rest */
+  std::uint64_t deferred_tx_timeout;
+  std::uint64_t deferred_ping;
+  std::uint64_t deferred_find_node;
+  std::uint64_t deferred_scrape;
+  std::uint64_t deferred_peer_expiry;
+
   Stat() noexcept;
   virtual ~Stat() {
   }
@@ -322,7 +395,9 @@ struct DHT {
   // stuff {{{
   Timestamp last_activity;
 
+  /* Cached time of the current tick, see dht::tick() */
   Timestamp &now;
+  Clock clock;
   // }}}
 
   // bootstrap {{{
@@ -338,11 +413,16 @@ struct DHT {
   // struct {
   static constexpr size_t ACTIVE_SCRAPES = 256;
   sp::UinStaticArray<DHTMetaScrape *, ACTIVE_SCRAPES> active_scrapes;
-  sp::UinStaticArray<sp::BloomFilter<Ip, ACTIVE_SCRAPES * 256 * 1024>, 7>
-      scrape_hour; // x * 7 = 1.75GB
-  // TODO calculate bloomfitler fpp
-  std::size_t scrape_hour_idx;
-  Timestamp scrape_hour_time;
+  /* the ids of $active_scrapes by their index */
+  ScrapeIndex scrape_index;
+  static_assert(ScrapeIndex::capacity == ACTIVE_SCRAPES);
+  /* 16MB, 4M remote IPs */
+  static constexpr size_t SCRAPE_REVISIT_BUCKETS = 256 * 1024;
+  /* when a remote may be sent sample_infohashes again */
+  RevisitTable scrape_revisit;
+  /* when the next sweep of $scrape_revisit starts, while a sweep is in
+   * progress it is in the past */
+  Timestamp scrape_revisit_sweep;
   sp::UinStaticArray<std::tuple<dht::Infohash, Contact>, 256>
       scrape_get_peers_ih;
   DHTMetaBootstrap<SCRAPE_FILTER_sz> scrape_bootstrap_filter;
@@ -361,6 +441,9 @@ struct DHT {
   void (*topup_bootstrap)(DHT &) noexcept = nullptr;
   // }}}
 
+  /* $now is the storage of DHT::now, when it is 0 the DHT sets it from its
+   * own clock.
+   */
   DHT(const Contact &self, Client &client, prng::xorshift32 &, Timestamp &now,
       const dht::Options &options, sp_upnp *upnp = nullptr) noexcept;
 
@@ -2,12 +2,16 @@
 #define SP_MAINLINE_DHT_TIMEOUT_H
 
 #include "db.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 namespace timeout {
+/* The nodes of a routing table scheduled in $wheel by when they are due to be
+ * refreshed, the handle of a node is its index in the routing table slab.
+ */
 struct Timeout {
   Timestamp timeout_next;
-  dht::Node *timeout_node;
+  Wheel wheel;
   Timestamp &now;
 
   explicit Timeout(Timestamp &now) noexcept;
@@ -31,43 +35,20 @@ const dht::Node *
 debug_find_node(const Timeout &, const dht::Node *) noexcept;
 
 //=====================================
-void
-unlink(dht::Node *&head, dht::Node *) noexcept;
-
 void
 unlink(Timeout &, dht::Node *) noexcept;
 
-void
-unlink(dht::KeyValue &, dht::Peer *) noexcept;
-
 //=====================================
+/* Schedule $node to be refreshed when $timeout has passed since its last
+ * request, a node which is already due is taken after the nodes already due.
+ */
 void
-move(Timeout &self, dht::Node *from, dht::Node *to) noexcept;
-
-//=====================================
-void
-append_all(Timeout &, dht::Node *) noexcept;
-
-void
-append_all(dht::KeyValue &, dht::Peer *) noexcept;
-
-//=====================================
-void
-prepend(Timeout &, dht::Node *) noexcept;
-
-//=====================================
-void
-insert_new(Timeout &, dht::Node *) noexcept;
+schedule(Timeout &, dht::Node *, sp::Milliseconds timeout) noexcept;
 
 //=====================================
+/* Unlink and return a node which is due, nullptr if none */
 dht::Node *
-take_node(Timeout &, sp::Milliseconds timeout) noexcept;
-
-dht::Peer *
-take_peer(db::DHTMetaDatabase &dht, dht::KeyValue &,
-          sp::Milliseconds timeout) noexcept;
-
-// TODO XXX what is timeout????!?!?! (i want last sent timeout)
+take_node(Timeout &) noexcept;
 
 //=====================================
 } // namespace timeout
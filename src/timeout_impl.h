@@ -8,65 +8,56 @@ namespace timeout {
 template <typename F>
 static inline bool
 for_all_node(dht::DHTMetaRoutingTable &routing_table, sp::Milliseconds timeout,
-             F f, dht::DHT *self = nullptr) {
+             dht::Budget &budget, F f, dht::DHT *self = nullptr) {
   const dht::Node *start = nullptr;
   assertx(debug_assert_all(routing_table));
   assertx(routing_table.tb.timeout);
   bool result = true;
 Lstart: {
-  dht::Node *const node =
-      timeout::take_node(*routing_table.tb.timeout, timeout);
-  logger::routing::head_node(routing_table, timeout);
+  if (is_exhausted(budget)) {
+    /* the remaining timed out nodes are left in the wheel for the next tick */
+    return result;
+  }
+
+  timeout::Timeout &tout = *routing_table.tb.timeout;
+  dht::Node *const node = timeout::take_node(tout);
+  logger::routing::head_node(routing_table);
   if (node) {
     if (node == start) {
-      assertx(!timeout::debug_find_node(*routing_table.tb.timeout, node));
-      timeout::prepend(*routing_table.tb.timeout, node);
-      assertx(node->timeout_next);
-      assertx(node->timeout_priv);
-      assertx(timeout::debug_find_node(*routing_table.tb.timeout, node) ==
-              node);
+      /* every due node has been visited once */
+      timeout::schedule(tout, node, timeout);
+      assertx(timeout::debug_find_node(tout, node) == node);
       assertx(debug_assert_all(routing_table));
       return true;
     }
 
+    /* only a node which was due is counted against the budget */
+    spend(budget);
     if (!start) {
       start = node;
     }
-    assertx(!timeout::debug_find_node(*routing_table.tb.timeout, node));
-
-    // printf("node: %s\n", to_hex(node->id));
-
-    assertx(!node->timeout_next);
-    assertx(!node->timeout_priv);
+    assertx(!timeout::debug_find_node(tout, node));
+    assertx(!timeout::is_scheduled(node->timer));
 
     if (node->properties.is_good) {
       if (self) {
         if (dht::should_mark_bad(*self, *node)) { // TODO ??
           node->properties.is_good = false;
           routing_table.bad_nodes++;
+          dht::promote_replacement(routing_table, *node);
         }
       }
     }
 
-    if (f(routing_table, *node)) {
-      timeout::append_all(*routing_table.tb.timeout, node);
-      assertx(node->timeout_next);
-      assertx(node->timeout_priv);
-      assertx(timeout::debug_find_node(*routing_table.tb.timeout, node) ==
-              node);
-      assertx(debug_assert_all(routing_table));
-
+    /* a node which could not be sent to is still due and retried next tick */
+    const bool sent = f(routing_table, *node);
+    timeout::schedule(tout, node, timeout);
+    assertx(timeout::debug_find_node(tout, node) == node);
+    assertx(debug_assert_all(routing_table));
+    if (sent) {
       goto Lstart;
-    } else {
-      timeout::prepend(*routing_table.tb.timeout, node);
-      assertx(node->timeout_next);
-      assertx(node->timeout_priv);
-      assertx(timeout::debug_find_node(*routing_table.tb.timeout, node) ==
-              node);
-      assertx(debug_assert_all(routing_table));
-
-      result = false;
     }
+    result = false;
   }
 }
 
@@ -0,0 +1,308 @@
+#include "timer_wheel.h"
+#include <util/assert.h>
+
+namespace timeout {
+//=====================================
+/*timeout::Timer*/
+Timer::Timer() noexcept
+    : next(0)
+    , priv(0)
+    , expire(0)
+    , slot(0) {
+}
+
+//=====================================
+/*timeout::Wheel*/
+Wheel::Wheel(sp::Milliseconds res,
+             Timer &(*t)(void *, std::uint32_t) noexcept, void *c) noexcept
+    : timer_of(t)
+    , ctx(c)
+    , wheel{}
+    , occupied{0}
+    , current(0)
+    , cascaded(false)
+    , resolution(res.value > 0 ? res.value : 1)
+    , length(0)
+    , scheduled(0)
+    , cancelled(0)
+    , expired(0)
+    , cascades(0) {
+}
+
+//=====================================
+static constexpr std::uint64_t slot_mask = Wheel::slots - 1;
+
+static std::uint64_t
+rotate_right(std::uint64_t v, std::size_t s) noexcept {
+  s &= 63;
+  return s == 0 ? v : (v >> s) | (v << (64 - s));
+}
+
+static std::size_t
+level_shift(std::size_t level) noexcept {
+  return Wheel::bits * level;
+}
+
+static Timer &
+at(const Wheel &self, std::uint32_t handle) noexcept {
+  assertx(handle != 0);
+  return self.timer_of(self.ctx, handle);
+}
+
+/* The tick $timer expires at, which is not before $base */
+static std::uint64_t
+expire_tick(const Timer &timer, std::uint64_t base) noexcept {
+  return base + std::uint32_t(timer.expire - std::uint32_t(base));
+}
+
+static void
+link(Wheel &self, std::uint32_t handle, std::size_t level,
+     std::size_t idx) noexcept {
+  Timer &timer = at(self, handle);
+  assertx(!timer.next);
+  assertx(!timer.priv);
+
+  std::uint32_t &head = self.wheel[level][idx];
+  if (head) {
+    Timer &first = at(self, head);
+    const std::uint32_t priv = first.priv;
+    timer.next = head;
+    timer.priv = priv;
+    at(self, priv).next = handle;
+    first.priv = handle;
+  } else {
+    timer.next = handle;
+    timer.priv = handle;
+    head = handle;
+    self.occupied[level] |= std::uint64_t(1) << idx;
+  }
+  timer.slot = std::uint8_t((level * Wheel::slots) + idx);
+}
+
+static void
+unlink(Wheel &self, std::uint32_t handle) noexcept {
+  Timer &timer = at(self, handle);
+  assertx(is_scheduled(timer));
+  const std::size_t level = timer.slot / Wheel::slots;
+  const std::size_t idx = timer.slot % Wheel::slots;
+  assertx(level < Wheel::levels);
+
+  std::uint32_t &head = self.wheel[level][idx];
+  if (timer.next == handle) {
+    assertx(head == handle);
+    head = 0;
+    self.occupied[level] &= ~(std::uint64_t(1) << idx);
+  } else {
+    at(self, timer.priv).next = timer.next;
+    at(self, timer.next).priv = timer.priv;
+    if (head == handle) {
+      head = timer.next;
+    }
+  }
+
+  timer.next = 0;
+  timer.priv = 0;
+}
+
+/* place $handle relative to $base which is the next tick to be processed */
+static void
+place(Wheel &self, std::uint32_t handle, std::uint64_t base) noexcept {
+  constexpr std::uint64_t max =
+      (std::uint64_t(1) << (Wheel::bits * Wheel::levels)) - 1;
+
+  std::uint64_t tick = expire_tick(at(self, handle), base);
+  if (tick - base > max) {
+    /* parked, will be placed again when reached */
+    tick = base + max;
+  }
+
+  const std::uint64_t delta = tick - base;
+  std::size_t level = 0;
+  while (delta >= (std::uint64_t(1) << level_shift(level + 1))) {
+    ++level;
+  }
+  assertx(level < Wheel::levels);
+
+  link(self, handle, level, (tick >> level_shift(level)) & slot_mask);
+}
+
+static void
+cascade(Wheel &self, std::uint64_t tick) noexcept {
+  for (std::size_t level = Wheel::levels - 1; level > 0; --level) {
+    const std::uint64_t span = std::uint64_t(1) << level_shift(level);
+    if ((tick & (span - 1)) != 0) {
+      continue;
+    }
+
+    const std::size_t idx = (tick >> level_shift(level)) & slot_mask;
+    std::uint32_t it = self.wheel[level][idx];
+    if (!it) {
+      continue;
+    }
+
+    self.wheel[level][idx] = 0;
+    self.occupied[level] &= ~(std::uint64_t(1) << idx);
+    at(self, at(self, it).priv).next = 0;
+    while (it) {
+      Timer &timer = at(self, it);
+      const std::uint32_t next = timer.next;
+      timer.next = 0;
+      timer.priv = 0;
+      place(self, it, tick);
+      ++self.cascades;
+      it = next;
+    }
+  }
+}
+
+/* The first tick after $after where a timer either expires or is cascaded */
+static bool
+next_tick(const Wheel &self, std::uint64_t after,
+          /*OUT*/ std::uint64_t &out) noexcept {
+  bool result = false;
+  out = ~std::uint64_t(0);
+
+  for (std::size_t level = 0; level < Wheel::levels; ++level) {
+    if (self.occupied[level] == 0) {
+      continue;
+    }
+
+    const std::uint64_t block = (after >> level_shift(level)) + 1;
+    const std::uint64_t rot =
+        rotate_right(self.occupied[level], std::size_t(block & slot_mask));
+    const std::uint64_t k = std::uint64_t(__builtin_ctzll(rot));
+    const std::uint64_t tick = (block + k) << level_shift(level);
+    if (tick < out) {
+      out = tick;
+    }
+    result = true;
+  }
+
+  return result;
+}
+
+//=====================================
+bool
+is_scheduled(const Timer &self) noexcept {
+  return self.next != 0;
+}
+
+void
+schedule(Wheel &self, std::uint32_t handle, const sp::Timestamp &now,
+         const sp::Timestamp &expire) noexcept {
+  Timer &timer = at(self, handle);
+  if (is_scheduled(timer)) {
+    unlink(self, handle);
+    assertx(self.length > 0);
+    --self.length;
+  }
+
+  if (self.length == 0) {
+    /* Nothing is scheduled, skip ahead instead of walking the idle ticks. The
+     * tick of $now is left so a timer which is already due expires at $now.
+     */
+    const std::uint64_t tick = std::uint64_t(now) / self.resolution;
+    if (tick > self.current + 1) {
+      self.current = tick - 1;
+      self.cascaded = false;
+    }
+  }
+
+  const std::uint64_t base = self.current + 1;
+  const std::uint64_t ms = std::uint64_t(expire);
+  std::uint64_t tick = (ms + self.resolution - 1) / self.resolution;
+  if (tick < base) {
+    tick = base;
+  }
+  if (tick - base > ~std::uint32_t(0)) {
+    tick = base + ~std::uint32_t(0);
+  }
+  timer.expire = std::uint32_t(tick);
+
+  place(self, handle, base);
+  ++self.length;
+  ++self.scheduled;
+}
+
+void
+cancel(Wheel &self, std::uint32_t handle) noexcept {
+  if (is_scheduled(at(self, handle))) {
+    unlink(self, handle);
+    assertx(self.length > 0);
+    --self.length;
+    ++self.cancelled;
+  }
+}
+
+//=====================================
+/* Walk and cascade the wheel until the first tick up to $target which has an
+ * expired timer, the head of its slot or 0 if there is none. The tick is left
+ * unprocessed so walking again returns the same head.
+ */
+static std::uint32_t
+walk(Wheel &self, std::uint64_t target) noexcept {
+  while (self.current < target) {
+    const std::uint64_t tick = self.current + 1;
+    if (!self.cascaded) {
+      cascade(self, tick);
+      self.cascaded = true;
+    }
+
+    const std::uint32_t head = self.wheel[0][tick & slot_mask];
+    if (head) {
+      assertxs(expire_tick(at(self, head), tick) == tick,
+               expire_tick(at(self, head), tick), tick);
+      return head;
+    }
+
+    self.cascaded = false;
+    std::uint64_t next = 0;
+    if (!next_tick(self, tick, next) || next > target) {
+      self.current = target;
+    } else {
+      self.current = next - 1;
+    }
+  }
+
+  return 0;
+}
+
+std::uint32_t
+take_expired(Wheel &self, const sp::Timestamp &now) noexcept {
+  const std::uint32_t head = walk(self, std::uint64_t(now) / self.resolution);
+  if (head) {
+    unlink(self, head);
+    assertx(self.length > 0);
+    --self.length;
+    ++self.expired;
+  }
+  return head;
+}
+
+void
+advance(Wheel &self, const sp::Timestamp &now) noexcept {
+  walk(self, std::uint64_t(now) / self.resolution);
+}
+
+bool
+next_expire(const Wheel &self, sp::Timestamp &out) noexcept {
+  std::uint64_t tick = 0;
+  if (!next_tick(self, self.current, tick)) {
+    return false;
+  }
+
+  out = sp::Timestamp(tick * self.resolution);
+  return true;
+}
+
+bool
+has_expired(const Wheel &self, const sp::Timestamp &now) noexcept {
+  sp::Timestamp next(0);
+  if (next_expire(self, next)) {
+    return next <= now;
+  }
+  return false;
+}
+
+//=====================================
+} // namespace timeout
@@ -0,0 +1,128 @@
+#ifndef SP_MAINLINE_DHT_TIMER_WHEEL_H
+#define SP_MAINLINE_DHT_TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <util/timeout.h>
+
+namespace timeout {
+//=====================================
+/* Intrusive timer scheduled in a Wheel, embedded in the object which should
+ * expire. Timers are linked by their handle, a non-zero 32bit index which the
+ * Wheel resolves with Wheel::timer_of, so the links stay small and the object
+ * may move while scheduled as long as its handle resolves to its new place.
+ */
+struct Timer {
+  /* handles of the neighbours in the slot, 0 when not scheduled */
+  std::uint32_t next;
+  std::uint32_t priv;
+  /* low 32 bits of the tick the timer expires at */
+  std::uint32_t expire;
+  /* level * Wheel::slots + slot index, only valid when scheduled */
+  std::uint8_t slot;
+
+  Timer() noexcept;
+};
+
+/* Hierarchical timing wheel. Every level has 64 slots where a slot in level
+ * 0 is one tick of $resolution and a slot in level N spans 64^N ticks. Timers
+ * are cascaded down a level when the wheel reaches the start of their slot.
+ * Schedule and cancel are O(1), expiring a timer is O(levels) amortized.
+ * Timers further away than 64^levels ticks are parked in the last level and
+ * rescheduled when reached. A timer can be at most 2^32 ticks away.
+ *
+ * Transactions, the node refresh of the routing tables and the peer expiry of
+ * the db are all scheduled in a Wheel of their own.
+ */
+struct Wheel {
+  static constexpr std::size_t levels = 4;
+  static constexpr std::size_t bits = 6;
+  static constexpr std::size_t slots = std::size_t(1) << bits;
+
+  /* resolve the handle of a scheduled timer */
+  Timer &(*timer_of)(void *ctx, std::uint32_t handle) noexcept;
+  void *ctx;
+  /* handle of the first timer in each slot, 0 if empty */
+  std::uint32_t wheel[levels][slots];
+  /* bitmap of non-empty slots for each level */
+  std::uint64_t occupied[levels];
+  /* the last tick which have been fully processed */
+  std::uint64_t current;
+  /* $current + 1 has been cascaded but not all of its timers expired */
+  bool cascaded;
+  std::uint64_t resolution;
+  std::uint64_t length;
+
+  std::uint64_t scheduled;
+  std::uint64_t cancelled;
+  std::uint64_t expired;
+  std::uint64_t cascades;
+
+  Wheel(sp::Milliseconds resolution,
+        Timer &(*timer_of)(void *, std::uint32_t) noexcept,
+        void *ctx) noexcept;
+
+  Wheel(const Wheel &) = delete;
+  Wheel(const Wheel &&) = delete;
+
+  Wheel &
+  operator=(const Wheel &) = delete;
+  Wheel &
+  operator=(const Wheel &&) = delete;
+};
+
+//=====================================
+bool
+is_scheduled(const Timer &) noexcept;
+
+/* Schedule the timer of $handle to expire at $expire, if it is already
+ * scheduled it is rescheduled.
+ */
+void
+schedule(Wheel &, std::uint32_t handle, const sp::Timestamp &now,
+         const sp::Timestamp &expire) noexcept;
+
+void
+cancel(Wheel &, std::uint32_t handle) noexcept;
+
+//=====================================
+/* Unlink and return the handle of one timer which has expired at $now, 0 if
+ * none. The caller decides how many timers to process per tick.
+ */
+std::uint32_t
+take_expired(Wheel &, const sp::Timestamp &now) noexcept;
+
+/* A lower bound of when the next timer expires, false if the wheel is empty */
+bool
+next_expire(const Wheel &, /*OUT*/ sp::Timestamp &) noexcept;
+
+/* Cascade every timer which is due at $now down to level 0, without taking
+ * any of them. Afterwards has_expired() is exact for $now.
+ */
+void
+advance(Wheel &, const sp::Timestamp &now) noexcept;
+
+/* Can there be expired timers at $now, a pending cascade counts as expired */
+bool
+has_expired(const Wheel &, const sp::Timestamp &now) noexcept;
+
+template <typename F>
+void
+for_each(const Wheel &self, F f) noexcept {
+  for (std::size_t level = 0; level < Wheel::levels; ++level) {
+    for (std::size_t idx = 0; idx < Wheel::slots; ++idx) {
+      const std::uint32_t head = self.wheel[level][idx];
+      std::uint32_t it = head;
+      while (it) {
+        const std::uint32_t next = self.timer_of(self.ctx, it).next;
+        f(it);
+        it = next == head ? 0 : next;
+      }
+    }
+  }
+}
+
+//=====================================
+} // namespace timeout
+
+#endif
@@ -1,6 +1,11 @@
 #include "transaction.h"
+#include "node_store.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
 #include <cstring>
+#include <new>
 #include <util/assert.h>
 
 namespace tx {
@@ -10,12 +15,6 @@ using dht::Config;
 using dht::DHT;
 
 //=====================================
-static Timestamp
-expire_time(const Tx &tx) {
-  Config config;
-  return tx.sent + config.transaction_timeout;
-}
-
 static bool
 is_sent(const Tx &tx) noexcept {
   return tx.sent != Timestamp(0);
@@ -24,163 +23,84 @@ is_sent(const Tx &tx) noexcept {
 static bool
 is_expired(const Tx &tx, const Timestamp &now) noexcept {
   if (is_sent(tx)) {
-    if (expire_time(tx) > now) {
+    if (tx.expire > now) {
       return false;
     }
-    assertxs(expire_time(tx) <= now, uint64_t(expire_time(tx)), uint64_t(now));
+    assertxs(tx.expire <= now, uint64_t(tx.expire), uint64_t(now));
   }
 
   return true;
 }
 
-//=====================================
-static bool
-debug_find(const Client &client, Tx *const needle) noexcept {
-  assertx(needle);
-  const Tx *const head = client.timeout_head;
-  const Tx *it = head;
-
-Lit:
-  if (it) {
-    if (it == needle) {
-      return true;
-    }
-
-    assertx(it == it->timeout_next->timeout_priv);
-    it = it->timeout_next;
-
-    if (it != head) {
-      goto Lit;
-    }
-  }
-
-  return false;
+static dht::TxClassStat &
+class_of(Client &self, const Tx &tx) noexcept {
+  return self.classes[std::size_t(tx.cls)];
 }
 
-static std::size_t
-debug_count(const Client &client) noexcept {
-  const Tx *const head = client.timeout_head;
-  const Tx *it = head;
-  std::size_t result = 0;
-
-Lit:
-  if (it) {
-    ++result;
-
-    assertx(it == it->timeout_next->timeout_priv);
-    it = it->timeout_next;
-
-    if (it != head) {
-      goto Lit;
-    }
-  }
+/* The wheel handle of a transaction is its $buffer index + 1 */
+static std::uint32_t
+handle_of(const Client &self, const Tx &tx) noexcept {
+  return std::uint32_t(&tx - self.buffer) + 1;
+}
 
-  return result;
+static Tx *
+tx_of(Client &self, std::uint32_t handle) noexcept {
+  assertx(handle > 0 && handle <= self.capacity);
+  return self.buffer + (handle - 1);
 }
 
-static std::size_t
-debug_count(const DHT &dht) noexcept {
-  return debug_count(dht.client);
+static timeout::Timer &
+timer_of(void *ctx, std::uint32_t handle) noexcept {
+  return tx_of(*(Client *)ctx, handle)->timer;
 }
 
+//=====================================
 static std::size_t
-debug_count_free_transactions(const DHT &dht) noexcept {
+debug_count_free(const Client &client) noexcept {
   std::size_t result = 0;
-  const Client &client = dht.client;
-  const Tx *const head = client.timeout_head;
-  const Tx *it2 = head;
-  if (it2) {
-    do {
-      if (is_expired(*it2, dht.now)) {
-        ++result;
-      }
-      it2 = it2->timeout_next;
-    } while (it2 != head);
+  for (const Tx *it = client.free; it; it = it->next_free) {
+    assertx(!is_sent(*it));
+    ++result;
   }
   return result;
 }
 
-static void
-debug_print_list(const DHT &dht) {
-  const Client &client = dht.client;
-  const Tx *const head = client.timeout_head;
-  const Tx *it2 = head;
-  do {
-    printf("%p[sent:%lu]->", (void *)it2, std::uint64_t(it2->sent));
-    it2 = it2->timeout_next;
-  } while (it2 != head);
-  printf("\n");
-}
-
+/* The debug checks walk the whole free list, only do them for small tables
+ * so that mint, consume and expire stays O(1) also in debug builds.
+ */
 static bool
-debug_is_ordered(const DHT &dht, Tx *const tout, bool is_exp,
-                 bool is_snt) noexcept {
-  const Client &client = dht.client;
-  const Tx *const head = client.timeout_head;
-  const Tx *it = head;
-
-  const Tx *priv = nullptr;
-Lit:
-  if (it) {
-    Timestamp priv_sent = priv ? priv->sent : Timestamp(0);
-    /* $it should have been sent later or the same time as the previous. */
-    if (!(it->sent >= priv_sent)) {
-      debug_print_list(dht);
-
-      assertxs(false, std::uint64_t(it->sent), std::uint64_t(priv_sent),
-               (void *)it, (void *)tout, (void *)head, is_exp, is_snt);
-      return false;
-    }
-
-    priv = it;
-    it = it->timeout_next;
-
-    assertx(it->timeout_priv == priv);
-
-    if (it != head) {
-      goto Lit;
-    }
-  } else {
-    assertx(false);
+debug_is_complete(const Client &client) noexcept {
+  if (client.capacity > Client::default_capacity) {
+    return true;
   }
+  return (debug_count_free(client) + client.wheel.length) == client.capacity;
+}
 
-  return true;
+static bool
+debug_is_complete(const DHT &dht) noexcept {
+  return debug_is_complete(dht.client);
 }
 
 //=====================================
 static void
-enlist(Client &client, Tx *const t) noexcept {
+add_free(Client &self, Tx *t) noexcept {
   assertx(t);
-  assertx(t->timeout_next == nullptr);
-  assertx(t->timeout_priv == nullptr);
-
-  if (client.timeout_head) {
-    auto *next = client.timeout_head;
-    auto *priv = next->timeout_priv;
-
-    next->timeout_priv = t;
-    priv->timeout_next = t;
+  assertx(!is_sent(*t));
+  assertx(!timeout::is_scheduled(t->timer));
+  assertx(!t->next_free);
 
-    t->timeout_next = next;
-    t->timeout_priv = priv;
-  } else {
-    t->timeout_next = t;
-    t->timeout_priv = t;
-  }
+  t->next_free = self.free;
+  self.free = t;
 }
 
-static void
-add_front(Client &self, Tx *t) noexcept {
-  assertx(t);
-
-  assertx(!debug_find(self, t));
-
-  std::size_t before = debug_count(self); // TODO only in debug
-  // TODO assert $i is not present in queue
-  enlist(self, t);
-  self.timeout_head = t;
-
-  assertxs((before + 1) == debug_count(self), (before + 1));
+static Tx *
+take_free(Client &self) noexcept {
+  Tx *const result = self.free;
+  if (result) {
+    self.free = result->next_free;
+    result->next_free = nullptr;
+  }
+  return result;
 }
 
 static void
@@ -189,93 +109,194 @@ deinit(Client &self) noexcept {
 }
 
 //=====================================
-static Tx *
-unlink(Client &self, Tx *t) noexcept {
-  assertx(self.timeout_head);
-  assertx(t);
+static constexpr std::size_t id_length =
+    sizeof(Tx::prefix) + sizeof(Tx::suffix);
+
+static std::uint64_t
+tx_key(const sp::byte *prefix, const sp::byte *suffix) noexcept {
+  std::uint64_t result = 0;
+  std::memcpy(&result, prefix, sizeof(Tx::prefix));
+  std::memcpy(((sp::byte *)&result) + sizeof(Tx::prefix), suffix,
+              sizeof(Tx::suffix));
+  return result;
+}
 
-  if (self.timeout_head == t) {
-    auto *next = t->timeout_next != t ? t->timeout_next : nullptr;
-    self.timeout_head = next;
-  }
+static std::uint64_t
+tx_key(const Tx &tx) noexcept {
+  return tx_key(tx.prefix, tx.suffix);
+}
 
-  auto *next = t->timeout_next;
-  auto *priv = t->timeout_priv;
+static std::uint64_t
+tx_key(const krpc::Transaction &tx) noexcept {
+  assertx(tx.length == id_length);
+  return tx_key(tx.id, tx.id + sizeof(Tx::prefix));
+}
 
-  next->timeout_priv = priv;
-  priv->timeout_next = next;
+static std::size_t
+tx_hash(std::uint64_t key) noexcept {
+  key *= 0x9E3779B97F4A7C15ull;
+  return std::size_t(key >> 32);
+}
+
+/* Either the slot containing $key or the empty slot where $key should be
+ * inserted.
+ */
+static std::uint32_t *
+lookup_slot(Client &self, std::uint64_t key) noexcept {
+  const std::size_t mask = self.lookup_capacity - 1;
+  std::size_t i = tx_hash(key) & mask;
+  while (true) {
+    std::uint32_t *const slot = self.lookup + i;
+    if (*slot == 0 || tx_key(self.buffer[*slot - 1]) == key) {
+      return slot;
+    }
+    i = (i + 1) & mask;
+  }
+}
 
-  t->timeout_next = nullptr;
-  t->timeout_priv = nullptr;
+static void
+lookup_insert(Client &self, Tx &tx) noexcept {
+  std::uint32_t *const slot = lookup_slot(self, tx_key(tx));
+  assertx(*slot == 0);
+  *slot = std::uint32_t(&tx - self.buffer) + 1;
+}
 
-  assertx(debug_count(self) == (Client::tree_capacity - 1));
+static void
+lookup_remove(Client &self, Tx &tx) noexcept {
+  std::uint32_t *const slot = lookup_slot(self, tx_key(tx));
+  assertx(*slot == std::uint32_t(&tx - self.buffer) + 1);
+
+  /* backward shift deletion to keep probe sequences intact */
+  const std::size_t mask = self.lookup_capacity - 1;
+  std::size_t hole = std::size_t(slot - self.lookup);
+  std::size_t i = hole;
+  while (true) {
+    i = (i + 1) & mask;
+    const std::uint32_t idx = self.lookup[i];
+    if (idx == 0) {
+      break;
+    }
 
-  return t;
+    const std::size_t home = tx_hash(tx_key(self.buffer[idx - 1])) & mask;
+    /* can $idx be moved to $hole without passing its home slot */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      self.lookup[hole] = idx;
+      hole = i;
+    }
+  }
+  self.lookup[hole] = 0;
 }
 
 static Tx *
-search(binary::StaticTree<Tx> &tree, const krpc::Transaction &needle) noexcept {
-  Tx *const result = (Tx *)find(tree, needle);
-  if (!result) {
-    // TODO only assert
-    in_order_for_each(tree, [&needle](auto &current) {
-      if (current == needle) {
-        assertx(false);
-      }
-    });
+search(Client &self, const krpc::Transaction &needle) noexcept {
+  if (needle.length != id_length) {
+    return nullptr;
   }
-  return result;
+
+  const std::uint32_t idx = *lookup_slot(self, tx_key(needle));
+  return idx ? self.buffer + (idx - 1) : nullptr;
 }
 
 static void
-reset(Tx &tx) noexcept {
+reset(Client &self, Tx &tx) noexcept {
+  if (is_sent(tx)) {
+    lookup_remove(self, tx);
+  }
+  timeout::cancel(self.wheel, handle_of(self, tx));
   reset(tx.context);
   tx.sent = Timestamp(0);
+  tx.expire = Timestamp(0);
+  tx.remote = dht::NodeContact();
 
   for (size_t i = 0; i < sizeof(tx.suffix); ++i) {
     tx.suffix[i] = '\0';
   }
 }
 
-static void
-move_front(Client &self, Tx *tx) noexcept {
-  assertx(tx);
-  assertx(debug_find(self, tx));
+/* Time out one expired transaction and return it to the free list */
+static bool
+reclaim_expired(DHT &dht) noexcept {
+  Client &self = dht.client;
 
-  unlink(self, tx);
+  const std::uint32_t handle = timeout::take_expired(self.wheel, dht.now);
+  if (!handle) {
+    return false;
+  }
 
-  assertx(!debug_find(self, tx));
+  Tx *const tx = tx_of(self, handle);
+  assertx(is_sent(*tx));
+  assertx(is_expired(*tx, dht.now));
+  assertx(self.active > 0);
+  --self.active;
+  dht::TxClassStat &stat = class_of(self, *tx);
+  assertx(stat.in_flight > 0);
+  --stat.in_flight;
+  ++stat.timeouts;
+  if (dht::NodeLiveness *const l = find(dht::node_store(), tx->remote)) {
+    const std::uint8_t max = ~std::uint8_t(0);
+    if (l->timeouts != max) {
+      ++l->timeouts;
+    }
+  }
 
-  add_front(self, tx);
+  tx->context.timeout(dht, tx);
+  reset(self, *tx);
+  assertx(!is_sent(*tx));
+  add_free(self, tx);
 
-  assertx(debug_find(self, tx));
+  return true;
 }
 
-bool
-consume_transaction(dht::DHT &dht, const krpc::Transaction &needle,
-                    /*OUT*/ TxContext &out) noexcept {
+static void
+rtt_sample(dht::DHT &dht, const Tx &tx, sp::Milliseconds latency) noexcept {
+  dht::NodeLiveness *const l = find(dht::node_store(), tx.remote);
+  if (l) {
+    rtt_sample(l->rtt, latency);
+    l->timeouts = 0;
+  }
+  rtt_sample(dht.client.rtt, latency);
+}
+
+static bool
+consume(dht::DHT &dht, const krpc::Transaction &needle, const Contact *remote,
+        /*OUT*/ TxContext &out, bool is_response) noexcept {
   dht::Client &self = dht.client;
 
-  assertx(debug_count(self) == Client::tree_capacity);
+  assertx(debug_is_complete(self));
 
-  constexpr std::size_t c = sizeof(Tx::prefix) + sizeof(Tx::suffix);
-  if (needle.length == c) {
-    Tx *const tx = search(self.tree, needle);
+  if (needle.length == id_length) {
+    Tx *const tx = search(self, needle);
+
+    if (tx && remote && !(tx->remote == *remote)) {
+      /* Do not let a spoofed response consume the transaction, the real
+       * response or the timeout will.
+       */
+      ++self.source_mismatch;
+      return false;
+    }
 
     if (tx) {
-      // Note: compare prefix in tree, here compare both prefix and suffix
       if (tx->operator==(needle) && is_sent(*tx)) {
         assertx(is_sent(*tx));
         assertx(self.active > 0);
         --self.active;
+        dht::TxClassStat &stat = class_of(self, *tx);
+        assertx(stat.in_flight > 0);
+        --stat.in_flight;
 
         out = tx->context;
         out.latency = dht.now - tx->sent;
+        if (is_response) {
+          rtt_sample(dht, *tx, sp::Milliseconds(out.latency));
+          rtt_sample(stat.latency, sp::Milliseconds(out.latency));
+          ++stat.responses;
+        }
 
-        reset(*tx);
+        reset(self, *tx);
         assertx(!is_sent(*tx));
-        move_front(self, tx);
+        add_free(self, tx);
 
+        assertx(debug_is_complete(self));
         return true;
       } else {
         fprintf(stderr, "[]Suffix not found tx: %.*s\n", (int)needle.length,
@@ -293,60 +314,70 @@ consume_transaction(dht::DHT &dht, const krpc::Transaction &needle,
   return false;
 }
 
-//=====================================
 bool
-has_free_transaction(const DHT &dht) {
-  const Client &client = dht.client;
-  const Tx *const head = client.timeout_head;
-  if (head) {
-    if (is_expired(*head, dht.now)) {
-      return true;
-    }
-  } else {
-    assertx(false);
-  }
-  assertx(debug_count_free_transactions(dht) == 0);
-  return false;
+consume_transaction(dht::DHT &dht, const krpc::Transaction &needle,
+                    const Contact &remote, /*OUT*/ TxContext &out) noexcept {
+  return consume(dht, needle, &remote, out, true);
+}
+
+bool
+cancel_transaction(dht::DHT &dht, const krpc::Transaction &needle,
+                   /*OUT*/ TxContext &out) noexcept {
+  return consume(dht, needle, nullptr, out, false);
 }
 
 //=====================================
-#if 0
-static Tx *
-unlink_free(DHT &dht) noexcept {
-  Client &client = dht.client;
-  Tx *const head = client.timeout_head;
-  Tx *result = nullptr;
-  bool is_exp = false;
-  bool is_snt = false;
-
-  // auto cnt = debug_count(dht);
-  // printf("cnt %zu\n", cnt);
-  assertx(debug_is_ordered(dht, NULL, is_exp, is_snt));
-
-  if (has_free_transaction(dht)) {
-    is_exp = true;
-    if (is_sent(*head)) {
-      is_snt = true;
-      assertx(client.active > 0);
-      --client.active;
-
-      head->context.timeout(dht, head);
-      reset(*head);
+static std::size_t
+share(const Client &self, std::uint8_t percentage) noexcept {
+  return (self.capacity * std::min(percentage, std::uint8_t(100))) / 100;
+}
+
+/* Can $cls use one of the free transactions without taking a transaction
+ * reserved by a class of higher priority.
+ */
+static bool
+is_admitted(const DHT &dht, dht::TxClass cls) noexcept {
+  const Client &self = dht.client;
+  const Config &cfg = dht.config;
+  const std::size_t c = std::size_t(cls);
+  assertx(c < dht::tx_classes);
+
+  if (self.classes[c].in_flight >= share(self, cfg.tx_limit[c])) {
+    return false;
+  }
+
+  std::size_t reserved = 0;
+  for (std::size_t h = 0; h < c; ++h) {
+    const std::size_t r = share(self, cfg.tx_reserved[h]);
+    if (self.classes[h].in_flight < r) {
+      reserved += r - self.classes[h].in_flight;
     }
+  }
 
-    assertx(debug_find(dht.client, head));
-    result = unlink(client, head);
-    assertx(!debug_find(dht.client, head));
-  } // if is_expired
+  assertx(self.capacity >= self.active);
+  return (self.capacity - self.active) > reserved;
+}
 
-  assertx(debug_is_ordered(dht, head, is_exp, is_snt));
+bool
+has_free_transaction(const DHT &dht) {
+  return has_free_transaction(dht, dht::TxClass::SEARCH);
+}
 
-  return result;
+bool
+has_free_transaction(const DHT &dht, dht::TxClass cls) {
+  const Client &client = dht.client;
+  if (client.free) {
+    return is_admitted(dht, cls);
+  }
+
+  /* mint will reclaim the expired transaction before admitting $cls */
+  return timeout::has_expired(client.wheel, dht.now);
 }
-#endif
 
+//=====================================
 static void
-make(Tx &tx) noexcept {
+make(Client &self, Tx &tx) noexcept {
+Lretry:
   const int r = rand();
   static_assert(sizeof(tx.suffix) <= sizeof(r), "");
 
@@ -358,56 +389,71 @@ make(Tx &tx) noexcept {
       tx.suffix[i]++;
     }
   }
+
+  /* the prefix is only unique for the first 255*255 transactions */
+  if (*lookup_slot(self, tx_key(tx)) != 0) {
+    goto Lretry;
+  }
 }
 
-static void
-add_back(Client &client, Tx *t) noexcept {
-  enlist(client, t);
-  client.timeout_head = t->timeout_next;
+/* Backed off by the timeouts of $remote since its last response */
+static sp::Milliseconds
+rto(const DHT &dht, const Contact &remote) noexcept {
+  const dht::NodeLiveness *const l = find(dht::node_store(), remote);
+  if (l && l->rtt.samples > 0) {
+    return rto(l->rtt, l->timeouts, dht.config);
+  }
+
+  return rto(dht.client.rtt, l ? l->timeouts : 0, dht.config);
 }
 
 bool
 mint_transaction(DHT &dht, krpc::Transaction &out, TxContext &ctx) noexcept {
-  bool is_exp = false;
-  bool is_snt = false;
-  assertx(debug_count(dht) == Client::tree_capacity);
-  assertx(debug_is_ordered(dht, NULL, is_exp, is_snt));
-
-  Client &self = dht.client;
-
-  Tx *const tx = self.timeout_head;
-  if (tx) {
-    if (is_sent(*tx) && is_expired(*tx, dht.now)) {
-      assertx(self.active > 0);
-      --self.active;
-
-      tx->context.timeout(dht, tx);
-      reset(*tx);
-      assertx(!is_sent(*tx));
-    }
-
-    if (!is_sent(*tx)) {
-      ++self.active;
-      make(*tx);
+  return mint_transaction(dht, out, ctx, Contact());
+}
 
-      out = krpc::Transaction(tx->prefix, tx->suffix);
+bool
+mint_transaction(DHT &dht, krpc::Transaction &out, TxContext &ctx,
+                 const Contact &remote, dht::TxClass cls) noexcept {
+  assertx(debug_is_complete(dht));
 
-      tx->context = ctx;
-      assertx(dht.now > sp::Timestamp(0));
-      tx->sent = dht.now;
-      assertx(tx->sent != sp::Timestamp(0));
+  Client &self = dht.client;
 
-      unlink(self, tx);
-      add_back(self, tx);
+  if (!self.free) {
+    reclaim_expired(dht);
+  }
 
-      assertx(debug_is_ordered(dht, tx, is_exp, is_snt));
+  if (self.free && !is_admitted(dht, cls)) {
+    ++self.classes[std::size_t(cls)].denied;
+    return false;
+  }
 
-      return true;
-    }
+  Tx *const tx = take_free(self);
+  if (tx) {
+    assertx(!is_sent(*tx));
+    ++self.active;
+    tx->cls = cls;
+    dht::TxClassStat &stat = class_of(self, *tx);
+    ++stat.in_flight;
+    ++stat.minted;
+    make(self, *tx);
+
+    out = krpc::Transaction(tx->prefix, tx->suffix);
+
+    tx->context = ctx;
+    assertx(dht.now > sp::Timestamp(0));
+    tx->sent = dht.now;
+    tx->expire = tx->sent + rto(dht, remote);
+    tx->remote = remote;
+    assertx(tx->sent != sp::Timestamp(0));
+    lookup_insert(self, *tx);
+    timeout::schedule(self.wheel, handle_of(self, *tx), dht.now, tx->expire);
+
+    assertx(debug_is_complete(dht));
+    return true;
   }
 
-  assertx(debug_count(dht) == Client::tree_capacity);
-  assertx(debug_is_ordered(dht, NULL, is_exp, is_snt));
+  assertx(debug_is_complete(dht));
 
   return false;
 } // dht::min_transaction()
@@ -415,11 +461,10 @@ mint_transaction(DHT &dht, krpc::Transaction &out, TxContext &ctx) noexcept {
 //=====================================
 bool
 is_valid(DHT &self, const krpc::Transaction &needle) noexcept {
-  assertx(debug_count(self) == Client::tree_capacity);
-  assertx(debug_is_ordered(self, NULL, false, false));
+  assertx(debug_is_complete(self));
 
   Client &client = self.client;
-  Tx *const tx = search(client.tree, needle);
+  Tx *const tx = search(client, needle);
   if (tx) {
     if (!is_expired(*tx, self.now)) {
       return true;
@@ -432,119 +477,115 @@ is_valid(DHT &self, const krpc::Transaction &needle) noexcept {
 //=====================================
 Timestamp
 next_available(const dht::DHT &self) noexcept {
-  assertx(debug_count(self) == Client::tree_capacity);
-  assertx(debug_is_ordered(self, NULL, false, false));
+  assertx(debug_is_complete(self));
 
   const Client &client = self.client;
-  const Tx *const head = client.timeout_head;
   const Config &cfg = self.config;
 
-  if (!head) {
-    // some arbitrary date in the future
-    return self.now + cfg.refresh_interval;
+  if (client.free) {
+    return self.now;
   }
 
-  if (is_expired(*head, self.now)) {
-    return self.now;
+  Timestamp next(0);
+  if (!timeout::next_expire(client.wheel, next)) {
+    // some arbitrary date in the future
+    return self.now + cfg.refresh_interval;
   }
 
-  return expire_time(*head);
+  return std::max(next, self.now);
 }
 
 //=====================================
 void
 eager_tx_timeout(dht::DHT &dht) noexcept {
-  dht::Client &self = dht.client;
+  assertx(debug_is_complete(dht));
 
-  assertx(debug_count(dht) == Client::tree_capacity);
-  assertx(debug_is_ordered(dht, NULL, false, false));
+  while (reclaim_expired(dht)) {
+  }
 
-  // [[sent=0], [sent=1, expired=true], [sent=1, expired=false]]
-  Tx *const head = self.timeout_head;
-  Tx *it = head;
-  if (it) {
-    do {
-      Tx *const next = it->timeout_next;
-      if (is_sent(*it) && is_expired(*it, dht.now)) {
-        assertx(self.active > 0);
-        --self.active;
+  assertx(debug_is_complete(dht));
+}
 
-        it->context.timeout(dht, it);
-        reset(*it);
-        assertx(!is_sent(*it));
-        assertx(is_expired(*it, dht.now));
+bool
+eager_tx_timeout(dht::DHT &dht, dht::Budget &budget) noexcept {
+  assertx(debug_is_complete(dht));
 
-        assertx(debug_is_ordered(dht, it, true, true));
-      } else if (is_sent(*it) && !is_expired(*it, dht.now)) {
-        break;
-      } else {
-      }
-      it = next;
-    } while (it != head);
+  while (!is_exhausted(budget)) {
+    if (!reclaim_expired(dht)) {
+      return true;
+    }
+    spend(budget);
   }
 
-  assertx(debug_count(dht) == Client::tree_capacity);
-  assertx(debug_is_ordered(dht, NULL, false, false));
+  assertx(debug_is_complete(dht));
+  return !timeout::has_expired(dht.client.wheel, dht.now);
 }
 
 //=====================================
-const Tx *
-next_timeout(const dht::DHT &self) noexcept {
-  const dht::Client &client = self.client;
-  const Config &cfg = self.config;
-  Tx *const head = client.timeout_head;
-  Tx *it = head;
-  if (it) {
-    do {
-      assertx(it->timeout_next);
-      assertx(it->timeout_priv);
-      if (is_sent(*it)) {
-        assertxs(!is_expired(*it, self.now), uint64_t(it->sent),
-                 uint64_t(it->sent + cfg.transaction_timeout),
-                 uint64_t(self.now));
-        return it;
-      }
-
-      it = it->timeout_next;
-    } while (it != head);
-  }
-
-  return nullptr;
+bool
+next_timeout(const dht::DHT &self, /*OUT*/ Timestamp &out) noexcept {
+  return timeout::next_expire(self.client.wheel, out);
 }
 
 } // namespace tx
+
 //=====================================
 namespace dht {
+/*dht::TxClassStat*/
+TxClassStat::TxClassStat() noexcept
+    : in_flight(0)
+    , minted(0)
+    , responses(0)
+    , timeouts(0)
+    , denied(0)
+    , latency() {
+}
+
 /*dht::Client*/
-Client::Client(fd &udp_fd, fd &_priv_fd) noexcept
+Client::Client(fd &udp_fd, fd &_priv_fd, std::size_t cap) noexcept
     : udp(udp_fd)
     , priv_fd(_priv_fd)
-    , timeout_head(nullptr)
-    , buffer{}
-    , tree{buffer}
+    , free(nullptr)
+    , wheel(sp::Milliseconds(1), tx::timer_of, this)
+    , buffer(nullptr)
+    , capacity(0)
+    , lookup(nullptr)
+    , lookup_capacity(0)
     , active(0)
+    , rtt()
+    , classes()
+    , source_mismatch(0)
     , deinit(nullptr) {
-  sp::byte a = 'a';
-  sp::byte b = 'a';
-  std::size_t cnt = 0;
-  in_order_for_each(this->tree, [this, &a, &b, &cnt](tx::Tx &tx) {
-    assertx(tx.prefix[0] == '\0');
-    assertx(tx.prefix[1] == '\0');
-
-    ++cnt;
-
-    tx.prefix[0] = a;
-    tx.prefix[1] = b++;
-    if (b == sp::byte('z')) {
-      ++a;
-      b = 'a';
-    }
-    // printf("prefix: %c%c\n", tx.prefix[0], tx.prefix[1]);
-    add_front(*this, &tx);
-  });
+  cap = std::max(std::min(cap, Client::max_capacity), std::size_t(1));
+
+  std::size_t lcap = 1;
+  while (lcap < cap * 2) {
+    lcap *= 2;
+  }
+
+  this->buffer = new (std::nothrow) tx::Tx[cap];
+  this->lookup = (std::uint32_t *)std::calloc(lcap, sizeof(std::uint32_t));
+  if (!this->buffer || !this->lookup) {
+    delete[] this->buffer;
+    std::free(this->lookup);
+    this->buffer = nullptr;
+    this->lookup = nullptr;
+    return;
+  }
+  this->capacity = cap;
+  this->lookup_capacity = lcap;
+
+  /* The prefix is derived from the index, avoiding 0 in the tx. The full
+   * transaction id is made unique by the random suffix when minted.
+   */
+  for (std::size_t i = this->capacity; i-- > 0;) {
+    tx::Tx &tx = this->buffer[i];
+    tx.prefix[0] = sp::byte(1 + (i % 255));
+    tx.prefix[1] = sp::byte(1 + ((i / 255) % 255));
+    add_free(*this, &tx);
+  }
 
-  assertx(tx::debug_count(*this) == Client::tree_capacity);
-  assertx(Client::tree_capacity == cnt);
+  assertx(tx::debug_is_complete(*this));
 
   this->deinit = tx::deinit;
 }
@@ -553,6 +594,10 @@ Client::~Client() noexcept {
   if (this->deinit) {
     this->deinit(*this);
   }
+  delete[] this->buffer;
+  std::free(this->lookup);
+  this->buffer = nullptr;
+  this->lookup = nullptr;
 }
 
 } // namespace dht
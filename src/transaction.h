@@ -5,27 +5,49 @@
 
 namespace tx {
 /*
- * inactive transaction cones first in the list, then transactions which are
- * closest to timeout in order of sent timestamp
+ * inactive transactions are kept in a free list, sent transactions are
+ * scheduled in a timing wheel by their expire timestamp
  */
 //=====================================
+/* Consume the transaction of a response received from $remote, the latency
+ * of the response is sampled into the RTT of the remote and the global RTT.
+ * A transaction is only consumed by the remote it was sent to.
+ */
 bool
 consume_transaction(dht::DHT &, const krpc::Transaction &,
-                    /*OUT*/ TxContext &) noexcept;
+                    const Contact &remote, /*OUT*/ TxContext &) noexcept;
+
+/* Consume the transaction of a request which were never sent */
+bool
+cancel_transaction(dht::DHT &, const krpc::Transaction &,
+                   /*OUT*/ TxContext &) noexcept;
 
 //=====================================
 bool
 has_free_transaction(const dht::DHT &);
 
+/* Is there a free transaction which $cls may use */
+bool
+has_free_transaction(const dht::DHT &, dht::TxClass);
+
 //=====================================
 /* Keep tracks of active outgoing transactions and what module should handle the
- * response for an eventual response. Client maintains a tree of active
- * transactions together with function pointer for the module which should
- * handle the response.
+ * response for an eventual response. Client maintains a hash table of active
+ * transactions keyed by the transaction id together with function pointer for
+ * the module which should handle the response.
  */
 bool
 mint_transaction(dht::DHT &, /*OUT*/ krpc::Transaction &, TxContext &) noexcept;
 
+/* The transaction expires after the RTO of $remote, or the global RTO when
+ * there is no RTT sample for $remote. Fails if $cls is out of transactions,
+ * see Config::tx_reserved.
+ */
+bool
+mint_transaction(dht::DHT &, /*OUT*/ krpc::Transaction &, TxContext &,
+                 const Contact &remote,
+                 dht::TxClass cls = dht::TxClass::SEARCH) noexcept;
+
 //=====================================
 bool
 is_valid(dht::DHT &, const krpc::Transaction &) noexcept;
@@ -38,9 +60,18 @@ next_available(const dht::DHT &) noexcept;
 void
 eager_tx_timeout(dht::DHT &) noexcept;
 
+/* Time out at most $budget expired transactions, false if expired
+ * transactions are left for the next tick.
+ */
+bool
+eager_tx_timeout(dht::DHT &, dht::Budget &) noexcept;
+
 //=====================================
-const Tx *
-next_timeout(const dht::DHT &dht) noexcept;
+/* A lower bound of when the next sent transaction expires, false if there are
+ * no sent transactions.
+ */
+bool
+next_timeout(const dht::DHT &dht, /*OUT*/ Timestamp &) noexcept;
 
 //=====================================
 } // namespace tx
@@ -1,4 +1,5 @@
 #include "util.h"
+#include "node_store.h"
 #include <arpa/inet.h>
 #include <cstring>
 #include <encode/hex.h>
@@ -843,66 +844,160 @@ to_string(const IdContact &c) noexcept {
 
 //=====================================
 namespace dht {
+/*NodeIp*/
+NodeIp::NodeIp() noexcept
+    : ipv4(0) {
+}
+
+NodeIp::NodeIp(Ipv4 v4) noexcept
+    : ipv4(v4) {
+}
+
+NodeIp::operator Ip() const noexcept {
+  return Ip(ipv4);
+}
+
+bool
+NodeIp::operator==(const NodeIp &o) const noexcept {
+  return ipv4 == o.ipv4;
+}
+
+//=====================================
+/*NodeContact*/
+NodeContact::NodeContact() noexcept
+    : ip()
+    , port(0) {
+}
+
+NodeContact::NodeContact(const Contact &c) noexcept
+    : ip()
+    , port(0) {
+  *this = c;
+}
+
+NodeContact &
+NodeContact::operator=(const Contact &c) noexcept {
+  assertx(c.ip.type == IpType::IPV4);
+  ip.ipv4 = c.ip.ipv4;
+  port = c.port;
+  return *this;
+}
+
+NodeContact::operator Contact() const noexcept {
+  return Contact(ip.ipv4, port);
+}
+
+bool
+NodeContact::operator==(const NodeContact &o) const noexcept {
+  return ip == o.ip && port == o.port;
+}
+
+bool
+NodeContact::operator==(const Contact &o) const noexcept {
+  return o.ip.type == IpType::IPV4 && ip.ipv4 == o.ip.ipv4 && port == o.port;
+}
+
+//=====================================
+/*NodeTime*/
+Timestamp NodeTime::base(0);
+std::size_t NodeTime::users(0);
+
+NodeTime::NodeTime() noexcept
+    : ticks(0) {
+}
+
+NodeTime::NodeTime(const Timestamp &t) noexcept
+    : ticks(0) {
+  *this = t;
+}
+
+NodeTime &
+NodeTime::operator=(const Timestamp &t) noexcept {
+  if (t.value <= base.value) {
+    ticks = 0;
+  } else {
+    const std::uint64_t result = (t.value - base.value) / resolution;
+    ticks = result > UINT32_MAX ? UINT32_MAX : std::uint32_t(result);
+  }
+  return *this;
+}
+
+NodeTime::operator Timestamp() const noexcept {
+  return Timestamp(base.value + std::uint64_t(ticks) * resolution);
+}
+
+bool
+NodeTime::start(const Timestamp &now) noexcept {
+  if (users++ > 0) {
+    return false;
+  }
+
+  const std::uint64_t slack = 24 * 60 * 60 * 1000;
+  const std::uint64_t result = now.value > slack ? now.value - slack : 0;
+  /* on a whole second, a time persisted in seconds is restored exactly */
+  base = Timestamp(result - (result % 1000));
+  return true;
+}
+
+void
+NodeTime::stop() noexcept {
+  assertx(users > 0);
+  --users;
+}
+
+//=====================================
 /*Node*/
 Node::Node() noexcept
-    // timeout{{{
-    : timeout_next(nullptr)
-    , timeout_priv(nullptr)
-    //}}}
-    // activity {{{
-    , remote_activity(0)
-    , req_sent(0) // TODO??
-    //}}}
     //{{{
+    : id()
     , contact()
-    , id()
-    //}}}
     //}}}
     //{{{
-    , outstanding(0)
     , properties{0} //}}}
+    // activity {{{
+    , req_sent() // TODO??
+    , shared(0)
+    //}}}
+    // timeout{{{
+    , timer()
+//}}}
 {
   properties.is_good = true;
 }
 
 Node::Node(const NodeId &nid, const Contact &p) noexcept
-    // timeout{{{
-    : timeout_next(nullptr)
-    , timeout_priv(nullptr)
-    //}}}
-    // activity {{{
-    , remote_activity(0)
-    , req_sent(0) // TODO??
-    //}}}
     //{{{
+    : id(nid)
     , contact(p)
-    , id(nid)
-    //}}}
     //}}}
     //{{{
-    , outstanding(0)
     , properties{0} //}}}
+    // activity {{{
+    , req_sent() // TODO??
+    , shared(0)
+    //}}}
+    // timeout{{{
+    , timer()
+//}}}
 {
   properties.is_good = true;
 }
 
 /*Node*/
 Node::Node(const NodeId &nid, const Contact &p, const Timestamp &act) noexcept
-    // timeout{{{
-    : timeout_next(nullptr)
-    , timeout_priv(nullptr)
-    //}}}
-    // activity {{{
-    , remote_activity(act)
-    , req_sent(act) // TODO??
-    //}}}
     //{{{
+    : id(nid)
     , contact(p)
-    , id(nid)
     //}}}
     //{{{
-    , outstanding(0)
     , properties{0} //}}}
+    // activity {{{
+    , req_sent(act) // TODO??
+    , shared(0)
+    //}}}
+    // timeout{{{
+    , timer()
+//}}}
 {
   properties.is_good = true;
 }
@@ -912,10 +1007,7 @@ Node::Node(const IdContact &node, Timestamp now) noexcept
 }
 
 Node::~Node() noexcept {
-  assertx(!this->timeout_next);
-  assertx(!this->timeout_priv);
-  this->timeout_next = nullptr;
-  this->timeout_priv = nullptr;
+  assertx(!timeout::is_scheduled(this->timer));
 }
 
 #if 0
@@ -932,18 +1024,17 @@ Node::operator==(const IdContact &o) const noexcept {
 
 bool
 operator==(const IdContact &f, const Node &s) noexcept {
-  return f.contact == s.contact && f.id == s.id;
+  return s.contact == f.contact && f.id == s.id;
 }
 
 bool
 is_valid(const Node &n) noexcept {
   bool res = is_valid(n.id);
   if (res) {
-    assertxs(n.timeout_next, n.timeout_next, n.timeout_priv, to_hex(n.id));
-    assertxs(n.timeout_priv, n.timeout_priv, n.timeout_next, to_hex(n.id));
+    assertxs(timeout::is_scheduled(n.timer), n.timer.next, n.timer.priv,
+             to_hex(n.id));
   } else {
-    assertx(!n.timeout_next);
-    assertx(!n.timeout_priv);
+    assertx(!timeout::is_scheduled(n.timer));
   }
 
   return res;
@@ -954,23 +1045,13 @@ is_valid(const Node &n) noexcept {
 Peer::Peer(Ipv4 i, Port p, const Timestamp &n, bool s) noexcept
     : contact(i, p)
     , activity(n)
-    , seed(s)
-    //{
-    , timeout_priv(nullptr)
-    , timeout_next(nullptr)
-//}
-{
+    , seed(s) {
 }
 
 Peer::Peer(const Contact &c, const Timestamp &a, bool s) noexcept
     : contact(c)
     , activity(a)
-    , seed(s)
-    //{
-    , timeout_priv(nullptr)
-    , timeout_next(nullptr)
-//}
-{
+    , seed(s) {
 }
 
 // Peer::Peer() noexcept
@@ -999,7 +1080,8 @@ operator>(const Contact &f, const Peer &s) noexcept {
 
 Timestamp
 activity(const Node &head) noexcept {
-  return Timestamp(head.remote_activity);
+  const NodeLiveness *l = liveness(head);
+  return l ? Timestamp(l->remote_activity) : Timestamp(head.req_sent);
 }
 
 Timestamp
@@ -1007,6 +1089,26 @@ activity(const Peer &peer) noexcept {
   return Timestamp(peer.activity);
 }
 
+// ========================================
+/*dht::Budget*/
+Budget::Budget(std::size_t n) noexcept
+    : remaining(n) {
+}
+
+bool
+spend(Budget &self) noexcept {
+  if (self.remaining == 0) {
+    return false;
+  }
+  --self.remaining;
+  return true;
+}
+
+bool
+is_exhausted(const Budget &self) noexcept {
+  return self.remaining == 0;
+}
+
 // ========================================
 /*dht::Config*/
 Config::Config() noexcept
@@ -1023,26 +1125,100 @@ Config::Config() noexcept
     , max_bucket_not_find_node(5)
     //
     , db_samples_refresh_interval(60)
+    , db_max_peers_per_infohash(512)
+    , db_max_infohashes_per_ip(256)
+    , db_memory_budget(64 * 1024 * 1024)
+    , db_max_values_bytes(1024)
+    , db_snapshot_interval(30)
+    , db_log_flush_interval(sp::Seconds(1))
     //
     , token_key_refresh(15)
     //
     , bootstrap_reset(60)
+    //
+    , routing_table_cap(8 * 1024)
+    //
+    , scrape_revisit_min(60)
+    , scrape_revisit_max(6 * 60)
+    //
+    , rto_min(sp::Seconds(1))
+    , rto_max(sp::Seconds(10))
+    //
+    , tx_reserved{10, 10, 5, 0}
+    , tx_limit{100, 100, 50, 75}
+    //
+    , node_max_timeouts(3)
+    //
+    , awake_budget(512)
 //
 {
 }
 
 // ========================================
-TokenKey::TokenKey() noexcept
-    : key{}
-    , created{0} {
+const char *
+to_string(TxClass cls) noexcept {
+  switch (cls) {
+  case TxClass::SEARCH:
+    return "search";
+  case TxClass::MAINTENANCE:
+    return "maintenance";
+  case TxClass::BOOTSTRAP:
+    return "bootstrap";
+  case TxClass::SCRAPE:
+    return "scrape";
+  }
+  return "unknown";
 }
 
-//=====================================
-get_peers_context::~get_peers_context() {
+// ========================================
+/*dht::Rtt*/
+Rtt::Rtt() noexcept
+    : srtt(0)
+    , rttvar(0)
+    , samples(0) {
+}
+
+void
+rtt_sample(Rtt &self, sp::Milliseconds latency) noexcept {
+  const std::uint64_t ms = latency.value;
+  const std::uint32_t r = std::uint32_t(std::min(ms, std::uint64_t(~0u)));
+
+  if (self.samples == 0) {
+    self.srtt = r;
+    self.rttvar = r / 2;
+  } else {
+    const std::uint32_t delta = self.srtt > r ? self.srtt - r : r - self.srtt;
+    self.rttvar = std::uint32_t((std::uint64_t(self.rttvar) * 3 + delta) / 4);
+    self.srtt = std::uint32_t((std::uint64_t(self.srtt) * 7 + r) / 8);
+  }
+
+  if (self.samples != UINT32_MAX) {
+    ++self.samples;
+  }
 }
 
-ScrapeContext::ScrapeContext(const dht::Infohash &ih)
-    : infohash(ih) {
+sp::Milliseconds
+rto(const Rtt &self, std::size_t backoff, const Config &cfg) noexcept {
+  if (self.samples == 0) {
+    return sp::Milliseconds(cfg.transaction_timeout);
+  }
+
+  const std::uint64_t min = cfg.rto_min.value;
+  const std::uint64_t max = cfg.rto_max.value;
+  std::uint64_t result =
+      std::uint64_t(self.srtt) + (std::uint64_t(self.rttvar) * 4);
+  result = std::max(min, std::min(result, max));
+  for (std::size_t i = 0; i < backoff && result < max; ++i) {
+    result *= 2;
+  }
+
+  return sp::Milliseconds(std::min(result, max));
+}
+
+// ========================================
+TokenKey::TokenKey() noexcept
+    : key{}
+    , created{0} {
 }
 
 //=====================================
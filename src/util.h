@@ -13,6 +13,8 @@
 #include <netinet/in.h>
 #include <util/timeout.h>
 
+#include "timer_wheel.h"
+
 using sp::fd;
 
 //=====================================
@@ -420,26 +422,82 @@ namespace dht {
 enum class NodeIdValid : std::uint8_t { VALID, NOT_VALID, NOT_YET };
 
 //=====================================
-struct Node {
-  // timeout {{{
-  Node *timeout_next;
-  Node *timeout_priv;
-  // }}}
+/* IPv4 address of a routing table Node, unlike Ip it does not carry a type
+ * since the routing table only contains IPv4 nodes.
+ */
+struct NodeIp {
+  Ipv4 ipv4;
 
-  // activity {{{
-  /* When we received request or response from remote */
-  Timestamp remote_activity;
-  /* When we sent a request to remote */
-  Timestamp req_sent;
-  //}}}
+  NodeIp() noexcept;
+  explicit NodeIp(Ipv4) noexcept;
+
+  operator Ip() const noexcept;
+
+  bool
+  operator==(const NodeIp &) const noexcept;
+};
+
+/* Packed IPv4:port of a routing table Node */
+struct NodeContact {
+  NodeIp ip;
+  Port port;
+
+  NodeContact() noexcept;
+  explicit NodeContact(const Contact &) noexcept;
+
+  NodeContact &
+  operator=(const Contact &) noexcept;
+
+  operator Contact() const noexcept;
+
+  bool
+  operator==(const NodeContact &) const noexcept;
+
+  bool
+  operator==(const Contact &) const noexcept;
+};
+
+/* Timestamp stored in 32bit as the number of $resolution ticks since a per
+ * process $base, a range of about 13 years. Times before $base are stored as
+ * $base and times past the range as the end of the range.
+ */
+struct NodeTime {
+  /* milliseconds per tick */
+  static constexpr std::uint64_t resolution = 100;
+  static Timestamp base;
+  /* number of started and not yet stopped users of $base */
+  static std::size_t users;
+
+  std::uint32_t ticks;
+
+  NodeTime() noexcept;
+  NodeTime(const Timestamp &) noexcept;
 
+  NodeTime &
+  operator=(const Timestamp &) noexcept;
+
+  operator Timestamp() const noexcept;
+
+  /* Set $base a day before $now, so times restored from before the start of
+   * the process are still in range. Every DHT of the process shares $base so
+   * it is only set by the first user, true if it was set.
+   */
+  static bool
+  start(const Timestamp &now) noexcept;
+
+  /* When the last user has stopped the next start() sets $base again */
+  static void
+  stop() noexcept;
+};
+
+//=====================================
+struct Node {
   //{{{
-  Contact contact;
   NodeId id;
+  NodeContact contact;
   // }}}
 
   //{{{
-  std::uint8_t outstanding;
 #if 0
   NodeIdValid valid_id; // TODO Bitmask flag
   bool good;            // TODO Bitmask flag
@@ -455,6 +513,22 @@ struct Node {
     bool support_sample_infohashes : 1;
   } properties;
 
+  // activity {{{
+  /* When we sent a request to remote from this routing table */
+  NodeTime req_sent;
+  /* Index of the liveness shared between routing tables, see
+   * dht::liveness(). 0 when not part of a routing table.
+   */
+  std::uint32_t shared;
+  //}}}
+
+  // timeout {{{
+  /* Scheduled in the timeout wheel of its routing table, linked by the slab
+   * index of the nodes, see dht::node_at()
+   */
+  timeout::Timer timer;
+  // }}}
+
   Node() noexcept;
   Node(const NodeId &, const Contact &) noexcept;
   Node(const NodeId &, const Contact &, const Timestamp &) noexcept;
@@ -553,15 +627,9 @@ struct KContact {
 // dht::Peer
 struct Peer {
   Contact contact;
-  Timestamp activity;
+  NodeTime activity;
   bool seed;
-  // // {
-  // Peer *next;
-  // // }
-  // {
-  Peer *timeout_priv;
-  Peer *timeout_next;
-  // }
+
   Peer(Ipv4, Port, const Timestamp &, bool) noexcept;
   Peer(const Contact &, const Timestamp &, bool) noexcept;
   // Peer() noexcept;
@@ -593,6 +661,41 @@ activity(const Node &) noexcept;
 Timestamp
 activity(const Peer &) noexcept;
 
+//=====================================
+// dht::TxClass
+/* Priority class of an outgoing request, in order of decreasing priority */
+enum class TxClass : std::uint8_t {
+  /* user initiated lookups, sp_search */
+  SEARCH = 0,
+  /* routing table ping and find_node refresh */
+  MAINTENANCE = 1,
+  BOOTSTRAP = 2,
+  SCRAPE = 3,
+};
+
+static constexpr std::size_t tx_classes = 4;
+
+const char *
+to_string(TxClass) noexcept;
+
+//=====================================
+// dht::Budget
+/* The work an awake callback may do in one tick, the remainder is deferred to
+ * the next tick so incoming packets are serviced in between.
+ */
+struct Budget {
+  std::size_t remaining;
+
+  explicit Budget(std::size_t) noexcept;
+};
+
+/* Use one unit of work, false if $budget is exhausted */
+bool
+spend(Budget &) noexcept;
+
+bool
+is_exhausted(const Budget &) noexcept;
+
 //=====================================
 // dht::Config
 struct Config {
@@ -633,16 +736,92 @@ struct Config {
   std::size_t max_bucket_not_find_node;
 
   sp::Minutes db_samples_refresh_interval;
+  /* The max number of peers stored for an infohash, when full the least
+   * recently announced peer is replaced.
+   */
+  std::uint32_t db_max_peers_per_infohash;
+  /* The max number of infohashes a single IP can be stored as a peer for */
+  std::uint32_t db_max_infohashes_per_ip;
+  /* Bytes of heap memory the peer db may use, instead of growing beyond it
+   * the infohashes with the fewest recent get_peers lookups and peers are
+   * evicted.
+   */
+  std::size_t db_memory_budget;
+  /* Max bytes of encoded peers in a get_peers reply, keeps the reply within a
+   * single datagram below the path MTU.
+   */
+  std::size_t db_max_values_bytes;
+  /* The interval of the peer db snapshots, the write-ahead log of the changes
+   * since the last snapshot is replayed on startup.
+   */
+  sp::Minutes db_snapshot_interval;
+  /* Max delay before a logged peer db change is written to disk */
+  sp::Milliseconds db_log_flush_interval;
 
   /*  */
   sp::Minutes token_key_refresh;
   /*  */
   sp::Minutes bootstrap_reset;
+  /* The maximum number of RoutingTable:s allocated at the same time from the
+   * slab shared by the main and all scrape routing tables.
+   */
+  std::size_t routing_table_cap;
+  /* Bounds of the time before a node is sent sample_infohashes again, the
+   * interval in its last sample_infohashes response is clamped to them.
+   */
+  sp::Minutes scrape_revisit_min;
+  sp::Minutes scrape_revisit_max;
+  /* Lower and upper bound of the retransmission timeout derived from the
+   * measured round trip time of a remote. The RTO is used as the expiry of an
+   * outgoing transaction once there is at least one RTT sample, before that
+   * /transaction_timeout/ is used.
+   */
+  sp::Milliseconds rto_min;
+  sp::Milliseconds rto_max;
+  /* Percentage of the transactions reserved for each TxClass. A class may
+   * borrow any free transaction which is not reserved by a class of higher
+   * priority, up to /tx_limit/.
+   */
+  std::uint8_t tx_reserved[tx_classes];
+  /* Percentage of the transactions a TxClass may have in flight */
+  std::uint8_t tx_limit[tx_classes];
+  /* A node is no longer good after this many consecutive transactions to it
+   * timed out, without waiting for the next ping round.
+   */
+  std::uint8_t node_max_timeouts;
+  /* The number of expired transactions, routing table nodes or infohashes
+   * with expired peers an awake callback processes per tick before deferring
+   * the rest to the next tick.
+   */
+  std::size_t awake_budget;
 
   Config() noexcept;
   Config(const Config &) = delete;
 };
 
+//=====================================
+// dht::Rtt
+/* Smoothed round trip time and its variance in milliseconds, maintained as
+ * SRTT/RTTVAR described in RFC6298.
+ */
+struct Rtt {
+  std::uint32_t srtt;
+  std::uint32_t rttvar;
+  std::uint32_t samples;
+
+  Rtt() noexcept;
+};
+
+void
+rtt_sample(Rtt &, sp::Milliseconds) noexcept;
+
+/* SRTT + 4 * RTTVAR clamped to [rto_min, rto_max], /transaction_timeout/ when
+ * there is no sample. The RTO is doubled for each of the $backoff consecutive
+ * timeouts since the last sample, up to rto_max (RFC 6298 5.5).
+ */
+sp::Milliseconds
+rto(const Rtt &, std::size_t backoff, const Config &) noexcept;
+
 // ========================================
 struct TokenKey {
   uint32_t key;
@@ -650,17 +829,6 @@ struct TokenKey {
   TokenKey() noexcept;
 };
 
-// ========================================
-struct get_peers_context {
-  int dummy;
-  virtual ~get_peers_context();
-};
-
-struct ScrapeContext : get_peers_context {
-  dht::Infohash infohash;
-  ScrapeContext(const dht::Infohash &infohash);
-};
-
 //=====================================
 bool
 support_sample_infohashes(const sp::byte version[DHT_VERSION_LEN]) noexcept;
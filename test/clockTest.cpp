@@ -0,0 +1,105 @@
+#include "clock.h"
+#include "gtest/gtest.h"
+#include <db.h>
+#include <shared.h>
+#include <transaction.h>
+
+using namespace dht;
+
+TEST(clockTest, test_fake) {
+  Clock clock;
+  init_fake(clock, Timestamp(1000));
+  ASSERT_EQ(std::uint64_t(1000), std::uint64_t(read(clock)));
+  ASSERT_EQ(std::uint64_t(1000), std::uint64_t(read(clock)));
+
+  advance(clock, sp::Milliseconds(250));
+  ASSERT_EQ(std::uint64_t(1250), std::uint64_t(read(clock)));
+}
+
+TEST(clockTest, test_monotonic) {
+  Clock clock;
+  Timestamp previous = read(clock);
+  ASSERT_TRUE(previous > Timestamp(0));
+  for (std::size_t i = 0; i < 1000; ++i) {
+    Timestamp current = read(clock);
+    ASSERT_TRUE(current >= previous);
+    previous = current;
+  }
+}
+
+TEST(clockTest, test_tick) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(5'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  init_fake(dht->clock, now);
+
+  advance(dht->clock, sp::Milliseconds(10));
+  ASSERT_EQ(std::uint64_t(5'000'010), std::uint64_t(tick(*dht)));
+  ASSERT_EQ(std::uint64_t(5'000'010), std::uint64_t(dht->now));
+  ASSERT_EQ(std::uint64_t(5'000'010), std::uint64_t(now));
+
+  /* never goes backwards */
+  init_fake(dht->clock, Timestamp(4'000'000));
+  ASSERT_EQ(std::uint64_t(5'000'010), std::uint64_t(tick(*dht)));
+}
+
+TEST(clockTest, test_token_rotation) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(1'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  init_fake(dht->clock, now);
+
+  dht::Node node(NodeId(), Contact(0x7f000001, 4711));
+  dht::Token first;
+  db::mint_token(dht->db, node.contact, first);
+  ASSERT_TRUE(db::is_valid_token(dht->db, node, first));
+
+  const sp::Milliseconds refresh(dht->config.token_key_refresh);
+  advance(dht->clock, sp::Milliseconds(refresh.value + 1));
+  tick(*dht);
+  dht::Token second;
+  db::mint_token(dht->db, node.contact, second);
+  ASSERT_FALSE(first == second);
+  ASSERT_TRUE(db::is_valid_token(dht->db, node, first));
+  ASSERT_TRUE(db::is_valid_token(dht->db, node, second));
+
+  advance(dht->clock, sp::Milliseconds(refresh.value + 1));
+  tick(*dht);
+  dht::Token third;
+  db::mint_token(dht->db, node.contact, third);
+  ASSERT_FALSE(db::is_valid_token(dht->db, node, first));
+  ASSERT_TRUE(db::is_valid_token(dht->db, node, second));
+  ASSERT_TRUE(db::is_valid_token(dht->db, node, third));
+}
+
+TEST(clockTest, test_tx_timeout) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(1'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  init_fake(dht->clock, now);
+
+  krpc::Transaction t;
+  tx::TxContext h;
+  ASSERT_TRUE(tx::mint_transaction(*dht, t, h));
+
+  const sp::Milliseconds timeout(dht->config.transaction_timeout);
+  advance(dht->clock, sp::Milliseconds(timeout.value - 1));
+  tick(*dht);
+  tx::eager_tx_timeout(*dht);
+  ASSERT_TRUE(tx::is_valid(*dht, t));
+
+  advance(dht->clock, sp::Milliseconds(1));
+  tick(*dht);
+  tx::eager_tx_timeout(*dht);
+  ASSERT_FALSE(tx::is_valid(*dht, t));
+  ASSERT_EQ(0u, client.active);
+}
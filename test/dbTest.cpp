@@ -0,0 +1,1121 @@
+#include "db.h"
+#include "infohash_table.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <list/SkipList.h>
+#include <map>
+#include <prng/util.h>
+#include <prng/xorshift.h>
+#include <shared.h>
+#include <string>
+#include <thread>
+#include <tree/avl.h>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#if __GLIBC_PREREQ(2, 33)
+#define HAVE_MALLINFO2
+#endif
+#endif
+
+using namespace dht;
+
+static Infohash
+make_infohash(prng::xorshift32 &r) {
+  Infohash result;
+  fill(r, result.id, sizeof(result.id));
+  return result;
+}
+
+static std::string
+key_of(const Infohash &ih) {
+  return std::string((const char *)ih.id, sizeof(ih.id));
+}
+
+TEST(dbTest, test_table) {
+  prng::xorshift32 r(1);
+  db::InfohashTable table(1234);
+  std::map<std::string, std::uint32_t> ref;
+
+  std::vector<Infohash> keys;
+  for (std::size_t i = 0; i < 5000; ++i) {
+    keys.push_back(make_infohash(r));
+  }
+
+  for (std::size_t i = 0; i < 200'000; ++i) {
+    const Infohash &ih = keys[random(r) % keys.size()];
+    const std::string key = key_of(ih);
+    switch (random(r) % 3) {
+    case 0: {
+      bool inserted = false;
+      KeyValue *kv = db::insert(table, ih, inserted);
+      ASSERT_TRUE(kv);
+      ASSERT_TRUE(kv->id == ih);
+      ASSERT_EQ(ref.count(key) == 0, inserted);
+      const Peer peer(Contact(Ipv4(i), Port(1)), Timestamp(0), false);
+      ASSERT_TRUE(push_back(kv->peers, table.pool, peer));
+      ref[key]++;
+    } break;
+    case 1:
+      ASSERT_EQ(ref.erase(key) == 1, db::remove(table, ih));
+      break;
+    default: {
+      KeyValue *kv = db::find(table, ih);
+      ASSERT_EQ(ref.count(key) == 1, kv != nullptr);
+      if (kv) {
+        ASSERT_EQ(ref[key], length(kv->peers));
+      }
+    } break;
+    }
+    ASSERT_EQ(ref.size(), length(table));
+  }
+
+  std::size_t visited = 0;
+  for_each(table, [&](const KeyValue &cur) {
+    ASSERT_EQ(1u, ref.count(key_of(cur.id)));
+    ++visited;
+  });
+  ASSERT_EQ(ref.size(), visited);
+
+  std::size_t removed = remove_if(table, [&](KeyValue &cur) {
+    if (cur.id.id[0] & 1) {
+      ref.erase(key_of(cur.id));
+      return true;
+    }
+    return false;
+  });
+  ASSERT_TRUE(removed > 0);
+  ASSERT_EQ(ref.size(), length(table));
+  for (const auto &ih : keys) {
+    ASSERT_EQ(ref.count(key_of(ih)) == 1, db::find(table, ih) != nullptr);
+  }
+}
+
+TEST(dbTest, test_concurrent_readers) {
+  constexpr std::size_t infohashes = 64;
+  constexpr std::size_t max_peers = 1024;
+  prng::xorshift32 r(1);
+  db::InfohashTable table(1234);
+  std::atomic<bool> done(false);
+  std::atomic<std::size_t> reads(0);
+
+  std::vector<Infohash> keys;
+  for (std::size_t i = 0; i < infohashes; ++i) {
+    keys.push_back(make_infohash(r));
+  }
+
+  /* every peer of the i:th key has port i, a torn read shows up as a peer of
+   * another key or as peers out of order */
+  std::thread readers[4];
+  for (std::size_t t = 0; t < 4; ++t) {
+    readers[t] = std::thread([&, t] {
+      prng::xorshift32 rr(std::uint32_t(t + 1));
+      std::size_t reader = 0;
+      ASSERT_TRUE(dht::register_reader(table.epoch, reader));
+      auto *out = (Peer *)malloc(sizeof(Peer) * max_peers);
+      while (!done.load()) {
+        const std::size_t k = random(rr) % infohashes;
+        const std::size_t n =
+            read_peers(table, reader, keys[k], out, max_peers);
+        reads += n > 0;
+        for (std::size_t i = 0; i < n; ++i) {
+          ASSERT_EQ(k, std::size_t(out[i].contact.port));
+          if (i > 0) {
+            ASSERT_LT(out[i - 1].contact.ip.ipv4, out[i].contact.ip.ipv4);
+          }
+        }
+      }
+      free(out);
+      dht::unregister_reader(table.epoch, reader);
+    });
+  }
+
+  /* until the readers have raced with the writer for a while */
+  for (std::uint32_t i = 1; i < 200'000 || reads.load() < 200'000; ++i) {
+    const std::size_t k = random(r) % infohashes;
+    const Infohash &ih = keys[k];
+    if (random(r) % 8 == 0) {
+      db::remove(table, ih);
+    } else {
+      bool inserted = false;
+      db::write_begin(table, ih);
+      KeyValue *kv = db::insert(table, ih, inserted);
+      ASSERT_TRUE(kv);
+      /* a few keys grow beyond the size classes of the pool */
+      const std::size_t cap = k < 8 ? max_peers : 8;
+      if (length(kv->peers) == cap) {
+        drop_front(kv->peers, table.pool, cap / 2);
+      }
+      const Peer peer(Contact(Ipv4(i), Port(k)), Timestamp(0), false);
+      ASSERT_TRUE(push_back(kv->peers, table.pool, peer));
+      db::write_end(table, ih);
+    }
+    if (i % 1024 == 0) {
+      dht::collect(table.epoch);
+    }
+  }
+  done.store(true);
+  for (std::thread &cur : readers) {
+    cur.join();
+  }
+
+  /* without readers the peers are still readable */
+  std::size_t reader = 0;
+  ASSERT_TRUE(dht::register_reader(table.epoch, reader));
+  auto *out = (Peer *)malloc(sizeof(Peer) * max_peers);
+  for (std::size_t k = 0; k < infohashes; ++k) {
+    const KeyValue *kv = db::find((const db::InfohashTable &)table, keys[k]);
+    const std::size_t n = read_peers(table, reader, keys[k], out, max_peers);
+    ASSERT_EQ(kv ? length(kv->peers) : 0u, n);
+  }
+  free(out);
+  dht::unregister_reader(table.epoch, reader);
+}
+
+TEST(dbTest, test_peer_list) {
+  Pool pool;
+  PeerList peers;
+  for (std::uint32_t i = 0; i < 10; ++i) {
+    ASSERT_TRUE(push_back(peers, pool, Peer(Contact(Ipv4(i), Port(1)),
+                                            Timestamp(i * 1000), false)));
+  }
+  ASSERT_EQ(block_size(16 * sizeof(Peer)), pool.used);
+  ASSERT_EQ(10u, length(peers));
+
+  Peer *p = find(peers, Contact(Ipv4(3), Port(1)));
+  ASSERT_TRUE(p);
+  p = touch(peers, p);
+  ASSERT_EQ(peers.data + 9, p);
+  ASSERT_TRUE(peers.data[3] == Contact(Ipv4(4), Port(1)));
+  ASSERT_TRUE(find(peers, Contact(Ipv4(42), Port(1))) == nullptr);
+
+  drop_front(peers, pool, 4);
+  ASSERT_EQ(6u, length(peers));
+  ASSERT_TRUE(peers.data[0] == Contact(Ipv4(5), Port(1)));
+  ASSERT_TRUE(peers.data[5] == Contact(Ipv4(3), Port(1)));
+
+  drop_front(peers, pool, 6);
+  ASSERT_TRUE(is_empty(peers));
+  ASSERT_EQ(0u, pool.used);
+}
+
+TEST(dbTest, test_names) {
+  prng::xorshift32 r(1);
+  db::InfohashTable table(1234);
+
+  std::vector<Infohash> keys;
+  for (std::size_t i = 0; i < 300; ++i) {
+    keys.push_back(make_infohash(r));
+    bool inserted = false;
+    KeyValue *kv = db::insert(table, keys.back(), inserted);
+    ASSERT_TRUE(kv);
+    const std::string name = "name" + std::to_string(i % 3);
+    ASSERT_TRUE(db::set_name(table, *kv, name.c_str()));
+    ASSERT_EQ(name, std::string(kv->name->str));
+  }
+  /* equal names are interned once */
+  ASSERT_EQ(3u, table.names.length);
+  ASSERT_EQ(db::find(table, keys[0])->name, db::find(table, keys[3])->name);
+  ASSERT_EQ(100u, db::find(table, keys[0])->name->refs);
+
+  /* renaming releases the previous name */
+  KeyValue *kv = db::find(table, keys[0]);
+  ASSERT_TRUE(db::set_name(table, *kv, "other"));
+  ASSERT_EQ(4u, table.names.length);
+  ASSERT_EQ(99u, db::find(table, keys[3])->name->refs);
+
+  /* names are truncated */
+  const std::string longer(200, 'x');
+  ASSERT_TRUE(db::set_name(table, *kv, longer.c_str()));
+  ASSERT_EQ(128u, kv->name->length);
+  ASSERT_EQ(4u, table.names.length);
+
+  for (const Infohash &ih : keys) {
+    ASSERT_TRUE(db::remove(table, ih));
+  }
+  ASSERT_EQ(0u, table.names.length);
+  ASSERT_EQ(0u, table.names.bytes);
+  ASSERT_EQ(0u, table.pool.used);
+}
+
+TEST(dbTest, test_insert_expire) {
+  const std::uint64_t minute = 60 * 1000;
+  const std::uint64_t start = 5'000'000;
+
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(start);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  Infohash ih = make_infohash(r);
+  const Contact a(Ipv4(1), Port(1));
+  const Contact b(Ipv4(2), Port(1));
+  const Contact c(Ipv4(3), Port(1));
+  ASSERT_TRUE(db::insert(dht->db, ih, a, false, ""));
+  now = Timestamp(start + 10 * minute);
+  ASSERT_TRUE(db::insert(dht->db, ih, b, true, ""));
+  now = Timestamp(start + 20 * minute);
+  ASSERT_TRUE(db::insert(dht->db, ih, c, false, "name"));
+  now = Timestamp(start + 30 * minute);
+  ASSERT_TRUE(db::insert(dht->db, ih, a, true, ""));
+
+  KeyValue *kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv);
+  ASSERT_EQ(3u, length(kv->peers));
+  ASSERT_STREQ("name", kv->name->str);
+  ASSERT_TRUE(kv->peers.data[2] == a);
+  ASSERT_TRUE(kv->peers.data[2].seed);
+
+  /* a is due at 45 minutes but was announced again, the next expiry is a
+   * lower bound of when the wheel has work to do */
+  ASSERT_GE(start + 45 * minute,
+            std::uint64_t(db::next_peer_expiry(dht->db)));
+  now = Timestamp(start + 45 * minute);
+  dht::Budget budget(1);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+  ASSERT_EQ(3u, length(kv->peers));
+
+  /* b expires at 55 minutes, the next expiry is c at 65 minutes */
+  ASSERT_GE(start + 55 * minute,
+            std::uint64_t(db::next_peer_expiry(dht->db)));
+  now = Timestamp(start + 54 * minute);
+  budget = dht::Budget(1);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+  ASSERT_EQ(3u, length(kv->peers));
+  now = Timestamp(start + 56 * minute);
+  budget = dht::Budget(1);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+  ASSERT_GE(start + 65 * minute,
+            std::uint64_t(db::next_peer_expiry(dht->db)));
+  ASSERT_LT(std::uint64_t(now), std::uint64_t(db::next_peer_expiry(dht->db)));
+  kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv);
+  ASSERT_EQ(2u, length(kv->peers));
+  ASSERT_TRUE(find(kv->peers, b) == nullptr);
+
+  now = Timestamp(start + 80 * minute);
+  budget = dht::Budget(2);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+  ASSERT_TRUE(db::lookup(dht->db, ih) == nullptr);
+  ASSERT_TRUE(is_empty(dht->db.lookup_table));
+  ASSERT_EQ(0u, dht->db.expiry.length);
+}
+
+TEST(dbTest, test_expire_budget) {
+  const std::uint64_t minute = 60 * 1000;
+  const std::uint64_t start = 5'000'000;
+
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(start);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  constexpr std::size_t N = 100;
+  for (std::size_t i = 0; i < N; ++i) {
+    ASSERT_TRUE(db::insert(dht->db, make_infohash(r),
+                           Contact(Ipv4(i + 1), Port(1)), false, ""));
+    now = now + sp::Milliseconds(1000);
+  }
+  now = Timestamp(start + 10 * minute);
+  const Infohash late = make_infohash(r);
+  ASSERT_TRUE(db::insert(dht->db, late, Contact(Ipv4(1), Port(1)), false, ""));
+  ASSERT_EQ(N + 1, length(dht->db.lookup_table));
+
+  /* nothing is due, no budget is spent */
+  dht::Budget budget(0);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+
+  /* every infohash except $late is due, 10 are expired per tick */
+  now = Timestamp(start + 47 * minute);
+  for (std::size_t i = 1; i <= N / 10; ++i) {
+    budget = dht::Budget(10);
+    ASSERT_EQ(i == N / 10, db::expire_peers(dht->db, budget));
+    ASSERT_EQ(N + 1 - (i * 10), length(dht->db.lookup_table));
+  }
+  ASSERT_TRUE(db::lookup(dht->db, late));
+  ASSERT_TRUE(db::next_peer_expiry(dht->db) > now);
+}
+
+TEST(dbTest, test_peer_by_ip) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(5'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  /* a NATed peer announcing from a new port replaces the previous port */
+  Infohash ih = make_infohash(r);
+  ASSERT_TRUE(db::insert(dht->db, ih, Contact(Ipv4(1), Port(1000)), false, ""));
+  ASSERT_TRUE(db::insert(dht->db, ih, Contact(Ipv4(2), Port(1000)), false, ""));
+  now = now + sp::Milliseconds(1000);
+  ASSERT_TRUE(db::insert(dht->db, ih, Contact(Ipv4(1), Port(2000)), true, ""));
+
+  KeyValue *kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv);
+  ASSERT_EQ(2u, length(kv->peers));
+  ASSERT_TRUE(kv->peers.data[1] == Contact(Ipv4(1), Port(2000)));
+  ASSERT_TRUE(kv->peers.data[1].seed);
+  ASSERT_EQ(2u, dht->db.ip_quota.length);
+}
+
+TEST(dbTest, test_caps) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(5'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  dht->config.db_max_peers_per_infohash = 4;
+  dht->config.db_max_infohashes_per_ip = 3;
+
+  /* the least recently announced peer is replaced when full */
+  Infohash ih = make_infohash(r);
+  for (std::uint32_t i = 1; i <= 6; ++i) {
+    ASSERT_TRUE(db::insert(dht->db, ih, Contact(Ipv4(i), Port(1)), false, ""));
+    now = now + sp::Milliseconds(1000);
+  }
+  KeyValue *kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv);
+  ASSERT_EQ(4u, length(kv->peers));
+  ASSERT_TRUE(kv->peers.data[0] == Contact(Ipv4(3), Port(1)));
+  ASSERT_EQ(2u, dht->db.peers_evicted);
+  ASSERT_EQ(4u, dht->db.ip_quota.length);
+
+  /* one ip can only be stored for a limited number of infohashes */
+  const Contact flood(Ipv4(42), Port(1));
+  std::vector<Infohash> ihs;
+  for (std::size_t i = 0; i < 5; ++i) {
+    ihs.push_back(make_infohash(r));
+    ASSERT_EQ(i < 3, db::insert(dht->db, ihs.back(), flood, false, ""));
+  }
+  ASSERT_EQ(2u, dht->db.ip_capped);
+  ASSERT_TRUE(db::lookup(dht->db, ihs[2]));
+  ASSERT_TRUE(db::lookup(dht->db, ihs[3]) == nullptr);
+  ASSERT_TRUE(db::lookup(dht->db, ihs[4]) == nullptr);
+
+  /* re-announcing an infohash it is already stored for is fine */
+  ASSERT_TRUE(db::insert(dht->db, ihs[0], flood, true, ""));
+
+  /* its quota is released when the peers expire */
+  now = now + sp::Milliseconds(sp::Minutes(46));
+  dht::Budget budget(100);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+  ASSERT_TRUE(is_empty(dht->db.lookup_table));
+  ASSERT_EQ(0u, dht->db.ip_quota.length);
+  ASSERT_TRUE(db::insert(dht->db, ihs[4], flood, false, ""));
+}
+
+static void
+assert_accounting(const db::DHTMetaDatabase &db) {
+  const db::InfohashTable &table = db.lookup_table;
+  std::size_t peers = 0;
+  for_each(table, [&peers](const KeyValue &cur) { //
+    peers += length(cur.peers);
+  });
+  ASSERT_EQ(peers, db.peers);
+
+  /* everything in the pool is accounted to an entry or a name */
+  ASSERT_EQ(table.pool.used, db.heap_bytes + table.names.bytes);
+}
+
+TEST(dbTest, test_memory_budget) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(5'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  const Infohash hot = make_infohash(r);
+  const Contact hot_peer(Ipv4(1), Port(1));
+  ASSERT_TRUE(db::insert(dht->db, hot, hot_peer, false, "hot"));
+  for (std::size_t i = 0; i < 50; ++i) {
+    ASSERT_TRUE(db::lookup(dht->db, hot));
+  }
+
+  std::vector<Infohash> ihs;
+  for (std::uint32_t i = 0; i < 300; ++i) {
+    ihs.push_back(make_infohash(r));
+    const Contact c(Ipv4(1000 + i), Port(1));
+    ASSERT_TRUE(db::insert(dht->db, ihs.back(), c, false, ""));
+  }
+  ASSERT_EQ(0u, dht->db.evictions);
+  ASSERT_EQ(301u, dht->db.peers);
+  assert_accounting(dht->db);
+
+  /* announces which would grow the db beyond the budget evict the cold
+   * infohashes and reuse their memory, or are refused if that does not make
+   * room */
+  const dht::Pool &pool = dht->db.lookup_table.pool;
+  const std::size_t reserved = pool.reserved;
+  dht->config.db_memory_budget = memory(dht->db);
+  for (std::uint32_t i = 0; i < 1500; ++i) {
+    const Infohash ih = make_infohash(r);
+    /* peer lists of different size classes */
+    const std::uint32_t n = 1 + (random(r) % 16);
+    char name[16] = "";
+    if (i % 4 == 0) {
+      snprintf(name, sizeof(name), "name%u", i % 8);
+    }
+    for (std::uint32_t k = 0; k < n; ++k) {
+      /* the IPs are already stored */
+      const Contact c(Ipv4(1000 + (random(r) % 300)), Port(1));
+      db::insert(dht->db, ih, c, false, name);
+      ASSERT_LE(memory(dht->db), dht->config.db_memory_budget);
+    }
+    assert_accounting(dht->db);
+  }
+  ASSERT_LT(0u, dht->db.evictions);
+  ASSERT_EQ(reserved, pool.reserved);
+  ASSERT_TRUE(db::lookup(dht->db, hot));
+
+  /* an evicted infohash released its expiry */
+  ASSERT_EQ(length(dht->db.lookup_table), dht->db.expiry.length);
+  now = now + sp::Milliseconds(sp::Minutes(46));
+  dht::Budget budget(10'000);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+  ASSERT_TRUE(is_empty(dht->db.lookup_table));
+  ASSERT_EQ(0u, dht->db.heap_bytes);
+  ASSERT_EQ(0u, dht->db.peers);
+  ASSERT_EQ(0u, dht->db.ip_quota.length);
+}
+
+struct Filters {
+  std::uint8_t seeds[256];
+  std::uint8_t peers[256];
+
+  bool
+  operator==(const Filters &o) const {
+    return memcmp(seeds, o.seeds, sizeof(seeds)) == 0 &&
+           memcmp(peers, o.peers, sizeof(peers)) == 0;
+  }
+};
+
+/* filters built from scratch for the peers $ips where odd ips are seeds */
+static Filters
+fresh_filters(const std::vector<std::uint32_t> &ips) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(5'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  const Infohash ih = make_infohash(r);
+  for (std::uint32_t ip : ips) {
+    const Contact c(Ipv4(ip), Port(1));
+    EXPECT_TRUE(db::insert(dht->db, ih, c, ip % 2 == 1, ""));
+  }
+
+  Filters result{};
+  KeyValue *kv = db::lookup(dht->db, ih);
+  EXPECT_TRUE(kv);
+  if (kv) {
+    db::scrape(dht->db, *kv, result.seeds, result.peers);
+  }
+  return result;
+}
+
+TEST(dbTest, test_scrape_bloom) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(5'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  const Infohash ih = make_infohash(r);
+  for (std::uint32_t ip = 1; ip <= 20; ++ip) {
+    const Contact c(Ipv4(ip), Port(1));
+    ASSERT_TRUE(db::insert(dht->db, ih, c, ip % 2 == 1, ""));
+  }
+  KeyValue *kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv);
+  ASSERT_TRUE(kv->bloom == nullptr);
+
+  Filters f{};
+  db::scrape(dht->db, *kv, f.seeds, f.peers);
+  ASSERT_TRUE(kv->bloom);
+  ASSERT_FALSE(kv->bloom->stale);
+
+  std::vector<std::uint32_t> ips;
+  for (std::uint32_t ip = 1; ip <= 20; ++ip) {
+    ips.push_back(ip);
+  }
+  ASSERT_TRUE(fresh_filters(ips) == f);
+
+  /* announces are added without a rebuild */
+  now = now + sp::Milliseconds(sp::Minutes(10));
+  for (std::uint32_t ip = 21; ip <= 30; ++ip) {
+    const Contact c(Ipv4(ip), Port(1));
+    ASSERT_TRUE(db::insert(dht->db, ih, c, ip % 2 == 1, ""));
+    ips.push_back(ip);
+  }
+  kv = db::lookup(dht->db, ih);
+  ASSERT_FALSE(kv->bloom->stale);
+  db::scrape(dht->db, *kv, f.seeds, f.peers);
+  ASSERT_TRUE(fresh_filters(ips) == f);
+
+  /* expired peers are removed from the filters */
+  now = now + sp::Milliseconds(sp::Minutes(40));
+  dht::Budget budget(100);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+  kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv);
+  ASSERT_EQ(10u, length(kv->peers));
+  ASSERT_TRUE(kv->bloom->stale);
+  db::scrape(dht->db, *kv, f.seeds, f.peers);
+  ASSERT_FALSE(kv->bloom->stale);
+
+  ips.erase(ips.begin(), ips.begin() + 20);
+  ASSERT_TRUE(fresh_filters(ips) == f);
+  assert_accounting(dht->db);
+}
+
+/* the contacts of the records in $window */
+static std::vector<Contact>
+window_contacts(const db::PeerWindow &window) {
+  std::vector<Contact> result;
+  for (std::size_t i = 0; i < window.parts; ++i) {
+    EXPECT_EQ(0u, window.length[i] % CompactBlob::record);
+    for (std::size_t o = 0; o < window.length[i]; o += CompactBlob::record) {
+      const sp::byte *const rec = window.part[i] + o;
+      EXPECT_EQ('6', rec[0]);
+      EXPECT_EQ(':', rec[1]);
+      Ipv4 ip;
+      Port port;
+      memcpy(&ip, rec + 2, sizeof(ip));
+      memcpy(&port, rec + 2 + sizeof(ip), sizeof(port));
+      result.push_back(Contact(Ipv4(ntohl(ip)), Port(ntohs(port))));
+    }
+  }
+  return result;
+}
+
+TEST(dbTest, test_values) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(5'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  const std::size_t max = dht->config.db_max_values_bytes / CompactBlob::record;
+
+  const Infohash ih = make_infohash(r);
+  for (std::uint32_t ip = 1; ip <= 300; ++ip) {
+    const Contact c(Ipv4(ip), Port(ip));
+    ASSERT_TRUE(db::insert(dht->db, ih, c, ip % 2 == 1, ""));
+  }
+  KeyValue *kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv);
+
+  /* a window bounded by the reply size at a random start, over a few replies
+   * every peer is returned */
+  std::map<std::uint32_t, std::size_t> seen;
+  for (std::size_t i = 0; i < 40; ++i) {
+    db::PeerWindow window;
+    ASSERT_TRUE(db::values(dht->db, *kv, true, true, window));
+    ASSERT_LE(window.parts, 3u);
+    const std::vector<Contact> contacts = window_contacts(window);
+    ASSERT_EQ(max, contacts.size());
+
+    std::map<std::uint32_t, std::size_t> distinct;
+    for (const Contact &c : contacts) {
+      ASSERT_EQ(Port(c.ip.ipv4), c.port);
+      ASSERT_TRUE(c.ip.ipv4 >= 1 && c.ip.ipv4 <= 300);
+      distinct[c.ip.ipv4]++;
+      seen[c.ip.ipv4]++;
+    }
+    ASSERT_EQ(max, distinct.size());
+  }
+  ASSERT_EQ(300u, seen.size());
+
+  /* noseed selects the non seeds, announces are appended without a rebuild */
+  ASSERT_TRUE(db::insert(dht->db, ih, Contact(Ipv4(302), Port(302)), false,
+                         ""));
+  kv = db::lookup(dht->db, ih);
+  ASSERT_FALSE(kv->compact->stale);
+  ASSERT_EQ(151u, kv->compact->peers.length);
+  for (std::size_t i = 0; i < 5; ++i) {
+    db::PeerWindow window;
+    ASSERT_TRUE(db::values(dht->db, *kv, false, true, window));
+    for (const Contact &c : window_contacts(window)) {
+      ASSERT_EQ(0u, c.ip.ipv4 % 2);
+    }
+  }
+
+  /* a changed port is picked up */
+  ASSERT_TRUE(db::insert(dht->db, ih, Contact(Ipv4(1), Port(9)), true, ""));
+  kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv->compact->stale);
+  dht->config.db_max_values_bytes = 1024 * CompactBlob::record;
+  db::PeerWindow window;
+  ASSERT_TRUE(db::values(dht->db, *kv, true, false, window));
+  const std::vector<Contact> seeds = window_contacts(window);
+  ASSERT_EQ(150u, seeds.size());
+  ASSERT_EQ(1u, std::count(seeds.begin(), seeds.end(),
+                           Contact(Ipv4(1), Port(9))));
+  assert_accounting(dht->db);
+}
+
+TEST(dbTest, test_read_budget) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(5'000'000);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  const std::size_t max = dht->config.db_max_values_bytes / CompactBlob::record;
+
+  std::vector<std::uint32_t> ips;
+  const Infohash ih = make_infohash(r);
+  for (std::uint32_t ip = 1; ip <= 300; ++ip) {
+    ASSERT_TRUE(db::insert(dht->db, ih, Contact(Ipv4(ip), Port(ip)),
+                           ip % 2 == 1, ""));
+    ips.push_back(ip);
+  }
+  const Infohash cold = make_infohash(r);
+  ASSERT_TRUE(db::insert(dht->db, cold, Contact(Ipv4(1000), Port(1)), false,
+                         ""));
+  KeyValue *kv = db::lookup(dht->db, ih);
+  ASSERT_TRUE(kv);
+
+  /* use up the pool so caching would have to reserve another arena */
+  dht::Pool &pool = dht->db.lookup_table.pool;
+  std::vector<std::pair<void *, std::size_t>> filler;
+  for (std::size_t size : {sizeof(ScrapeBloom), sizeof(CompactPeers),
+                           150 * CompactBlob::record}) {
+    while (growth(pool, &size, 1) == 0) {
+      filler.emplace_back(allocate(pool, size), size);
+    }
+  }
+
+  /* the reads are answered without caching, nothing is evicted for them */
+  dht->config.db_memory_budget = memory(dht->db);
+  const std::size_t before = memory(dht->db);
+  Filters filters{};
+  db::scrape(dht->db, *kv, filters.seeds, filters.peers);
+  ASSERT_FALSE(kv->bloom);
+  ASSERT_TRUE(fresh_filters(ips) == filters);
+
+  db::PeerWindow window;
+  ASSERT_TRUE(db::values(dht->db, *kv, true, true, window));
+  ASSERT_FALSE(kv->compact);
+  ASSERT_EQ(1u, window.parts);
+  const std::vector<Contact> contacts = window_contacts(window);
+  ASSERT_EQ(max, contacts.size());
+  for (const Contact &c : contacts) {
+    ASSERT_EQ(Port(c.ip.ipv4), c.port);
+  }
+  ASSERT_EQ(before, memory(dht->db));
+  ASSERT_EQ(0u, dht->db.evictions);
+  ASSERT_TRUE(find(dht->db.lookup_table, cold));
+
+  /* cached again once there is room */
+  dht->config.db_memory_budget = memory(dht->db) + Pool::arena;
+  ASSERT_TRUE(db::values(dht->db, *kv, true, true, window));
+  ASSERT_TRUE(kv->compact);
+  ASSERT_EQ(0u, dht->db.evictions);
+  for (const auto &cur : filler) {
+    deallocate(pool, cur.first, cur.second);
+  }
+  assert_accounting(dht->db);
+}
+
+/* infohash -> name and the sorted peers of every entry */
+static std::map<std::string, std::vector<std::string>>
+db_state(const db::DHTMetaDatabase &db) {
+  std::map<std::string, std::vector<std::string>> result;
+  for_each(db.lookup_table, [&result](const KeyValue &cur) {
+    std::vector<std::string> &out = result[key_of(cur.id)];
+    for_each(cur.peers, [&out](const Peer &p) {
+      char str[128];
+      snprintf(str, sizeof(str), "%u:%u:%llu:%d", p.contact.ip.ipv4,
+               p.contact.port,
+               (unsigned long long)(Timestamp(p.activity).value / 1000),
+               int(p.seed));
+      out.push_back(str);
+    });
+    std::sort(out.begin(), out.end());
+    out.insert(out.begin(), cur.name ? cur.name->str : "");
+  });
+  return result;
+}
+
+TEST(dbTest, test_persist) {
+  const std::uint64_t minute = 60 * 1000;
+  const std::uint64_t start = 1'700'000'000'000;
+
+  char dir[] = "/tmp/dbTest_persistXXXXXX";
+  ASSERT_TRUE(mkdtemp(dir));
+  dht::Options opt;
+  snprintf(opt.dump_file, sizeof(opt.dump_file), "%s/dump", dir);
+
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(start);
+  dht::Client client{s, s};
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  ASSERT_TRUE(db::restore(dht->db));
+  ASSERT_EQ(0u, dht->db.persist.restored_infohashes);
+
+  std::vector<Infohash> ihs;
+  for (std::size_t i = 0; i < 64; ++i) {
+    ihs.push_back(make_infohash(r));
+  }
+  auto announce = [&](std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      const Infohash &ih = ihs[random(r) % ihs.size()];
+      const Contact c(Ipv4(1 + (random(r) % 300)), Port(random(r) % 4));
+      const char *name = random(r) % 8 == 0 ? "name" : "";
+      db::insert(dht->db, ih, c, random(r) % 2 == 0, name);
+      now = now + sp::Milliseconds(random(r) % 2000);
+    }
+  };
+
+  /* the snapshot is written a few entries per call while announces goes on */
+  announce(2000);
+  std::size_t calls = 0;
+  while (dht->db.persist.snapshots == 0) {
+    ASSERT_LT(++calls, 1000u);
+    dht::Budget budget(4);
+    db::persist(dht->db, budget);
+    announce(5);
+  }
+  announce(1000);
+  now = now + sp::Milliseconds(30 * minute);
+  announce(500);
+  dht::Budget budget(1024);
+  ASSERT_TRUE(db::expire_peers(dht->db, budget));
+  ASSERT_TRUE(db::flush(dht->db.persist));
+
+  char file[PATH_MAX + 32];
+  snprintf(file, sizeof(file), "%s.log.0", dht->db.persist.path);
+  ASSERT_FALSE(std::filesystem::exists(file));
+
+  const auto expected = db_state(dht->db);
+  ASSERT_FALSE(expected.empty());
+  const std::size_t peers = dht->db.peers;
+
+  prng::xorshift32 r2(2);
+  Timestamp now2(now);
+  auto restored =
+      std::make_unique<dht::DHT>(Contact(0, 0), client, r2, now2, opt);
+  ASSERT_TRUE(db::restore(restored->db));
+  ASSERT_EQ(expected, db_state(restored->db));
+  ASSERT_EQ(expected.size(), restored->db.persist.restored_infohashes);
+  ASSERT_EQ(peers, restored->db.persist.restored_peers);
+  ASSERT_GT(restored->db.persist.replayed_records, 0u);
+  assert_accounting(restored->db);
+
+  /* peers which expired while the node was down are skipped */
+  restored.reset();
+  now2 = now + sp::Milliseconds(45 * minute);
+  restored = std::make_unique<dht::DHT>(Contact(0, 0), client, r2, now2, opt);
+  ASSERT_TRUE(db::restore(restored->db));
+  ASSERT_EQ(0u, restored->db.persist.restored_peers);
+  ASSERT_TRUE(is_empty(restored->db.lookup_table));
+
+  restored.reset();
+  dht.reset();
+  std::filesystem::remove_all(dir);
+}
+
+TEST(dbTest, test_persist_rehash) {
+  char dir[] = "/tmp/dbTest_persistXXXXXX";
+  ASSERT_TRUE(mkdtemp(dir));
+  dht::Options opt;
+  snprintf(opt.dump_file, sizeof(opt.dump_file), "%s/dump", dir);
+
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(1'700'000'000'000);
+  dht::Client client{s, s};
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  ASSERT_TRUE(db::restore(dht->db));
+
+  std::uint32_t ip = 1;
+  auto add = [&](std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      const Infohash ih = make_infohash(r);
+      for (std::size_t k = 0; k < 40; ++k, ++ip) {
+        ASSERT_TRUE(db::insert(dht->db, ih, Contact(Ipv4(ip), Port(1)),
+                               k % 2 == 0, ""));
+      }
+      now = now + sp::Milliseconds(10);
+    }
+  };
+
+  /* the shards grow while the snapshot is written, a grown shard is written
+   * again without starting over */
+  add(400);
+  const std::uint64_t rehashes = dht->db.lookup_table.rehashes;
+  std::size_t calls = 0;
+  while (dht->db.persist.snapshots == 0) {
+    ASSERT_LT(++calls, 10'000u);
+    dht::Budget budget(4);
+    db::persist(dht->db, budget);
+    add(8);
+  }
+  ASSERT_LT(rehashes, dht->db.lookup_table.rehashes);
+  ASSERT_EQ(1u, dht->db.persist.generation);
+  ASSERT_EQ(0u, dht->db.persist.snapshot_failures);
+  ASSERT_TRUE(db::flush(dht->db.persist));
+
+  const auto expected = db_state(dht->db);
+  prng::xorshift32 r2(2);
+  Timestamp now2(now);
+  auto restored =
+      std::make_unique<dht::DHT>(Contact(0, 0), client, r2, now2, opt);
+  ASSERT_TRUE(db::restore(restored->db));
+  ASSERT_EQ(expected, db_state(restored->db));
+  ASSERT_EQ(dht->db.peers, restored->db.persist.restored_peers);
+  assert_accounting(restored->db);
+
+  restored.reset();
+  dht.reset();
+  std::filesystem::remove_all(dir);
+}
+
+static std::vector<std::string>
+sorted_keys(const sp::UinStaticArray<Infohash, 20> &samples) {
+  std::vector<std::string> result;
+  for_each(samples, [&](const Infohash &cur) { //
+    result.push_back(key_of(cur));
+  });
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+TEST(dbTest, test_samples) {
+  const std::uint64_t hour = 60 * 60 * 1000;
+  const std::uint64_t start = 100 * hour;
+
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now(start);
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  const Contact a(Ipv4(1), Port(1));
+  const Contact b(Ipv4(2), Port(1));
+
+  ASSERT_TRUE(is_empty(db::randomize_samples(dht->db, a)));
+  for (std::size_t i = 0; i < 5; ++i) {
+    ASSERT_TRUE(db::insert(dht->db, make_infohash(r), a, false, ""));
+  }
+  ASSERT_EQ(5u, length(db::randomize_samples(dht->db, a)));
+  for (std::size_t i = 0; i < 95; ++i) {
+    ASSERT_TRUE(db::insert(dht->db, make_infohash(r), a, false, ""));
+  }
+
+  std::vector<std::string> first =
+      sorted_keys(db::randomize_samples(dht->db, a));
+  ASSERT_EQ(20u, first.size());
+  ASSERT_TRUE(std::unique(first.begin(), first.end()) == first.end());
+  for (const auto &key : first) {
+    Infohash ih;
+    memcpy(ih.id, key.data(), sizeof(ih.id));
+    ASSERT_TRUE(db::lookup(dht->db, ih));
+  }
+
+  /* stable for the same requester within the interval */
+  now = Timestamp(start + 10 * 60 * 1000);
+  ASSERT_EQ(first, sorted_keys(db::randomize_samples(dht->db, a)));
+  ASSERT_NE(first, sorted_keys(db::randomize_samples(dht->db, b)));
+  ASSERT_EQ(50u * 60u, db::next_randomize_samples(dht->db, now));
+
+  /* rotated in the next interval */
+  now = Timestamp(start + hour);
+  ASSERT_NE(first, sorted_keys(db::randomize_samples(dht->db, a)));
+  ASSERT_EQ(60u * 60u, db::next_randomize_samples(dht->db, now));
+}
+
+namespace {
+/* The peer db before the open addressing table: an AVL tree of infohashes
+ * where every infohash has a skiplist of peers, its timeout list is left out.
+ */
+struct LegacyPeer {
+  Contact contact;
+  Timestamp activity;
+  bool seed;
+  LegacyPeer *timeout_priv;
+  LegacyPeer *timeout_next;
+
+  LegacyPeer(const Contact &c, const Timestamp &a, bool s) noexcept
+      : contact(c)
+      , activity(a)
+      , seed(s)
+      , timeout_priv(nullptr)
+      , timeout_next(nullptr) {
+  }
+
+  bool
+  operator>(const Contact &o) const noexcept {
+    return contact > o;
+  }
+
+  bool
+  operator>(const LegacyPeer &o) const noexcept {
+    return contact > o.contact;
+  }
+};
+
+bool
+operator>(const Contact &f, const LegacyPeer &s) noexcept {
+  return f > s.contact;
+}
+
+struct LegacyKeyValue {
+  Infohash id;
+  sp::SkipList<LegacyPeer, 6> peers;
+  LegacyPeer *timeout_peer;
+  char *name;
+
+  explicit LegacyKeyValue(const Infohash &ih) noexcept
+      : id(ih)
+      , peers{}
+      , timeout_peer(nullptr)
+      , name(nullptr) {
+  }
+};
+
+bool
+operator>(const LegacyKeyValue &self, const Infohash &o) noexcept {
+  return self.id > o.id;
+}
+
+bool
+operator>(const LegacyKeyValue &self, const LegacyKeyValue &o) noexcept {
+  return self.id > o.id.id;
+}
+
+bool
+operator>(const Infohash &f, const LegacyKeyValue &s) noexcept {
+  return f > s.id.id;
+}
+} // namespace
+
+static std::size_t
+heap_used() {
+#ifdef HAVE_MALLINFO2
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+/* run with --gtest_also_run_disabled_tests */
+TEST(dbTest, DISABLED_bench_announce_lookup) {
+  using ns = std::chrono::nanoseconds;
+  constexpr std::size_t infohashes = std::size_t(1) << 20;
+  constexpr std::size_t announces = infohashes * 2;
+  constexpr std::size_t lookups = std::size_t(1) << 20;
+
+  prng::xorshift32 r(1);
+  std::vector<Infohash> keys;
+  keys.reserve(infohashes);
+  for (std::size_t i = 0; i < infohashes; ++i) {
+    keys.push_back(make_infohash(r));
+  }
+  /* the first pass announces every infohash once */
+  std::vector<std::uint32_t> order(announces);
+  for (std::size_t i = 0; i < announces; ++i) {
+    order[i] = std::uint32_t(i < infohashes ? i : random(r) % infohashes);
+  }
+  const Timestamp now(1000);
+
+  auto report = [&](const char *name, ns announce, ns lookup,
+                    std::size_t bytes) {
+    printf("%s: %zu infohashes, announce %lldns/op, lookup %lldns/op, "
+           "%zu bytes/peer\n",
+           name, infohashes, (long long)announce.count() / (long long)announces,
+           (long long)lookup.count() / (long long)lookups,
+           bytes / announces);
+  };
+
+  {
+    const std::size_t before = heap_used();
+    auto *tree = new avl::Tree<LegacyKeyValue>;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < announces; ++i) {
+      const Infohash &ih = keys[order[i]];
+      const Contact contact(Ipv4(std::uint32_t(i)), Port(1));
+      LegacyKeyValue *kv = find(*tree, ih);
+      if (!kv) {
+        kv = std::get<0>(insert(*tree, ih));
+      }
+      ASSERT_TRUE(kv);
+      LegacyPeer *existing = find(kv->peers, contact);
+      if (existing) {
+        existing->activity = now;
+      } else {
+        ASSERT_TRUE(insert(kv->peers, LegacyPeer(contact, now, false)));
+      }
+    }
+    auto announce = std::chrono::steady_clock::now() - start;
+    const std::size_t bytes = heap_used() - before;
+
+    std::size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < lookups; ++i) {
+      found += find(*tree, keys[random(r) % infohashes]) != nullptr;
+    }
+    auto lookup = std::chrono::steady_clock::now() - start;
+    ASSERT_EQ(lookups, found);
+
+    report("avl+skiplist", std::chrono::duration_cast<ns>(announce),
+           std::chrono::duration_cast<ns>(lookup), bytes);
+    delete tree;
+  }
+
+  {
+    const std::size_t before = heap_used();
+    auto *table = new db::InfohashTable(random(r));
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < announces; ++i) {
+      const Infohash &ih = keys[order[i]];
+      const Contact contact(Ipv4(std::uint32_t(i)), Port(1));
+      bool inserted = false;
+      KeyValue *kv = db::insert(*table, ih, inserted);
+      ASSERT_TRUE(kv);
+      Peer *existing = find(kv->peers, contact);
+      if (existing) {
+        existing->activity = now;
+        touch(kv->peers, existing);
+      } else {
+        const Peer peer(contact, now, false);
+        ASSERT_TRUE(push_back(kv->peers, table->pool, peer));
+      }
+    }
+    auto announce = std::chrono::steady_clock::now() - start;
+    std::size_t bytes = heap_used() - before;
+    if (bytes == 0) {
+      bytes = memory(*table);
+    }
+
+    std::size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < lookups; ++i) {
+      found += db::find(*table, keys[random(r) % infohashes]) != nullptr;
+    }
+    auto lookup = std::chrono::steady_clock::now() - start;
+    ASSERT_EQ(lookups, found);
+    ASSERT_EQ(infohashes, length(*table));
+
+    report("open addressing", std::chrono::duration_cast<ns>(announce),
+           std::chrono::duration_cast<ns>(lookup), bytes);
+    delete table;
+  }
+}
@@ -1,6 +1,8 @@
+#include "node_store.h"
 #include "timeout.h"
 #include "util.h"
 #include "gtest/gtest.h"
+#include <chrono>
 #include <dht.h>
 #include <hash/fnv.h>
 #include <list>
@@ -8,6 +10,7 @@
 #include <prng/util.h>
 #include <set>
 #include <util/assert.h>
+#include <vector>
 
 using namespace dht;
 
@@ -39,8 +42,7 @@ __random_insert(prng::xorshift32 &r, DHTMetaRoutingTable &rt, bool wasd) {
   // ASSERT_TRUE(res);
   if (res) {
     assertx(n.id == res->id);
-    assertx(res->timeout_next);
-    assertx(res->timeout_priv);
+    assertx(timeout::is_scheduled(res->timer));
   }
   // const auto r = rank(dht.id, n.id);
   // printf("rank: %zu, self->root.depth: %zu\n", r,
@@ -90,17 +92,14 @@ random_insert(prng::xorshift32 &r, DHTMetaRoutingTable &rt, std::size_t cap) {
 static void
 assert_empty(const Node &contact) {
   ASSERT_FALSE(is_valid(contact));
-  ASSERT_EQ(contact.timeout_next, nullptr);
-  ASSERT_EQ(contact.timeout_priv, nullptr);
+  ASSERT_FALSE(timeout::is_scheduled(contact.timer));
 
   ASSERT_FALSE(dht::is_valid(contact.id));
   ASSERT_EQ(contact.contact.ip.ipv4, Ipv4(0));
   ASSERT_EQ(contact.contact.port, Port(0));
 
-  ASSERT_EQ(contact.remote_activity, Timestamp(0));
-  ASSERT_EQ(contact.req_sent, Timestamp(0));
-
-  ASSERT_EQ(contact.outstanding, std::uint8_t(0));
+  ASSERT_EQ(Timestamp(contact.req_sent), Timestamp(0));
+  ASSERT_EQ(contact.shared, 0u);
   ASSERT_EQ(contact.properties.is_good, true);
 }
 
@@ -255,16 +254,14 @@ assert_present(DHTMetaRoutingTable &routing_table, const Node &current) {
     dht::Node *res = dht::find_node(routing_table, current.id);
     ASSERT_TRUE(res);
     ASSERT_EQ(res->id, current.id);
-    ASSERT_TRUE(res->timeout_next);
-    ASSERT_TRUE(res->timeout_priv);
+    ASSERT_TRUE(timeout::is_scheduled(res->timer));
 
     timeout::unlink(*routing_table.tb.timeout, res);
-    ASSERT_FALSE(res->timeout_next);
-    ASSERT_FALSE(res->timeout_priv);
+    ASSERT_FALSE(timeout::is_scheduled(res->timer));
 
-    timeout::append_all(*routing_table.tb.timeout, res);
-    ASSERT_TRUE(res->timeout_next);
-    ASSERT_TRUE(res->timeout_priv);
+    timeout::schedule(*routing_table.tb.timeout, res,
+                      routing_table.config.refresh_interval);
+    ASSERT_TRUE(timeout::is_scheduled(res->timer));
   }
 }
 
@@ -418,6 +415,401 @@ TEST(dhtTest, test_routing_table_dequeue_root) {
   ASSERT_TRUE(dht->routing_table.root == nullptr);
 }
 
+TEST(dhtTest, test_routing_table_slab) {
+  RoutingTableSlab slab;
+  slab.cap = 3;
+
+  RoutingTable *first = alloc(slab, 1);
+  RoutingTable *second = alloc(slab, 2);
+  RoutingTable *third = alloc(slab, 3);
+  ASSERT_TRUE(first);
+  ASSERT_TRUE(second);
+  ASSERT_TRUE(third);
+  ASSERT_EQ(second->depth, 2);
+  ASSERT_TRUE(is_empty(*second));
+  ASSERT_EQ(capacity(slab), RoutingTableSlab::per_chunk);
+
+  ASSERT_FALSE(alloc(slab, 4));
+  ASSERT_EQ(slab.cap_reached, 1u);
+  ASSERT_EQ(slab.in_use, 3u);
+
+  dealloc(slab, second);
+  ASSERT_EQ(slab.in_use, 2u);
+  RoutingTable *reused = alloc(slab, 5);
+  ASSERT_EQ(reused, second);
+  ASSERT_EQ(reused->depth, 5);
+  ASSERT_EQ(slab.reused, 1u);
+
+  for (std::size_t i = 0; i < Bucket::K; ++i) {
+    Node *node = &third->bucket.contacts[i];
+    std::uint32_t idx = node_index(slab, node);
+    ASSERT_NE(idx, 0u);
+    ASSERT_EQ(node_at(slab, idx), node);
+  }
+  ASSERT_EQ(node_at(slab, 0), nullptr);
+  ASSERT_LE(sizeof(Node), std::size_t(48));
+
+  dealloc(slab, first);
+  dealloc(slab, reused);
+  dealloc(slab, third);
+  ASSERT_EQ(slab.in_use, 0u);
+  ASSERT_EQ(slab.peak, 3u);
+  ASSERT_EQ(slab.allocs, slab.frees);
+}
+
+TEST(dhtTest, test_node_store_shared) {
+  prng::xorshift32 r(7);
+  Timestamp now = sp::now();
+  dht::Config conf;
+  NodeStore &store = node_store();
+  const std::uint64_t in_use = store.in_use;
+
+  NodeId id;
+  randomize_NodeId(r, Ip(Ipv4(0)), id);
+  NodeId nid;
+  randomize_NodeId(r, Ip(Ipv4(0)), nid);
+  const Contact remote(Ipv4(0x7f000001), Port(6881));
+
+  timeout::TimeoutBox main_tb(now);
+  auto main_rt = std::make_unique<DHTMetaRoutingTable>(100, r, main_tb, now,
+                                                       id, conf);
+  Node *first = insert(*main_rt, Node(nid, remote, now));
+  ASSERT_TRUE(first);
+  ASSERT_NE(first->shared, 0u);
+  ASSERT_EQ(store.in_use, in_use + 1);
+
+  {
+    timeout::TimeoutBox scrape_tb(now);
+    DHTMetaRoutingTable scrape(30, r, scrape_tb, now, id, conf);
+    Node *second = insert(scrape, Node(nid, remote));
+    ASSERT_TRUE(second);
+    ASSERT_EQ(first->shared, second->shared);
+    ASSERT_EQ(store.in_use, in_use + 1);
+
+    NodeLiveness *l = find(store, remote);
+    ASSERT_EQ(l, liveness(*first));
+    ASSERT_EQ(l->refs, 2u);
+
+    /* liveness is shared */
+    ASSERT_TRUE(is_good(*main_rt, *first));
+    ASSERT_TRUE(is_good(scrape, *second));
+    l->outstanding = 3;
+    l->remote_activity = now;
+    ASSERT_FALSE(is_good(*main_rt, *first));
+    ASSERT_FALSE(is_good(scrape, *second));
+    l->outstanding = 0;
+
+    /* a request sent through one table is visible to the other */
+    ASSERT_FALSE(is_recently_contacted(*second, now, conf.refresh_interval));
+    l->req_sent = now + sp::Seconds(2);
+    ASSERT_TRUE(is_recently_contacted(*second, now, conf.refresh_interval));
+  }
+
+  ASSERT_EQ(liveness(*first)->refs, 1u);
+  main_rt.reset();
+  ASSERT_EQ(store.in_use, in_use);
+  ASSERT_FALSE(find(store, remote));
+}
+
+TEST(dhtTest, test_replacement_cache) {
+  prng::xorshift32 r(9);
+  Timestamp now = sp::now();
+  dht::Config conf;
+  timeout::TimeoutBox tb(now);
+  NodeId id;
+  randomize_NodeId(r, Ip(Ipv4(0)), id);
+  /* a single RoutingTable so the rank 0 level can not grow */
+  DHTMetaRoutingTable routing_table(1, r, tb, now, id, conf);
+
+  auto rank0 = [&](NodeId &out) {
+    randomize_NodeId(r, Ip(Ipv4(0)), out);
+    if (bit(out.id, 0) == bit(id.id, 0)) {
+      out.id[0] ^= 0x80;
+    }
+    ASSERT_EQ(rank(id, out), std::size_t(0));
+  };
+
+  Node *first = nullptr;
+  for (std::size_t i = 0; i < Bucket::K; ++i) {
+    NodeId nid;
+    rank0(nid);
+    Node *res = insert(routing_table, Node(nid, Contact(Ipv4(i + 1), 1), now));
+    ASSERT_TRUE(res);
+    if (!first) {
+      first = res;
+    }
+  }
+  ASSERT_EQ(routing_table.replacements_cached, 0u);
+
+  NodeId older;
+  rank0(older);
+  ASSERT_FALSE(insert(routing_table, Node(older, Contact(Ipv4(100), 1), now)));
+  NodeId newer;
+  rank0(newer);
+  Timestamp later = now + sp::Seconds(10);
+  ASSERT_FALSE(
+      insert(routing_table, Node(newer, Contact(Ipv4(101), 1), later)));
+  ASSERT_EQ(routing_table.replacements_cached, 2u);
+  ReplacementCache *const cache = routing_table.replacements[0];
+  ASSERT_TRUE(cache);
+  ASSERT_EQ(cache->length, 2u);
+
+  /* a measured SRTT ranks above a more recent activity */
+  NodeId fast;
+  rank0(fast);
+  const Contact fast_contact(Ipv4(102), 1);
+  const std::uint32_t ref = acquire(node_store(), fast_contact, now);
+  ASSERT_TRUE(ref);
+  rtt_sample(liveness(node_store(), ref)->rtt, sp::Milliseconds(40));
+  ASSERT_FALSE(insert(routing_table, Node(fast, fast_contact, now)));
+  ASSERT_EQ(cache->length, 3u);
+
+  /* mark bad and promote the best candidate */
+  timeout::unlink(*tb.timeout, first);
+  first->properties.is_good = false;
+  routing_table.bad_nodes++;
+  ASSERT_TRUE(promote_replacement(routing_table, *first));
+  timeout::schedule(*tb.timeout, first, conf.refresh_interval);
+
+  ASSERT_EQ(first->id, fast);
+  ASSERT_TRUE(first->properties.is_good);
+  ASSERT_EQ(nodes_bad(routing_table), 0u);
+  ASSERT_EQ(nodes_total(routing_table), std::uint32_t(Bucket::K));
+  ASSERT_EQ(routing_table.replacements_promoted, 1u);
+  ASSERT_EQ(find_node(routing_table, fast), first);
+  ASSERT_EQ(cache->length, 2u);
+  release(node_store(), ref);
+
+  /* without SRTT the most recently seen candidate is next */
+  timeout::unlink(*tb.timeout, first);
+  ASSERT_TRUE(promote_replacement(routing_table, *first));
+  timeout::schedule(*tb.timeout, first, conf.refresh_interval);
+  ASSERT_EQ(first->id, newer);
+  ASSERT_EQ(cache->length, 1u);
+}
+
+static void
+count_retire_good(void *ctx, const Node &) noexcept {
+  ++*(std::size_t *)ctx;
+}
+
+TEST(dhtTest, test_timed_out_node_not_retired) {
+  prng::xorshift32 r(11);
+  Timestamp now = sp::now();
+  dht::Config conf;
+  timeout::TimeoutBox tb(now);
+  NodeId id;
+  randomize_NodeId(r, Ip(Ipv4(0)), id);
+  DHTMetaRoutingTable routing_table(1, r, tb, now, id, conf);
+  std::size_t retired = 0;
+  insert(routing_table.retire_good,
+         std::make_tuple(count_retire_good, (void *)&retired));
+
+  auto rank0 = [&](NodeId &out) {
+    randomize_NodeId(r, Ip(Ipv4(0)), out);
+    if (bit(out.id, 0) == bit(id.id, 0)) {
+      out.id[0] ^= 0x80;
+    }
+  };
+
+  Node *first = nullptr;
+  for (std::size_t i = 0; i < Bucket::K; ++i) {
+    NodeId nid;
+    rank0(nid);
+    Node *res = insert(routing_table, Node(nid, Contact(Ipv4(i + 1), 1), now));
+    ASSERT_TRUE(res);
+    if (!first) {
+      first = res;
+    }
+  }
+
+  /* the node timed out too many times but was not refreshed since */
+  NodeLiveness *const l = liveness(*first);
+  ASSERT_TRUE(l);
+  l->timeouts = conf.node_max_timeouts;
+  ASSERT_TRUE(first->properties.is_good);
+  ASSERT_FALSE(is_good(routing_table, *first));
+
+  NodeId nid;
+  rank0(nid);
+  Node *res = insert(routing_table, Node(nid, Contact(Ipv4(100), 1), now));
+  ASSERT_EQ(first, res);
+  ASSERT_EQ(res->id, nid);
+  ASSERT_EQ(0u, retired);
+  ASSERT_EQ(nodes_bad(routing_table), 0u);
+  ASSERT_EQ(nodes_total(routing_table), std::uint32_t(Bucket::K));
+}
+
+TEST(dhtTest, bench_bucket_lookup) {
+  prng::xorshift32 r(11);
+  Timestamp now = sp::now();
+  dht::Config conf;
+  timeout::TimeoutBox tb(now);
+  NodeId id;
+  randomize_NodeId(r, Ip(Ipv4(0)), id);
+  /* same capacity as a scrape routing table */
+  DHTMetaRoutingTable routing_table(30, r, tb, now, id, conf);
+
+  std::vector<NodeId> ids;
+  for (std::size_t i = 0; i < 20'000; ++i) {
+    NodeId nid;
+    randomize_NodeId(r, Ip(Ipv4(i + 1)), nid);
+    ids.push_back(nid);
+    insert(routing_table, Node(nid, Contact(Ipv4(i + 1), 1), now));
+  }
+
+  auto linear_find = [&](const NodeId &needle) -> Node * {
+    const std::size_t lvl = rank(routing_table.id, needle);
+    for (RoutingTable *it = routing_table.root; it; it = it->in_tree) {
+      if (std::size_t(it->depth) == lvl) {
+        for (RoutingTable *p = it; p; p = p->parallel) {
+          Node *res = find(p->bucket, needle);
+          if (res) {
+            return res;
+          }
+        }
+      }
+    }
+    return nullptr;
+  };
+
+  constexpr std::size_t rounds = 10;
+  std::size_t hits_sorted = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < rounds; ++i) {
+    for (const auto &nid : ids) {
+      hits_sorted += find_node(routing_table, nid) ? 1 : 0;
+    }
+  }
+  auto sorted = std::chrono::steady_clock::now() - start;
+
+  std::size_t hits_linear = 0;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < rounds; ++i) {
+    for (const auto &nid : ids) {
+      hits_linear += linear_find(nid) ? 1 : 0;
+    }
+  }
+  auto linear = std::chrono::steady_clock::now() - start;
+
+  ASSERT_EQ(hits_sorted, hits_linear);
+  ASSERT_EQ(hits_sorted, rounds * std::size_t(nodes_total(routing_table)));
+  for (const auto &nid : ids) {
+    ASSERT_EQ(find_node(routing_table, nid), linear_find(nid));
+  }
+
+  using us = std::chrono::microseconds;
+  printf("lookup %zu x %zu: sorted %lldus, linear %lldus\n", rounds,
+         ids.size(), (long long)std::chrono::duration_cast<us>(sorted).count(),
+         (long long)std::chrono::duration_cast<us>(linear).count());
+}
+
+TEST(dhtTest, bench_bucket_insert) {
+  prng::xorshift32 r(12);
+  Timestamp now = sp::now();
+  dht::Config conf;
+  timeout::TimeoutBox tb(now);
+  NodeId id;
+  randomize_NodeId(r, Ip(Ipv4(0)), id);
+
+  std::vector<NodeId> ids;
+  for (std::size_t i = 0; i < 20'000; ++i) {
+    NodeId nid;
+    randomize_NodeId(r, Ip(Ipv4(i + 1)), nid);
+    ids.push_back(nid);
+  }
+
+  /* every round starts from an empty table so the levels are split again */
+  constexpr std::size_t rounds = 10;
+  std::size_t levels = 0;
+  std::uint32_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < rounds; ++i) {
+    DHTMetaRoutingTable routing_table(30, r, tb, now, id, conf);
+    for (std::size_t k = 0; k < ids.size(); ++k) {
+      insert(routing_table, Node(ids[k], Contact(Ipv4(k + 1), 1), now));
+    }
+    ASSERT_TRUE(debug_assert_all(routing_table));
+    levels = debug_count_levels(routing_table);
+    total = nodes_total(routing_table);
+  }
+  const auto fill = std::chrono::steady_clock::now() - start;
+
+  ASSERT_GT(levels, 1u);
+  ASSERT_GT(total, std::uint32_t(Bucket::K));
+
+  /* Once the table is full most inserts of a scrape are of known nodes or
+   * for full levels. Before the buckets were sorted an insert scanned every
+   * slot of the level for a duplicate, a free slot and a node which is not
+   * good, which is the baseline.
+   */
+  DHTMetaRoutingTable routing_table(30, r, tb, now, id, conf);
+  for (std::size_t k = 0; k < ids.size(); ++k) {
+    insert(routing_table, Node(ids[k], Contact(Ipv4(k + 1), 1), now));
+  }
+  std::vector<NodeId> workload(ids);
+  for (std::size_t i = 0; i < 20'000; ++i) {
+    NodeId nid;
+    randomize_NodeId(r, Ip(Ipv4(100'000 + i)), nid);
+    workload.push_back(nid);
+  }
+
+  auto linear_insert = [&](const NodeId &needle) -> bool {
+    const std::size_t lvl = rank(routing_table.id, needle);
+    for (RoutingTable *it = routing_table.root; it; it = it->in_tree) {
+      if (std::size_t(it->depth) != lvl) {
+        continue;
+      }
+      bool is_full = true;
+      for (RoutingTable *p = it; p; p = p->parallel) {
+        for (std::size_t i = 0; i < Bucket::K; ++i) {
+          const Node &contact = p->bucket.contacts[i];
+          if (!is_valid(contact) || !is_good(routing_table, contact)) {
+            is_full = false;
+          } else if (contact.id == needle) {
+            return true;
+          }
+        }
+      }
+      return !is_full;
+    }
+    return false;
+  };
+
+  std::size_t present = 0;
+  for (const auto &nid : ids) {
+    present += find_node(routing_table, nid) ? 1 : 0;
+  }
+
+  std::size_t known_linear = 0;
+  start = std::chrono::steady_clock::now();
+  for (const auto &nid : workload) {
+    known_linear += linear_insert(nid) ? 1 : 0;
+  }
+  const auto linear = std::chrono::steady_clock::now() - start;
+
+  std::size_t known_sorted = 0;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < workload.size(); ++i) {
+    const Contact c(Ipv4(i + 1), 1);
+    known_sorted += insert(routing_table, Node(workload[i], c, now)) ? 1 : 0;
+  }
+  const auto sorted = std::chrono::steady_clock::now() - start;
+  ASSERT_TRUE(debug_assert_all(routing_table));
+  /* both find every node which is already in the table */
+  ASSERT_GE(known_linear, present);
+  ASSERT_GE(known_sorted, present);
+
+  using us = std::chrono::microseconds;
+  printf("insert %zu x %zu: %lldus, %zu levels, %u nodes\n", rounds,
+         ids.size(), (long long)std::chrono::duration_cast<us>(fill).count(),
+         levels, total);
+  printf("insert full table %zu: sorted %lldus, linear %lldus\n",
+         workload.size(),
+         (long long)std::chrono::duration_cast<us>(sorted).count(),
+         (long long)std::chrono::duration_cast<us>(linear).count());
+}
+
 TEST(dhtTest, test) {
   prng::xorshift32 r(5);
   Timestamp now = sp::now();
@@ -456,16 +848,10 @@ TEST(dhtTest, test) {
 
 template <typename F>
 static void
-for_each(Node *const start, F f) noexcept {
-  Node *it = start;
-Lstart:
-  if (it) {
-    f(it);
-    it = it->timeout_next;
-    if (it != start) {
-      goto Lstart;
-    }
-  }
+for_each(const timeout::Timeout &tout, F f) noexcept {
+  timeout::for_each(tout.wheel, [&f](std::uint32_t idx) {
+    f(node_at(routing_table_slab(), idx));
+  });
 }
 
 TEST(dhtTest, test_link) {
@@ -538,14 +924,13 @@ TEST(dhtTest, test_append) {
       dht::Node *res = dht::find_node(dht->routing_table, ins->id);
       ASSERT_TRUE(res);
       ASSERT_EQ(res->id, ins->id);
-      ASSERT_TRUE(res->timeout_next);
-      ASSERT_TRUE(res->timeout_priv);
+      ASSERT_TRUE(timeout::is_scheduled(res->timer));
 
       {
         std::list<dht::NodeId> unique;
 
         std::size_t number = 0;
-        for_each(dht->tb.timeout->timeout_node, [&](Node *n) { //
+        for_each(*dht->tb.timeout, [&](Node *n) { //
           ++number;
           insert(unique, n->id);
           // printf("NodeId: ");
@@ -558,13 +943,12 @@ TEST(dhtTest, test_append) {
       }
 
       timeout::unlink(*dht->tb.timeout, res);
-      ASSERT_FALSE(res->timeout_next);
-      ASSERT_FALSE(res->timeout_priv);
+      ASSERT_FALSE(timeout::is_scheduled(res->timer));
       {
         std::list<dht::NodeId> unique;
 
         std::size_t number = 0;
-        for_each(dht->tb.timeout->timeout_node, [&](Node *n) { //
+        for_each(*dht->tb.timeout, [&](Node *n) { //
           ++number;
           insert(unique, n->id);
         });
@@ -574,16 +958,16 @@ TEST(dhtTest, test_append) {
       }
 
       {
-        timeout::append_all(*dht->tb.timeout, res);
-        ASSERT_TRUE(res->timeout_next);
-        ASSERT_TRUE(res->timeout_priv);
+        timeout::schedule(*dht->tb.timeout, res,
+                          dht->config.refresh_interval);
+        ASSERT_TRUE(timeout::is_scheduled(res->timer));
       }
 
       {
         std::list<dht::NodeId> unique;
 
         std::size_t number = 0;
-        for_each(dht->tb.timeout->timeout_node, [&](Node *n) { //
+        for_each(*dht->tb.timeout, [&](Node *n) { //
           ++number;
           insert(unique, n->id);
         });
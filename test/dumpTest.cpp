@@ -41,8 +41,8 @@ TEST(dumpTest, test) {
       current = dht::Node(id, rand_contact(r), Timestamp(0));
 
       // dummy
-      current.timeout_next = &current;
-      current.timeout_priv = &current;
+      current.timer.next = 1;
+      current.timer.priv = 1;
 
       dht->routing_table.root->bucket.length++;
     }
@@ -0,0 +1,107 @@
+#include "epoch.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+using namespace dht;
+
+TEST(epochTest, test_retire_without_readers) {
+  Epoch epoch;
+  retire(epoch, malloc(64));
+  ASSERT_EQ(0u, epoch.length);
+  retire(epoch, nullptr);
+  ASSERT_EQ(0u, epoch.length);
+}
+
+TEST(epochTest, test_register) {
+  Epoch epoch;
+  std::size_t readers[Epoch::max_readers];
+  for (std::size_t i = 0; i < Epoch::max_readers; ++i) {
+    ASSERT_TRUE(register_reader(epoch, readers[i]));
+  }
+  std::size_t extra = 0;
+  ASSERT_FALSE(register_reader(epoch, extra));
+
+  /* a released slot is handed out again */
+  unregister_reader(epoch, readers[3]);
+  ASSERT_TRUE(register_reader(epoch, extra));
+  ASSERT_EQ(readers[3], extra);
+
+  for (std::size_t i = 0; i < Epoch::max_readers; ++i) {
+    unregister_reader(epoch, readers[i]);
+  }
+  ASSERT_EQ(0u, epoch.readers.load());
+}
+
+TEST(epochTest, test_retire_pinned) {
+  Epoch epoch;
+  std::size_t reader = 0;
+  ASSERT_TRUE(register_reader(epoch, reader));
+
+  /* retired while no reader is pinned */
+  retire(epoch, malloc(64));
+  ASSERT_EQ(1u, epoch.length);
+  collect(epoch);
+  ASSERT_EQ(0u, epoch.length);
+
+  /* kept as long as the reader pins an epoch before the retire */
+  pin(epoch, reader);
+  retire(epoch, malloc(64));
+  collect(epoch);
+  ASSERT_EQ(1u, epoch.length);
+
+  /* a reader pinning after the retire can not reach it */
+  unpin(epoch, reader);
+  pin(epoch, reader);
+  collect(epoch);
+  ASSERT_EQ(0u, epoch.length);
+
+  retire(epoch, malloc(64));
+  unpin(epoch, reader);
+  unregister_reader(epoch, reader);
+  /* the rest is freed with the epoch */
+  ASSERT_EQ(1u, epoch.length);
+}
+
+TEST(epochTest, test_concurrent) {
+  constexpr std::size_t rounds = 20000;
+  Epoch epoch;
+  std::atomic<std::uint64_t *> shared(nullptr);
+  std::atomic<bool> done(false);
+
+  auto *first = (std::uint64_t *)malloc(sizeof(std::uint64_t));
+  *first = 0;
+  shared.store(first);
+
+  std::thread readers[4];
+  for (std::thread &cur : readers) {
+    cur = std::thread([&epoch, &shared, &done] {
+      std::size_t reader = 0;
+      ASSERT_TRUE(register_reader(epoch, reader));
+      std::uint64_t last = 0;
+      while (!done.load()) {
+        pin(epoch, reader);
+        const std::uint64_t value = *shared.load();
+        unpin(epoch, reader);
+        ASSERT_GE(value, last);
+        last = value;
+      }
+      unregister_reader(epoch, reader);
+    });
+  }
+
+  for (std::uint64_t i = 1; i <= rounds; ++i) {
+    auto *next = (std::uint64_t *)malloc(sizeof(std::uint64_t));
+    *next = i;
+    retire(epoch, shared.exchange(next));
+    collect(epoch);
+  }
+  done.store(true);
+  for (std::thread &cur : readers) {
+    cur.join();
+  }
+
+  ASSERT_EQ(rounds, *shared.load());
+  free(shared.load());
+}
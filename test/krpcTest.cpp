@@ -1,4 +1,5 @@
 #include "util.h"
+#include <arpa/inet.h>
 #include <bencode_offset.h>
 #include <bencode_print.h>
 #include <decode_bencode.h>
@@ -298,7 +299,6 @@ TEST(krpcTest, test_find_node) {
     for (std::size_t i = 0; i < length4; ++i) {
       rand_nodeId(nodes[i].id);
       nodes[i].contact.ip.ipv4 = (Ipv4)rand();
-      nodes[i].contact.ip.type = IpType::IPV4;
       nodes[i].contact.port = (Port)rand();
       nodes4[i] = &nodes[i];
     }
@@ -558,7 +558,6 @@ TEST(krpcTest, test_get_peers) {
     for (std::size_t i = 0; i < NODE_SIZE; ++i) {
       rand_nodeId(node[i].id);
       node[i].contact.ip.ipv4 = (Ipv4)rand();
-      node[i].contact.ip.type = IpType::IPV4;
       node[i].contact.port = (Port)rand();
       in[i] = &node[i];
     }
@@ -600,17 +599,40 @@ TEST(krpcTest, test_get_peers) {
     token.length = 8;
     std::memcpy(token.id, "thetoken", token.length);
 
-    sp::UinStaticArray<Contact, 256> peer;
     constexpr std::size_t PEER_SIZE = 128;
+    constexpr std::size_t record = dht::CompactBlob::record;
+    Contact contacts[PEER_SIZE];
+    sp::byte encoded[PEER_SIZE * record];
     for (std::size_t i = 0; i < PEER_SIZE; ++i) {
-      Contact c;
+      Contact &c = contacts[i];
       c.ip.ipv4 = (Ipv4)rand();
       c.ip.type = IpType::IPV4;
       c.port = (Port)rand();
-      insert(peer, c);
+
+      sp::byte *const out = encoded + (i * record);
+      const Ipv4 ip = htonl(c.ip.ipv4);
+      const Port port = htons(c.port);
+      out[0] = '6';
+      out[1] = ':';
+      std::memcpy(out + 2, &ip, sizeof(ip));
+      std::memcpy(out + 2 + sizeof(ip), &port, sizeof(port));
+    }
+
+    /* a window which wraps around the end of the encoded peers */
+    const std::size_t split = PEER_SIZE / 4;
+    db::PeerWindow window;
+    window.part[0] = encoded + (split * record);
+    window.length[0] = (PEER_SIZE - split) * record;
+    window.part[1] = encoded;
+    window.length[1] = split * record;
+    window.parts = 2;
+
+    sp::UinStaticArray<Contact, 256> peer;
+    for (std::size_t i = 0; i < PEER_SIZE; ++i) {
+      insert(peer, contacts[(split + i) % PEER_SIZE]);
     }
 
-    ASSERT_TRUE(krpc::response::get_peers_peers(buff, t, id, token, peer));
+    ASSERT_TRUE(krpc::response::get_peers_peers(buff, t, id, token, window));
     sp::flip(buff);
     dht::Domain dom = dht::Domain::Domain_public;
     krpc::ParseContext ctx(dom, *dht, buff);
@@ -1039,10 +1061,10 @@ TEST(krpcTest, test_sample_infohashes) {
     for (std::size_t i = 0; i < NODE_SIZE; ++i) {
       rand_nodeId(node[i].id);
       node[i].contact.ip.ipv4 = (Ipv4)rand();
-      node[i].contact.ip.type = IpType::IPV4;
       node[i].contact.port = (Port)rand();
       in[i] = &node[i];
-      insert(nodes_cmp, std::make_tuple(node[i].id, node[i].contact));
+      insert(nodes_cmp,
+             std::make_tuple(node[i].id, Contact(node[i].contact)));
     }
 
     sp::UinStaticArray<dht::Infohash, 128> samples;
@@ -0,0 +1,122 @@
+#include "pool.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <prng/xorshift.h>
+#include <vector>
+
+using namespace dht;
+
+TEST(poolTest, test_size_classes) {
+  ASSERT_EQ(16u, block_size(1));
+  ASSERT_EQ(16u, block_size(16));
+  ASSERT_EQ(32u, block_size(17));
+  ASSERT_EQ(1024u, block_size(513));
+  ASSERT_EQ(Pool::max, block_size(Pool::max));
+  ASSERT_EQ(Pool::max + 1, block_size(Pool::max + 1));
+}
+
+TEST(poolTest, test_reuse) {
+  Pool pool;
+  void *a = allocate(pool, 100);
+  ASSERT_TRUE(a);
+  ASSERT_EQ(0u, std::uintptr_t(a) % 16);
+  ASSERT_EQ(128u, pool.used);
+  ASSERT_EQ(Pool::arena, pool.reserved);
+
+  /* a freed block is handed out again for the same class */
+  deallocate(pool, a, 100);
+  ASSERT_EQ(0u, pool.used);
+  ASSERT_EQ(a, allocate(pool, 120));
+
+  /* large allocations bypass the arenas */
+  void *large = allocate(pool, Pool::max * 2);
+  ASSERT_TRUE(large);
+  ASSERT_EQ(Pool::arena + (Pool::max * 2), pool.reserved);
+  deallocate(pool, large, Pool::max * 2);
+  ASSERT_EQ(Pool::arena, pool.reserved);
+
+  /* growing within the same class keeps the block */
+  void *b = reallocate(pool, a, 120, 128);
+  ASSERT_EQ(a, b);
+  std::memset(b, 7, 128);
+  void *c = reallocate(pool, b, 128, 256);
+  ASSERT_TRUE(c);
+  ASSERT_EQ(7, ((unsigned char *)c)[127]);
+  ASSERT_EQ(256u, pool.used);
+  deallocate(pool, c, 256);
+  ASSERT_EQ(0u, pool.used);
+}
+
+TEST(poolTest, test_growth) {
+  Pool pool;
+  const std::size_t small[] = {100, 0, 1000};
+  ASSERT_EQ(Pool::arena, growth(pool, small, 3));
+
+  /* the rest of the arena serves the requests */
+  void *a = allocate(pool, 1000);
+  ASSERT_EQ(0u, growth(pool, small, 3));
+
+  /* a used up arena is only replaced once for all of the requests */
+  std::vector<void *> blocks;
+  std::size_t size = 1000;
+  while (growth(pool, &size, 1) == 0) {
+    blocks.push_back(allocate(pool, size));
+  }
+  ASSERT_EQ(Pool::arena, growth(pool, small, 3));
+  const std::size_t large[] = {1000, Pool::max * 2};
+  ASSERT_EQ(Pool::arena + (Pool::max * 2), growth(pool, large, 2));
+
+  /* a freed block is reused instead */
+  deallocate(pool, a, 1000);
+  ASSERT_EQ(0u, growth(pool, &size, 1));
+  const std::size_t twice[] = {1000, 1000};
+  ASSERT_EQ(Pool::arena, growth(pool, twice, 2));
+  ASSERT_EQ(Pool::arena, pool.reserved);
+  for (void *cur : blocks) {
+    deallocate(pool, cur, size);
+  }
+}
+
+TEST(poolTest, test_random) {
+  prng::xorshift32 r(1);
+  Pool pool;
+  struct Live {
+    unsigned char *ptr;
+    std::size_t size;
+    unsigned char fill;
+  };
+  std::vector<Live> live;
+
+  std::size_t used = 0;
+  for (std::size_t i = 0; i < 100'000; ++i) {
+    if (live.empty() || random(r) % 3 != 0) {
+      const std::size_t size = 1 + (random(r) % (Pool::max + 512));
+      auto *ptr = (unsigned char *)allocate(pool, size);
+      ASSERT_TRUE(ptr);
+      const unsigned char fill = (unsigned char)random(r);
+      std::memset(ptr, fill, size);
+      live.push_back(Live{ptr, size, fill});
+      used += block_size(size);
+    } else {
+      const std::size_t idx = random(r) % live.size();
+      const Live cur = live[idx];
+      /* no other allocation overlapped this one */
+      for (std::size_t k = 0; k < cur.size; ++k) {
+        ASSERT_EQ(cur.fill, cur.ptr[k]);
+      }
+      deallocate(pool, cur.ptr, cur.size);
+      used -= block_size(cur.size);
+      live[idx] = live.back();
+      live.pop_back();
+    }
+    ASSERT_EQ(used, pool.used);
+    if (live.size() > 2000) {
+      break;
+    }
+  }
+
+  for (const Live &cur : live) {
+    deallocate(pool, cur.ptr, cur.size);
+  }
+  ASSERT_EQ(0u, pool.used);
+}
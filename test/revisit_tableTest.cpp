@@ -0,0 +1,84 @@
+#include "revisit_table.h"
+#include "gtest/gtest.h"
+#include <prng/xorshift.h>
+
+using namespace dht;
+
+TEST(revisit_tableTest, test_block) {
+  const std::uint64_t minute = 60 * 1000;
+  const std::uint64_t start = 1'700'000'000'000;
+  RevisitTable table(1024, 1234);
+  const Ip a(Ipv4(1));
+  const Ip b(Ipv4(2));
+
+  ASSERT_FALSE(is_blocked(table, a, Timestamp(start)));
+  block(table, a, Timestamp(start), sp::Milliseconds(60 * minute));
+  ASSERT_EQ(1u, table.length);
+  ASSERT_TRUE(is_blocked(table, a, Timestamp(start)));
+  ASSERT_TRUE(is_blocked(table, a, Timestamp(start + 59 * minute)));
+  ASSERT_FALSE(is_blocked(table, a, Timestamp(start + 61 * minute)));
+  ASSERT_FALSE(is_blocked(table, b, Timestamp(start)));
+
+  /* a shorter interval does not shorten the recorded one */
+  block(table, a, Timestamp(start), sp::Milliseconds(10 * minute));
+  ASSERT_TRUE(is_blocked(table, a, Timestamp(start + 30 * minute)));
+  block(table, a, Timestamp(start), sp::Milliseconds(120 * minute));
+  ASSERT_TRUE(is_blocked(table, a, Timestamp(start + 90 * minute)));
+  ASSERT_EQ(1u, table.length);
+
+  /* the interval is clamped */
+  block(table, b, Timestamp(start), sp::Milliseconds(30 * 24 * 60 * minute));
+  ASSERT_TRUE(is_blocked(table, b, Timestamp(start + 23 * 60 * minute)));
+  ASSERT_FALSE(is_blocked(table, b, Timestamp(start + 25 * 60 * minute)));
+
+  /* a sweep is resumed where the budget ran out */
+  Budget budget(512);
+  ASSERT_FALSE(sweep(table, Timestamp(start + 25 * 60 * minute), budget));
+  ASSERT_EQ(512u, table.cursor);
+  budget = Budget(512);
+  ASSERT_TRUE(sweep(table, Timestamp(start + 25 * 60 * minute), budget));
+  ASSERT_EQ(0u, table.cursor);
+  ASSERT_EQ(0u, table.length);
+}
+
+TEST(revisit_tableTest, test_fill) {
+  const std::uint64_t minute = 60 * 1000;
+  const std::uint64_t start = 1'700'000'000'000;
+  constexpr std::size_t buckets = 64;
+  constexpr std::size_t slots = buckets * RevisitTable::bucket_slots;
+  RevisitTable table(buckets, 1234);
+  prng::xorshift32 r(1);
+
+  /* over filled, a full bucket drops the slot due first */
+  for (std::uint32_t i = 0; i < slots * 4; ++i) {
+    const sp::Milliseconds interval((10 + i % 50) * minute);
+    block(table, Ip(Ipv4(i)), Timestamp(start), interval);
+  }
+  ASSERT_EQ(slots, table.length);
+  ASSERT_GT(table.evictions, 0u);
+  ASSERT_EQ(1'000'000u, fill_ppm(table));
+  ASSERT_EQ(16'000'000u / 0xffff, false_positive_ppm(table));
+
+  /* every ip still recorded is blocked for at least its interval */
+  std::size_t blocked = 0;
+  for (std::uint32_t i = 0; i < slots * 4; ++i) {
+    blocked += is_blocked(table, Ip(Ipv4(i)), Timestamp(start));
+  }
+  ASSERT_GE(blocked, slots);
+
+  /* unknown ips are rarely blocked */
+  std::size_t false_positives = 0;
+  for (std::uint32_t i = 0; i < 100'000; ++i) {
+    const Ip ip(Ipv4(random(r) | 0x80000000));
+    false_positives += is_blocked(table, ip, Timestamp(start));
+  }
+  ASSERT_LT(false_positives, 100u);
+
+  /* expired slots are cleared once their bucket is updated */
+  const Timestamp later(start + 60 * minute);
+  block(table, Ip(Ipv4(0)), later, sp::Milliseconds(10 * minute));
+  ASSERT_LT(table.length, slots);
+  Budget budget(buckets);
+  ASSERT_TRUE(sweep(table, later, budget));
+  ASSERT_EQ(1u, table.length);
+}
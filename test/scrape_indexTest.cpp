@@ -0,0 +1,97 @@
+#include "scrape_index.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <prng/util.h>
+#include <prng/xorshift.h>
+
+using namespace dht;
+
+/* The linear scan the index replaces */
+template <typename F>
+static std::size_t
+reference(const ScrapeIndex &index, const Key &id, std::size_t min_rank,
+          F f) {
+  std::size_t result = ScrapeIndex::capacity;
+  std::size_t max_rank = min_rank;
+  for (std::size_t i = 0; i < ScrapeIndex::capacity; ++i) {
+    if (!index.used[i]) {
+      continue;
+    }
+    const std::size_t r = rank(index.ids[i], id);
+    if (r >= max_rank && f(i, r)) {
+      max_rank = r;
+      result = i;
+    }
+  }
+  return result;
+}
+
+TEST(scrape_indexTest, test_match) {
+  prng::xorshift32 r(1);
+  auto *index = new ScrapeIndex;
+
+  /* only a few prefixes so the ranks collide */
+  auto random_id = [&r](Key &out) {
+    fill(r, out, sizeof(Key));
+    out[0] &= 0xf0;
+  };
+
+  Key id;
+  for (std::size_t i = 0; i < 50'000; ++i) {
+    const std::size_t slot = random(r) % ScrapeIndex::capacity;
+    if (index->used[slot] && random(r) % 2) {
+      remove(*index, slot);
+      ASSERT_FALSE(index->used[slot]);
+    } else {
+      remove(*index, slot);
+      random_id(id);
+      ASSERT_TRUE(insert(*index, slot, id));
+    }
+
+    if (random(r) % 2) {
+      std::memcpy(id, index->ids[random(r) % ScrapeIndex::capacity],
+                  sizeof(id));
+    } else {
+      random_id(id);
+    }
+    const std::size_t min_rank = random(r) % 2 ? 0 : 4;
+    const std::uint32_t seed = random(r);
+    auto accept = [seed](std::size_t slot, std::size_t rank) {
+      return ((slot * 31 + rank + seed) % 3) != 0;
+    };
+    ASSERT_EQ(reference(*index, id, min_rank, accept),
+              best_match(*index, id, min_rank, accept));
+  }
+
+  delete index;
+}
+
+TEST(scrape_indexTest, test_insert_remove) {
+  ScrapeIndex index;
+  Key a{0};
+  Key b{0};
+  b[19] = 1;
+
+  ASSERT_EQ(ScrapeIndex::capacity,
+            best_match(index, a, 0, [](std::size_t, std::size_t) { //
+              return true;
+            }));
+  ASSERT_TRUE(insert(index, 3, a));
+  /* the same id is only indexed once */
+  ASSERT_FALSE(insert(index, 4, a));
+  ASSERT_FALSE(index.used[4]);
+  ASSERT_TRUE(insert(index, 4, b));
+  ASSERT_EQ(2u, index.length);
+
+  auto any = [](std::size_t, std::size_t) { return true; };
+  ASSERT_EQ(3u, best_match(index, a, 0, any));
+  ASSERT_EQ(4u, best_match(index, b, 0, any));
+  ASSERT_EQ(4u, best_match(index, b, NodeId::bits, any));
+
+  remove(index, 4);
+  ASSERT_EQ(3u, best_match(index, b, 0, any));
+  ASSERT_EQ(ScrapeIndex::capacity, best_match(index, b, NodeId::bits, any));
+  remove(index, 3);
+  ASSERT_EQ(0u, index.length);
+  ASSERT_EQ(ScrapeIndex::none, index.root);
+}
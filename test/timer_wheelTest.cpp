@@ -0,0 +1,121 @@
+#include "timer_wheel.h"
+#include "util.h"
+#include "gtest/gtest.h"
+#include <prng/xorshift.h>
+#include <vector>
+
+using namespace timeout;
+
+struct TestTimer {
+  Timer timer;
+  Timestamp expire;
+
+  TestTimer() noexcept
+      : timer()
+      , expire(0) {
+  }
+};
+
+static Timer &
+timer_of(void *ctx, std::uint32_t handle) noexcept {
+  auto *timers = (std::vector<TestTimer> *)ctx;
+  return (*timers)[handle - 1].timer;
+}
+
+static void
+schedule(Wheel &wheel, std::vector<TestTimer> &timers, std::size_t i,
+         const Timestamp &now, const Timestamp &expire) noexcept {
+  timers[i].expire = expire;
+  schedule(wheel, std::uint32_t(i + 1), now, expire);
+}
+
+TEST(timer_wheelTest, test_schedule_cancel) {
+  std::vector<TestTimer> timers(2);
+  Wheel wheel(sp::Milliseconds(1), timer_of, &timers);
+  Timestamp now(1'000'000);
+  const Timer &a = timers[0].timer;
+  const Timer &b = timers[1].timer;
+
+  schedule(wheel, timers, 0, now, now + sp::Milliseconds(10));
+  schedule(wheel, timers, 1, now, now + sp::Milliseconds(5000));
+  ASSERT_TRUE(is_scheduled(a));
+  ASSERT_TRUE(is_scheduled(b));
+  ASSERT_EQ(2u, wheel.length);
+
+  cancel(wheel, 1);
+  ASSERT_FALSE(is_scheduled(a));
+  ASSERT_EQ(1u, wheel.length);
+  ASSERT_EQ(0u, take_expired(wheel, now + sp::Milliseconds(10)));
+
+  /* reschedule earlier */
+  schedule(wheel, timers, 1, now, now + sp::Milliseconds(20));
+  ASSERT_EQ(1u, wheel.length);
+  ASSERT_EQ(0u, take_expired(wheel, now + sp::Milliseconds(19)));
+  ASSERT_EQ(2u, take_expired(wheel, now + sp::Milliseconds(20)));
+  ASSERT_FALSE(is_scheduled(b));
+  ASSERT_EQ(0u, wheel.length);
+
+  Timestamp next(0);
+  ASSERT_FALSE(next_expire(wheel, next));
+}
+
+TEST(timer_wheelTest, test_random) {
+  prng::xorshift32 r(7);
+  constexpr std::size_t N = 4096;
+  std::vector<TestTimer> timers(N);
+  Wheel wheel(sp::Milliseconds(1), timer_of, &timers);
+  Timestamp now(123'456);
+
+  for (std::size_t i = 0; i < N; ++i) {
+    /* up to ~12h away, beyond the range of the wheel */
+    std::uint64_t delta = random(r) % (12 * 60 * 60 * 1000);
+    if (random(r) % 2) {
+      delta %= 5000;
+    }
+    schedule(wheel, timers, i, now, now + sp::Milliseconds(delta));
+  }
+  ASSERT_EQ(N, wheel.length);
+
+  std::size_t fired = 0;
+  while (wheel.length > 0) {
+    Timestamp next(0);
+    ASSERT_TRUE(next_expire(wheel, next));
+    ASSERT_TRUE(next > now);
+
+    now = now + sp::Milliseconds(1 + (random(r) % 60'000));
+    std::uint32_t h;
+    while ((h = take_expired(wheel, now))) {
+      const TestTimer &t = timers[h - 1];
+      ASSERT_FALSE(is_scheduled(t.timer));
+      ASSERT_TRUE(t.expire <= now);
+      ++fired;
+    }
+
+    /* every timer which are still scheduled has not expired */
+    for (const auto &it : timers) {
+      if (is_scheduled(it.timer)) {
+        ASSERT_TRUE(it.expire > now);
+      }
+    }
+  }
+  ASSERT_EQ(N, fired);
+  ASSERT_EQ(N, wheel.expired);
+}
+
+TEST(timer_wheelTest, test_exact) {
+  constexpr std::size_t N = 300;
+  std::vector<TestTimer> timers(N);
+  Wheel wheel(sp::Milliseconds(1), timer_of, &timers);
+  Timestamp now(77);
+
+  for (std::size_t i = 0; i < N; ++i) {
+    schedule(wheel, timers, i, now, now + sp::Milliseconds((i + 1) * 97));
+  }
+
+  /* each timer expires at exactly its tick */
+  for (std::size_t i = 0; i < N; ++i) {
+    const std::uint64_t expire = (i + 1) * 97;
+    ASSERT_EQ(0u, take_expired(wheel, now + sp::Milliseconds(expire - 1)));
+    ASSERT_EQ(i + 1, take_expired(wheel, now + sp::Milliseconds(expire)));
+  }
+}
@@ -1,145 +1,39 @@
+#include "routing_table.h"
 #include "shared.h"
 #include "timeout.h"
 
 #include "gtest/gtest.h"
 
-static std::size_t
-is_cycle(dht::DHT &dht) noexcept {
-  std::size_t result = 0;
-  dht::Node *const head = dht.tb.timeout->timeout_node;
-  if (head) {
-    dht::Node *it = head;
-  Lit:
-    if (head) {
-      dht::Node *next = it->timeout_next;
-      assert(it == next->timeout_priv);
-
-      ++result;
-      it = next;
-      if (it != head) {
-        goto Lit;
-      }
-    } else {
-      assert(head);
+/* The timeout wheel links Nodes by their slab index, so the Nodes under test
+ * have to live in RoutingTable:s allocated from the slab.
+ */
+template <std::size_t N>
+struct SlabNodes {
+  static constexpr std::size_t K = dht::Bucket::K;
+  dht::RoutingTable *tables[(N + K - 1) / K];
+
+  SlabNodes() noexcept
+      : tables{nullptr} {
+    for (auto &t : tables) {
+      t = dht::alloc(dht::routing_table_slab(), 0);
+      assertx(t);
     }
   }
-  return result;
-}
-
-TEST(TimeoutTest, test) {
-  fd sock(-1);
-  Contact c(0, 0);
-  prng::xorshift32 r(1);
-  Timestamp now = sp::now();
-  dht::Client client{sock, sock};
-  dht::Options opt;
-  dht::DHT dht(c, client, r, now, opt);
-  ASSERT_EQ(std::size_t(0), is_cycle(dht));
-
-  dht::Node n1;
-  dht::Node n2;
-  dht::Node n3;
-  {
-    timeout::prepend(*dht.tb.timeout, &n1);
-    ASSERT_EQ(std::size_t(1), is_cycle(dht));
-
-    timeout::prepend(*dht.tb.timeout, &n2);
-    ASSERT_EQ(std::size_t(2), is_cycle(dht));
-
-    timeout::prepend(*dht.tb.timeout, &n3);
-    ASSERT_EQ(std::size_t(3), is_cycle(dht));
-  }
-
-  {
-    timeout::unlink(*dht.tb.timeout, &n2);
-    ASSERT_EQ(std::size_t(2), is_cycle(dht));
-
-    timeout::append_all(*dht.tb.timeout, &n2);
-    ASSERT_EQ(std::size_t(3), is_cycle(dht));
-  }
-
-  {
-    timeout::unlink(*dht.tb.timeout, &n2);
-    ASSERT_EQ(std::size_t(2), is_cycle(dht));
-
-    timeout::unlink(*dht.tb.timeout, &n1);
-    ASSERT_EQ(std::size_t(1), is_cycle(dht));
-
-    timeout::unlink(*dht.tb.timeout, &n3);
-    ASSERT_EQ(std::size_t(0), is_cycle(dht));
-
-    timeout::append_all(*dht.tb.timeout, &n2);
-    ASSERT_EQ(std::size_t(1), is_cycle(dht));
-
-    timeout::append_all(*dht.tb.timeout, &n1);
-    ASSERT_EQ(std::size_t(2), is_cycle(dht));
-
-    timeout::append_all(*dht.tb.timeout, &n3);
-    ASSERT_EQ(std::size_t(3), is_cycle(dht));
-  }
-}
-
-TEST(TimeoutTest, test2) {
-  fd sock(-1);
-  Contact c(0, 0);
-  prng::xorshift32 r(1);
-  Timestamp now = sp::now();
-  dht::Client client{sock, sock};
-  dht::Options opt;
-  dht::DHT dht(c, client, r, now, opt);
-  dht.now = sp::Timestamp(0);
-  ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(1)), nullptr);
-
-  dht::Node node0;
-  node0.req_sent = sp::Timestamp(0);
-  ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  timeout::insert_new(*dht.tb.timeout, &node0);
-  ASSERT_TRUE(dht.tb.timeout->timeout_node);
-  {
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(0)),
-              nullptr);
-
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(1)), &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(0)),
-              nullptr);
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(1)),
-              nullptr);
-  }
-  ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  timeout::append_all(*dht.tb.timeout, &node0);
-  ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  {
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(0)),
-              nullptr);
-
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(1)), &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
 
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(0)),
-              nullptr);
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(1)),
-              nullptr);
+  ~SlabNodes() noexcept {
+    for (auto &t : tables) {
+      dht::dealloc(dht::routing_table_slab(), t);
+    }
   }
-  ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  timeout::prepend(*dht.tb.timeout, &node0);
-  ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  {
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(0)),
-              nullptr);
-
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(1)), &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
 
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(0)),
-              nullptr);
-    ASSERT_EQ(timeout::take_node(*dht.tb.timeout, sp::Milliseconds(1)),
-              nullptr);
+  dht::Node &
+  operator[](std::size_t i) noexcept {
+    assertx(i < N);
+    return tables[i / K]->bucket.contacts[i % K];
   }
-}
+};
 
-TEST(TimeoutTest, test3) {
+TEST(TimeoutTest, test) {
   fd sock(-1);
   Contact c(0, 0);
   prng::xorshift32 r(1);
@@ -147,50 +41,42 @@ TEST(TimeoutTest, test3) {
   dht::Client client{sock, sock};
   dht::Options opt;
   dht::DHT dht(c, client, r, now, opt);
+  timeout::Timeout &tout = *dht.tb.timeout;
+  const sp::Milliseconds timeout = dht.config.refresh_interval;
+  ASSERT_EQ(std::size_t(0), timeout::debug_count_nodes(tout));
 
-  ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  dht::Node node0;
-  {
-    timeout::insert_new(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
+  SlabNodes<3> nodes;
+  dht::Node &n1 = nodes[0];
+  dht::Node &n2 = nodes[1];
+  dht::Node &n3 = nodes[2];
   {
-    timeout::unlink(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  }
+    timeout::schedule(tout, &n1, timeout);
+    ASSERT_EQ(std::size_t(1), timeout::debug_count_nodes(tout));
 
-  {
-    timeout::insert_new(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-  dht::Node node1;
-  {
-    timeout::insert_new(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node1);
-  }
+    timeout::schedule(tout, &n2, timeout);
+    ASSERT_EQ(std::size_t(2), timeout::debug_count_nodes(tout));
 
-  {
-    timeout::unlink(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
+    timeout::schedule(tout, &n3, timeout);
+    ASSERT_EQ(std::size_t(3), timeout::debug_count_nodes(tout));
   }
 
   {
-    timeout::insert_new(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node1);
-  }
+    timeout::unlink(tout, &n2);
+    ASSERT_EQ(std::size_t(2), timeout::debug_count_nodes(tout));
+    ASSERT_FALSE(timeout::debug_find_node(tout, &n2));
 
-  {
-    timeout::unlink(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node1);
+    timeout::schedule(tout, &n2, timeout);
+    ASSERT_EQ(std::size_t(3), timeout::debug_count_nodes(tout));
+    ASSERT_EQ(&n2, timeout::debug_find_node(tout, &n2));
   }
 
-  {
-    timeout::unlink(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  }
+  timeout::unlink(tout, &n1);
+  timeout::unlink(tout, &n2);
+  timeout::unlink(tout, &n3);
+  ASSERT_EQ(std::size_t(0), timeout::debug_count_nodes(tout));
 }
 
-TEST(TimeoutTest, test4) {
+TEST(TimeoutTest, test2) {
   fd sock(-1);
   Contact c(0, 0);
   prng::xorshift32 r(1);
@@ -198,50 +84,27 @@ TEST(TimeoutTest, test4) {
   dht::Client client{sock, sock};
   dht::Options opt;
   dht::DHT dht(c, client, r, now, opt);
+  timeout::Timeout &tout = *dht.tb.timeout;
+  const sp::Milliseconds timeout = sp::Minutes(1);
+  ASSERT_EQ(timeout::take_node(tout), nullptr);
 
-  ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  dht::Node node0;
-  {
-    timeout::prepend(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-  {
-    timeout::unlink(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  }
-
-  {
-    timeout::prepend(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-  dht::Node node1;
-  {
-    timeout::prepend(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node1);
-  }
-
-  {
-    timeout::unlink(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-
-  {
-    timeout::prepend(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node1);
-  }
+  SlabNodes<1> nodes;
+  dht::Node &node0 = nodes[0];
+  for (std::size_t i = 0; i < 3; ++i) {
+    const Timestamp start = dht.now;
+    node0.req_sent = start;
+    timeout::schedule(tout, &node0, timeout);
+    ASSERT_EQ(timeout::take_node(tout), nullptr);
 
-  {
-    timeout::unlink(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node1);
-  }
+    dht.now = start + sp::Minutes(2);
+    ASSERT_EQ(timeout::take_node(tout), &node0);
+    ASSERT_EQ(std::size_t(0), timeout::debug_count_nodes(tout));
 
-  {
-    timeout::unlink(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
+    ASSERT_EQ(timeout::take_node(tout), nullptr);
   }
 }
 
-TEST(TimeoutTest, test5) {
+TEST(TimeoutTest, test_order) {
   fd sock(-1);
   Contact c(0, 0);
   prng::xorshift32 r(1);
@@ -249,47 +112,27 @@ TEST(TimeoutTest, test5) {
   dht::Client client{sock, sock};
   dht::Options opt;
   dht::DHT dht(c, client, r, now, opt);
-
-  ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  dht::Node node0;
-  {
-    timeout::append_all(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-  {
-    timeout::unlink(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  }
-
-  {
-    timeout::append_all(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-  dht::Node node1;
-  {
-    timeout::append_all(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-
-  {
-    timeout::unlink(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-
-  {
-    timeout::append_all(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node0);
-  }
-
-  {
-    timeout::unlink(*dht.tb.timeout, &node0);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, &node1);
-  }
-
-  {
-    timeout::unlink(*dht.tb.timeout, &node1);
-    ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
-  }
+  timeout::Timeout &tout = *dht.tb.timeout;
+  const Timestamp start = dht.now;
+  const sp::Milliseconds timeout = sp::Minutes(15);
+
+  /* the node with the oldest request is due first */
+  SlabNodes<3> nodes;
+  nodes[0].req_sent = start;
+  nodes[1].req_sent = start + sp::Minutes(5);
+  nodes[2].req_sent = start + sp::Minutes(2);
+  for (std::size_t i = 0; i < 3; ++i) {
+    timeout::schedule(tout, &nodes[i], timeout);
+  }
+
+  dht.now = start + sp::Minutes(16);
+  ASSERT_EQ(timeout::take_node(tout), &nodes[0]);
+  ASSERT_EQ(timeout::take_node(tout), nullptr);
+
+  dht.now = start + sp::Minutes(30);
+  ASSERT_EQ(timeout::take_node(tout), &nodes[2]);
+  ASSERT_EQ(timeout::take_node(tout), &nodes[1]);
+  ASSERT_EQ(timeout::take_node(tout), nullptr);
 }
 
 TEST(TimeoutTest, test_arr) {
@@ -300,51 +143,46 @@ TEST(TimeoutTest, test_arr) {
   dht::Client client{sock, sock};
   dht::Options opt;
   dht::DHT dht(c, client, r, now, opt);
+  timeout::Timeout &tout = *dht.tb.timeout;
+  const sp::Milliseconds timeout(1);
 
-  sp::UinStaticArray<dht::Node, 1024> a;
-  while (!is_full(a)) {
-    dht::Node in;
-    auto c = insert(a, in);
+  SlabNodes<1024> a;
+  std::size_t length_a = 0;
+  while (length_a < 1024) {
+    auto c = &a[length_a++];
   Lit: {
-    ASSERT_FALSE(timeout::debug_find_node(*dht.tb.timeout, c));
-    auto type = uniform_dist(dht.random, 0, 3);
-    if (type == 0) {
-      timeout::insert_new(*dht.tb.timeout, c);
-    } else if (type == 1) {
-      timeout::append_all(*dht.tb.timeout, c);
-    } else if (type == 2) {
-      timeout::prepend(*dht.tb.timeout, c);
-    } else {
-      assertx(false);
-    }
+    ASSERT_FALSE(timeout::debug_find_node(tout, c));
+    c->req_sent = dht.now;
+    timeout::schedule(tout, c, timeout);
   }
 
-    ASSERT_EQ(timeout::debug_find_node(*dht.tb.timeout, c), c);
-    ASSERT_EQ(timeout::debug_count_nodes(*dht.tb.timeout), length(a));
+    ASSERT_EQ(timeout::debug_find_node(tout, c), c);
+    ASSERT_EQ(timeout::debug_count_nodes(tout), length_a);
     // 25%
     if (uniform_dist(dht.random, 0, 4) == 0) {
-      c = timeout::take_node(*dht.tb.timeout, sp::Milliseconds(1));
-      ASSERT_EQ(timeout::debug_count_nodes(*dht.tb.timeout), length(a) - 1);
-      ASSERT_FALSE(timeout::debug_find_node(*dht.tb.timeout, c));
+      dht.now = dht.now + sp::Milliseconds(NodeTime::resolution);
+      c = timeout::take_node(tout);
       ASSERT_TRUE(c);
+      ASSERT_EQ(timeout::debug_count_nodes(tout), length_a - 1);
+      ASSERT_FALSE(timeout::debug_find_node(tout, c));
       goto Lit;
     }
 
     // 25%
     if (uniform_dist(dht.random, 0, 4) == 0) {
-      c = &a[uniform_dist(dht.random, 0, length(a))];
-      timeout::unlink(*dht.tb.timeout, c);
-      ASSERT_EQ(timeout::debug_count_nodes(*dht.tb.timeout), length(a) - 1);
-      ASSERT_FALSE(timeout::debug_find_node(*dht.tb.timeout, c));
+      c = &a[uniform_dist(dht.random, 0, length_a)];
+      timeout::unlink(tout, c);
+      ASSERT_EQ(timeout::debug_count_nodes(tout), length_a - 1);
+      ASSERT_FALSE(timeout::debug_find_node(tout, c));
       goto Lit;
     }
 
-    ASSERT_EQ(timeout::debug_count_nodes(*dht.tb.timeout), length(a));
+    ASSERT_EQ(timeout::debug_count_nodes(tout), length_a);
   }
-  for (std::size_t i = 0; i < length(a); ++i) {
-    ASSERT_EQ(timeout::debug_count_nodes(*dht.tb.timeout), length(a) - i);
-    timeout::unlink(*dht.tb.timeout, &a[i]);
+  for (std::size_t i = 0; i < length_a; ++i) {
+    ASSERT_EQ(timeout::debug_count_nodes(tout), length_a - i);
+    timeout::unlink(tout, &a[i]);
   }
-  ASSERT_EQ(timeout::debug_count_nodes(*dht.tb.timeout), 0);
-  ASSERT_EQ(dht.tb.timeout->timeout_node, nullptr);
+  ASSERT_EQ(timeout::debug_count_nodes(tout), 0);
+  ASSERT_EQ(tout.wheel.length, 0u);
 }
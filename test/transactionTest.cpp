@@ -1,5 +1,9 @@
 #include "util.h"
+#include <chrono>
+#include <node_store.h>
 #include <transaction.h>
+#include <tree/StaticTree.h>
+#include <vector>
 
 using namespace dht;
 
@@ -32,9 +36,9 @@ TEST(transactionTest, test_mint_consume) {
   auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
   fprintf(stderr, "%s:sizeof(%zuKB)\n", __func__, sizeof(dht::DHT) / 1024);
 
-  krpc::Transaction ts[Client::tree_capacity] = {};
+  krpc::Transaction ts[Client::default_capacity] = {};
 
-  for (size_t i = 0; i < Client::tree_capacity; ++i) {
+  for (size_t i = 0; i < Client::default_capacity; ++i) {
     tx::TxContext h;
     ASSERT_TRUE(tx::has_free_transaction(*dht));
     ASSERT_TRUE(tx::mint_transaction(*dht, ts[i], h));
@@ -46,10 +50,10 @@ TEST(transactionTest, test_mint_consume) {
     ASSERT_FALSE(tx::mint_transaction(*dht, dummy, h));
   }
   shuffle_tx(r, ts);
-  for (size_t i = 0; i < Client::tree_capacity; ++i) {
+  for (size_t i = 0; i < Client::default_capacity; ++i) {
     tx::TxContext h;
-    ASSERT_TRUE(tx::consume_transaction(*dht, ts[i], h));
-    ASSERT_FALSE(tx::consume_transaction(*dht, ts[i], h));
+    ASSERT_TRUE(tx::consume_transaction(*dht, ts[i], Contact(), h));
+    ASSERT_FALSE(tx::consume_transaction(*dht, ts[i], Contact(), h));
     ASSERT_TRUE(tx::has_free_transaction(*dht));
   }
 }
@@ -65,14 +69,14 @@ TEST(transactionTest, test_mint_timeout) {
   auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
   fprintf(stderr, "%s:sizeof(%zuKB)\n", __func__, sizeof(dht::DHT) / 1024);
 
-  krpc::Transaction ts[Client::tree_capacity] = {};
+  krpc::Transaction ts[Client::default_capacity] = {};
   tx::TxContext h;
   global_count = 0;
   h.int_timeout = [](dht::DHT &, const krpc::Transaction &, const Timestamp &,
-                     void *) { //
+                     const tx::TxClosure &) { //
     global_count++;
   };
-  for (size_t i = 0; i < Client::tree_capacity; ++i) {
+  for (size_t i = 0; i < Client::default_capacity; ++i) {
     ASSERT_TRUE(tx::has_free_transaction(*dht));
     ASSERT_TRUE(tx::mint_transaction(*dht, ts[i], h));
   }
@@ -87,7 +91,7 @@ TEST(transactionTest, test_mint_timeout) {
   Config config;
   now = now + config.transaction_timeout;
   size_t i = 0;
-  for (; i < Client::tree_capacity; ++i) {
+  for (; i < Client::default_capacity; ++i) {
     ASSERT_TRUE(tx::has_free_transaction(*dht));
     ASSERT_EQ(i, global_count);
     ASSERT_TRUE(tx::mint_transaction(*dht, ts[i], h));
@@ -115,10 +119,10 @@ TEST(transactionTest, test_mint_timeout2) {
   global_count = 0;
   tx::TxContext h;
   h.int_timeout = [](dht::DHT &, const krpc::Transaction &, const Timestamp &,
-                     void *) { //
+                     const tx::TxClosure &) { //
     global_count++;
   };
-  for (size_t i = 0; i < Client::tree_capacity; ++i) {
+  for (size_t i = 0; i < Client::default_capacity; ++i) {
     krpc::Transaction dummy;
     ASSERT_TRUE(tx::has_free_transaction(*dht));
     ASSERT_TRUE(tx::mint_transaction(*dht, dummy, h));
@@ -134,7 +138,7 @@ TEST(transactionTest, test_mint_timeout2) {
   Config config;
   size_t i = 0;
 
-  for (; i < Client::tree_capacity; ++i) {
+  for (; i < Client::default_capacity; ++i) {
     ASSERT_EQ(i, global_count);
 
     ASSERT_FALSE(tx::has_free_transaction(*dht));
@@ -167,10 +171,10 @@ TEST(transactionTest, test_eager_tx_timeout) {
   global_count = 0;
   tx::TxContext h;
   h.int_timeout = [](dht::DHT &, const krpc::Transaction &, const Timestamp &,
-                     void *) { //
+                     const tx::TxClosure &) { //
     global_count++;
   };
-  for (size_t i = 0; i < Client::tree_capacity; ++i) {
+  for (size_t i = 0; i < Client::default_capacity; ++i) {
     krpc::Transaction dummy;
     ASSERT_TRUE(tx::has_free_transaction(*dht));
     ASSERT_TRUE(tx::mint_transaction(*dht, dummy, h));
@@ -187,6 +191,122 @@ TEST(transactionTest, test_eager_tx_timeout) {
   ASSERT_FALSE(tx::has_free_transaction(*dht));
 }
 
+TEST(transactionTest, test_rtt) {
+  dht::Config config;
+  dht::Rtt rtt;
+  ASSERT_EQ(sp::Milliseconds(config.transaction_timeout).value,
+            rto(rtt, 0, config).value);
+
+  dht::rtt_sample(rtt, sp::Milliseconds(2000));
+  ASSERT_EQ(2000u, rtt.srtt);
+  ASSERT_EQ(1000u, rtt.rttvar);
+  ASSERT_EQ(std::uint64_t(6000), rto(rtt, 0, config).value);
+
+  for (std::size_t i = 0; i < 64; ++i) {
+    dht::rtt_sample(rtt, sp::Milliseconds(100));
+  }
+  ASSERT_EQ(100u, rtt.srtt);
+  ASSERT_EQ(config.rto_min.value, rto(rtt, 0, config).value);
+
+  /* doubled for each timeout since the last sample */
+  ASSERT_EQ(config.rto_min.value * 2, rto(rtt, 1, config).value);
+  ASSERT_EQ(config.rto_min.value * 8, rto(rtt, 3, config).value);
+  ASSERT_EQ(config.rto_max.value, rto(rtt, 255, config).value);
+
+  dht::rtt_sample(rtt, sp::Milliseconds(sp::Minutes(5)));
+  ASSERT_EQ(config.rto_max.value, rto(rtt, 0, config).value);
+}
+
+TEST(transactionTest, test_rto_expire) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now = sp::now();
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  global_count = 0;
+  tx::TxContext h;
+  h.int_timeout = [](dht::DHT &, const krpc::Transaction &, const Timestamp &,
+                     const tx::TxClosure &) { //
+    global_count++;
+  };
+
+  ASSERT_EQ(std::uint64_t(1000), dht->config.rto_min.value);
+  const Contact remote(0x7f000001, 4711);
+  NodeStore &store = node_store();
+  const std::uint32_t idx = acquire(store, remote, dht->now);
+  ASSERT_NE(0u, idx);
+
+  {
+    // global RTT
+    krpc::Transaction t;
+    tx::TxContext out;
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h, Contact()));
+    dht->now = dht->now + sp::Milliseconds(2000);
+    ASSERT_TRUE(tx::consume_transaction(*dht, t, Contact(), out));
+    ASSERT_EQ(std::uint64_t(2000), sp::Milliseconds(out.latency).value);
+    ASSERT_EQ(std::uint64_t(6000), rto(client.rtt, dht->config).value);
+  }
+  {
+    // node RTT, also sampled into the global RTT
+    krpc::Transaction t;
+    tx::TxContext out;
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h, remote));
+    dht->now = dht->now + sp::Milliseconds(100);
+    ASSERT_TRUE(tx::consume_transaction(*dht, t, remote, out));
+    ASSERT_EQ(100u, liveness(store, idx)->rtt.srtt);
+    ASSERT_EQ(std::uint64_t(1000),
+              rto(liveness(store, idx)->rtt, dht->config).value);
+    ASSERT_EQ(std::uint64_t(6662), rto(client.rtt, dht->config).value);
+  }
+  {
+    // a transaction which is never sent does not affect the RTT
+    krpc::Transaction t;
+    tx::TxContext out;
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h, remote));
+    dht->now = dht->now + sp::Milliseconds(500);
+    ASSERT_TRUE(tx::cancel_transaction(*dht, t, out));
+    ASSERT_EQ(2u, client.rtt.samples);
+    ASSERT_EQ(1u, liveness(store, idx)->rtt.samples);
+  }
+
+  const Timestamp before = dht->now;
+  krpc::Transaction t_global;
+  krpc::Transaction t_node;
+  ASSERT_TRUE(tx::mint_transaction(*dht, t_global, h, Contact()));
+  ASSERT_TRUE(tx::mint_transaction(*dht, t_node, h, remote));
+  {
+    Timestamp next(0);
+    ASSERT_TRUE(tx::next_timeout(*dht, next));
+    ASSERT_TRUE(next > before);
+    ASSERT_TRUE(next <= before + sp::Milliseconds(1000));
+  }
+
+  dht->now = before + sp::Milliseconds(999);
+  ASSERT_TRUE(tx::is_valid(*dht, t_node));
+  ASSERT_TRUE(tx::is_valid(*dht, t_global));
+  tx::eager_tx_timeout(*dht);
+  ASSERT_EQ(0u, global_count);
+
+  dht->now = before + sp::Milliseconds(1000);
+  ASSERT_FALSE(tx::is_valid(*dht, t_node));
+  ASSERT_TRUE(tx::is_valid(*dht, t_global));
+  tx::eager_tx_timeout(*dht);
+  ASSERT_EQ(1u, global_count);
+
+  dht->now = before + sp::Milliseconds(6662);
+  ASSERT_FALSE(tx::is_valid(*dht, t_global));
+  tx::eager_tx_timeout(*dht);
+  ASSERT_EQ(2u, global_count);
+  {
+    Timestamp next(0);
+    ASSERT_FALSE(tx::next_timeout(*dht, next));
+  }
+
+  release(store, idx);
+}
+
 TEST(transactionTest, test_valid) {
   std::size_t test_it = 0;
   fd s(-1);
@@ -199,7 +319,7 @@ TEST(transactionTest, test_valid) {
 
 Lrestart:
   if (test_it++ < 100) {
-    constexpr std::size_t IT = Client::tree_capacity;
+    constexpr std::size_t IT = Client::default_capacity;
     krpc::Transaction ts[IT] = {};
 
     // printf("nodes: %zu\n", IT);
@@ -233,13 +353,301 @@ Lrestart:
       tx::TxContext h;
       // printf("i: %zu\n", i);
       ASSERT_TRUE(tx::is_valid(*dht, ts[i]));
-      ASSERT_TRUE(tx::consume_transaction(*dht, ts[i], h));
+      ASSERT_TRUE(tx::consume_transaction(*dht, ts[i], Contact(), h));
       ASSERT_FALSE(tx::is_valid(*dht, ts[i]));
     }
     goto Lrestart;
   }
 }
 
+TEST(transactionTest, test_capacity) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now = sp::now();
+  dht::Client client{s, s, Client::max_capacity};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  ASSERT_EQ(Client::max_capacity, client.capacity);
+
+  std::vector<krpc::Transaction> ts(client.capacity);
+  for (auto &t : ts) {
+    tx::TxContext h;
+    ASSERT_TRUE(tx::has_free_transaction(*dht));
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h));
+  }
+  ASSERT_FALSE(tx::has_free_transaction(*dht));
+  ASSERT_EQ(client.capacity, client.active);
+
+  for (auto &t : ts) {
+    ASSERT_TRUE(tx::is_valid(*dht, t));
+  }
+  for (std::size_t i = 0; i < ts.size(); i += 2) {
+    tx::TxContext h;
+    ASSERT_TRUE(tx::consume_transaction(*dht, ts[i], Contact(), h));
+    ASSERT_FALSE(tx::is_valid(*dht, ts[i]));
+    ASSERT_FALSE(tx::consume_transaction(*dht, ts[i], Contact(), h));
+  }
+  for (std::size_t i = 1; i < ts.size(); i += 2) {
+    ASSERT_TRUE(tx::is_valid(*dht, ts[i]));
+  }
+  ASSERT_EQ(client.capacity / 2, client.active);
+}
+
+TEST(transactionTest, test_bind_remote) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now = sp::now();
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  const Contact remote(0x7f000002, 4711);
+  const Contact spoof(0x7f000003, 4711);
+  NodeStore &store = node_store();
+  const std::uint32_t idx = acquire(store, remote, dht->now);
+  ASSERT_NE(0u, idx);
+
+  tx::TxContext h;
+  h.int_timeout = [](dht::DHT &, const krpc::Transaction &, const Timestamp &,
+                     const tx::TxClosure &) {};
+  {
+    krpc::Transaction t;
+    tx::TxContext out;
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h, remote));
+    ASSERT_FALSE(tx::consume_transaction(*dht, t, spoof, out));
+    ASSERT_FALSE(tx::consume_transaction(*dht, t, Contact(), out));
+    ASSERT_EQ(2u, client.source_mismatch);
+    ASSERT_TRUE(tx::is_valid(*dht, t));
+    ASSERT_TRUE(tx::consume_transaction(*dht, t, remote, out));
+    ASSERT_FALSE(tx::is_valid(*dht, t));
+  }
+
+  /* consecutive timeouts are counted until remote responds */
+  for (std::size_t i = 0; i < dht->config.node_max_timeouts; ++i) {
+    krpc::Transaction t;
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h, remote));
+    dht->now = dht->now + dht->config.rto_max;
+    tx::eager_tx_timeout(*dht);
+    ASSERT_FALSE(tx::is_valid(*dht, t));
+  }
+  ASSERT_EQ(dht->config.node_max_timeouts, liveness(store, idx)->timeouts);
+  {
+    krpc::Transaction t;
+    tx::TxContext out;
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h, remote));
+    ASSERT_TRUE(tx::consume_transaction(*dht, t, remote, out));
+  }
+  ASSERT_EQ(0u, liveness(store, idx)->timeouts);
+
+  release(store, idx);
+}
+
+TEST(transactionTest, test_eager_budget) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now = sp::now();
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  global_count = 0;
+  tx::TxContext h;
+  h.int_timeout = [](dht::DHT &, const krpc::Transaction &, const Timestamp &,
+                     const tx::TxClosure &) { //
+    global_count++;
+  };
+
+  constexpr std::size_t N = 100;
+  for (std::size_t i = 0; i < N; ++i) {
+    krpc::Transaction t;
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h));
+  }
+  dht->now = dht->now + dht->config.transaction_timeout;
+
+  std::size_t ticks = 0;
+  while (true) {
+    dht::Budget budget(30);
+    const bool done = tx::eager_tx_timeout(*dht, budget);
+    ++ticks;
+    ASSERT_EQ(std::min(N, ticks * 30), global_count);
+    if (done) {
+      break;
+    }
+    ASSERT_TRUE(is_exhausted(budget));
+  }
+  ASSERT_EQ(4u, ticks);
+  ASSERT_EQ(0u, client.active);
+
+  dht::Budget budget(30);
+  ASSERT_TRUE(tx::eager_tx_timeout(*dht, budget));
+  ASSERT_EQ(30u, budget.remaining);
+}
+
+TEST(transactionTest, test_closure) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now = sp::now();
+  dht::Client client{s, s};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+  const dht::KContact bs(7, Contact(0x7f000001, 4711));
+  dht::Infohash ih;
+  ih.id[0] = 42;
+
+  krpc::Transaction t0;
+  krpc::Transaction t1;
+  krpc::Transaction t2;
+  {
+    tx::TxContext h;
+    h.closure = tx::TxClosure(bs);
+    ASSERT_TRUE(tx::mint_transaction(*dht, t0, h));
+    h.closure = tx::TxClosure(ih);
+    ASSERT_TRUE(tx::mint_transaction(*dht, t1, h));
+    h.closure = tx::TxClosure();
+    ASSERT_TRUE(tx::mint_transaction(*dht, t2, h));
+  }
+
+  tx::TxContext out;
+  ASSERT_TRUE(tx::consume_transaction(*dht, t1, Contact(), out));
+  ASSERT_EQ(tx::TxClosureType::SCRAPE, out.closure.type);
+  ASSERT_TRUE(out.closure.scrape == ih);
+
+  ASSERT_TRUE(tx::consume_transaction(*dht, t0, Contact(), out));
+  ASSERT_EQ(tx::TxClosureType::BOOTSTRAP, out.closure.type);
+  ASSERT_EQ(bs.common, out.closure.bootstrap.common);
+  ASSERT_TRUE(out.closure.bootstrap.contact == bs.contact);
+
+  ASSERT_TRUE(tx::consume_transaction(*dht, t2, Contact(), out));
+  ASSERT_EQ(tx::TxClosureType::NONE, out.closure.type);
+}
+
+static std::size_t
+mint_all(dht::DHT &dht, TxClass cls, std::vector<krpc::Transaction> &out) {
+  std::size_t result = 0;
+  while (tx::has_free_transaction(dht, cls)) {
+    krpc::Transaction t;
+    tx::TxContext h;
+    if (!tx::mint_transaction(dht, t, h, Contact(), cls)) {
+      break;
+    }
+    out.push_back(t);
+    ++result;
+  }
+  return result;
+}
+
+TEST(transactionTest, test_priority_classes) {
+  fd s(-1);
+  prng::xorshift32 r(1);
+  Timestamp now = sp::now();
+  dht::Client client{s, s, 100};
+  dht::Options opt;
+  auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+  ASSERT_EQ(100u, client.capacity);
+  auto &scrape = client.classes[std::size_t(TxClass::SCRAPE)];
+  auto &search = client.classes[std::size_t(TxClass::SEARCH)];
+
+  std::vector<krpc::Transaction> scrapes;
+  std::vector<krpc::Transaction> searches;
+  std::vector<krpc::Transaction> other;
+
+  /* scrape is capped by its limit */
+  ASSERT_EQ(dht->config.tx_limit[std::size_t(TxClass::SCRAPE)],
+            mint_all(*dht, TxClass::SCRAPE, scrapes));
+  ASSERT_TRUE(tx::has_free_transaction(*dht, TxClass::SEARCH));
+  {
+    krpc::Transaction t;
+    tx::TxContext h;
+    ASSERT_FALSE(tx::mint_transaction(*dht, t, h, Contact(), TxClass::SCRAPE));
+    ASSERT_EQ(1u, scrape.denied);
+  }
+  for (const auto &t : scrapes) {
+    tx::TxContext h;
+    ASSERT_TRUE(tx::consume_transaction(*dht, t, Contact(), h));
+  }
+  scrapes.clear();
+  ASSERT_EQ(75u, scrape.responses);
+  ASSERT_EQ(0u, client.active);
+
+  /* without a limit scrape can still not take the reserved transactions */
+  dht->config.tx_limit[std::size_t(TxClass::SCRAPE)] = 100;
+  ASSERT_EQ(75u, mint_all(*dht, TxClass::SCRAPE, scrapes));
+
+  /* each class can only borrow what is not reserved by a higher class */
+  ASSERT_EQ(5u, mint_all(*dht, TxClass::BOOTSTRAP, other));
+  ASSERT_EQ(10u, mint_all(*dht, TxClass::MAINTENANCE, other));
+  ASSERT_EQ(10u, mint_all(*dht, TxClass::SEARCH, searches));
+  ASSERT_EQ(client.capacity, client.active);
+  ASSERT_FALSE(tx::has_free_transaction(*dht, TxClass::SEARCH));
+
+  /* a free search transaction is reserved for search */
+  {
+    krpc::Transaction t;
+    tx::TxContext h;
+    ASSERT_TRUE(tx::consume_transaction(*dht, searches.back(), Contact(), h));
+    searches.pop_back();
+
+    ASSERT_FALSE(tx::has_free_transaction(*dht, TxClass::SCRAPE));
+    ASSERT_FALSE(tx::has_free_transaction(*dht, TxClass::MAINTENANCE));
+    ASSERT_FALSE(tx::mint_transaction(*dht, t, h, Contact(), TxClass::SCRAPE));
+    ASSERT_EQ(2u, scrape.denied);
+    ASSERT_TRUE(tx::has_free_transaction(*dht, TxClass::SEARCH));
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h, Contact(), TxClass::SEARCH));
+  }
+
+  /* a free scrape transaction can be borrowed by a higher class */
+  {
+    krpc::Transaction t;
+    tx::TxContext h;
+    ASSERT_TRUE(tx::consume_transaction(*dht, scrapes.back(), Contact(), h));
+    scrapes.pop_back();
+
+    ASSERT_TRUE(tx::mint_transaction(*dht, t, h, Contact(), TxClass::SEARCH));
+  }
+  ASSERT_EQ(74u, scrape.in_flight);
+  ASSERT_EQ(11u, search.in_flight);
+  ASSERT_EQ(0u, search.denied);
+}
+
+TEST(transactionTest, bench_mint_consume) {
+  const std::size_t caps[] = {Client::default_capacity, 16 * 1024,
+                              Client::max_capacity};
+  for (std::size_t cap : caps) {
+    fd s(-1);
+    prng::xorshift32 r(1);
+    Timestamp now = sp::now();
+    dht::Client client{s, s, cap};
+    dht::Options opt;
+    auto dht = std::make_unique<dht::DHT>(Contact(0, 0), client, r, now, opt);
+
+    /* keep the table at 90% occupancy while minting and consuming */
+    const std::size_t occupied = (cap * 9) / 10;
+    std::vector<krpc::Transaction> ts(occupied);
+    tx::TxContext h;
+    for (auto &t : ts) {
+      ASSERT_TRUE(tx::mint_transaction(*dht, t, h));
+    }
+
+    const std::size_t rounds = 100'000;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i) {
+      krpc::Transaction &t = ts[random(r) % occupied];
+      tx::TxContext out;
+      ASSERT_TRUE(tx::consume_transaction(*dht, t, Contact(), out));
+      ASSERT_TRUE(tx::mint_transaction(*dht, t, h));
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    ASSERT_EQ(occupied, client.active);
+
+    using ns = std::chrono::nanoseconds;
+    printf("mint+consume capacity %zu at %zu in-flight: %lldns/op\n", cap,
+           occupied,
+           (long long)std::chrono::duration_cast<ns>(elapsed).count() /
+               (long long)rounds);
+  }
+}
+
 TEST(transactionTest, asd) {
   using tx::Tx;
   sp::byte a = 'a';
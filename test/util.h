@@ -119,7 +119,7 @@ assert_eq(const T &first, const T &second) {
 inline static void
 assert_eq(const dht::Node &first, const dht::IdContact &second) {
   assert_eq(first.id.id, second.id.id);
-  ASSERT_EQ(first.contact.ip, second.contact.ip);
+  ASSERT_EQ(Ip(first.contact.ip), second.contact.ip);
   ASSERT_EQ(first.contact.port, second.contact.port);
 }
 
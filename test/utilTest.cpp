@@ -16,3 +16,22 @@ TEST(utilTest, test) {
     ASSERT_TRUE(test(bootstrap_filter, c.ip));
   }
 }
+
+TEST(utilTest, test_node_time_start) {
+  const std::uint64_t day = 24 * 60 * 60 * 1000;
+  const Timestamp now(100 * day);
+  ASSERT_EQ(0u, NodeTime::users);
+  ASSERT_TRUE(NodeTime::start(now));
+  const NodeTime t(now);
+
+  /* a second DHT of the process keeps the base of the first */
+  ASSERT_FALSE(NodeTime::start(Timestamp(200 * day)));
+  ASSERT_EQ(99 * day, std::uint64_t(NodeTime::base));
+  ASSERT_EQ(std::uint64_t(now), std::uint64_t(Timestamp(t)));
+
+  NodeTime::stop();
+  NodeTime::stop();
+  ASSERT_TRUE(NodeTime::start(Timestamp(200 * day)));
+  ASSERT_EQ(199 * day, std::uint64_t(NodeTime::base));
+  NodeTime::stop();
+}